@@ -0,0 +1,100 @@
+// Measures the cost per element of checking an array of vptrs against one
+// range: one __type_casting_verification_ranged call per element, the
+// inline rotate-compare of -sd-inline-cast-checks (with an early exit and
+// with the results and'ed together, which the loop vectorizer can widen),
+// and one __type_casting_verification_ranged_batch call for the array.
+// All vptrs are valid, so every form has to look at every element.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#define ITERATIONS  (1 << 12)
+#define NUM_VPTRS   4096
+#define ALIGN_BITS  5          // 32 byte aligned address points (orderCloud)
+#define WIDTH       64         // valid slots in the range
+
+extern "C" bool __type_casting_verification_ranged(const uint64_t start,
+                                                   const uint64_t width,
+                                                   const uint64_t alignment,
+                                                   const uint64_t alignment_r,
+                                                   const void* vpointer);
+
+extern "C" uint64_t __type_casting_verification_ranged_batch(const uint64_t start,
+                                                             const uint64_t width,
+                                                             const uint64_t alignment,
+                                                             const uint64_t alignment_r,
+                                                             const void* const* vptrs,
+                                                             const uint64_t n);
+
+typedef uint64_t (*check_fn)(const void* const*, uint64_t);
+
+static uint64_t start;
+
+static inline bool inRange(const void* vptr) {
+  uint64_t diff = (uint64_t) vptr - start;
+  return ((diff >> ALIGN_BITS) | (diff << (64 - ALIGN_BITS))) < WIDTH;
+}
+
+__attribute__((noinline)) static uint64_t checkCalls(const void* const* vptrs, uint64_t n) {
+  for (uint64_t i = 0; i < n; i++)
+    if (!__type_casting_verification_ranged(start, WIDTH, ALIGN_BITS, 64 - ALIGN_BITS, vptrs[i]))
+      return i;
+  return n;
+}
+
+__attribute__((noinline)) static uint64_t checkInline(const void* const* vptrs, uint64_t n) {
+  for (uint64_t i = 0; i < n; i++)
+    if (!inRange(vptrs[i]))
+      return i;
+  return n;
+}
+
+__attribute__((noinline)) static uint64_t checkInlineAnd(const void* const* vptrs, uint64_t n) {
+  bool ok = true;
+  for (uint64_t i = 0; i < n; i++)
+    ok &= inRange(vptrs[i]);
+  return ok ? n : 0;
+}
+
+__attribute__((noinline)) static uint64_t checkBatch(const void* const* vptrs, uint64_t n) {
+  return __type_casting_verification_ranged_batch(start, WIDTH, ALIGN_BITS, 64 - ALIGN_BITS, vptrs, n);
+}
+
+static double run(check_fn fn, const std::vector<const void*>& vptrs, uint64_t& checked) {
+  auto begin = std::chrono::steady_clock::now();
+  checked = 0;
+  for (uint64_t i = 0; i < ITERATIONS; i++)
+    checked += fn(vptrs.data(), vptrs.size());
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::nano>(end - begin).count() / ((double) ITERATIONS * NUM_VPTRS);
+}
+
+int main() {
+  static uint64_t storage[WIDTH << (ALIGN_BITS - 3)] __attribute__((aligned(1 << ALIGN_BITS)));
+  start = (uint64_t) storage;
+
+  srand(42);
+  std::vector<const void*> vptrs(NUM_VPTRS);
+  for (int i = 0; i < NUM_VPTRS; i++)
+    vptrs[i] = (const void*) (start + ((uint64_t)(rand() % WIDTH) << ALIGN_BITS));
+
+  struct { const char* name; check_fn fn; } forms[] = {
+    { "call/element", checkCalls },
+    { "inline",       checkInline },
+    { "inline and",   checkInlineAnd },
+    { "batch",        checkBatch },
+  };
+
+  printf("%-16s %12s %12s\n", "form", "ns/element", "checked");
+  for (auto& form : forms) {
+    uint64_t checked;
+    double ns = run(form.fn, vptrs, checked);
+    printf("%-16s %12.3f %12lu\n", form.name, ns, checked);
+  }
+
+  return 0;
+}
@@ -0,0 +1,108 @@
+// Measures the cost of one vptr check for each of the forms that
+// SDCheckLowering can emit. The cloud is a plain aligned array, the
+// checked vptrs are drawn from it (mostly valid, some invalid) so the
+// branch predictor cannot learn a single outcome.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#define ITERATIONS  (1 << 24)
+#define NUM_VPTRS   4096
+#define ALIGN_BITS  5          // 32 byte aligned address points (orderCloud)
+#define SLOTS       256        // slots in the cloud
+
+typedef bool (*check_fn)(uint64_t);
+
+static uint64_t cloud;
+static uint64_t starts[3];
+static uint64_t widths[3];
+static uint64_t inlineMask;
+static uint8_t  memBits[SLOTS / 8];
+
+static inline uint64_t ror(uint64_t diff) {
+  return (diff >> ALIGN_BITS) | (diff << (64 - ALIGN_BITS));
+}
+
+__attribute__((noinline)) static bool checkEq(uint64_t vptr) {
+  return vptr == starts[0];
+}
+
+__attribute__((noinline)) static bool checkRotate(uint64_t vptr) {
+  return ror(vptr - starts[0]) < widths[0];
+}
+
+__attribute__((noinline)) static bool checkTwoRanges(uint64_t vptr) {
+  return (ror(vptr - starts[0]) < widths[0]) |
+         (ror(vptr - starts[1]) < widths[1]);
+}
+
+__attribute__((noinline)) static bool checkThreeRanges(uint64_t vptr) {
+  return (ror(vptr - starts[0]) < widths[0]) |
+         (ror(vptr - starts[1]) < widths[1]) |
+         (ror(vptr - starts[2]) < widths[2]);
+}
+
+__attribute__((noinline)) static bool checkInlineBitset(uint64_t vptr) {
+  uint64_t index = ror(vptr - cloud);
+  return (index < 64) & ((inlineMask >> (index & 63)) & 1);
+}
+
+__attribute__((noinline)) static bool checkMemBitset(uint64_t vptr) {
+  uint64_t index = ror(vptr - cloud);
+  bool inRange = index < SLOTS;
+  uint64_t safeIndex = inRange ? index : 0;
+  return inRange & ((memBits[safeIndex >> 3] >> (safeIndex & 7)) & 1);
+}
+
+static double run(check_fn fn, const std::vector<uint64_t>& vptrs, uint64_t& hits) {
+  auto begin = std::chrono::steady_clock::now();
+  hits = 0;
+  for (uint64_t i = 0; i < ITERATIONS; i++)
+    hits += fn(vptrs[i % NUM_VPTRS]);
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::nano>(end - begin).count() / ITERATIONS;
+}
+
+int main() {
+  static uint64_t storage[SLOTS << (ALIGN_BITS - 3)] __attribute__((aligned(1 << ALIGN_BITS)));
+  cloud = (uint64_t) storage;
+
+  // three disjoint ranges inside the first 64 slots, like the ranges of
+  // a secondary vtable whose descendants are spread over the preorder
+  uint64_t first[3] = {2, 20, 41};
+  for (int i = 0; i < 3; i++) {
+    starts[i] = cloud + (first[i] << ALIGN_BITS);
+    widths[i] = 4 + i;
+    for (uint64_t s = first[i]; s < first[i] + widths[i]; s++) {
+      inlineMask |= 1ULL << s;
+      memBits[s / 8] |= 1 << (s % 8);
+    }
+  }
+
+  srand(42);
+  std::vector<uint64_t> vptrs(NUM_VPTRS);
+  for (int i = 0; i < NUM_VPTRS; i++)
+    vptrs[i] = cloud + ((uint64_t)(rand() % 64) << ALIGN_BITS);
+
+  struct { const char* name; check_fn fn; } forms[] = {
+    { "eq",            checkEq },
+    { "rotate",        checkRotate },
+    { "2 ranges",      checkTwoRanges },
+    { "3 ranges",      checkThreeRanges },
+    { "inline bitset", checkInlineBitset },
+    { "mem bitset",    checkMemBitset },
+  };
+
+  printf("%-16s %12s %10s\n", "form", "ns/check", "hits");
+  for (auto& form : forms) {
+    uint64_t hits;
+    double ns = run(form.fn, vptrs, hits);
+    printf("%-16s %12.3f %10lu\n", form.name, ns, hits);
+  }
+
+  return 0;
+}
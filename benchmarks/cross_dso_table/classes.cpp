@@ -0,0 +1,5 @@
+#include "classes.h"
+#include <iostream>
+
+Shape::~Shape() { std::cout << "deleted Shape" << std::endl; }
+int Shape::sides() { return 0; }
@@ -0,0 +1,15 @@
+#ifndef __CLASSES_H__
+#define __CLASSES_H__
+
+class Shape {
+public:
+  virtual ~Shape();
+  virtual int sides();
+};
+
+// defined in libT.so, its vtable is only in the range table of libT.so
+Shape* makeRemote();
+// called from libT.so on an object whose vtable lives in main
+int countSides(Shape *s);
+
+#endif
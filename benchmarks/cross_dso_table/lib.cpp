@@ -0,0 +1,20 @@
+#include "classes.h"
+
+#include <iostream>
+
+class Triangle : public Shape {
+public:
+  virtual ~Triangle();
+  virtual int sides();
+};
+
+Triangle::~Triangle() { std::cout << "deleted Triangle" << std::endl; }
+int Triangle::sides() { return 3; }
+
+Shape* makeRemote() {
+  return new Triangle();
+}
+
+int countSides(Shape *s) {
+  return s->sides();
+}
@@ -0,0 +1,29 @@
+#include "classes.h"
+
+#include <iostream>
+
+// Square's vtable is only known to main, Triangle's only to libT.so. The
+// vcalls on an object of the other DSO fail the inlined check and only pass
+// if that DSO registered its range table (sd-cross-dso).
+class Square : public Shape {
+public:
+  virtual ~Square();
+  virtual int sides();
+};
+
+Square::~Square() { std::cout << "deleted Square" << std::endl; }
+int Square::sides() { return 4; }
+
+int main(int argc, char *argv[])
+{
+  Shape *local = new Square();
+  Shape *remote = makeRemote();
+
+  std::cout << "local " << local->sides() << std::endl;
+  std::cout << "remote " << remote->sides() << std::endl;
+  std::cout << "local from libT " << countSides(local) << std::endl;
+
+  delete remote;
+  delete local;
+  return 0;
+}
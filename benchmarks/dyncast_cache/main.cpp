@@ -0,0 +1,105 @@
+// Measures dynamic_cast throughput in a dispatch loop over a mix of
+// objects, with virtual bases and cross casts, on 1 to 8 threads. The
+// CastSan build goes through __ivtbl_dynamic_cast and its result cache,
+// NO_LTO=OK through libstdc++'s __dynamic_cast.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#define CASTS_PER_THREAD  (1 << 22)
+#define NUM_OBJS          4096
+
+struct Stats { uint64_t hits, misses, inserts, dropped; };
+extern "C" void __sd_dyncast_cache_get_stats(Stats *stats) __attribute__((weak));
+
+struct Node {
+  virtual ~Node() {}
+  int n;
+};
+
+struct Expr : virtual Node {
+  int e;
+};
+
+struct Stmt : virtual Node {
+  int s;
+};
+
+struct ExprStmt : Expr, Stmt {
+  int es;
+};
+
+struct Decl : Node {
+  int d;
+};
+
+struct Visitor {
+  virtual ~Visitor() {}
+};
+
+// reached from Visitor only by a cross cast
+struct VisitedExpr : Visitor, Expr {
+  int v;
+};
+
+static std::vector<Node*> nodes;
+static std::vector<Visitor*> visitors;
+
+static uint64_t dispatch(uint64_t casts) {
+  uint64_t hits = 0;
+  for (uint64_t i = 0; i < casts; i++) {
+    Node* n = nodes[i % NUM_OBJS];
+    hits += dynamic_cast<Expr*>(n) != nullptr;
+    hits += dynamic_cast<Stmt*>(n) != nullptr;
+    hits += dynamic_cast<ExprStmt*>(n) != nullptr;
+    hits += dynamic_cast<Expr*>(visitors[i % NUM_OBJS]) != nullptr;
+  }
+  return hits;
+}
+
+int main() {
+  srand(42);
+  nodes.resize(NUM_OBJS);
+  visitors.resize(NUM_OBJS);
+  for (int i = 0; i < NUM_OBJS; i++) {
+    switch (rand() % 4) {
+    case 0:  nodes[i] = new Expr; break;
+    case 1:  nodes[i] = new Stmt; break;
+    case 2:  nodes[i] = new ExprStmt; break;
+    default: nodes[i] = new Decl; break;
+    }
+    visitors[i] = rand() % 2 ? static_cast<Visitor*>(new VisitedExpr) : new Visitor;
+  }
+
+  printf("%-8s %12s %14s\n", "threads", "ns/cast", "Mcasts/s");
+  for (int threads = 1; threads <= 8; threads *= 2) {
+    std::vector<std::thread> workers;
+    std::vector<uint64_t> hits(threads);
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++)
+      workers.emplace_back([&hits, t] { hits[t] = dispatch(CASTS_PER_THREAD / 4); });
+    for (auto& w : workers)
+      w.join();
+    auto end = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - begin).count();
+    double casts = (double) CASTS_PER_THREAD * threads;
+    printf("%-8d %12.3f %14.1f\n", threads, ns * threads / casts, casts / ns * 1000.0);
+  }
+
+  if (__sd_dyncast_cache_get_stats) {
+    Stats stats;
+    __sd_dyncast_cache_get_stats(&stats);
+    uint64_t lookups = stats.hits + stats.misses;
+    printf("cache: %lu lookups, %.1f%% hits, %lu inserts, %lu dropped\n",
+           lookups, lookups ? 100.0 * stats.hits / lookups : 0.0,
+           stats.inserts, stats.dropped);
+  }
+
+  return 0;
+}
@@ -0,0 +1,116 @@
+// Measures ns per dynamic_cast for the casts the CastSan fast path can
+// answer with one range check and a static offset, and for the ones that
+// still need the RTTI walk. Build it once per mode and compare the numbers:
+// the default build (fast path, falls back to __ivtbl_dynamic_cast) and
+// NO_LTO=OK (g++ and libstdc++'s __dynamic_cast).
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#define ITERATIONS  (1 << 24)
+#define NUM_OBJS    4096
+
+struct Base {
+  virtual ~Base() {}
+  int b;
+};
+
+struct Other {
+  virtual ~Other() {}
+  int o;
+};
+
+// Base is the primary base, the cast does not move the pointer
+struct Derived : Base {
+  int d;
+};
+
+struct MoreDerived : Derived {
+  int m;
+};
+
+// Base at a non-zero offset, the cast subtracts a constant
+struct Secondary : Other, Base {
+  int s;
+};
+
+struct Sibling : Base {
+  int x;
+};
+
+// Derived reached through Base from the Other side: a cross cast,
+// only the RTTI walk can find it
+struct Cross : Other, Derived {
+  int c;
+};
+
+typedef uint64_t (*cast_fn)(Base* const*, uint64_t);
+
+__attribute__((noinline)) static uint64_t castDerived(Base* const* objs, uint64_t n) {
+  uint64_t hits = 0;
+  for (uint64_t i = 0; i < n; i++)
+    hits += dynamic_cast<Derived*>(objs[i]) != nullptr;
+  return hits;
+}
+
+__attribute__((noinline)) static uint64_t castSecondary(Base* const* objs, uint64_t n) {
+  uint64_t hits = 0;
+  for (uint64_t i = 0; i < n; i++)
+    hits += dynamic_cast<Secondary*>(objs[i]) != nullptr;
+  return hits;
+}
+
+__attribute__((noinline)) static uint64_t castCross(Other* const* objs, uint64_t n) {
+  uint64_t hits = 0;
+  for (uint64_t i = 0; i < n; i++)
+    hits += dynamic_cast<Derived*>(objs[i]) != nullptr;
+  return hits;
+}
+
+template <typename T, typename F>
+static double run(F fn, const std::vector<T*>& objs, uint64_t& hits) {
+  auto begin = std::chrono::steady_clock::now();
+  hits = 0;
+  for (uint64_t i = 0; i < ITERATIONS / NUM_OBJS; i++)
+    hits += fn(objs.data(), objs.size());
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::nano>(end - begin).count() / ITERATIONS;
+}
+
+int main() {
+  srand(42);
+
+  // mostly hits, some misses, so the branch predictor cannot learn one outcome
+  std::vector<Base*> objs(NUM_OBJS);
+  for (int i = 0; i < NUM_OBJS; i++) {
+    switch (rand() % 4) {
+    case 0:  objs[i] = new Derived; break;
+    case 1:  objs[i] = new MoreDerived; break;
+    case 2:  objs[i] = new Secondary; break;
+    default: objs[i] = new Sibling; break;
+    }
+  }
+
+  std::vector<Other*> others(NUM_OBJS);
+  for (int i = 0; i < NUM_OBJS; i++)
+    others[i] = rand() % 2 ? static_cast<Other*>(new Cross) : new Other;
+
+  uint64_t hits;
+  double ns;
+  printf("%-24s %12s %10s\n", "cast", "ns/cast", "hits");
+
+  ns = run(castDerived, objs, hits);
+  printf("%-24s %12.3f %10lu\n", "Base -> Derived", ns, hits);
+
+  ns = run(castSecondary, objs, hits);
+  printf("%-24s %12.3f %10lu\n", "Base -> Secondary", ns, hits);
+
+  ns = run(castCross, others, hits);
+  printf("%-24s %12.3f %10lu\n", "Other -> Derived (cross)", ns, hits);
+
+  return 0;
+}
@@ -0,0 +1,218 @@
+#!/bin/bash
+
+# Builds the benchmarks in every mode of Makefile.default and compares them:
+#
+#   gcc      NO_LTO=OK   g++, no checks (the baseline)
+#   vtv      VTV=OK      g++-4.9 -fvtable-verify=std
+#   cfi      LLVMCFI=OK  clang -fsanitize=cfi-vcall
+#   castsan              clang -femit-ivtbl -femit-vtbl-checks -femit-cast-checks
+#   hextype  HEXTYPE=OK  castsan plus -fsanitize=hextype
+#
+# Every binary is run REPS times. The table has the median wall time, the
+# peak RSS, the binary size and the bytes of vtable symbols (_ZTV, _ZTC and
+# the _SD_ZTV ones CastSan lays out), with the overhead over gcc next to
+# each. When perf is installed, the median cycles and instructions are
+# recorded as well. Every row is also appended to a csv file together with
+# the date and the git revision, so runs can be compared over time.
+#
+# All modes are built with the same optimization level (-O, default -O2),
+# it overrides the OPT of the benchmark Makefiles and is recorded in the
+# table and the csv.
+#
+# usage: perf_compare.sh [-r REPS] [-O LEVEL] [-m "MODES"] [-o TABLE] [-c CSV] [benchmark ...]
+
+REPS=5
+OPT_LEVEL=-O2
+MODES="gcc vtv cfi castsan hextype"
+CUR_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
+TABLE="$CUR_DIR/perf_results.txt"
+CSV="$CUR_DIR/perf_history.csv"
+
+# these abort on purpose once checked, there is nothing to time
+NEG_BENCHS=('bad_cast'
+            'bad_multiple_inheritnace_cast'
+            'bad_mult_inh_sibling_cast'
+            'bad_shrinkwrap_ex'
+            'bad_sibling_cast_parent_method_call'
+            'bad_cast_info'
+            'bad_downward_cast'
+            'bad_reinterpret_cast'
+            'good_cast_bad_cast'
+            'good_cast_bad_cast_reference')
+
+containsElement () {
+  local e
+  for e in "${@:2}"; do
+    [[ "$e" == "$1" ]] && return 0
+  done
+  return 1
+}
+
+modeEnv() {
+  case $1 in
+    gcc)     echo "NO_LTO=OK" ;;
+    vtv)     echo "VTV=OK" ;;
+    cfi)     echo "LLVMCFI=OK" ;;
+    castsan) echo "" ;;
+    hextype) echo "HEXTYPE=OK" ;;
+    *)       return 1 ;;
+  esac
+}
+
+# median of the numbers in file $1, n/a if there are none
+median() {
+  sort -g "$1" 2> /dev/null | awk '{ v[NR] = $1 } END { if (NR == 0) print "n/a"; else if (NR % 2) print v[(NR + 1) / 2]; else print (v[NR / 2] + v[NR / 2 + 1]) / 2 }'
+}
+
+# overhead of $1 over the baseline $2 in percent
+overhead() {
+  if [[ ! $1 =~ ^[0-9.]+$ || ! $2 =~ ^[0-9.]+$ || $2 == "0" ]]; then
+    echo "-"
+  else
+    awk -v v="$1" -v b="$2" 'BEGIN { printf "%+.1f%%", (v - b) * 100 / b }'
+  fi
+}
+
+vtableBytes() {
+  readelf -sW "$1" | awk '$4 == "OBJECT" && $8 ~ /^(_SD)?_ZT[VC]/ { s += $3 } END { print s + 0 }'
+}
+
+# runs ./main REPS times, prints "time rss cycles instructions" (medians)
+measure() {
+  local i
+  local havePerf=0
+  command -v perf > /dev/null && perf stat -x, -e cycles true > /dev/null 2>&1 && havePerf=1
+
+  rm -f /tmp/perf_cmp_{time,rss,cycles,instr}.txt
+  for ((i = 0; i < REPS; i++)); do
+    if [[ -x /usr/bin/time ]]; then
+      /usr/bin/time -f "%e %M" -o /tmp/perf_cmp_run.txt ./main > /dev/null 2>&1
+      if [[ $? -ne 0 ]]; then return 1; fi
+      awk '{ print $1 }' /tmp/perf_cmp_run.txt >> /tmp/perf_cmp_time.txt
+      awk '{ print $2 }' /tmp/perf_cmp_run.txt >> /tmp/perf_cmp_rss.txt
+    else
+      # without GNU time there is no peak RSS, only the wall time
+      local begin=$(date +%s%N)
+      ./main > /dev/null 2>&1
+      if [[ $? -ne 0 ]]; then return 1; fi
+      local end=$(date +%s%N)
+      awk -v ns=$((end - begin)) 'BEGIN { printf "%.3f\n", ns / 1e9 }' >> /tmp/perf_cmp_time.txt
+    fi
+
+    if [[ $havePerf -eq 1 ]]; then
+      perf stat -x, -e cycles,instructions -o /tmp/perf_cmp_run.txt ./main > /dev/null 2>&1
+      awk -F, '$3 ~ /^cycles/ { print $1 }' /tmp/perf_cmp_run.txt >> /tmp/perf_cmp_cycles.txt
+      awk -F, '$3 ~ /^instructions/ { print $1 }' /tmp/perf_cmp_run.txt >> /tmp/perf_cmp_instr.txt
+    fi
+  done
+
+  echo "$(median /tmp/perf_cmp_time.txt)" \
+       "$(median /tmp/perf_cmp_rss.txt)" \
+       "$(median /tmp/perf_cmp_cycles.txt)" \
+       "$(median /tmp/perf_cmp_instr.txt)"
+  rm -f /tmp/perf_cmp_{run,time,rss,cycles,instr}.txt
+}
+
+perf_compare() {
+  local opt
+  while getopts "r:O:m:o:c:" opt; do
+    case $opt in
+      r) REPS=$OPTARG ;;
+      O) OPT_LEVEL=-O${OPTARG#-O} ;;
+      m) MODES=$OPTARG ;;
+      o) TABLE=$OPTARG ;;
+      c) CSV=$OPTARG ;;
+      *) echo "usage: $0 [-r REPS] [-O LEVEL] [-m \"MODES\"] [-o TABLE] [-c CSV] [benchmark ...]"; return 1 ;;
+    esac
+  done
+  shift $((OPTIND - 1))
+
+  local m
+  for m in $MODES; do
+    modeEnv $m > /dev/null || { echo "unknown mode $m"; return 1; }
+  done
+
+  # if an argument is not given, compare all the benchmarks
+  # otherwise compare the given ones
+  local -a benchmarks
+  local b
+  if [[ $# -gt 0 ]]; then
+    benchmarks=($@)
+  else
+    for b in $(ls "$CUR_DIR"); do
+      [[ -f "$CUR_DIR/$b/Makefile" ]] || continue
+      containsElement "$b" "${NEG_BENCHS[@]}" && continue
+      benchmarks+=($b)
+    done
+  fi
+
+  local rev=$(git -C "$CUR_DIR" rev-parse --short HEAD 2> /dev/null)
+  local date=$(date +%F)
+  local header="date,revision,benchmark,mode,opt,time_s,rss_kb,size_b,vtable_b,cycles,instructions"
+  # a history without the opt column is kept aside instead of mixing layouts
+  if [[ -f "$CSV" && "$(head -n 1 "$CSV")" != "$header" ]]; then
+    mv "$CSV" "$CSV.old"
+    echo "moved the history with the old columns to $CSV.old"
+  fi
+  [[ -f "$CSV" ]] || echo "$header" > "$CSV"
+
+  {
+    echo "revision ${rev:-unknown}, $date, $OPT_LEVEL, $REPS runs, medians, overhead relative to gcc"
+    printf "%-40s %-8s %10s %9s %10s %9s %10s %9s %10s %9s\n" \
+           "benchmark" "mode" "time(s)" "" "rss(KB)" "" "size(B)" "" "vtbl(B)" ""
+  } > "$TABLE"
+
+  for b in ${benchmarks[@]}; do
+    if [[ ! -d "$CUR_DIR/$b" ]]; then
+      echo "$b does not exist"
+      continue
+    fi
+    pushd "$CUR_DIR/$b" > /dev/null
+
+    local baseTime="n/a" baseRss="n/a" baseSize="n/a" baseVtbl="n/a"
+    for m in $MODES; do
+      echo "############################################################"
+      echo "$m compiling and running $b"
+
+      local time="n/a" rss="n/a" size="n/a" vtbl="n/a" cycles="n/a" instr="n/a"
+      env $(modeEnv $m) make clean all OPT=$OPT_LEVEL > /dev/null 2>&1
+      if [[ $? -ne 0 ]]; then
+        echo "$m compilation fail"
+        time="build-fail"
+      else
+        size=$(stat -c %s main)
+        vtbl=$(vtableBytes main)
+        local res
+        res=$(measure)
+        if [[ $? -ne 0 ]]; then
+          echo "$m run fail"
+          time="run-fail"
+        else
+          read time rss cycles instr <<< "$res"
+        fi
+      fi
+
+      if [[ $m == "gcc" ]]; then
+        baseTime=$time baseRss=$rss baseSize=$size baseVtbl=$vtbl
+      fi
+
+      printf "%-40s %-8s %10s %9s %10s %9s %10s %9s %10s %9s\n" "$b" "$m" \
+             "$time" "$(overhead $time $baseTime)" \
+             "$rss" "$(overhead $rss $baseRss)" \
+             "$size" "$(overhead $size $baseSize)" \
+             "$vtbl" "$(overhead $vtbl $baseVtbl)" >> "$TABLE"
+      echo "$date,$rev,$b,$m,$OPT_LEVEL,$time,$rss,$size,$vtbl,$cycles,$instr" >> "$CSV"
+    done
+
+    make clean > /dev/null 2>&1
+    popd > /dev/null
+  done
+
+  echo
+  echo "############################################################"
+  cat "$TABLE"
+  echo "############################################################"
+  echo "history appended to $CSV"
+}
+
+perf_compare "$@"
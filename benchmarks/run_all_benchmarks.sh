@@ -11,9 +11,9 @@ containsElement () {
 run_benchmarks() {
   local CUR_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
 
-
-  # TODO: Add  'dyn_link1' 
   local -a benchmarks=('abi_ex' 
+                       'dyn_link1' 
+                       'cross_dso_table' 
                        'multiple_secondary' 
                        'my_ex1' 
                        'only_mult2' 
@@ -19,11 +19,11 @@
 #include "clang/Basic/TargetInfo.h"
 #include "llvm/ADT/SetOperations.h"
 #include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/Debug.h"
 #include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
 #include <algorithm>
 #include <cstdio>
-#include <iostream>
 #include <pthread.h>
 
 using namespace clang;
@@ -1804,13 +1804,13 @@ const CXXRecordDecl *RD = Base.getBase();
     CurInheritancePath.push_back(DirectParent);
 
   // Add to map.
-  std::cerr << "{" << MostDerivedClass->getQualifiedNameAsString() << "} Setting [";
-  for (auto it : CurInheritancePath)  std::cerr << it->getQualifiedNameAsString() << ",";
-  std::cerr << "] to " << CurVTableInd << "\n";
+  DEBUG_WITH_TYPE("castsan", llvm::dbgs() << "{" << MostDerivedClass->getQualifiedNameAsString() << "} Setting [");
+  for (auto it : CurInheritancePath)  DEBUG_WITH_TYPE("castsan", llvm::dbgs() << it->getQualifiedNameAsString() << ",");
+  DEBUG_WITH_TYPE("castsan", llvm::dbgs() << "] to " << CurVTableInd << "\n");
 
   InheritanceMap[CurInheritancePath] = CurVTableInd;
   if (BaseIsMorallyVirtual) {
-    std::cerr << "VirtualBasesDefMap[" << Base.getBase()->getQualifiedNameAsString() << "]=" << CurVTableInd << "\n";
+    DEBUG_WITH_TYPE("castsan", llvm::dbgs() << "VirtualBasesDefMap[" << Base.getBase()->getQualifiedNameAsString() << "]=" << CurVTableInd << "\n");
     VirtualBasesDefMap[Base.getBase()] = CurInheritancePath;
   }
   if (hasPrimaryBase)
@@ -2366,7 +2366,7 @@ VTableLayout::VTableLayout(uint64_t NumVTableComponents,
   for (auto it : AddressPoints) {
     uintptr_t addrPt = it.second;
     const CXXRecordDecl* base = it.first.getBase();
-    std::cerr << "Addr Pt: " << addrPt << " base " << base->getQualifiedNameAsString() << "\n";
+    DEBUG_WITH_TYPE("castsan", llvm::dbgs() << "Addr Pt: " << addrPt << " base " << base->getQualifiedNameAsString() << "\n");
     ParentMap[addrPt].insert(base);
     addrPts.insert(addrPt);
   }
@@ -2456,7 +2456,7 @@ ItaniumVTableContext::computeVTableRelatedInformation(const CXXRecordDecl *RD) {
   ItaniumVTableBuilder Builder(*this, RD, CharUnits::Zero(),
                                /*MostDerivedClassIsVirtual=*/0, RD);
 
-  std::cerr << "Create vtable layout for " << RD->getQualifiedNameAsString() << "\n";
+  DEBUG_WITH_TYPE("castsan", llvm::dbgs() << "Create vtable layout for " << RD->getQualifiedNameAsString() << "\n");
   VTableLayouts[RD] = CreateVTableLayout(Builder);
 
 
@@ -2491,11 +2491,11 @@ VTableLayout *ItaniumVTableContext::createConstructionVTableLayout(
     bool MostDerivedClassIsVirtual, const CXXRecordDecl *LayoutClass) {
   ItaniumVTableBuilder Builder(*this, MostDerivedClass, MostDerivedClassOffset,
                                MostDerivedClassIsVirtual, LayoutClass);
-  std::cerr << "Create construction vtable layout for "
+  DEBUG_WITH_TYPE("castsan", llvm::dbgs() << "Create construction vtable layout for "
     << MostDerivedClass->getQualifiedNameAsString()
     << " in " 
     << LayoutClass->getQualifiedNameAsString()
-    << "\n";
+    << "\n");
 
   return CreateVTableLayout(Builder);
 }
@@ -2521,9 +2521,6 @@ void CodeGenFunction::EmitVTablePtrCheckForCall(const CXXRecordDecl *RD,
 Paul: generates the hash value for each class name.
 */
 llvm::Value *CodeGenFunction::getHashValueFromQualType(QualType &T) {
-
-  llvm::HexTypeCommonUtil HexTypeUtil;
-
   if (const RecordType *ClassTy = T->getAs<RecordType>()) {
     const CXXRecordDecl *ClassDecl = cast<CXXRecordDecl>(ClassTy->getDecl());
     if ((!ClassDecl) || !ClassDecl->isCompleteDefinition() ||
@@ -2531,9 +2528,7 @@ llvm::Value *CodeGenFunction::getHashValueFromQualType(QualType &T) {
       return nullptr;
     }
 
-    std::string DstTyStr =
-      getTypes().getCGRecordLayout(ClassDecl).getLLVMType()->getName();
-    uint64_t DstHashValue = HexTypeUtil.getHashValueFromStr(DstTyStr);
+    uint64_t DstHashValue = CGM.getHexTypeLayoutHash(ClassDecl);
     return llvm::ConstantInt::get(Int64Ty, DstHashValue);
   }
 
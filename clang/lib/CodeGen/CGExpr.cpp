@@ -521,7 +521,7 @@ void CodeGenFunction::EmitVTableCastCheck(Address V, const CXXRecordDecl *Derive
   while(!Layout->hasOwnVFPtr()) {
     VBaseDecl = Layout->getPrimaryBase();
 	if (!VBaseDecl ) {
-		std::cerr << "CastCheck: " << BaseMangledName << " does not have it's own Vtable, but also no Parent with one." << std::endl;
+		DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "CastCheck: " << BaseMangledName << " does not have it's own Vtable, but also no Parent with one.\n");
 		return;
 	}
     Layout = &Context.getASTRecordLayout(VBaseDecl);
@@ -536,11 +536,13 @@ void CodeGenFunction::EmitVTableCastCheck(Address V, const CXXRecordDecl *Derive
 
   if (!sd_isVtableName(DerivedMangledName) || ! sd_isVtableName(VBaseMangledName))
   {
-    printf("Cast Check: Cast from %s to %s: one is not eligible for checking.");
+    DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "CastCheck: Cast from " << VBaseMangledName << " to "
+                    << DerivedMangledName << ": one is not eligible for checking.\n");
     return;
   }
 
-  printf("Cast Check: inserting cast check from %s to %s", VBaseMangledName.c_str(), DerivedMangledName.c_str());
+  DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "CastCheck: inserting cast check from " << VBaseMangledName
+                  << " to " << DerivedMangledName << "\n");
 
   llvm::Value * isNull = Builder.CreateIsNull(V.getPointer());
 
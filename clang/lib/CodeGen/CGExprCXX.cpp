@@ -1359,10 +1359,8 @@ void CodeGenFunction::getTypeRelationInfo(const CXXRecordDecl *TargetDecl,
     return;
   }
 
-  std::string TargetStr = TargetDecl->getName();
-  std::string ParentStr = ParentDecl->getName();
-  uint64_t TargetHashValue = HexTypeUtil.getHashValueFromStr(TargetStr);
-  uint64_t ParentHashValue = HexTypeUtil.getHashValueFromStr(ParentStr);
+  uint64_t TargetHashValue = CGM.getHexTypeNameHash(TargetDecl);
+  uint64_t ParentHashValue = CGM.getHexTypeNameHash(ParentDecl);
 
   if (TargetDecl != ParentDecl &&
       TargetHashValue != 0 && ParentHashValue != 0) {
@@ -1403,15 +1401,12 @@ void CodeGenFunction::getTypeElement(const CXXRecordDecl *ClassDecl,
                                      llvm::Value *ValueAddr,
                                      uint64_t offsetInt,
                                      char *InstName) {
-  llvm::HexTypeCommonUtil HexTypeUtil;
-
   if ((!ClassDecl) || !ClassDecl->isCompleteDefinition() ||
       !ClassDecl->hasDefinition() || ClassDecl->isAnonymousStructOrUnion()) {
     return;
   }
 
-  std::string DstTyStr = ClassDecl->getName();
-  uint64_t DstHashValue = HexTypeUtil.getHashValueFromStr(DstTyStr);
+  uint64_t DstHashValue = CGM.getHexTypeNameHash(ClassDecl);
   llvm::Value *DstValue = llvm::ConstantInt::get(Int64Ty, DstHashValue);
   llvm::Value *Offset = llvm::ConstantInt::get(Int64Ty, offsetInt);
 
@@ -862,7 +862,7 @@ CodeGenVTables::GenerateConstructionVTable(const CXXRecordDecl *RD,
   CGM.EmitVTableBitSetEntries(VTable, *VTLayout.get());
 
   //Paul: added by us
-  std::cerr << "Creating construction vtable for " << RD->getQualifiedNameAsString() << "\n";
+  DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "Creating construction vtable for " << RD->getQualifiedNameAsString() << "\n");
 
   //Paul added by us: this function is calling into our SD_VtableMD.h. 
   //The goal is to make sure that the v table metadata is written
@@ -32,8 +32,10 @@
 #include "llvm/ADT/SetVector.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/ValueHandle.h"
+#include "llvm/Transforms/IPO/CastSanClassBlob.h"
 #include "llvm/Transforms/Utils/SanitizerStats.h"
 
 namespace llvm {
@@ -296,6 +298,19 @@ private:
   InstrProfStats PGOStats;
   std::unique_ptr<llvm::SanitizerStatReport> SanStats;
 
+  /// CastSan: the class info of all vtables, collected by sd_insertVtableMD()
+  /// and written into the module by Release().
+  llvm::SDClassBlob CastSanClassBlob;
+
+  /// CastSan: the member pointers to virtual methods built with EmitIVTBL,
+  /// their vtable indices are rewritten by Release().
+  llvm::SetVector<llvm::ConstantMemberPointer *> CastSanMemberPointers;
+
+  /// HexType: the type hashes of the records seen so far, of the name of
+  /// their LLVM struct type and of their plain name.
+  llvm::DenseMap<const CXXRecordDecl *, uint64_t> HexTypeLayoutHashes;
+  llvm::DenseMap<const CXXRecordDecl *, uint64_t> HexTypeNameHashes;
+
   // A set of references that have only been seen via a weakref so far. This is
   // used to remove the weak of the reference if we ever see a direct reference
   // or a definition.
@@ -541,6 +556,24 @@ public:
   InstrProfStats &getPGOStats() { return PGOStats; }
   llvm::IndexedInstrProfReader *getPGOReader() const { return PGOReader.get(); }
 
+  llvm::SDClassBlob &getCastSanClassBlob() { return CastSanClassBlob; }
+
+  void addCastSanMemberPointer(llvm::ConstantMemberPointer *MPtr) {
+    CastSanMemberPointers.insert(MPtr);
+  }
+  const llvm::SetVector<llvm::ConstantMemberPointer *> &
+  getCastSanMemberPointers() const {
+    return CastSanMemberPointers;
+  }
+
+  /// HexType: the hash of the LLVM struct type name of a complete record,
+  /// computed once per record.
+  uint64_t getHexTypeLayoutHash(const CXXRecordDecl *RD);
+
+  /// HexType: the hash of the plain name of a record, computed once per
+  /// record.
+  uint64_t getHexTypeNameHash(const CXXRecordDecl *RD);
+
   CoverageMappingModuleGen *getCoverageMapping() const {
     return CoverageMapping.get();
   }
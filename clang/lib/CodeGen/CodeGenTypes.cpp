@@ -175,38 +175,14 @@ void CodeGenTypes::CastSanInsertTypeMD(std::string TyMangledName,
                                        bool Polymorphic,
                                        std::vector<uint64_t> TyParents)
 {
-	llvm::Module & M = CGM.getModule();
-	llvm::LLVMContext & C = CGM.getLLVMContext();
-	llvm::NamedMDNode * TyInfoMD = M.getOrInsertNamedMetadata(CS_MD_TYPEINFO + TyMangledName);
-
-	// Type is already inserted
-	if (TyInfoMD->getNumOperands() > 0) {
-		TyInfoMD->getOperand(0);
-		
-		llvm::MDString * MangledNameMD = dyn_cast_or_null<llvm::MDString>(TyInfoMD->getOperand(0)->getOperand(0));
-		std::string name = MangledNameMD->getString();
-
-		if (name.compare(TyMangledName) != 0)
-		
-		return;
-	}
-
-
-	// Mangled Name for identification with IVT Metadata
-	TyInfoMD->addOperand(llvm::MDNode::get(C, sd_getMDString(C, TyMangledName)));
-	
-	// Hash for identification with HexType Metadata (llvm::StructType)
-	TyInfoMD->addOperand(llvm::MDNode::get(C, sd_getMDNumber(C, TyHashValue)));
-
-	// If Class is Polymorphic
-	TyInfoMD->addOperand(llvm::MDNode::get(C, sd_getMDNumber(C, Polymorphic && CGM.getCodeGenOpts().EmitCastChecks ? 1 : 0)));
-
-	// Parent Count for correct reading of Metadata in LLVM
-	TyInfoMD->addOperand(llvm::MDNode::get(C, sd_getMDNumber(C, TyParents.size())));
-	
-	// Each parent as one operand
-	for (auto & parent : TyParents)
-		TyInfoMD->addOperand(llvm::MDNode::get(C, sd_getMDNumber(C, parent)));
+	// the first definition of a type wins, see CastSanUtil::getTypeMetadata()
+	CastSanTypes.insert(TyMangledName, TyHashValue,
+	                    Polymorphic && CGM.getCodeGenOpts().EmitCastChecks,
+	                    TyParents);
+}
+
+void CodeGenTypes::CastSanEmitTypeTable() {
+	CastSanTypes.emit(CGM.getModule());
 }
 
 /// ConvertTypeForMem - Convert type T into a llvm::Type.  This differs from
@@ -876,7 +852,7 @@ CodeGenTypes::getCGRecordLayout(const RecordDecl *RD) {
 
   if (!Layout) {
 	  std::string TyMangledName = CGM.getCXXABI().GetClassMangledName(dyn_cast<CXXRecordDecl>(RD));
-	  std::cerr << "Could not find RecordLayout for " << TyMangledName << std::endl;
+	  DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "Could not find RecordLayout for " << TyMangledName << "\n");
 
   }
   assert(Layout && "Unable to find record layout information for type");
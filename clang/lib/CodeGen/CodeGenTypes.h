@@ -19,6 +19,7 @@
 #include "clang/CodeGen/CGFunctionInfo.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/CastSanUtil.h"
 #include <vector>
 
 namespace llvm {
@@ -220,6 +221,10 @@ public:
   /// gets assigned to a class.
   void RefreshTypeCacheForClass(const CXXRecordDecl *RD);
 
+  /// CastSanEmitTypeTable - Write the CastSan type records as one sorted
+  /// table into the module (CS_MD_TYPETABLE).
+  void CastSanEmitTypeTable();
+
   // The arrangement methods are split into three families:
   //   - those meant to drive the signature and prologue/epilogue
   //     of a function declaration or definition,
@@ -340,6 +345,9 @@ public:
                            bool Polymorphic,
                            std::vector<uint64_t> TyParents);
 
+  /// CastSan: the type records of this module, see CastSanInsertTypeMD().
+  llvm::CastSanTypeTable CastSanTypes;
+
 public:  // These are internal details of CGT that shouldn't be used externally.
   /// ConvertRecordDeclType - Lay out a tagged decl type like struct or union.
   llvm::StructType *ConvertRecordDeclType(const RecordDecl *TD);
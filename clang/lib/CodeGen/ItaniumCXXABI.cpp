@@ -963,8 +963,11 @@ llvm::Constant *ItaniumCXXABI::BuildMemberPointer(const CXXMethodDecl *MD,
                                          ThisAdjustment.getQuantity());
     
       std::string className = GetClassMangledName(MD->getParent());
-	if (CGM.getCodeGenOpts().EmitIVTBL)
-      return llvm::ConstantMemberPointer::getAnon(MemPtr, className);
+      if (CGM.getCodeGenOpts().EmitIVTBL) {
+        llvm::Constant *CMPtr = llvm::ConstantMemberPointer::getAnon(MemPtr, className);
+        CGM.addCastSanMemberPointer(cast<llvm::ConstantMemberPointer>(CMPtr));
+        return CMPtr;
+      }
     }
   } else {
     const FunctionProtoType *FPT = MD->getType()->castAs<FunctionProtoType>();
@@ -1432,15 +1435,22 @@ llvm::Value *ItaniumCXXABI::EmitDynamicCastCall(
 
   // Emit the call to __dynamic_cast.
   llvm::Value *Value = ThisAddr.getPointer();
-  llvm::Value *DcastResult;
   Value = CGF.EmitCastToVoidPtr(Value);
 
   llvm::Value *args[] = {Value, SrcRTTI, DestRTTI, OffsetHint};
   
-  //Paul: create bad cast blocks
-  std::cerr << "Enhance Dynamic: " << ClEnhanceDynamicCast << std::endl;
-  if((ClEnhanceDynamicCast) && CGF.SanOpts.has(SanitizerKind::HexType)) {
-    llvm::HexTypeCommonUtil HexTypeUtil;
+  //Paul: with -enhance-dynamic-cast, a cast to a class of which the source
+  //is a unique public nonvirtual base (OffsetHint >= 0) first tries the
+  //CastSan range check of the destination type. A vptr in the range means
+  //the cast succeeds and the result is the source minus the static offset.
+  //Everything else (a miss, a cross cast, virtual or ambiguous bases) still
+  //takes the RTTI walk below.
+  llvm::Value *FastResult = nullptr;
+  llvm::BasicBlock *FastBlock = nullptr;
+  llvm::BasicBlock *FastEnd = nullptr;
+  DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "Enhance Dynamic: " << ClEnhanceDynamicCast << "\n");
+  if((ClEnhanceDynamicCast) && CGF.SanOpts.has(SanitizerKind::HexType) &&
+     cast<llvm::ConstantInt>(OffsetHint)->getSExtValue() >= 0) {
     QualType T = DestTy->getPointeeType();
     auto *ClassTy = T->getAs<RecordType>();
     auto *SrcClassTy = SrcRecordTy->getAs<RecordType>();
@@ -1448,45 +1458,38 @@ llvm::Value *ItaniumCXXABI::EmitDynamicCastCall(
 	  assert(SrcClassTy && "Src Class has no decl???");
       const CXXRecordDecl *ClassDecl = cast<CXXRecordDecl>(ClassTy->getDecl());
       const CXXRecordDecl *SrcClassDecl = cast<CXXRecordDecl>(SrcClassTy->getDecl());
-      if ((!ClassDecl) || !ClassDecl->isCompleteDefinition() ||
-          !ClassDecl->hasDefinition() || ClassDecl->isAnonymousStructOrUnion() || (!SrcClassDecl) || !SrcClassDecl->isCompleteDefinition() ||
-          !SrcClassDecl->hasDefinition() || SrcClassDecl->isAnonymousStructOrUnion()) {
-        return Value;
-      }
-
-      auto &layout = CGM.getTypes().getCGRecordLayout(ClassDecl);
-      auto &layoutSrc = CGM.getTypes().getCGRecordLayout(SrcClassDecl);
-      std::string DstTyStr = layout.getLLVMType()->getName();
-      std::string SrcTyStr = layoutSrc.getLLVMType()->getName();
-      uint64_t DstHashValue = HexTypeUtil.getHashValueFromStr(DstTyStr);
-      uint64_t SrcHashValue = HexTypeUtil.getHashValueFromStr(SrcTyStr);
-      llvm::Value *DstValue = llvm::ConstantInt::get(CGF.Int64Ty,
-                                                     DstHashValue);
-      llvm::Value *SrcValue = llvm::ConstantInt::get(CGF.Int64Ty,
-                                                     SrcHashValue);
-
-      llvm::Value * const_null = llvm::ConstantInt::getNullValue(CGF.Builder.getInt64Ty());
-      llvm::Value *DynamicArgs[] = { Value, SrcValue, DstValue, const_null, const_null, OffsetHint };
-
-      DcastResult = CGF.EmitNounwindRuntimeCall(
-        getItaniumHexTypeDynamicCastFn(CGF), DynamicArgs);
-      Value = CGF.Builder.CreateBitCast(DcastResult, DestLTy);
-      CGM.EmitVTable(ClassDecl);
-      if (DestTy->isReferenceType()) {
-        llvm::BasicBlock *BadCastBlock =
-          CGF.createBasicBlock("dynamic_cast_hextype.bad_cast");
-
-        Value = CGF.Builder.CreateBitCast(DcastResult, DestLTy);
-
-        llvm::Value *IsNull = CGF.Builder.CreateIsNull(DcastResult);
-        CGF.Builder.CreateCondBr(IsNull, BadCastBlock, CastEnd);
-        CGF.EmitBlock(BadCastBlock);
-        EmitBadCastCall(CGF);
+      if (ClassDecl && ClassDecl->isCompleteDefinition() &&
+          ClassDecl->hasDefinition() && !ClassDecl->isAnonymousStructOrUnion() &&
+          SrcClassDecl && SrcClassDecl->isCompleteDefinition() &&
+          SrcClassDecl->hasDefinition() && !SrcClassDecl->isAnonymousStructOrUnion()) {
+        uint64_t DstHashValue = CGM.getHexTypeLayoutHash(ClassDecl);
+        uint64_t SrcHashValue = CGM.getHexTypeLayoutHash(SrcClassDecl);
+        llvm::Value *DstValue = llvm::ConstantInt::get(CGF.Int64Ty,
+                                                       DstHashValue);
+        llvm::Value *SrcValue = llvm::ConstantInt::get(CGF.Int64Ty,
+                                                       SrcHashValue);
+
+        llvm::Value * const_null = llvm::ConstantInt::getNullValue(CGF.Builder.getInt64Ty());
+        llvm::Value *DynamicArgs[] = { Value, SrcValue, DstValue, const_null, const_null, OffsetHint };
+
+        //Paul: the range arguments are filled in (or the call is replaced by
+        //the inline check) in P4 of CastSan, a null result means "unknown"
+        FastResult = CGF.EmitNounwindRuntimeCall(
+          getItaniumHexTypeDynamicCastFn(CGF), DynamicArgs);
+        CGM.EmitVTable(ClassDecl);
+
+        llvm::BasicBlock *SlowBlock =
+          CGF.createBasicBlock("dynamic_cast_hextype.slow");
+        FastEnd = CGF.createBasicBlock("dynamic_cast_hextype.end");
+        FastBlock = CGF.Builder.GetInsertBlock();
+        CGF.Builder.CreateCondBr(CGF.Builder.CreateIsNull(FastResult),
+                                 SlowBlock, FastEnd);
+        CGF.EmitBlock(SlowBlock);
       }
     }
   }
-  else {
-    // put mangled vtable name into a string
+
+  // put mangled vtable name into a string
   std::string className = CGM.getCXXABI().GetClassMangledName(SrcDecl);
   
   //Paul: used to call a function which is located outside a module 
@@ -1543,20 +1546,28 @@ llvm::Value *ItaniumCXXABI::EmitDynamicCastCall(
     Value = CGF.EmitNounwindRuntimeCall(getItaniumDynamicCastFn(CGF), args);
   }
 
-    Value = CGF.Builder.CreateBitCast(Value, DestLTy);
+  if (FastEnd) {
+    llvm::BasicBlock *SlowEnd = CGF.Builder.GetInsertBlock();
+    CGF.EmitBlock(FastEnd);
+    llvm::PHINode *PHI = CGF.Builder.CreatePHI(Value->getType(), 2);
+    PHI->addIncoming(FastResult, FastBlock);
+    PHI->addIncoming(Value, SlowEnd);
+    Value = PHI;
+  }
 
-    /// C++ [expr.dynamic.cast]p9:
-    ///   A failed cast to reference type throws std::bad_cast
-    if (DestTy->isReferenceType()) {
-      llvm::BasicBlock *BadCastBlock =
-        CGF.createBasicBlock("dynamic_cast.bad_cast");
+  Value = CGF.Builder.CreateBitCast(Value, DestLTy);
 
-      llvm::Value *IsNull = CGF.Builder.CreateIsNull(Value);
-      CGF.Builder.CreateCondBr(IsNull, BadCastBlock, CastEnd);
+  /// C++ [expr.dynamic.cast]p9:
+  ///   A failed cast to reference type throws std::bad_cast
+  if (DestTy->isReferenceType()) {
+    llvm::BasicBlock *BadCastBlock =
+      CGF.createBasicBlock("dynamic_cast.bad_cast");
 
-      CGF.EmitBlock(BadCastBlock);
-      EmitBadCastCall(CGF);
-    }
+    llvm::Value *IsNull = CGF.Builder.CreateIsNull(Value);
+    CGF.Builder.CreateCondBr(IsNull, BadCastBlock, CastEnd);
+
+    CGF.EmitBlock(BadCastBlock);
+    EmitBadCastCall(CGF);
   }
 
   return Value;
@@ -1809,7 +1820,7 @@ void ItaniumCXXABI::emitVTableDefinitions(CodeGenVTables &CGVT,
 
   if (!VTable->isDeclarationForLinker())
     CGM.EmitVTableBitSetEntries(VTable, VTLayout);
-  std::cerr << "emitVTableDefinitions for " << RD->getQualifiedNameAsString() << "\n";
+  DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "emitVTableDefinitions for " << RD->getQualifiedNameAsString() << "\n");
 
   //Paul: insert the v table module, calls into SafeDispatchVtblMD.h
   //this create a new module node with the v table definition attached to the each 
@@ -1895,8 +1906,8 @@ llvm::GlobalVariable *ItaniumCXXABI::getAddrOfVTable(const CXXRecordDecl *RD,
   getMangleContext().mangleCXXVTable(RD, Out);
 
   ItaniumVTableContext &VTContext = CGM.getItaniumVTableContext();
-  std::cerr << "getAddrOfVTable: " << RD->getQualifiedNameAsString() << "\n";
-  std::cerr << "layout : " << &(VTContext.getVTableLayout(RD)) << "\n";
+  DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "getAddrOfVTable: " << RD->getQualifiedNameAsString() << "\n");
+  DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "layout : " << &(VTContext.getVTableLayout(RD)) << "\n");
 
   llvm::ArrayType *ArrayType = llvm::ArrayType::get(
       CGM.Int8PtrTy, VTContext.getVTableLayout(RD).getNumVTableComponents());
@@ -1913,8 +1924,6 @@ llvm::GlobalVariable *ItaniumCXXABI::getAddrOfVTable(const CXXRecordDecl *RD,
   return VTable;
 }
 
-#include <iostream>
-
 //Paul: add checked v table code, this method adds the corresponding def contained
 // in the Intrinsic.td into the generated code during code genneration 
 static llvm::Value* sd_getCheckedVTable(CodeGenModule &CGM, 
@@ -1934,9 +1943,9 @@ static llvm::Value* sd_getCheckedVTable(CodeGenModule &CGM,
 
   std::string Name = CGM.getCXXABI().GetClassMangledName(MD->getParent());
 
-  std::cerr << "get checked VTable in " <<
+  DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "get checked VTable in " <<
     dyn_cast<NamedDecl>(CGF.CurFuncDecl)->getQualifiedNameAsString() <<
-    " for class " << Name << " for method " << MD->getQualifiedNameAsString() << std::endl; 
+    " for class " << Name << " for method " << MD->getQualifiedNameAsString() << "\n"); 
 
   llvm::BasicBlock *fastCheckFailed = CGF.createBasicBlock("vtblCheck.fastpath.fail");
   llvm::BasicBlock *checkFailed = CGF.createBasicBlock("vtblCheck.fail");
@@ -2026,9 +2035,9 @@ static llvm::Value* sd_getCheckedVTable2(CodeGenModule &CGM,
   //class name of the object making the call
   std::string PreciseName = (preciseType ? CGM.getCXXABI().GetClassMangledName(preciseType) : ClassName);
 
-  std::cerr << "get checked VTable in " <<
+  DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "get checked VTable in " <<
     dyn_cast<NamedDecl>(CGF.CurFuncDecl)->getQualifiedNameAsString() <<
-    " for class " << ClassName << "(more precisely " << PreciseName << ")" << " for method " << MD->getQualifiedNameAsString() << std::endl; 
+    " for class " << ClassName << "(more precisely " << PreciseName << ")" << " for method " << MD->getQualifiedNameAsString() << "\n"); 
 
   llvm::Module& M = CGM.getModule();
   llvm::LLVMContext& C = M.getContext();
@@ -0,0 +1,347 @@
+//===-- hextype_bench.cc -- microbenchmarks of the HexType runtime ----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===-------------------------------------------------------------------===//
+
+//Paul: measures the runtime entry points on their own, linked against the
+//runtime sources (make hextype-bench). Each scenario prints ns/op and,
+//where perf events are available, cache misses/op. findObjInfo is inlined
+//into the checks, it is measured through __type_casting_verification.
+//
+//Usage: hextype-bench [scenario...], no argument runs all of them.
+//
+//The object addresses are never dereferenced by these entry points, so
+//most scenarios use made-up addresses. Two addresses 2^31 bytes apart
+//land in the same ObjTypeMap slot (see getHash), which is how the
+//collision scenarios fill the rb trees.
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef uintptr_t uptr;
+
+extern "C" {
+void __init_obj_type_map();
+bool __type_casting_verification_ranged(const uint64_t start,
+                                        const uint64_t width,
+                                        const uint64_t alignment,
+                                        const uint64_t alignment_r,
+                                        const void *vpointer);
+uint8_t __type_casting_verification_equal(const uint64_t start,
+                                          const void *vpointer);
+void __type_casting_verification(uptr *const SrcAddr,
+                                 const uint64_t DstTypeHashValue,
+                                 const uint64_t RangeStart,
+                                 const uint64_t RangeWidth);
+void __update_direct_oinfo(uptr *const AllocAddr, const uint32_t FakeVPointer);
+void __update_oinfo(uptr *const AllocAddr, const uint32_t TypeSize,
+                    const unsigned long ArraySize, const uint32_t FakeVPointer);
+void __remove_oinfo(uptr *const ObjectAddr, const uint32_t TypeSize,
+                    unsigned long ArraySize, const uint32_t AllocType);
+}
+
+#define HEAPALLOC 2
+
+#define FAKEVPTR 5              // inside [RANGESTART, RANGESTART + RANGEWIDTH)
+#define RANGESTART 0
+#define RANGEWIDTH 16
+
+#define NUMOBJS 65536
+#define COLLISIONS 64           // objects per ObjTypeMap slot
+#define COLLIDESTRIDE (1ULL << 31)
+#define ARRAYSIZE 100000
+#define OBJSIZE 32
+#define NUMTHREADS 4
+
+//Paul: fake objects live far away from anything the process maps
+static uptr *fakeAddr(uint64_t Base, uint64_t i) {
+  return (uptr *)(0x100000000000ULL + Base + i * OBJSIZE);
+}
+
+static uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//Paul: last level cache misses of this process (threads started later
+//included), or -1 if perf events are not available
+static int openCacheMisses() {
+  struct perf_event_attr Attr;
+  memset(&Attr, 0, sizeof(Attr));
+  Attr.size = sizeof(Attr);
+  Attr.type = PERF_TYPE_HARDWARE;
+  Attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  Attr.disabled = 1;
+  Attr.inherit = 1;
+  Attr.exclude_kernel = 1;
+  Attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &Attr, 0, -1, -1, 0);
+}
+
+struct Measurement {
+  int Fd;
+  uint64_t Start;
+};
+
+static Measurement begin() {
+  Measurement M;
+  M.Fd = openCacheMisses();
+  if (M.Fd >= 0) {
+    ioctl(M.Fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(M.Fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  M.Start = nowNs();
+  return M;
+}
+
+static void end(const Measurement &M, const char *Name, uint64_t Ops) {
+  uint64_t Ns = nowNs() - M.Start;
+  long long Misses = -1;
+  if (M.Fd >= 0) {
+    ioctl(M.Fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(M.Fd, &Misses, sizeof(Misses)) != sizeof(Misses))
+      Misses = -1;
+    close(M.Fd);
+  }
+
+  if (Misses >= 0)
+    printf("%-28s %12.2f %14.3f\n", Name, (double)Ns / Ops,
+           (double)Misses / Ops);
+  else
+    printf("%-28s %12.2f %14s\n", Name, (double)Ns / Ops, "n/a");
+}
+
+//Paul: a cheap generator, rand() would show up in the numbers
+static uint64_t nextRandom(uint64_t &State) {
+  State ^= State << 13;
+  State ^= State >> 7;
+  State ^= State << 17;
+  return State;
+}
+
+static void benchRanged() {
+  const uint64_t Ops = 1 << 24;
+  uint64_t Ok = 0;
+  Measurement M = begin();
+  for (uint64_t i = 0; i < Ops; i++)
+    Ok += __type_casting_verification_ranged(0x1000, 64, 5, 59,
+                                             (const void *)(0x1000 + ((i & 63) << 5)));
+  end(M, "ranged", Ops);
+  if (Ok != Ops)
+    printf("  unexpected: %lu of %lu checks failed\n", Ops - Ok, Ops);
+}
+
+static void benchEqual() {
+  const uint64_t Ops = 1 << 24;
+  uint64_t Ok = 0;
+  Measurement M = begin();
+  for (uint64_t i = 0; i < Ops; i++)
+    Ok += __type_casting_verification_equal(0x1000, (const void *)0x1000);
+  end(M, "equal", Ops);
+  if (Ok != Ops)
+    printf("  unexpected: %lu of %lu checks failed\n", Ops - Ok, Ops);
+}
+
+static void benchUpdateRemove() {
+  Measurement M = begin();
+  for (uint64_t i = 0; i < NUMOBJS; i++)
+    __update_oinfo(fakeAddr(0, i), OBJSIZE, 1, FAKEVPTR);
+  end(M, "update_oinfo", NUMOBJS);
+
+  M = begin();
+  for (uint64_t i = 0; i < NUMOBJS; i++)
+    __remove_oinfo(fakeAddr(0, i), OBJSIZE, 1, HEAPALLOC);
+  end(M, "remove_oinfo", NUMOBJS);
+
+  M = begin();
+  for (uint64_t i = 0; i < NUMOBJS; i++)
+    __update_direct_oinfo(fakeAddr(0, i), FAKEVPTR);
+  end(M, "update_direct_oinfo", NUMOBJS);
+
+  for (uint64_t i = 0; i < NUMOBJS; i++)
+    __remove_oinfo(fakeAddr(0, i), OBJSIZE, 1, HEAPALLOC);
+}
+
+//Paul: lookups of registered objects, one per ObjTypeMap slot
+static void benchLookupHit() {
+  for (uint64_t i = 0; i < NUMOBJS; i++)
+    __update_oinfo(fakeAddr(0, i), OBJSIZE, 1, FAKEVPTR);
+
+  const uint64_t Ops = 1 << 22;
+  uint64_t State = 88172645463325252ULL;
+  Measurement M = begin();
+  for (uint64_t i = 0; i < Ops; i++)
+    __type_casting_verification(fakeAddr(0, nextRandom(State) % NUMOBJS), 0,
+                                RANGESTART, RANGEWIDTH);
+  end(M, "lookup hit", Ops);
+
+  for (uint64_t i = 0; i < NUMOBJS; i++)
+    __remove_oinfo(fakeAddr(0, i), OBJSIZE, 1, HEAPALLOC);
+}
+
+//Paul: lookups of objects nobody registered, every fallback is tried
+static void benchLookupMiss() {
+  const uint64_t Ops = 1 << 22;
+  uint64_t State = 88172645463325252ULL;
+  Measurement M = begin();
+  for (uint64_t i = 0; i < Ops; i++)
+    __type_casting_verification(fakeAddr(0, nextRandom(State) % NUMOBJS), 0,
+                                RANGESTART, RANGEWIDTH);
+  end(M, "lookup miss", Ops);
+}
+
+//Paul: COLLISIONS objects per slot, all but one of them in the rb tree
+static void benchCollisions() {
+  const uint64_t Slots = NUMOBJS / COLLISIONS;
+  Measurement M = begin();
+  for (uint64_t c = 0; c < COLLISIONS; c++)
+    for (uint64_t i = 0; i < Slots; i++)
+      __update_oinfo(fakeAddr(c * COLLIDESTRIDE, i), OBJSIZE, 1, FAKEVPTR);
+  end(M, "update_oinfo collide", NUMOBJS);
+
+  const uint64_t Ops = 1 << 22;
+  uint64_t State = 88172645463325252ULL;
+  M = begin();
+  for (uint64_t i = 0; i < Ops; i++) {
+    uint64_t R = nextRandom(State);
+    __type_casting_verification(
+        fakeAddr((R % COLLISIONS) * COLLIDESTRIDE, (R >> 32) % Slots), 0,
+        RANGESTART, RANGEWIDTH);
+  }
+  end(M, "lookup collide", Ops);
+
+  M = begin();
+  for (uint64_t c = 0; c < COLLISIONS; c++)
+    for (uint64_t i = 0; i < Slots; i++)
+      __remove_oinfo(fakeAddr(c * COLLIDESTRIDE, i), OBJSIZE, 1, HEAPALLOC);
+  end(M, "remove_oinfo collide", NUMOBJS);
+}
+
+//Paul: arrays go to the interval map as one record
+static void benchLargeArray() {
+  const uint64_t Arrays = 16;
+  Measurement M = begin();
+  for (uint64_t a = 0; a < Arrays; a++)
+    __update_oinfo(fakeAddr(a << 28, 0), OBJSIZE, ARRAYSIZE, FAKEVPTR);
+  end(M, "update_oinfo array", Arrays);
+
+  const uint64_t Ops = 1 << 22;
+  uint64_t State = 88172645463325252ULL;
+  M = begin();
+  for (uint64_t i = 0; i < Ops; i++) {
+    uint64_t R = nextRandom(State);
+    __type_casting_verification(fakeAddr((R % Arrays) << 28, (R >> 32) % ARRAYSIZE),
+                                0, RANGESTART, RANGEWIDTH);
+  }
+  end(M, "lookup array element", Ops);
+
+  M = begin();
+  for (uint64_t a = 0; a < Arrays; a++)
+    __remove_oinfo(fakeAddr(a << 28, 0), OBJSIZE, ARRAYSIZE, HEAPALLOC);
+  end(M, "remove_oinfo array", Arrays);
+}
+
+//Paul: a heap in steady state: malloc, register, check a few live
+//objects, free and unregister, like the instrumentation of new/delete
+static void benchChurn() {
+  const uint64_t Live = 4096;
+  const uint64_t Ops = 1 << 20;
+  uptr **Objs = (uptr **)calloc(Live, sizeof(uptr *));
+  uint64_t State = 88172645463325252ULL;
+
+  for (uint64_t i = 0; i < Live; i++) {
+    Objs[i] = (uptr *)malloc(OBJSIZE);
+    __update_oinfo(Objs[i], OBJSIZE, 1, FAKEVPTR);
+  }
+
+  Measurement M = begin();
+  for (uint64_t i = 0; i < Ops; i++) {
+    uint64_t Victim = nextRandom(State) % Live;
+    __remove_oinfo(Objs[Victim], OBJSIZE, 1, HEAPALLOC);
+    free(Objs[Victim]);
+
+    Objs[Victim] = (uptr *)malloc(OBJSIZE + (nextRandom(State) & 3) * 16);
+    __update_oinfo(Objs[Victim], OBJSIZE, 1, FAKEVPTR);
+
+    for (int c = 0; c < 4; c++)
+      __type_casting_verification(Objs[nextRandom(State) % Live], 0,
+                                  RANGESTART, RANGEWIDTH);
+  }
+  end(M, "churn (free+new+4 checks)", Ops);
+
+  for (uint64_t i = 0; i < Live; i++) {
+    __remove_oinfo(Objs[i], OBJSIZE, 1, HEAPALLOC);
+    free(Objs[i]);
+  }
+  free(Objs);
+}
+
+//Paul: each thread owns its own slots, the ObjTypeMap has no locks
+static void *threadBody(void *Arg) {
+  uint64_t Base = (uint64_t)Arg * (NUMOBJS * OBJSIZE);
+  uint64_t State = 88172645463325252ULL + (uint64_t)Arg;
+  for (int Round = 0; Round < 16; Round++) {
+    for (uint64_t i = 0; i < NUMOBJS; i++)
+      __update_oinfo(fakeAddr(Base, i), OBJSIZE, 1, FAKEVPTR);
+    for (uint64_t i = 0; i < NUMOBJS; i++)
+      __type_casting_verification(fakeAddr(Base, nextRandom(State) % NUMOBJS),
+                                  0, RANGESTART, RANGEWIDTH);
+    for (uint64_t i = 0; i < NUMOBJS; i++)
+      __remove_oinfo(fakeAddr(Base, i), OBJSIZE, 1, HEAPALLOC);
+  }
+  return nullptr;
+}
+
+static void benchThreads() {
+  pthread_t Threads[NUMTHREADS];
+  Measurement M = begin();
+  for (uint64_t t = 0; t < NUMTHREADS; t++)
+    pthread_create(&Threads[t], nullptr, threadBody, (void *)t);
+  for (uint64_t t = 0; t < NUMTHREADS; t++)
+    pthread_join(Threads[t], nullptr);
+  // wall time over all operations of all threads
+  end(M, "threads (update+check+rm)", NUMTHREADS * 16 * NUMOBJS * 3ULL);
+}
+
+struct Scenario {
+  const char *Name;
+  void (*Run)();
+};
+
+static const Scenario Scenarios[] = {
+  {"ranged", benchRanged},
+  {"equal", benchEqual},
+  {"update", benchUpdateRemove},
+  {"hit", benchLookupHit},
+  {"miss", benchLookupMiss},
+  {"collide", benchCollisions},
+  {"array", benchLargeArray},
+  {"churn", benchChurn},
+  {"threads", benchThreads},
+};
+
+int main(int argc, char **argv) {
+  __init_obj_type_map();
+
+  printf("%-28s %12s %14s\n", "scenario", "ns/op", "misses/op");
+  for (const Scenario &S : Scenarios) {
+    bool Selected = argc == 1;
+    for (int i = 1; i < argc; i++)
+      Selected |= strcmp(argv[i], S.Name) == 0;
+    if (Selected)
+      S.Run();
+  }
+  return 0;
+}
@@ -10,6 +10,9 @@
 //Paul: one of the main files of hextype, all runtime functionality
 //is here contained.
 #include "hextype.h"
+#ifdef HEX_ALLOCATOR
+#include "hextype_allocator.h"
+#endif
 #include <string.h>
 #include <cmath>
 
@@ -17,6 +20,26 @@
 //of the object.
 __attribute__((always_inline))
   inline ObjTypeMapEntry *findObjInfo(uptr* SrcAddr) {
+    //Paul: stack objects of frames registered as a whole
+    ObjTypeMapEntry *FrameValue = frame_lookup(SrcAddr);
+    if (FrameValue != nullptr) {
+#ifdef HEX_LOG
+      IncVal(numLookFrame, 1);
+#endif
+      return FrameValue;
+    }
+
+#ifdef HEX_ALLOCATOR
+    //Paul: heap objects carry their type in the chunk metadata
+    ObjTypeMapEntry *ChunkValue = hextype_chunk_lookup(SrcAddr);
+    if (ChunkValue != nullptr) {
+#ifdef HEX_LOG
+      IncVal(numLookChunk, 1);
+#endif
+      return ChunkValue;
+    }
+#endif
+
     uint32_t MapIndex = getHash((uptr)SrcAddr);
     if (ObjTypeMap[MapIndex].ObjAddr == SrcAddr) {
 #ifdef HEX_LOG
@@ -30,18 +53,45 @@ __attribute__((always_inline))
       ObjTypeMapEntry *FindValue =
         //search in the rb tree for the object
         (ObjTypeMapEntry *)rbtree_lookup(ObjTypeMap[MapIndex].HexTree, SrcAddr);
+      if (FindValue != nullptr) {
 #ifdef HEX_LOG
-      if (FindValue != nullptr)
         IncVal(numLookMiss, 1);
-      else
-        IncVal(numLookFail, 1);
 #endif
-      return FindValue;
+        return FindValue;
+      }
+    }
+
+    //Paul: an element of an array registered as one interval
+    ObjTypeMapEntry *ArrayValue = interval_lookup(SrcAddr);
+#ifdef HEX_ALLOCATOR
+    //Paul: large heap objects last, looking them up takes the allocator lock
+    if (ArrayValue == nullptr) {
+      ChunkValue = hextype_large_chunk_lookup(SrcAddr);
+      if (ChunkValue != nullptr) {
+#ifdef HEX_LOG
+        IncVal(numLookChunk, 1);
+#endif
+        return ChunkValue;
+      }
     }
+#endif
+    //Paul: globals from the static table
+    if (ArrayValue == nullptr) {
+      ObjTypeMapEntry *GlobalValue = global_table_lookup(SrcAddr);
+      if (GlobalValue != nullptr) {
 #ifdef HEX_LOG
-    IncVal(numLookFail, 1);
+        IncVal(numLookGlobalTable, 1);
 #endif
-    return nullptr;
+        return GlobalValue;
+      }
+    }
+#ifdef HEX_LOG
+    if (ArrayValue != nullptr)
+      IncVal(numLookArray, 1);
+    else
+      IncVal(numLookFail, 1);
+#endif
+    return ArrayValue;
   }
 
 //Paul: this is CastSan function
@@ -111,6 +161,7 @@ void __init_obj_type_map() {
   if (ObjTypeMap == nullptr) {
 #ifdef HEX_LOG
     InstallAtExitHandler();
+    InstallLiveStats();
 #endif
     ObjTypeMap = new ObjTypeMapEntry[NUMMAP];
   }
@@ -176,7 +227,10 @@ void __type_casting_verification(uptr* const SrcAddr,
 	verifyTypeCasting(SrcAddr, RangeStart, RangeWidth);
 }
 
-//Paul: this function calls verifyTypeCasting()
+//Paul: fast path of an enhanced dynamic_cast (see EmitDynamicCastCall).
+//Returns the source adjusted by the static offset if its vptr is in the
+//range of the destination type, and nullptr otherwise. The caller then
+//takes the RTTI walk, so a miss does not have to be a bad cast.
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE
 void* __dynamic_casting_verification(uptr* const SrcAddr,
                                      const uint64_t start,
@@ -185,16 +239,12 @@ void* __dynamic_casting_verification(uptr* const SrcAddr,
                                      const uint64_t alignment_r,
                                      std::ptrdiff_t Src2dst_offset) {
   uptr* TmpAddr = (uptr *)((char *)SrcAddr - Src2dst_offset);
-  uint64_t vptr = *(uint64_t*) SrcAddr;
-  printf("dyncast!!! vptr: %lu, start: %lu, width: %lu \n", vptr, start, width);
-  if (__type_casting_verification_ranged(start, width, alignment, alignment_r, (const void*)vptr))
-  {
+  uint64_t diff = *(uint64_t*) SrcAddr - start;
+  //Paul: no bad cast report here, the RTTI walk decides
+  if (((diff >> alignment) | (diff << alignment_r)) < width)
 	  return TmpAddr;
-  }
   else
-  {
 	  return nullptr;
-  }
 }
 
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE
@@ -203,8 +253,7 @@ void* __dynamic_casting_verification_equal(uptr* const SrcAddr,
                                            std::ptrdiff_t Src2dst_offset) {
   uptr* TmpAddr = (uptr *)((char *)SrcAddr - Src2dst_offset);
   uint64_t vptr = *(uint64_t*) SrcAddr;
-  printf("dyncast!!! vptr: %lu, start: %lu \n", vptr, start);
-  if (__type_casting_verification_equal(start, (const void*)vptr))
+  if (vptr == start)
 	  return TmpAddr;
   else
 	  return nullptr;
@@ -218,7 +267,6 @@ void __update_direct_oinfo(uptr* const AllocAddr,
                            const uint32_t FakeVPointer) {
   uptr MapIndex = getHash((uptr)AllocAddr);
 
-  printf("Inserting Type info: %lu, %lu, %lu\n", ObjTypeMap, FakeVPointer, AllocAddr);
   if (ObjTypeMap[MapIndex].ObjAddr == nullptr ||
       ObjTypeMap[MapIndex].ObjAddr == AllocAddr) {
     ObjTypeMap[MapIndex].ObjAddr = AllocAddr;
@@ -281,6 +329,19 @@ extern "C" SANITIZER_INTERFACE_ATTRIBUTE
 void __update_oinfo(uptr* const AllocAddr,
                     const uint32_t TypeSize, const unsigned long ArraySize,
                     const uint32_t FakeVPointer) {
+#ifdef HEX_ALLOCATOR
+  //Paul: placement new into a typed chunk, the new object replaces its type
+  hextype_chunk_clear_type(AllocAddr);
+#endif
+  //Paul: one record for the whole array instead of one update per element
+  if (ArraySize >= ARRAYINTERVALMIN && TypeSize != 0) {
+    interval_insert(AllocAddr, TypeSize, ArraySize, FakeVPointer);
+#ifdef HEX_LOG
+    IncVal(numArrayUp, 1);
+#endif
+    return;
+  }
+
   for (uint32_t i=0;i<ArraySize;i++) {
     uptr *addr = (uptr *)((char *)AllocAddr + (TypeSize*i));
     uptr MapIndex = getHash((uptr)addr);
@@ -313,6 +374,27 @@ void __update_oinfo(uptr* const AllocAddr,
   }
 }
 
+#ifdef HEX_ALLOCATOR
+//Paul: update the type of a heap object in the metadata of its chunk.
+//Emitted instead of __update_oinfo for heap objects with -alloc-metadata-opt,
+//only this runtime defines it so that a build against the plain runtime
+//fails to link. Memory that does not come from our allocator (e.g. a custom
+//pool of an uninstrumented library) goes to the ObjTypeMap as before.
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+void __update_heap_chunk_oinfo(uptr* const AllocAddr,
+                               const uint32_t TypeSize,
+                               const unsigned long ArraySize,
+                               const uint32_t FakeVPointer) {
+  if (hextype_chunk_set_type(AllocAddr, TypeSize, FakeVPointer)) {
+#ifdef HEX_LOG
+    IncVal(numChunkUp, 1);
+#endif
+    return;
+  }
+  __update_oinfo(AllocAddr, TypeSize, ArraySize, FakeVPointer);
+}
+#endif
+
 //Paul: remove object address from object type map
 //this function is called when free() is called on an object.
 //The object lifetime ends and as such the object can be safely removed
@@ -362,6 +444,17 @@ void __remove_direct_oinfo_inline(uptr* const TargetAddr,
 extern "C" SANITIZER_INTERFACE_ATTRIBUTE
 void __remove_oinfo(uptr* const ObjectAddr, const uint32_t TypeSize,
                     unsigned long ArraySize, const uint32_t AllocType) {
+  //Paul: arrays registered as one interval are removed the same way
+  uint64_t ArrayElems = interval_remove(ObjectAddr);
+  if (ArrayElems != 0) {
+#ifdef HEX_LOG
+    if (AllocType == HEAPALLOC || AllocType == REALLOC)
+      IncVal(numHeapRm, ArrayElems);
+    IncVal(numArrayRm, 1);
+#endif
+    return;
+  }
+
   if (AllocType == HEAPALLOC || AllocType == REALLOC) {
     uptr MapIndex = getHash((uptr)ObjectAddr);
     if (ObjTypeMap[MapIndex].ObjAddr == ObjectAddr)
@@ -412,6 +505,21 @@ void __remove_oinfo(uptr* const ObjectAddr, const uint32_t TypeSize,
   }
 }
 
+#ifdef HEX_ALLOCATOR
+//Paul: emitted instead of __remove_oinfo for heap objects with
+//-alloc-metadata-opt. Types kept in the chunk metadata are cleared by free,
+//the objects __update_heap_chunk_oinfo had to put into the ObjTypeMap
+//(foreign memory, objects far from the chunk start) are removed from it.
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+void __remove_heap_chunk_oinfo(uptr* const ObjectAddr, const uint32_t TypeSize,
+                               unsigned long ArraySize,
+                               const uint32_t AllocType) {
+  if (hextype_chunk_has_type(ObjectAddr))
+    return;
+  __remove_oinfo(ObjectAddr, TypeSize, ArraySize, AllocType);
+}
+#endif
+
 #ifdef HEX_LOG
 //Paul: used for logging
 //the function counts if the lookup was successfull.
@@ -1,4 +1,7 @@
 #include "hextype_report.h"
+#include "hextype_interval.h"
+#include "hextype_frame.h"
+#include "hextype_global_table.h"
 #include <unordered_map>
 
 #define NUMMAP 268435460
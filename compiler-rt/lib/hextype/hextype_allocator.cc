@@ -0,0 +1,246 @@
+//===-- hextype_allocator.cc -- heap allocator for HexType ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===-------------------------------------------------------------------===//
+
+//Paul: the allocator of the HEX_ALLOCATOR runtime, modeled on the one of
+//standalone LSan. Each chunk carries a ChunkMetadata record in the metadata
+//region of the allocator, so finding the type of a heap object costs a block
+//lookup instead of a walk over the ObjTypeMap and its rb trees.
+#include "hextype_allocator.h"
+#include "hextype_report.h"
+
+#include "sanitizer_common/sanitizer_allocator.h"
+#include "sanitizer_common/sanitizer_atomic.h"
+#include "sanitizer_common/sanitizer_internal_defs.h"
+
+#include <dlfcn.h>
+#include <pthread.h>
+
+using namespace __sanitizer;
+
+extern "C" void *memset(void *ptr, int value, uptr num);
+
+namespace {
+
+struct ChunkMetadata {
+  u8 allocated;       // Must be first.
+  u8 typed;
+  u16 ObjOffset;      // offset of the first object, e.g. after a new[] cookie
+  u32 ElemSize;
+  u32 FakeVPointer;
+  uptr requested_size;
+};
+
+const uptr kMaxAllowedMallocSize = 8UL << 30;
+// a new[] cookie is at most one max_align_t in front of the objects
+const uptr kMaxObjOffset = 64;
+const uptr kAllocatorSpace = 0x600000000000ULL;
+const uptr kAllocatorSize = 0x40000000000ULL; // 4T.
+typedef SizeClassAllocator64<kAllocatorSpace, kAllocatorSize,
+        sizeof(ChunkMetadata), DefaultSizeClassMap> PrimaryAllocator;
+typedef SizeClassAllocatorLocalCache<PrimaryAllocator> AllocatorCache;
+typedef LargeMmapAllocator<> SecondaryAllocator;
+typedef CombinedAllocator<PrimaryAllocator, AllocatorCache,
+          SecondaryAllocator> Allocator;
+
+Allocator allocator;
+THREADLOCAL AllocatorCache cache;
+THREADLOCAL bool cacheRegistered;
+THREADLOCAL ObjTypeMapEntry lookupResult;
+pthread_key_t threadFinishKey;
+atomic_uint8_t allocatorInited;
+StaticSpinMutex initLock;
+
+ChunkMetadata *Metadata(const void *p) {
+  return reinterpret_cast<ChunkMetadata *>(allocator.GetMetaData(p));
+}
+
+// give the cache of an exiting thread back to the allocator
+void ThreadFinish(void *) {
+  allocator.SwallowCache(&cache);
+}
+
+// usable size of a chunk that libc or ld.so handed out before our malloc
+// was interposed, 0 if libc does not tell
+uptr ForeignUsableSize(void *P) {
+  typedef uptr (*usable_size_f)(void *);
+  static atomic_uintptr_t RealUsableSize;
+  uptr F = atomic_load(&RealUsableSize, memory_order_acquire);
+  if (!F) {
+    F = (uptr)dlsym(RTLD_NEXT, "malloc_usable_size");
+    atomic_store(&RealUsableSize, F, memory_order_release);
+  }
+  return F ? reinterpret_cast<usable_size_f>(F)(P) : 0;
+}
+
+ObjTypeMapEntry *LookupInChunk(uptr *Addr, void *Begin) {
+  if (!Begin)
+    return nullptr;
+
+  ChunkMetadata *m = Metadata(Begin);
+  uptr Offset = (uptr)Addr - (uptr)Begin;
+  if (!m->allocated || Offset >= m->requested_size)
+    return nullptr;
+
+  if (!m->typed) {
+#ifdef HEX_LOG
+    IncVal(numLookUntypedChunk, 1);
+#endif
+    return nullptr;
+  }
+
+  // only the start of an element is an object of the chunk's type, anything
+  // else is a member subobject and is still traced in the ObjTypeMap
+  if (Offset < m->ObjOffset || (Offset - m->ObjOffset) % m->ElemSize != 0)
+    return nullptr;
+
+  lookupResult.ObjAddr = Addr;
+  lookupResult.HeapArraySize =
+    (m->requested_size - m->ObjOffset) / m->ElemSize;
+  lookupResult.FakeVPointer = m->FakeVPointer;
+  lookupResult.HexTree = nullptr;
+  return &lookupResult;
+}
+
+} // namespace
+
+void hextype_allocator_init() {
+  if (atomic_load(&allocatorInited, memory_order_acquire))
+    return;
+
+  SpinMutexLock l(&initLock);
+  if (atomic_load(&allocatorInited, memory_order_relaxed))
+    return;
+  // the allocator lives in zero-initialized storage
+  allocator.InitLinkerInitialized(/*may_return_null*/ true);
+  pthread_key_create(&threadFinishKey, ThreadFinish);
+  atomic_store(&allocatorInited, 1, memory_order_release);
+}
+
+void *hextype_allocate(uptr Size, uptr Alignment, bool Cleared) {
+  hextype_allocator_init();
+  if (Size == 0)
+    Size = 1;
+  if (Size > kMaxAllowedMallocSize)
+    return nullptr;
+
+  if (!cacheRegistered) {
+    cacheRegistered = true;
+    pthread_setspecific(threadFinishKey, &cache);
+  }
+
+  void *p = allocator.Allocate(&cache, Size, Alignment, false);
+  if (!p)
+    return nullptr;
+  // Do not rely on the allocator to clear the memory (it's slow).
+  if (Cleared && allocator.FromPrimary(p))
+    memset(p, 0, Size);
+
+  ChunkMetadata *m = Metadata(p);
+  m->typed = 0;
+  m->requested_size = Size;
+  atomic_store(reinterpret_cast<atomic_uint8_t *>(m), 1, memory_order_relaxed);
+  return p;
+}
+
+void hextype_deallocate(void *P) {
+  // ld.so and the dlsym calloc pool hand out memory that is not ours
+  if (!P || !allocator.PointerIsMine(P))
+    return;
+
+  ChunkMetadata *m = Metadata(P);
+  m->typed = 0;
+  atomic_store(reinterpret_cast<atomic_uint8_t *>(m), 0, memory_order_relaxed);
+  allocator.Deallocate(&cache, P);
+}
+
+void *hextype_reallocate(void *P, uptr NewSize, uptr Alignment) {
+  if (!P)
+    return hextype_allocate(NewSize, Alignment, false);
+  if (NewSize == 0) {
+    hextype_deallocate(P);
+    return nullptr;
+  }
+
+  // the instrumentation types the new chunk again after a typed realloc.
+  // A foreign chunk is copied into one of ours and left to its owner.
+  uptr OldSize = allocator.PointerIsMine(P) ? hextype_usable_size(P)
+                                            : ForeignUsableSize(P);
+  void *NewP = hextype_allocate(NewSize, Alignment, false);
+  if (NewP) {
+    internal_memcpy(NewP, P, Min(OldSize, NewSize));
+    hextype_deallocate(P);
+  }
+  return NewP;
+}
+
+uptr hextype_usable_size(const void *P) {
+  if (!P || !allocator.PointerIsMine(const_cast<void *>(P)))
+    return 0;
+  ChunkMetadata *m = Metadata(P);
+  return m->allocated ? m->requested_size : 0;
+}
+
+bool hextype_chunk_set_type(uptr* Addr, uint32_t ElemSize,
+                            uint32_t FakeVPointer) {
+  if (ElemSize == 0 || !allocator.PointerIsMine(Addr))
+    return false;
+
+  void *Begin = allocator.GetBlockBegin(Addr);
+  uptr Offset = (uptr)Addr - (uptr)Begin;
+  if (!Begin || Offset >= kMaxObjOffset)
+    return false;
+
+  ChunkMetadata *m = Metadata(Begin);
+  if (!m->allocated || Offset >= m->requested_size)
+    return false;
+  m->ObjOffset = Offset;
+  m->ElemSize = ElemSize;
+  m->FakeVPointer = FakeVPointer;
+  m->typed = 1;
+  return true;
+}
+
+bool hextype_chunk_has_type(uptr* Addr) {
+  if (!allocator.PointerIsMine(Addr))
+    return false;
+
+  void *Begin = allocator.GetBlockBegin(Addr);
+  if (!Begin)
+    return false;
+  ChunkMetadata *m = Metadata(Begin);
+  return m->allocated && m->typed &&
+         (uptr)Addr == (uptr)Begin + m->ObjOffset;
+}
+
+bool hextype_chunk_clear_type(uptr* Addr) {
+  if (!allocator.FromPrimary(Addr))
+    return false;
+
+  void *Begin = allocator.GetBlockBegin(Addr);
+  if (!Begin)
+    return false;
+  // the member subobjects of the chunk's objects leave its type alone
+  if (!LookupInChunk(Addr, Begin))
+    return false;
+  Metadata(Begin)->typed = 0;
+  return true;
+}
+
+ObjTypeMapEntry* hextype_chunk_lookup(uptr* Addr) {
+  if (!allocator.FromPrimary(Addr))
+    return nullptr;
+  return LookupInChunk(Addr, allocator.GetBlockBegin(Addr));
+}
+
+ObjTypeMapEntry* hextype_large_chunk_lookup(uptr* Addr) {
+  if (!atomic_load(&allocatorInited, memory_order_acquire) ||
+      allocator.FromPrimary(Addr))
+    return nullptr;
+  return LookupInChunk(Addr, allocator.GetBlockBegin(Addr));
+}
@@ -0,0 +1,38 @@
+#ifndef HEXTYPE_ALLOCATOR_H
+#define HEXTYPE_ALLOCATOR_H
+
+#include "hextype_rbtree.h"
+
+//Paul: only part of the clang_rt.hextype_alloc runtime (HEX_ALLOCATOR).
+//The malloc family and operator new/delete are served by the sanitizer_common
+//allocator, and the type of a heap object lives in the metadata of its chunk
+//instead of the ObjTypeMap. Chunks allocated by uninstrumented code are known
+//to the runtime as well, they just carry no type.
+
+void hextype_allocator_init();
+void *hextype_allocate(uptr Size, uptr Alignment, bool Cleared);
+void hextype_deallocate(void *P);
+void *hextype_reallocate(void *P, uptr NewSize, uptr Alignment);
+uptr hextype_usable_size(const void *P);
+
+//Paul: attach the type of its objects to the chunk whose first object is at
+//Addr. Returns false if Addr is not near the start of a chunk of this allocator.
+bool hextype_chunk_set_type(uptr* Addr, uint32_t ElemSize, uint32_t FakeVPointer);
+//Paul: true if the type of the object at Addr was attached to its chunk by
+//hextype_chunk_set_type, free clears it. False for the objects that went to
+//the ObjTypeMap instead.
+bool hextype_chunk_has_type(uptr* Addr);
+//Paul: drop the type of the size class chunk if one of its objects starts at
+//Addr, e.g. when a placement new puts another object there. The chunk is looked up before the
+//ObjTypeMap, so its stale type would hide the new entry. Large chunks are
+//looked up after the ObjTypeMap and need no clearing.
+bool hextype_chunk_clear_type(uptr* Addr);
+
+//Paul: type information of the object starting at Addr inside a typed chunk,
+//or nullptr. hextype_chunk_lookup only looks at the size class chunks (a range
+//check), hextype_large_chunk_lookup at the mmap-ed ones (takes a lock).
+//The returned entry is thread local and valid until the next lookup.
+ObjTypeMapEntry* hextype_chunk_lookup(uptr* Addr);
+ObjTypeMapEntry* hextype_large_chunk_lookup(uptr* Addr);
+
+#endif
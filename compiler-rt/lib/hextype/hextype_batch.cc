@@ -0,0 +1,130 @@
+//===-- hextype_batch.cc -- batched CastSan range checks ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===-------------------------------------------------------------------===//
+
+//Paul: checks N vptrs against one (start, width, alignment) range, for
+//code that downcasts every element of an array of base pointers. It is
+//the same sub, rotate and unsigned compare as
+//__type_casting_verification_ranged, done on 4 (AVX2) or 2 (SSE4.2) vptrs
+//at a time. The runtime is not built with -mavx2, so both vector loops are
+//compiled with a target attribute and picked once by cpuid.
+#include "hextype_report.h"
+
+#include <immintrin.h>
+
+typedef uint64_t (*batch_check_fn)(uint64_t, uint64_t, uint64_t, uint64_t,
+                                   const void* const*, uint64_t);
+
+__attribute__((always_inline))
+inline static bool inRange(uint64_t start, uint64_t width, uint64_t alignment,
+                           uint64_t alignment_r, const void *vpointer) {
+  uint64_t diff = (uint64_t)vpointer - start;
+  uint64_t diffRor = (diff >> alignment) | (diff << alignment_r);
+  return diffRor < width;
+}
+
+static uint64_t checkScalar(uint64_t start, uint64_t width, uint64_t alignment,
+                            uint64_t alignment_r, const void* const* vptrs,
+                            uint64_t n) {
+  for (uint64_t i = 0; i < n; i++)
+    if (!inRange(start, width, alignment, alignment_r, vptrs[i]))
+      return i;
+  return n;
+}
+
+//Paul: there is no unsigned 64 bit compare before AVX-512, flipping the
+//sign bit of both sides turns the signed one into it
+__attribute__((target("avx2")))
+static uint64_t checkAVX2(uint64_t start, uint64_t width, uint64_t alignment,
+                          uint64_t alignment_r, const void* const* vptrs,
+                          uint64_t n) {
+  const __m256i Sign = _mm256_set1_epi64x(0x8000000000000000ULL);
+  const __m256i Start = _mm256_set1_epi64x(start);
+  const __m256i Width = _mm256_xor_si256(_mm256_set1_epi64x(width), Sign);
+  const __m128i Shr = _mm_cvtsi64_si128(alignment);
+  const __m128i Shl = _mm_cvtsi64_si128(alignment_r);
+
+  uint64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i V = _mm256_loadu_si256((const __m256i *)(vptrs + i));
+    __m256i Diff = _mm256_sub_epi64(V, Start);
+    __m256i Ror = _mm256_or_si256(_mm256_srl_epi64(Diff, Shr),
+                                  _mm256_sll_epi64(Diff, Shl));
+    __m256i Ok = _mm256_cmpgt_epi64(Width, _mm256_xor_si256(Ror, Sign));
+    int Mask = _mm256_movemask_pd(_mm256_castsi256_pd(Ok));
+    if (Mask != 0xf)
+      return i + __builtin_ctz(~Mask);
+  }
+  return i + checkScalar(start, width, alignment, alignment_r, vptrs + i,
+                         n - i);
+}
+
+__attribute__((target("sse4.2")))
+static uint64_t checkSSE42(uint64_t start, uint64_t width, uint64_t alignment,
+                           uint64_t alignment_r, const void* const* vptrs,
+                           uint64_t n) {
+  const __m128i Sign = _mm_set1_epi64x(0x8000000000000000ULL);
+  const __m128i Start = _mm_set1_epi64x(start);
+  const __m128i Width = _mm_xor_si128(_mm_set1_epi64x(width), Sign);
+  const __m128i Shr = _mm_cvtsi64_si128(alignment);
+  const __m128i Shl = _mm_cvtsi64_si128(alignment_r);
+
+  uint64_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i V = _mm_loadu_si128((const __m128i *)(vptrs + i));
+    __m128i Diff = _mm_sub_epi64(V, Start);
+    __m128i Ror = _mm_or_si128(_mm_srl_epi64(Diff, Shr),
+                               _mm_sll_epi64(Diff, Shl));
+    __m128i Ok = _mm_cmpgt_epi64(Width, _mm_xor_si128(Ror, Sign));
+    int Mask = _mm_movemask_pd(_mm_castsi128_pd(Ok));
+    if (Mask != 0x3)
+      return i + __builtin_ctz(~Mask);
+  }
+  return i + checkScalar(start, width, alignment, alignment_r, vptrs + i,
+                         n - i);
+}
+
+static batch_check_fn selectBatchCheck() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return checkAVX2;
+  if (__builtin_cpu_supports("sse4.2"))
+    return checkSSE42;
+  return checkScalar;
+}
+
+//Paul: returns the index of the first vptr that is not in the range, or n
+//if all of them are. A bad cast is reported (and counted) once per call,
+//for the first failing element only.
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+uint64_t __type_casting_verification_ranged_batch(const uint64_t start,
+                                                  const uint64_t width,
+                                                  const uint64_t alignment,
+                                                  const uint64_t alignment_r,
+                                                  const void* const* vptrs,
+                                                  const uint64_t n) {
+  static batch_check_fn BatchCheck = selectBatchCheck();
+  uint64_t Failed = BatchCheck(start, width, alignment, alignment_r, vptrs, n);
+
+#ifdef HEX_LOG
+  IncVal(numCastBatch, 1);
+  IncVal(numCasting, Failed == n ? n : Failed + 1);
+  IncVal(numPolyCasting, Failed == n ? n : Failed + 1);
+  IncVal(numCastNonBadCast, Failed);
+#endif
+  if (Failed == n)
+    return n;
+
+#ifdef HEX_LOG
+  IncVal(numCastBadCast, 1);
+#endif
+#if defined(PRINT_BAD_CASTING) || defined(PRINT_BAD_CASTING_FILE)
+  printTypeConfusion(1, 0, start);
+#endif
+  return Failed;
+}
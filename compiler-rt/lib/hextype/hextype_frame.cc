@@ -0,0 +1,148 @@
+//===-- hextype_frame.cc -- per-thread frame registry for HexType -----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===-------------------------------------------------------------------===//
+
+//Paul: with -stack-frame-opt, a function registers all its traced stack
+//objects with one __hextype_push_frame on entry and drops them with
+//__hextype_pop_frame on exit, instead of one ObjTypeMap update and remove
+//per object. The registry is a shadow stack of FrameRecords per thread.
+//
+//A frame left by an exception or a longjmp is never popped. Its record is
+//dropped by the next push or pop of a frame at the same or a higher address,
+//the stale record can be found by a lookup until then, just as the
+//ObjTypeMap entries of such a frame are never removed.
+#include "hextype_frame.h"
+#include "hextype_report.h"
+
+#include <pthread.h>
+
+static THREADLOCAL FrameRecord *FrameStack;
+static THREADLOCAL uint32_t FrameTop;
+static THREADLOCAL uint32_t FrameCapacity;
+static THREADLOCAL uptr StackLo;
+static THREADLOCAL uptr StackHi;
+static THREADLOCAL ObjTypeMapEntry FrameResult;
+
+#define FRAMESTACKINIT 1024
+
+//Paul: records of frames at or below Addrs are dead
+__attribute__((always_inline))
+inline static void dropDeadFrames(uptr **Addrs) {
+  while (FrameTop > 0 && FrameStack[FrameTop - 1].Addrs <= Addrs)
+    FrameTop--;
+}
+
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+void __hextype_push_frame(uptr **Addrs, const FrameObjDesc *Desc,
+                          uint32_t NumDesc) {
+  dropDeadFrames(Addrs);
+  if (FrameTop == FrameCapacity) {
+    uint32_t NewCapacity = FrameCapacity ? 2 * FrameCapacity : FRAMESTACKINIT;
+    FrameRecord *NewStack =
+      (FrameRecord *)realloc(FrameStack, NewCapacity * sizeof(FrameRecord));
+    //Paul: the objects of this frame stay untraced
+    if (NewStack == nullptr)
+      return;
+    FrameStack = NewStack;
+    FrameCapacity = NewCapacity;
+  }
+
+  FrameRecord &Rec = FrameStack[FrameTop++];
+  Rec.Addrs = Addrs;
+  Rec.Desc = Desc;
+  Rec.NumDesc = NumDesc;
+  Rec.Hi = 0;
+#ifdef HEX_LOG
+  IncVal(numFramePush, 1);
+#endif
+}
+
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+void __hextype_pop_frame(uptr **Addrs) {
+  dropDeadFrames(Addrs);
+}
+
+static bool inCurrentStack(uptr Addr) {
+  if (StackHi == 0) {
+    pthread_attr_t Attr;
+    void *Base;
+    size_t Size;
+    if (pthread_getattr_np(pthread_self(), &Attr) != 0)
+      return false;
+    pthread_attr_getstack(&Attr, &Base, &Size);
+    pthread_attr_destroy(&Attr);
+    StackLo = (uptr)Base;
+    StackHi = (uptr)Base + Size;
+  }
+  return Addr >= StackLo && Addr < StackHi;
+}
+
+static void computeRange(FrameRecord &Rec) {
+  uptr Lo = ~(uptr)0, Hi = 0;
+  for (uint32_t i = 0; i < Rec.NumDesc; i++) {
+    const FrameObjDesc &D = Rec.Desc[i];
+    uptr Begin = (uptr)Rec.Addrs[D.ObjIndex] + D.Offset;
+    uptr End = Begin + (uptr)D.TypeSize * D.ArraySize;
+    if (Begin < Lo) Lo = Begin;
+    if (End > Hi) Hi = End;
+  }
+  //Paul: an empty range at the frame itself keeps the records sorted
+  if (Hi == 0)
+    Lo = Hi = (uptr)Rec.Addrs;
+  Rec.Lo = Lo;
+  Rec.Hi = Hi;
+}
+
+__attribute__((always_inline))
+inline static FrameRecord &getRecord(uint32_t r) {
+  FrameRecord &Rec = FrameStack[r];
+  if (Rec.Hi == 0)
+    computeRange(Rec);
+  return Rec;
+}
+
+ObjTypeMapEntry* frame_lookup(uptr* Addr) {
+  uptr A = (uptr)Addr;
+  if (FrameTop == 0 || !inCurrentStack(A))
+    return nullptr;
+
+  //Paul: a push drops every record at or below its frame, so the frames,
+  //and with them the object ranges, go down the stack as r goes up. Find
+  //the first record whose range starts at or below A.
+  uint32_t Left = 0, Right = FrameTop;
+  while (Left < Right) {
+    uint32_t Mid = Left + (Right - Left) / 2;
+    if (getRecord(Mid).Lo > A)
+      Left = Mid + 1;
+    else
+      Right = Mid;
+  }
+  if (Left == FrameTop)
+    return nullptr;
+
+  FrameRecord &Rec = getRecord(Left);
+  if (A >= Rec.Hi)
+    return nullptr;
+
+  for (uint32_t i = 0; i < Rec.NumDesc; i++) {
+    const FrameObjDesc &D = Rec.Desc[i];
+    uptr Begin = (uptr)Rec.Addrs[D.ObjIndex] + D.Offset;
+    if (A < Begin)
+      continue;
+    uptr Diff = A - Begin;
+    if (Diff % D.TypeSize != 0 || Diff / D.TypeSize >= D.ArraySize)
+      continue;
+
+    FrameResult.ObjAddr = Addr;
+    FrameResult.HeapArraySize = D.ArraySize;
+    FrameResult.FakeVPointer = D.FakeVPointer;
+    FrameResult.HexTree = nullptr;
+    return &FrameResult;
+  }
+  return nullptr;
+}
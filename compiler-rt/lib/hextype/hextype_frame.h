@@ -0,0 +1,31 @@
+#ifndef HEXTYPE_FRAME_H
+#define HEXTYPE_FRAME_H
+
+#include "hextype_rbtree.h"
+
+//Paul: one traced object of a frame registered with __hextype_push_frame,
+//has to match FrameObjInfo in llvm/Transforms/Utils/HexTypeUtil.h
+typedef struct FrameObjDesc {
+  uint32_t ObjIndex;      // index into the address array of the frame
+  uint32_t Offset;        // offset of the object from that address
+  uint32_t TypeSize;      // distance between two array elements
+  uint32_t ArraySize;
+  uint32_t FakeVPointer;
+} FrameObjDesc;
+
+//Paul: an entry of the per-thread frame registry. Addrs points into the
+//frame itself, so records of deeper frames have lower Addrs.
+typedef struct FrameRecord {
+  uptr **Addrs;
+  const FrameObjDesc *Desc;
+  uint32_t NumDesc;
+  uptr Lo;                // address range of the objects, Hi == 0 until
+  uptr Hi;                // the first lookup computes it
+} FrameRecord;
+
+//Paul: type information of the object starting at Addr in a live frame of
+//the current thread, or nullptr. Only addresses inside the stack of the
+//current thread are looked up. The returned entry is thread local.
+ObjTypeMapEntry* frame_lookup(uptr* Addr);
+
+#endif
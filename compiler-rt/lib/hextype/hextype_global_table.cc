@@ -0,0 +1,103 @@
+//===-- hextype_global_table.cc -- static global table for HexType ----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===-------------------------------------------------------------------===//
+
+//Paul: globals compiled with -global-table-opt are not registered in the
+//ObjTypeMap at startup. Their descriptors end up in the hextype_globals
+//section of the executable and are only looked at when the ObjTypeMap has
+//no entry for an address. Descriptors of shared libraries are not seen,
+//their globals stay untraced.
+#include "hextype_global_table.h"
+
+#include <algorithm>
+#include <pthread.h>
+
+extern "C" {
+extern GlobalObjDesc __start_hextype_globals[] __attribute__((weak));
+extern GlobalObjDesc __stop_hextype_globals[] __attribute__((weak));
+}
+
+namespace {
+
+struct GlobalObjEntry {
+  uptr Addr;
+  uint32_t FakeVPointer;
+};
+
+bool entryLess(const GlobalObjEntry &a, const GlobalObjEntry &b) {
+  return a.Addr < b.Addr;
+}
+
+GlobalObjEntry *GlobalTable;
+size_t GlobalTableSize;
+uptr GlobalTableLo, GlobalTableHi;
+pthread_once_t GlobalTableOnce = PTHREAD_ONCE_INIT;
+THREADLOCAL ObjTypeMapEntry GlobalResult;
+
+void buildGlobalTable() {
+  GlobalObjDesc *Begin = __start_hextype_globals;
+  GlobalObjDesc *End = __stop_hextype_globals;
+  if (Begin == nullptr || Begin == End)
+    return;
+
+  size_t Count = 0;
+  for (GlobalObjDesc *D = Begin; D != End; D++)
+    Count += D->ArraySize;
+
+  GlobalObjEntry *Table =
+    (GlobalObjEntry *)malloc(Count * sizeof(GlobalObjEntry));
+  if (Table == nullptr)
+    return;
+
+  size_t N = 0;
+  for (GlobalObjDesc *D = Begin; D != End; D++)
+    for (uint32_t i = 0; i < D->ArraySize; i++) {
+      Table[N].Addr = (uptr)D->Addr + D->Offset + (uptr)i * D->TypeSize;
+      Table[N].FakeVPointer = D->FakeVPointer;
+      N++;
+    }
+
+  //Paul: a global used by several modules has one descriptor per module.
+  //The stable sort keeps the descriptors of one address in section (link)
+  //order, so the one kept does not depend on the sort implementation.
+  std::stable_sort(Table, Table + N, entryLess);
+  size_t Unique = 0;
+  for (size_t i = 0; i < N; i++)
+    if (Unique == 0 || Table[Unique - 1].Addr != Table[i].Addr)
+      Table[Unique++] = Table[i];
+
+  GlobalTableLo = Table[0].Addr;
+  GlobalTableHi = Table[Unique - 1].Addr;
+  GlobalTableSize = Unique;
+  GlobalTable = Table;
+}
+
+} // namespace
+
+ObjTypeMapEntry* global_table_lookup(uptr* Addr) {
+  if (&__start_hextype_globals[0] == &__stop_hextype_globals[0])
+    return nullptr;
+
+  pthread_once(&GlobalTableOnce, buildGlobalTable);
+  uptr A = (uptr)Addr;
+  if (GlobalTableSize == 0 || A < GlobalTableLo || A > GlobalTableHi)
+    return nullptr;
+
+  GlobalObjEntry Key = {A, 0};
+  GlobalObjEntry *It = std::lower_bound(GlobalTable,
+                                        GlobalTable + GlobalTableSize,
+                                        Key, entryLess);
+  if (It == GlobalTable + GlobalTableSize || It->Addr != A)
+    return nullptr;
+
+  GlobalResult.ObjAddr = Addr;
+  GlobalResult.HeapArraySize = 1;
+  GlobalResult.FakeVPointer = It->FakeVPointer;
+  GlobalResult.HexTree = nullptr;
+  return &GlobalResult;
+}
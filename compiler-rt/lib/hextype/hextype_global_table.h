@@ -0,0 +1,22 @@
+#ifndef HEXTYPE_GLOBAL_TABLE_H
+#define HEXTYPE_GLOBAL_TABLE_H
+
+#include "hextype_rbtree.h"
+
+//Paul: an entry of the hextype_globals section emitted by HexTypePass
+//with -global-table-opt: ArraySize objects of TypeSize bytes starting at
+//Addr + Offset, all of the type FakeVPointer.
+typedef struct GlobalObjDesc {
+  char *Addr;
+  uint32_t Offset;
+  uint32_t TypeSize;
+  uint32_t ArraySize;
+  uint32_t FakeVPointer;
+} GlobalObjDesc;
+
+//Paul: type information of the global object starting at Addr, or nullptr.
+//The first call expands the section into a sorted (address, FakeVPointer)
+//array, later calls binary search it.
+ObjTypeMapEntry* global_table_lookup(uptr* Addr);
+
+#endif
@@ -0,0 +1,119 @@
+//===-- hextype_interceptors.cc -- malloc interceptors for HexType ----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===-------------------------------------------------------------------===//
+
+//Paul: routes the malloc family and operator new/delete of the whole
+//program, uninstrumented libraries included, to hextype_allocator.cc.
+//Only part of the clang_rt.hextype_alloc runtime.
+#include "interception/interception.h"
+#include "sanitizer_common/sanitizer_allocator.h"
+#include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_internal_defs.h"
+#include "hextype_allocator.h"
+
+#include <errno.h>
+
+using namespace __sanitizer;
+
+namespace std {
+  struct nothrow_t;
+}
+
+INTERCEPTOR(void*, malloc, uptr size) {
+  return hextype_allocate(size, 1, false);
+}
+
+INTERCEPTOR(void, free, void *p) {
+  hextype_deallocate(p);
+}
+
+INTERCEPTOR(void, cfree, void *p) ALIAS(WRAPPER_NAME(free));
+
+INTERCEPTOR(void*, calloc, uptr nmemb, uptr size) {
+  if (CallocShouldReturnNullDueToOverflow(size, nmemb)) return nullptr;
+  return hextype_allocate(nmemb * size, 1, true);
+}
+
+INTERCEPTOR(void*, realloc, void *q, uptr size) {
+  return hextype_reallocate(q, size, 1);
+}
+
+INTERCEPTOR(void*, memalign, uptr alignment, uptr size) {
+  return hextype_allocate(size, alignment, false);
+}
+
+INTERCEPTOR(void*, aligned_alloc, uptr alignment, uptr size) {
+  return hextype_allocate(size, alignment, false);
+}
+
+INTERCEPTOR(int, posix_memalign, void **memptr, uptr alignment, uptr size) {
+  if (alignment == 0 || !IsPowerOfTwo(alignment) ||
+      alignment % sizeof(void *) != 0)
+    return EINVAL;
+  void *p = hextype_allocate(size, alignment, false);
+  if (!p)
+    return ENOMEM;
+  *memptr = p;
+  return 0;
+}
+
+INTERCEPTOR(void*, valloc, uptr size) {
+  if (size == 0)
+    size = GetPageSizeCached();
+  return hextype_allocate(size, GetPageSizeCached(), false);
+}
+
+INTERCEPTOR(void*, pvalloc, uptr size) {
+  uptr PageSize = GetPageSizeCached();
+  size = RoundUpTo(size, PageSize);
+  if (size == 0) {
+    // pvalloc(0) should allocate one page.
+    size = PageSize;
+  }
+  return hextype_allocate(size, PageSize, false);
+}
+
+INTERCEPTOR(uptr, malloc_usable_size, void *ptr) {
+  return hextype_usable_size(ptr);
+}
+
+#define OPERATOR_NEW_BODY                              \
+  void *res = hextype_allocate(size, 1, false);        \
+  if (!res)                                            \
+    ReportAllocatorCannotReturnNull();                 \
+  return res;
+
+#define OPERATOR_NEW_NOTHROW_BODY                      \
+  return hextype_allocate(size, 1, false);
+
+INTERCEPTOR_ATTRIBUTE
+void *operator new(uptr size) { OPERATOR_NEW_BODY; }
+INTERCEPTOR_ATTRIBUTE
+void *operator new[](uptr size) { OPERATOR_NEW_BODY; }
+INTERCEPTOR_ATTRIBUTE
+void *operator new(uptr size, std::nothrow_t const&) {
+  OPERATOR_NEW_NOTHROW_BODY;
+}
+INTERCEPTOR_ATTRIBUTE
+void *operator new[](uptr size, std::nothrow_t const&) {
+  OPERATOR_NEW_NOTHROW_BODY;
+}
+
+#define OPERATOR_DELETE_BODY \
+  hextype_deallocate(ptr);
+
+INTERCEPTOR_ATTRIBUTE
+void operator delete(void *ptr) NOEXCEPT { OPERATOR_DELETE_BODY; }
+INTERCEPTOR_ATTRIBUTE
+void operator delete[](void *ptr) NOEXCEPT { OPERATOR_DELETE_BODY; }
+INTERCEPTOR_ATTRIBUTE
+void operator delete(void *ptr, std::nothrow_t const&) { OPERATOR_DELETE_BODY; }
+INTERCEPTOR_ATTRIBUTE
+void operator delete[](void *ptr, std::nothrow_t const &) {
+  OPERATOR_DELETE_BODY;
+}
@@ -0,0 +1,214 @@
+//===-- hextype_interval.cc -- array intervals for HexType  ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===-------------------------------------------------------------------===//
+
+//Paul: new T[n] used to be registered with one ObjTypeMap update per
+//element, and removed the same way. Here an array is one record keyed by
+//its base address, so registering and removing it does not depend on n.
+//Member arrays of the elements are records of their own, nested in the
+//record of the array they are part of.
+//Lookups only come here when the ObjTypeMap has no entry for the address.
+#include "hextype_interval.h"
+#include <sched.h>
+
+struct IntervalNode;
+typedef std::map<uptr, IntervalNode> IntervalMapTy;
+
+struct IntervalNode {
+  ArrayIntervalEntry Rec;
+  uint64_t Seq;                 // registration order
+  IntervalMapTy *Children;      // arrays inside the elements of Rec
+};
+
+static IntervalMapTy *IntervalMap;
+static uint64_t IntervalSeq;
+// the runtime does not link sanitizer_common, so no StaticSpinMutex here
+static std::atomic_flag IntervalMapLock = ATOMIC_FLAG_INIT;
+static THREADLOCAL ObjTypeMapEntry IntervalResult;
+
+namespace {
+struct IntervalMapLocker {
+  IntervalMapLocker() {
+    while (IntervalMapLock.test_and_set(std::memory_order_acquire))
+      sched_yield();
+  }
+  ~IntervalMapLocker() {
+    IntervalMapLock.clear(std::memory_order_release);
+  }
+};
+}
+// lets lookups skip the lock while no array is registered
+static std::atomic<uint64_t> NumIntervals;
+static uint64_t NumNodes;
+// [IntervalLo, IntervalHi) covers every registered array, so that frees
+// and lookups of other memory do not take the lock either. Only grows while
+// arrays are registered.
+static std::atomic<uptr> IntervalLo(~(uptr)0);
+static std::atomic<uptr> IntervalHi;
+
+static bool outsideIntervals(uptr A) {
+  return NumIntervals.load(std::memory_order_relaxed) == 0 ||
+         A < IntervalLo.load(std::memory_order_relaxed) ||
+         A >= IntervalHi.load(std::memory_order_relaxed);
+}
+
+// called with the lock held after NumNodes changed
+static void updateBounds(const ArrayIntervalEntry *New) {
+  if (NumNodes == 0) {
+    IntervalLo.store(~(uptr)0, std::memory_order_relaxed);
+    IntervalHi.store(0, std::memory_order_relaxed);
+  } else if (New != nullptr) {
+    if (New->Base < IntervalLo.load(std::memory_order_relaxed))
+      IntervalLo.store(New->Base, std::memory_order_relaxed);
+    if (New->End > IntervalHi.load(std::memory_order_relaxed))
+      IntervalHi.store(New->End, std::memory_order_relaxed);
+  }
+  NumIntervals.store(NumNodes, std::memory_order_relaxed);
+}
+
+static void freeChildren(IntervalNode &Node) {
+  if (Node.Children == nullptr)
+    return;
+  for (auto &Child : *Node.Children)
+    freeChildren(Child.second);
+  NumNodes -= Node.Children->size();
+  delete Node.Children;
+  Node.Children = nullptr;
+}
+
+static bool sameExtent(const ArrayIntervalEntry &A, const ArrayIntervalEntry &B) {
+  return A.Base == B.Base && A.End == B.End;
+}
+
+static bool isInside(const ArrayIntervalEntry &Inner,
+                     const ArrayIntervalEntry &Outer) {
+  return Inner.Base >= Outer.Base && Inner.End <= Outer.End &&
+         !sameExtent(Inner, Outer);
+}
+
+static void insertInterval(IntervalMapTy &Level, const ArrayIntervalEntry &New) {
+  // a member array of an element of a registered array
+  IntervalMapTy::iterator It = Level.upper_bound(New.Base);
+  if (It != Level.begin()) {
+    IntervalNode &Outer = std::prev(It)->second;
+    if (isInside(New, Outer.Rec)) {
+      if (Outer.Children == nullptr)
+        Outer.Children = new IntervalMapTy();
+      insertInterval(*Outer.Children, New);
+      return;
+    }
+  }
+
+  IntervalNode Node;
+  Node.Rec = New;
+  Node.Seq = ++IntervalSeq;
+  Node.Children = nullptr;
+
+  // records inside the new one are its member arrays. The memory of the
+  // others was reused without a remove (e.g. a missed free), they are stale.
+  It = Level.lower_bound(New.Base);
+  if (It != Level.begin() && std::prev(It)->second.Rec.End > New.Base)
+    --It;
+  while (It != Level.end() && It->first < New.End) {
+    IntervalNode &Old = It->second;
+    if (isInside(Old.Rec, New)) {
+      if (Node.Children == nullptr)
+        Node.Children = new IntervalMapTy();
+      Node.Children->insert(*It);
+    } else if (sameExtent(Old.Rec, New)) {
+      // registered again, its member arrays are still there
+      Node.Children = Old.Children;
+      NumNodes--;
+    } else {
+      freeChildren(Old);
+      NumNodes--;
+    }
+    It = Level.erase(It);
+  }
+
+  Level[New.Base] = Node;
+  NumNodes++;
+}
+
+void interval_insert(uptr* Base, uint32_t ElemSize, uint64_t ElemCount,
+                     uint32_t FakeVPointer) {
+  ArrayIntervalEntry New;
+  New.Base = (uptr)Base;
+  New.End = New.Base + (uptr)ElemSize * ElemCount;
+  New.ElemSize = ElemSize;
+  New.Entry.ObjAddr = Base;
+  New.Entry.HeapArraySize = ElemCount;
+  New.Entry.FakeVPointer = FakeVPointer;
+  New.Entry.HexTree = nullptr;
+
+  IntervalMapLocker l;
+  if (IntervalMap == nullptr)
+    IntervalMap = new IntervalMapTy();
+  insertInterval(*IntervalMap, New);
+  updateBounds(&New);
+}
+
+uint64_t interval_remove(uptr* Base) {
+  uptr B = (uptr)Base;
+  if (outsideIntervals(B))
+    return 0;
+
+  IntervalMapLocker l;
+  for (IntervalMapTy *Level = IntervalMap; Level != nullptr;) {
+    IntervalMapTy::iterator It = Level->upper_bound(B);
+    if (It == Level->begin())
+      return 0;
+    --It;
+
+    IntervalNode &Node = It->second;
+    if (B >= Node.Rec.End)
+      return 0;
+    if (Node.Rec.Base != B) {
+      Level = Node.Children;
+      continue;
+    }
+
+    uint64_t ElemCount = (Node.Rec.End - Node.Rec.Base) / Node.Rec.ElemSize;
+    freeChildren(Node);
+    Level->erase(It);
+    NumNodes--;
+    updateBounds(nullptr);
+    return ElemCount;
+  }
+  return 0;
+}
+
+ObjTypeMapEntry* interval_lookup(uptr* Addr) {
+  uptr A = (uptr)Addr;
+  if (outsideIntervals(A))
+    return nullptr;
+
+  IntervalMapLocker l;
+  const IntervalNode *Found = nullptr;
+  for (IntervalMapTy *Level = IntervalMap; Level != nullptr;) {
+    IntervalMapTy::iterator It = Level->upper_bound(A);
+    if (It == Level->begin())
+      break;
+    --It;
+
+    const IntervalNode &Node = It->second;
+    if (A >= Node.Rec.End)
+      break;
+    // only the start of an element was ever registered
+    if ((A - Node.Rec.Base) % Node.Rec.ElemSize == 0 &&
+        (Found == nullptr || Node.Seq > Found->Seq))
+      Found = &Node;
+    Level = Node.Children;
+  }
+  if (Found == nullptr)
+    return nullptr;
+
+  // the record may be removed as soon as the lock is released
+  IntervalResult = Found->Rec.Entry;
+  return &IntervalResult;
+}
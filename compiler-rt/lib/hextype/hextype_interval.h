@@ -0,0 +1,34 @@
+#ifndef HEXTYPE_INTERVAL_H
+#define HEXTYPE_INTERVAL_H
+
+#include "hextype_rbtree.h"
+#include <atomic>
+
+// arrays with at least this many elements are registered as one interval
+// instead of one ObjTypeMap entry per element
+#define ARRAYINTERVALMIN 2
+
+//Paul: an array of ElemCount objects of ElemSize bytes starting at Base.
+//Entry holds the type information shared by all elements.
+typedef struct ArrayIntervalEntry {
+  uptr Base;
+  uptr End;
+  uint32_t ElemSize;
+  ObjTypeMapEntry Entry;
+} ArrayIntervalEntry;
+
+//Paul: register an array. Arrays inside the element of another one (member
+//arrays of its objects) are kept as its subobjects, older intervals that
+//only partially overlap it are dropped.
+void interval_insert(uptr* Base, uint32_t ElemSize, uint64_t ElemCount,
+                     uint32_t FakeVPointer);
+//Paul: remove the outermost array starting at Base together with its
+//subobjects. Returns its number of elements, or 0 if there is no array at
+//Base.
+uint64_t interval_remove(uptr* Base);
+//Paul: type information of the array element starting at Addr, or
+//nullptr. If Addr starts elements of nested arrays, the latest registered
+//one wins like in the ObjTypeMap. The returned entry is thread local.
+ObjTypeMapEntry* interval_lookup(uptr* Addr);
+
+#endif
@@ -0,0 +1,88 @@
+//===-- hextype_profile.cc -- per site cast check profile -----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+//Paul: with -sd-cast-profile-generate every cast check site has a
+//{ id, count } record in the __castsan_sites section (see
+//SDCastProfile). At exit the records are written to CASTSAN_PROFILE_FILE
+//(default castsan.prof, %p is replaced by the pid) as lines of
+//"<id in hex> <count>", which -sd-cast-profile-use reads back.
+#include "sanitizer_common/sanitizer_internal_defs.h"
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct CastSanSite {
+  uint64_t Id;
+  uint64_t Count;
+};
+
+//Paul: the linker defines these for every section with a C name
+extern "C" CastSanSite __start___castsan_sites[] __attribute__((weak));
+extern "C" CastSanSite __stop___castsan_sites[] __attribute__((weak));
+
+static bool ProfileInstalled = false;
+
+static void getProfilePath(char *Path, size_t Size) {
+  const char *Pattern = getenv("CASTSAN_PROFILE_FILE");
+  if (Pattern == nullptr || *Pattern == '\0')
+    Pattern = "castsan.prof";
+
+  size_t Len = 0;
+  for (const char *P = Pattern; *P != '\0' && Len + 1 < Size; P++) {
+    if (P[0] == '%' && P[1] == 'p') {
+      Len += snprintf(Path + Len, Size - Len, "%d", (int)getpid());
+      if (Len >= Size)
+        Len = Size - 1;
+      P++;
+    } else {
+      Path[Len++] = *P;
+    }
+  }
+  Path[Len] = '\0';
+}
+
+//Paul: also callable from the program, services that never exit can
+//dump their profile from a signal handler or a debug endpoint
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+void __castsan_profile_dump() {
+  //Paul: both are null if the section does not exist, they are weak
+  CastSanSite *Begin = __start___castsan_sites;
+  CastSanSite *End = __stop___castsan_sites;
+  if (Begin == nullptr || Begin == End)
+    return;
+
+  char Path[1000];
+  getProfilePath(Path, sizeof(Path));
+
+  FILE *Out = fopen(Path, "w");
+  if (Out == nullptr) {
+    fprintf(stderr, "CastSan: cannot write the cast profile %s\n", Path);
+    return;
+  }
+
+  fprintf(Out, "# CastSan cast profile\n");
+  for (CastSanSite *Site = Begin; Site < End; Site++)
+    fprintf(Out, "%" PRIx64 " %" PRIu64 "\n", Site->Id, Site->Count);
+  fclose(Out);
+}
+
+static void CastSanProfileAtExit(void) {
+  __castsan_profile_dump();
+}
+
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+void __castsan_profile_init() {
+  if (ProfileInstalled)
+    return;
+  ProfileInstalled = true;
+  atexit(CastSanProfileAtExit);
+}
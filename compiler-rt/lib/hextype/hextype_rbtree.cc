@@ -1,4 +1,5 @@
 #include "hextype_rbtree.h"
+#include "hextype_report.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,7 +20,7 @@ static node new_node(void* key, void* value, color node_color,
                      node left, node right);
 
 //Paul: used to look-up a node by providing a key value.
-static node lookup_node(rbtree t, void* key);
+static node lookup_node(rbtree t, void* key, unsigned* depth = NULL);
 static void rotate_left(rbtree t, node n);
 static void rotate_right(rbtree t, node n);
 
@@ -132,10 +133,12 @@ int compare(void* leftp, void* rightp) {
   }
 }
 
-node lookup_node(rbtree t, void* key) {
+node lookup_node(rbtree t, void* key, unsigned* depth) {
 
   node n = t->root;
   while (n != NULL) {
+    if (depth)
+      (*depth)++;
     int comp_result = compare(key, n->key);
     if (comp_result == 0) {
       return n;
@@ -151,7 +154,13 @@ node lookup_node(rbtree t, void* key) {
 
 void* rbtree_lookup(rbtree t, void* key) {
 
+#ifdef HEX_LOG
+  unsigned depth = 0;
+  node n = lookup_node(t, key, &depth);
+  IncTreeDepth(depth);
+#else
   node n = lookup_node(t, key);
+#endif
 
   return n == NULL ? NULL : n->value;
 }
@@ -1,3 +1,6 @@
+#ifndef HEXTYPE_RBTREE_H
+#define HEXTYPE_RBTREE_H
+
 #include "sanitizer_common/sanitizer_stacktrace.h"
 #include <map>
 #include <set>
@@ -54,3 +57,5 @@ void rbtree_insert(rbtree t, void* key, void* value);
 int rbtree_delete(rbtree t, void* key);
 //Paul: write to log.
 void write_log(char *result, char *filename);
+
+#endif
@@ -2,19 +2,93 @@
 #include <inttypes.h>
 #include <execinfo.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 
 #ifdef HEX_LOG
 #define BT_BUF_SIZE 100
 
 std::atomic<unsigned long> count_index[MAXINDEX];
 
-//Paul: increment value function
+//Paul: the counters in use, count_index or the shared memory segment
+static std::atomic<std::atomic<unsigned long> *> counters(count_index);
+
+//Paul: the segment file, removed again when the program exits
+static char LiveStatsPath[MAXPATH];
+
+//Paul: increment value function. A single fetch_add, so the counters
+//stay wait-free when they are in the shared memory segment.
 void IncVal(int index, int count) {
-  count_index[index].fetch_add(count);
+  counters.load(std::memory_order_relaxed)[index].fetch_add(
+      count, std::memory_order_relaxed);
 }
 
 unsigned long getVal(int index) {
-  return count_index[index].load();
+  return counters.load(std::memory_order_relaxed)[index].load();
+}
+
+void IncTreeDepth(unsigned depth) {
+  if (depth >= TREE_DEPTH_BINS)
+    depth = TREE_DEPTH_BINS - 1;
+  IncVal(numTreeDepth + depth, 1);
+}
+
+//Paul: the segment is created with open() on /dev/shm, which is all
+//shm_open does on Linux, and saves linking the runtime against librt
+void InstallLiveStats() {
+  const char *Env = getenv("HEXTYPE_STATS_SHM");
+  if (Env == nullptr || *Env == '\0')
+    return;
+
+  char *Path = LiveStatsPath;
+  if (strcmp(Env, "1") == 0)
+    snprintf(Path, MAXPATH, "/dev/shm/hextype.%d", (int)getpid());
+  else
+    snprintf(Path, MAXPATH, "/dev/shm/%s", Env[0] == '/' ? Env + 1 : Env);
+
+  size_t Size = sizeof(HexStatsHeader) + MAXINDEX * sizeof(uint64_t);
+  int Fd = open(Path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (Fd < 0) {
+    fprintf(stderr, "HexType: cannot create %s\n", Path);
+    Path[0] = '\0';
+    return;
+  }
+  if (ftruncate(Fd, Size) != 0) {
+    close(Fd);
+    unlink(Path);
+    fprintf(stderr, "HexType: cannot resize %s\n", Path);
+    Path[0] = '\0';
+    return;
+  }
+  void *Map = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+  close(Fd);
+  if (Map == MAP_FAILED) {
+    unlink(Path);
+    fprintf(stderr, "HexType: cannot map %s\n", Path);
+    Path[0] = '\0';
+    return;
+  }
+
+  HexStatsHeader *Header = (HexStatsHeader *)Map;
+  Header->Version = HEX_STATS_VERSION;
+  Header->NumCounters = MAXINDEX;
+  Header->Pid = getpid();
+  Header->StartTime = time(nullptr);
+
+  //Paul: this runs from __init_obj_type_map, before the program has
+  //threads of its own, so no counts get lost while switching over
+  std::atomic<unsigned long> *Shared =
+    (std::atomic<unsigned long> *)(Header + 1);
+  for (int i = 0; i < MAXINDEX; i++)
+    Shared[i].store(count_index[i].load(), std::memory_order_relaxed);
+  counters.store(Shared, std::memory_order_release);
+
+  //Paul: the magic last, a reader only trusts a complete segment
+  __atomic_store_n(&Header->Magic, HEX_STATS_MAGIC, __ATOMIC_RELEASE);
 }
 
 void printInfotoFile(char *PrintStr, char *FileName) {
@@ -112,12 +186,41 @@ static void PrintStatResult(void) {
   snprintf(tmp, sizeof(tmp), "\t%lu: Stack object Remove\n",getVal(numStackRm));
   printInfotoFile(tmp, fileName);
 
+  //Paul: arrays registered as one interval record
+  snprintf(tmp, sizeof(tmp), "%lu %lu: Array interval update remove\n",
+           getVal(numArrayUp), getVal(numArrayRm));
+  printInfotoFile(tmp, fileName);
+
+  //Paul: stack frames registered as one record (-stack-frame-opt)
+  snprintf(tmp, sizeof(tmp), "\t%lu: Stack frame push\n", getVal(numFramePush));
+  printInfotoFile(tmp, fileName);
+
+  //Paul: heap objects typed in their allocator chunk (HEX_ALLOCATOR)
+  snprintf(tmp, sizeof(tmp), "\t%lu: Heap chunk update\n", getVal(numChunkUp));
+  printInfotoFile(tmp, fileName);
+
+  snprintf(tmp, sizeof(tmp), "== RB-tree lookup depth ==\n");
+  printInfotoFile(tmp, fileName);
+
+  for (int i = 0; i < TREE_DEPTH_BINS; i++) {
+    if (getVal(numTreeDepth + i) == 0)
+      continue;
+    snprintf(tmp, sizeof(tmp), "\t%lu: depth %d%s\n",
+             getVal(numTreeDepth + i), i,
+             i == TREE_DEPTH_BINS - 1 ? "+" : "");
+    printInfotoFile(tmp, fileName);
+  }
+
   snprintf(tmp, sizeof(tmp), "== Casting verification status ==\n");
   printInfotoFile(tmp, fileName);
 
   snprintf(tmp, sizeof(tmp), "%lu (verified %lu): Casting operation\n",
            getVal(numCasting), getVal(numVerifiedCasting));
   printInfotoFile(tmp, fileName);
+
+  snprintf(tmp, sizeof(tmp), "\t%lu: Batched range checks\n",
+           getVal(numCastBatch));
+  printInfotoFile(tmp, fileName);
   
   //Paul: object lookup success.
   snprintf(tmp, sizeof(tmp), "\t%lu: Object lookup success\n",
@@ -128,6 +231,31 @@ static void PrintStatResult(void) {
            "\t%lu: Object lookup success (find in the RB-tree)\n",
           getVal(numLookMiss));
   printInfotoFile(tmp, fileName);
+
+  snprintf(tmp, sizeof(tmp),
+           "\t%lu: Object lookup success (find in the array intervals)\n",
+          getVal(numLookArray));
+  printInfotoFile(tmp, fileName);
+
+  snprintf(tmp, sizeof(tmp),
+           "\t%lu: Object lookup success (find in the frame registry)\n",
+          getVal(numLookFrame));
+  printInfotoFile(tmp, fileName);
+
+  snprintf(tmp, sizeof(tmp),
+           "\t%lu: Object lookup success (find in the global table)\n",
+          getVal(numLookGlobalTable));
+  printInfotoFile(tmp, fileName);
+
+  snprintf(tmp, sizeof(tmp),
+           "\t%lu: Object lookup success (find in the heap chunk header)\n",
+          getVal(numLookChunk));
+  printInfotoFile(tmp, fileName);
+
+  snprintf(tmp, sizeof(tmp),
+           "\t%lu: Object lookup in an untyped heap chunk\n",
+          getVal(numLookUntypedChunk));
+  printInfotoFile(tmp, fileName);
   
   //Paul: object update fail.
   snprintf(tmp, sizeof(tmp),
@@ -241,6 +369,12 @@ static void PrintStatResult(void) {
 //Paul: when hextype terminates it will print all the above statistics.
 static void HexTypeAtExit(void) {
   PrintStatResult();
+
+  //Paul: a reader that is still attached keeps its mapping. A program
+  //that is killed leaves the segment behind, the next run with the same
+  //name truncates it.
+  if (LiveStatsPath[0] != '\0')
+    unlink(LiveStatsPath);
 }
 
 //Paul: at exit print all statistics from above.
@@ -55,12 +55,52 @@
 #define numBadCastType3 34
 #define numBadCastType4 35
 
+#define numArrayUp 36
+#define numArrayRm 37
+#define numLookArray 38
+
+#define numChunkUp 39
+#define numLookChunk 40
+#define numLookUntypedChunk 41
+
+#define numFramePush 42
+#define numLookFrame 43
+
+#define numLookGlobalTable 44
+
+#define numCastBatch 45
+
+//Paul: histogram of the rb-tree lookup depth, bin i counts the lookups
+//that visited i nodes, the last bin everything deeper
+#define numTreeDepth 50
+#define TREE_DEPTH_BINS 32
+
+//Paul: live statistics. With HEXTYPE_STATS_SHM=<name> (or =1 for
+//hextype.<pid>) the counters live in /dev/shm/<name> instead of the
+//process, so scripts/hextype_stats.py can watch a running program. The
+//file is removed at exit. The segment is this header followed by
+//MAXINDEX 64 bit counters, the indices are the num* values above.
+#define HEX_STATS_MAGIC 0x5453455059545848ULL /* "HXTYPEST" */
+#define HEX_STATS_VERSION 1
+
+struct HexStatsHeader {
+  uint64_t Magic;
+  uint32_t Version;
+  uint32_t NumCounters;
+  uint64_t Pid;
+  uint64_t StartTime; // seconds since the epoch
+};
+
 //Paul: counting utility function
 void IncVal(int index, int count);
 //Paul: get the actual value of a count
 unsigned long getVal(int index);
 //Paul: print a type confusion
 void printTypeConfusion(int, uint64_t, uint64_t);
+//Paul: count one rb-tree lookup that visited depth nodes
+void IncTreeDepth(unsigned depth);
 //Paul: used to print statistics at the end when HexType terminates
 void InstallAtExitHandler();
+//Paul: move the counters into the shared memory segment, if requested
+void InstallLiveStats();
 #endif
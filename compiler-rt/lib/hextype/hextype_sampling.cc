@@ -0,0 +1,73 @@
+//===-- hextype_sampling.cc -- sampled cast checks ------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+//Paul: with -sd-sample-cast-checks every cast check site counts down a
+//thread local variable and only runs its check when it reaches zero (see
+//SDCastSampler). The check then asks __castsan_sample_next how far to
+//count down until the next one.
+#include "sanitizer_common/sanitizer_internal_defs.h"
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+
+//Paul: the sampling rate starts at CASTSAN_SAMPLE_RATE (default 100)
+//and can be changed with __castsan_set_sample_rate while running. 1 checks
+//every execution.
+#define DEFAULT_SAMPLE_RATE 100
+
+//Paul: a site has to be checked this often at its current period before
+//the period doubles, sites that run less than that are checked every time
+#define SAMPLE_WARMUP 64
+
+struct CastSanSampleSite {
+  uint64_t Checks;
+  uint32_t Period;
+  uint32_t ChecksAtPeriod;
+};
+
+static std::atomic<uint32_t> SampleRate(0);
+
+static uint32_t getSampleRate() {
+  uint32_t Rate = SampleRate.load(std::memory_order_relaxed);
+  if (Rate != 0)
+    return Rate;
+
+  const char *Env = getenv("CASTSAN_SAMPLE_RATE");
+  Rate = Env != nullptr ? (uint32_t)strtoul(Env, nullptr, 10) : 0;
+  if (Rate == 0)
+    Rate = DEFAULT_SAMPLE_RATE;
+
+  uint32_t Unset = 0;
+  if (!SampleRate.compare_exchange_strong(Unset, Rate))
+    Rate = Unset;
+  return Rate;
+}
+
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+void __castsan_set_sample_rate(uint32_t Rate) {
+  SampleRate.store(Rate == 0 ? 1 : Rate, std::memory_order_relaxed);
+}
+
+//Paul: the sites are shared by all threads and updated without
+//synchronization, a lost update only delays the next period change
+extern "C" SANITIZER_INTERFACE_ATTRIBUTE
+uint32_t __castsan_sample_next(CastSanSampleSite *Site) {
+  uint32_t Rate = getSampleRate();
+
+  Site->Checks++;
+  if (Site->Period > Rate) {
+    //Paul: the rate was lowered at runtime
+    Site->Period = Rate;
+    Site->ChecksAtPeriod = 0;
+  } else if (Site->Period < Rate && ++Site->ChecksAtPeriod >= SAMPLE_WARMUP) {
+    Site->Period = Site->Period * 2 < Rate ? Site->Period * 2 : Rate;
+    Site->ChecksAtPeriod = 0;
+  }
+  return Site->Period;
+}
@@ -0,0 +1,164 @@
+// Runtime part of the cross-DSO mode (-plugin-opt=sd-cross-dso).
+//
+// Every DSO linked in cross-DSO mode carries a table of range descriptors,
+// one per coalesced vptr range of each of its vtables, and registers it
+// from a constructor. The tables of all loaded DSOs are merged into one
+// global index. A vptr check that fails against the ranges of its own DSO
+// calls __sd_cross_dso_check, which looks the vtable up in that index.
+//
+// Readers never lock: the index is immutable once published. Registering
+// or unregistering a DSO builds a new index under a mutex and publishes it
+// with a single atomic store. Old indices are never freed, since a reader
+// may still be probing them; this leaks one index per dlopen/dlclose.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// has to match SDUpdateIndices::emitRangeDescriptorTable
+struct __sd_range_desc {
+  uint64_t classHash;   // FNV-1a of the mangled vtable name and sub-vtable index
+  uint64_t start;       // first valid vptr
+  uint32_t width;       // number of valid vptrs
+  uint32_t alignShift;  // log2 of the distance between two valid vptrs
+};
+
+namespace {
+
+struct sd_range {
+  uint64_t start;
+  uint64_t width;
+  uint32_t alignShift;
+};
+
+// open addressing, a slot with count == 0 is empty
+struct sd_slot {
+  uint64_t classHash;
+  uint32_t first;       // ranges[first, first + count)
+  uint32_t count;
+};
+
+struct sd_range_index {
+  uint64_t mask;        // number of slots - 1
+  sd_slot *slots;
+  sd_range *ranges;
+};
+
+typedef std::vector<std::pair<const __sd_range_desc *, uint64_t> > sd_registry_t;
+
+std::atomic<const sd_range_index *> currentIndex(nullptr);
+
+// only touched under registryLock. Allocated on first use and never freed,
+// so that DSO destructors running late in exit() can still unregister
+std::mutex registryLock;
+sd_registry_t *registry = nullptr;
+
+bool descLess(const __sd_range_desc &a, const __sd_range_desc &b) {
+  return a.classHash < b.classHash ||
+         (a.classHash == b.classHash && a.start < b.start);
+}
+
+const sd_range_index *buildIndex(const sd_registry_t &reg) {
+  std::vector<__sd_range_desc> descs;
+  for (auto &table : reg)
+    descs.insert(descs.end(), table.first, table.first + table.second);
+
+  if (descs.empty())
+    return nullptr;
+
+  std::sort(descs.begin(), descs.end(), descLess);
+
+  uint64_t classes = 0;
+  for (size_t i = 0; i < descs.size(); i++)
+    if (i == 0 || descs[i].classHash != descs[i - 1].classHash)
+      classes++;
+
+  // keep the load factor at or below 1/2, so probing always terminates quickly
+  uint64_t slots = 16;
+  while (slots < 2 * classes)
+    slots *= 2;
+
+  sd_range_index *index = new sd_range_index;
+  index->mask = slots - 1;
+  index->slots = new sd_slot[slots];
+  index->ranges = new sd_range[descs.size()];
+  memset(index->slots, 0, slots * sizeof(sd_slot));
+
+  for (size_t i = 0; i < descs.size(); ) {
+    size_t j = i;
+    for (; j < descs.size() && descs[j].classHash == descs[i].classHash; j++) {
+      index->ranges[j].start = descs[j].start;
+      index->ranges[j].width = descs[j].width;
+      index->ranges[j].alignShift = descs[j].alignShift;
+    }
+
+    uint64_t s = descs[i].classHash & index->mask;
+    while (index->slots[s].count != 0)
+      s = (s + 1) & index->mask;
+
+    index->slots[s].classHash = descs[i].classHash;
+    index->slots[s].first = i;
+    index->slots[s].count = j - i;
+    i = j;
+  }
+
+  return index;
+}
+
+inline bool inRange(const sd_range &r, uint64_t vptr) {
+  // same rotate check as the inlined one: misaligned vptrs end up in the high bits
+  uint64_t diff = vptr - r.start;
+  uint64_t index = r.alignShift == 0 ? diff :
+                   (diff >> r.alignShift) | (diff << (64 - r.alignShift));
+  return index < r.width;
+}
+
+} // namespace
+
+extern "C" void __sd_register_ranges(const __sd_range_desc *table, uint64_t count) {
+  std::lock_guard<std::mutex> guard(registryLock);
+  if (!registry)
+    registry = new sd_registry_t();
+
+  registry->push_back(std::make_pair(table, count));
+  currentIndex.store(buildIndex(*registry), std::memory_order_release);
+}
+
+extern "C" void __sd_unregister_ranges(const __sd_range_desc *table) {
+  std::lock_guard<std::mutex> guard(registryLock);
+  if (!registry)
+    return;
+
+  for (auto it = registry->begin(); it != registry->end(); ++it) {
+    if (it->first == table) {
+      registry->erase(it);
+      break;
+    }
+  }
+  currentIndex.store(buildIndex(*registry), std::memory_order_release);
+}
+
+// returns non-zero iff vptr is a valid vptr for the vtable in any loaded DSO
+extern "C" int __sd_cross_dso_check(const void *vptr, uint64_t classHash) {
+  const sd_range_index *index = currentIndex.load(std::memory_order_acquire);
+  if (!index)
+    return 0;
+
+  for (uint64_t s = classHash & index->mask; ; s = (s + 1) & index->mask) {
+    const sd_slot &slot = index->slots[s];
+    if (slot.count == 0)
+      return 0;
+    if (slot.classHash != classHash)
+      continue;
+
+    for (uint32_t i = slot.first; i < slot.first + slot.count; i++)
+      if (inRange(index->ranges[i], (uint64_t) vptr))
+        return 1;
+    return 0;
+  }
+}
@@ -22,6 +22,7 @@
 // <http://www.gnu.org/licenses/>.
 
 #include "tinfo.h"
+#include "dyncast_cache.h"
 
 namespace __cxxabiv1 {
 
@@ -34,35 +35,15 @@ static ptrdiff_t __ivtbl_get_ott(const void *vtable, const ptrdiff_t off) {
   return *(adjust_pointer<ptrdiff_t>(vtable, off));
 }
 
-// this is the external interface to the dynamic cast machinery
-/* sub: source address to be adjusted; nonnull, and since the
- *      source object is polymorphic, *(void**)sub is a virtual pointer.
- * src: static type of the source object.
- * dst: destination type (the "T" in "dynamic_cast<T>(v)").
- * src2dst_offset: a static hint about the location of the
- *    source subobject with respect to the complete object;
- *    special negative values are:
- *       -1: no hint
- *       -2: src is not a public base of dst
- *       -3: src is a multiple public base type but never a
- *           virtual base type
- *    otherwise, the src type is a unique public nonvirtual
- *    base type of dst at offset src2dst_offset from the
- *    origin of dst.  */
-extern "C" void *
-__ivtbl_dynamic_cast (const void *src_ptr,    // object started from
-                const __class_type_info *src_type, // type of the starting object
-                const __class_type_info *dst_type, // desired target type
-                ptrdiff_t src2dst,
-                ptrdiff_t rttiOff,
-                ptrdiff_t ottOff) // how src and dst are related
+// the RTTI walk of __ivtbl_dynamic_cast, whole_ptr is the complete object
+static void *
+__ivtbl_do_dynamic_cast (const void *src_ptr,
+                         const __class_type_info *src_type,
+                         const __class_type_info *dst_type,
+                         ptrdiff_t src2dst,
+                         const void *whole_ptr,
+                         const __class_type_info *whole_type)
   {
-  const void *vtable = *static_cast <const void *const *> (src_ptr);
-
-  const void *whole_ptr =
-      adjust_pointer <void> (src_ptr, __ivtbl_get_ott(vtable, ottOff));
-  const __class_type_info *whole_type = __ivtbl_get_rtti(vtable, rttiOff);
-
   // If the whole object vptr doesn't refer to the whole object type, we're
   // in the middle of constructing a primary base, and src is a separate
   // base.  This has undefined behavior and we can't find anything outside
@@ -107,5 +88,54 @@ __ivtbl_dynamic_cast (const void *src_ptr,    // object started from
   return NULL;
 }
 
+// this is the external interface to the dynamic cast machinery
+/* sub: source address to be adjusted; nonnull, and since the
+ *      source object is polymorphic, *(void**)sub is a virtual pointer.
+ * src: static type of the source object.
+ * dst: destination type (the "T" in "dynamic_cast<T>(v)").
+ * src2dst_offset: a static hint about the location of the
+ *    source subobject with respect to the complete object;
+ *    special negative values are:
+ *       -1: no hint
+ *       -2: src is not a public base of dst
+ *       -3: src is a multiple public base type but never a
+ *           virtual base type
+ *    otherwise, the src type is a unique public nonvirtual
+ *    base type of dst at offset src2dst_offset from the
+ *    origin of dst.  */
+extern "C" void *
+__ivtbl_dynamic_cast (const void *src_ptr,    // object started from
+                const __class_type_info *src_type, // type of the starting object
+                const __class_type_info *dst_type, // desired target type
+                ptrdiff_t src2dst,
+                ptrdiff_t rttiOff,
+                ptrdiff_t ottOff) // how src and dst are related
+  {
+  const void *vtable = *static_cast <const void *const *> (src_ptr);
+
+  const void *whole_ptr =
+      adjust_pointer <void> (src_ptr, __ivtbl_get_ott(vtable, ottOff));
+
+  // the hierarchy walk is only done once per cache key, see dyncast_cache.h
+  __sd_dyncast_key key;
+  key.srcVtable = vtable;
+  key.wholeVtable = *static_cast <const void *const *> (whole_ptr);
+  key.srcType = src_type;
+  key.dstType = dst_type;
+  key.src2dst = src2dst;
+
+  bool failed;
+  ptrdiff_t srcToDst;
+  if (__sd_dyncast_cache_lookup(key, failed, srcToDst))
+    return failed ? NULL : const_cast <void *> (adjust_pointer <void> (src_ptr, srcToDst));
+
+  const __class_type_info *whole_type = __ivtbl_get_rtti(vtable, rttiOff);
+  void *dst_ptr = __ivtbl_do_dynamic_cast (src_ptr, src_type, dst_type, src2dst,
+                                           whole_ptr, whole_type);
+
+  __sd_dyncast_cache_insert(key, dst_ptr == NULL,
+                            (const char *) dst_ptr - (const char *) src_ptr);
+  return dst_ptr;
 }
 
+}
@@ -0,0 +1,141 @@
+// Fixed-size, lock-free result cache of __ivtbl_dynamic_cast.
+//
+// The cache is a direct-mapped table of slots, each guarded by a sequence
+// counter (a seqlock). Readers never write to the slot. They retry nothing
+// either: a slot that is being written or changed under them counts as a
+// miss. A writer claims a slot by moving its counter from even to odd and
+// simply drops the insert if another thread holds it. A colliding key
+// evicts the old one.
+//
+// Built with -DSD_DYNCAST_CACHE_STATS, the cache counts hits, misses and
+// inserts and prints them to stderr at exit.
+
+#include "dyncast_cache.h"
+
+#include <atomic>
+#include <limits>
+
+#ifdef SD_DYNCAST_CACHE_STATS
+#include <stdio.h>
+#endif
+
+namespace {
+
+#define SD_DYNCAST_CACHE_SLOTS 1024   // has to be a power of 2
+
+struct alignas(64) sd_cache_slot {
+  std::atomic<uint64_t> seq;          // odd while a writer fills the slot, 0 if never written
+  std::atomic<uintptr_t> srcVtable;
+  std::atomic<uintptr_t> wholeVtable;
+  std::atomic<uintptr_t> srcType;
+  std::atomic<uintptr_t> dstType;
+  std::atomic<ptrdiff_t> src2dst;
+  std::atomic<ptrdiff_t> srcToDst;    // kFailed if the cast returns null
+};
+
+const ptrdiff_t kFailed = std::numeric_limits<ptrdiff_t>::min();
+
+sd_cache_slot cache[SD_DYNCAST_CACHE_SLOTS];
+
+#ifdef SD_DYNCAST_CACHE_STATS
+std::atomic<uint64_t> statHits(0);
+std::atomic<uint64_t> statMisses(0);
+std::atomic<uint64_t> statInserts(0);
+std::atomic<uint64_t> statDropped(0);
+#define SD_CACHE_COUNT(stat) stat.fetch_add(1, std::memory_order_relaxed)
+#else
+#define SD_CACHE_COUNT(stat)
+#endif
+
+inline sd_cache_slot &slotFor(const __sd_dyncast_key &key) {
+  // vtables and type infos are at least 8 byte aligned, drop the zero bits
+  uint64_t h = ((uintptr_t) key.srcVtable >> 3) * 0x9E3779B97F4A7C15ULL;
+  h ^= ((uintptr_t) key.dstType >> 3) * 0xC2B2AE3D27D4EB4FULL;
+  h ^= (uintptr_t) key.srcType >> 3;
+  h ^= (uint64_t) key.src2dst;
+  return cache[(h >> 32) & (SD_DYNCAST_CACHE_SLOTS - 1)];
+}
+
+} // namespace
+
+bool __sd_dyncast_cache_lookup(const __sd_dyncast_key &key, bool &failed,
+                               ptrdiff_t &srcToDst) {
+  sd_cache_slot &slot = slotFor(key);
+
+  uint64_t seq = slot.seq.load(std::memory_order_acquire);
+  if (seq == 0 || (seq & 1)) {
+    SD_CACHE_COUNT(statMisses);
+    return false;
+  }
+
+  uintptr_t srcVtable   = slot.srcVtable.load(std::memory_order_relaxed);
+  uintptr_t wholeVtable = slot.wholeVtable.load(std::memory_order_relaxed);
+  uintptr_t srcType     = slot.srcType.load(std::memory_order_relaxed);
+  uintptr_t dstType     = slot.dstType.load(std::memory_order_relaxed);
+  ptrdiff_t src2dst     = slot.src2dst.load(std::memory_order_relaxed);
+  ptrdiff_t result      = slot.srcToDst.load(std::memory_order_relaxed);
+
+  // the fields above must not be read after the counter is checked again
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (slot.seq.load(std::memory_order_relaxed) != seq ||
+      srcVtable != (uintptr_t) key.srcVtable ||
+      wholeVtable != (uintptr_t) key.wholeVtable ||
+      srcType != (uintptr_t) key.srcType ||
+      dstType != (uintptr_t) key.dstType ||
+      src2dst != key.src2dst) {
+    SD_CACHE_COUNT(statMisses);
+    return false;
+  }
+
+  SD_CACHE_COUNT(statHits);
+  failed = result == kFailed;
+  srcToDst = failed ? 0 : result;
+  return true;
+}
+
+void __sd_dyncast_cache_insert(const __sd_dyncast_key &key, bool failed,
+                               ptrdiff_t srcToDst) {
+  sd_cache_slot &slot = slotFor(key);
+
+  uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+  if ((seq & 1) ||
+      !slot.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_relaxed)) {
+    SD_CACHE_COUNT(statDropped);
+    return;
+  }
+  // the field stores must not become visible before the odd counter
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot.srcVtable.store((uintptr_t) key.srcVtable, std::memory_order_relaxed);
+  slot.wholeVtable.store((uintptr_t) key.wholeVtable, std::memory_order_relaxed);
+  slot.srcType.store((uintptr_t) key.srcType, std::memory_order_relaxed);
+  slot.dstType.store((uintptr_t) key.dstType, std::memory_order_relaxed);
+  slot.src2dst.store(key.src2dst, std::memory_order_relaxed);
+  slot.srcToDst.store(failed ? kFailed : srcToDst, std::memory_order_relaxed);
+
+  slot.seq.store(seq + 2, std::memory_order_release);
+  SD_CACHE_COUNT(statInserts);
+}
+
+extern "C" void __sd_dyncast_cache_get_stats(__sd_dyncast_cache_stats *stats) {
+#ifdef SD_DYNCAST_CACHE_STATS
+  stats->hits    = statHits.load(std::memory_order_relaxed);
+  stats->misses  = statMisses.load(std::memory_order_relaxed);
+  stats->inserts = statInserts.load(std::memory_order_relaxed);
+  stats->dropped = statDropped.load(std::memory_order_relaxed);
+#else
+  stats->hits = stats->misses = stats->inserts = stats->dropped = 0;
+#endif
+}
+
+#ifdef SD_DYNCAST_CACHE_STATS
+__attribute__((destructor)) static void sd_dyncast_cache_print_stats() {
+  __sd_dyncast_cache_stats stats;
+  __sd_dyncast_cache_get_stats(&stats);
+
+  uint64_t lookups = stats.hits + stats.misses;
+  fprintf(stderr, "dynamic_cast cache: %lu lookups, %lu hits (%.1f%%), %lu inserts, %lu dropped\n",
+          lookups, stats.hits, lookups ? 100.0 * stats.hits / lookups : 0.0,
+          stats.inserts, stats.dropped);
+}
+#endif
@@ -0,0 +1,41 @@
+// Result cache of __ivtbl_dynamic_cast.
+//
+// The outcome of a dynamic_cast only depends on the vptr of the source
+// subobject, the vptr of the whole object, the static source and
+// destination types and the offset hint. For a fixed pair of vptrs the
+// layout of the whole object is fixed too, virtual bases included, so the
+// distance from the source to the result is a constant that can be cached.
+
+#ifndef DYNCAST_CACHE_H
+#define DYNCAST_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct __sd_dyncast_key {
+  const void *srcVtable;    // vptr of the source subobject
+  const void *wholeVtable;  // vptr of the whole object
+  const void *srcType;
+  const void *dstType;
+  ptrdiff_t src2dst;
+};
+
+struct __sd_dyncast_cache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t inserts;
+  uint64_t dropped;         // inserts skipped because another thread was writing the slot
+};
+
+// returns true on a hit. failed is set if the cast returns null, otherwise
+// the result is the source pointer plus srcToDst
+bool __sd_dyncast_cache_lookup(const __sd_dyncast_key &key, bool &failed,
+                               ptrdiff_t &srcToDst);
+
+void __sd_dyncast_cache_insert(const __sd_dyncast_key &key, bool failed,
+                               ptrdiff_t srcToDst);
+
+// all zero unless libdyncast is built with SD_DYNCAST_CACHE_STATS=1
+extern "C" void __sd_dyncast_cache_get_stats(__sd_dyncast_cache_stats *stats);
+
+#endif
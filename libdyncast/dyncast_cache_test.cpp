@@ -0,0 +1,149 @@
+// Checks the results of __ivtbl_dynamic_cast, cached or not, against the
+// dynamic_cast of the compiler. Several threads run the same casts in a
+// different order, so that inserts, hits and evictions of the cache race.
+//
+// The objects here come from the normal C++ ABI, so the offset to top is
+// the second and the RTTI the first word in front of the vptr.
+//
+//   make test
+
+#include "dyncast_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <typeinfo>
+#include <vector>
+
+extern "C" void *__ivtbl_dynamic_cast(const void *src_ptr, const void *src_type,
+                                      const void *dst_type, ptrdiff_t src2dst,
+                                      ptrdiff_t rttiOff, ptrdiff_t ottOff);
+
+namespace {
+
+const ptrdiff_t kRttiOff = -(ptrdiff_t) sizeof(void *);
+const ptrdiff_t kOttOff = -2 * (ptrdiff_t) sizeof(void *);
+// the src2dst hint the compiler passes when it knows nothing
+const ptrdiff_t kNoHint = -1;
+
+// a diamond over a virtual base
+struct A { virtual ~A() {} int a; };
+struct B : virtual A { int b; };
+struct C : virtual A { int c; };
+struct D : B, C { int d; };
+
+// cross casts between unrelated bases
+struct E { virtual ~E() {} int e; };
+struct F : D, E { int f; };
+
+// E is an ambiguous, non-virtual base of I
+struct G : E { int g; };
+struct H : E { int h; };
+struct I : G, H { int i; };
+
+// a private base, casts to it fail
+struct J : private B, E { int j; B *asB() { return this; } };
+
+typedef bool (*cast_check_t)(const void *obj);
+
+template <class Src, class Dst>
+bool checkCast(const void *obj) {
+  Src *src = (Src *) obj;
+  void *expected = dynamic_cast<Dst *>(src);
+  void *got = __ivtbl_dynamic_cast(src, &typeid(Src), &typeid(Dst), kNoHint,
+                                   kRttiOff, kOttOff);
+  if (got != expected) {
+    fprintf(stderr, "dynamic_cast<%s *>(%s *) is %p, expected %p\n",
+            typeid(Dst).name(), typeid(Src).name(), got, expected);
+    return false;
+  }
+  return true;
+}
+
+struct cast_case_t {
+  const void *src;          // already converted to the static source type
+  cast_check_t check;
+};
+
+std::vector<cast_case_t> buildCases() {
+  static D d;
+  static F f;
+  static I i;
+  static J j;
+  static B b;
+
+  std::vector<cast_case_t> cases;
+  // down casts through the virtual base, and from either side of the diamond
+  cases.push_back({ (A *) &d, checkCast<A, D> });
+  cases.push_back({ (A *) &d, checkCast<A, B> });
+  cases.push_back({ (A *) &d, checkCast<A, C> });
+  cases.push_back({ (B *) &d, checkCast<B, C> });
+  cases.push_back({ (C *) &d, checkCast<C, B> });
+  cases.push_back({ (A *) &b, checkCast<A, D> });
+  cases.push_back({ (A *) &b, checkCast<A, B> });
+  // cross casts to and from the unrelated base
+  cases.push_back({ (E *) &f, checkCast<E, B> });
+  cases.push_back({ (E *) &f, checkCast<E, D> });
+  cases.push_back({ (A *) &f, checkCast<A, E> });
+  cases.push_back({ (C *) &f, checkCast<C, F> });
+  cases.push_back({ (B *) &f, checkCast<B, E> });
+  // ambiguous base: E exists twice in I
+  cases.push_back({ (E *) (G *) &i, checkCast<E, I> });
+  cases.push_back({ (E *) (H *) &i, checkCast<E, G> });
+  cases.push_back({ (E *) (G *) &i, checkCast<E, H> });
+  cases.push_back({ (G *) &i, checkCast<G, H> });
+  // the private base is not reachable
+  cases.push_back({ (E *) &j, checkCast<E, B> });
+  cases.push_back({ (B *) j.asB(), checkCast<B, J> });
+  cases.push_back({ (A *) j.asB(), checkCast<A, E> });
+  return cases;
+}
+
+const unsigned kThreads = 8;
+const unsigned kRounds = 20000;
+
+void runCases(const std::vector<cast_case_t> *cases, unsigned seed, bool *ok) {
+  size_t n = cases->size();
+  for (unsigned round = 0; round < kRounds; round++) {
+    // every thread walks the cases with its own stride and start
+    size_t step = 1 + (seed + round) % (n - 1);
+    while (n % step == 0 && step != 1)
+      step--;
+    for (size_t k = 0, c = (seed * 7 + round) % n; k < n; k++, c = (c + step) % n) {
+      const cast_case_t &cc = (*cases)[c];
+      if (!cc.check(cc.src)) {
+        *ok = false;
+        return;
+      }
+    }
+  }
+}
+
+} // namespace
+
+int main() {
+  std::vector<cast_case_t> cases = buildCases();
+
+  std::vector<std::thread> threads;
+  bool ok[kThreads];
+  for (unsigned t = 0; t < kThreads; t++) {
+    ok[t] = true;
+    threads.push_back(std::thread(runCases, &cases, t, &ok[t]));
+  }
+  for (std::thread &t : threads)
+    t.join();
+
+  for (unsigned t = 0; t < kThreads; t++) {
+    if (!ok[t]) {
+      fprintf(stderr, "FAIL: thread %u\n", t);
+      return 1;
+    }
+  }
+
+  __sd_dyncast_cache_stats stats;
+  __sd_dyncast_cache_get_stats(&stats);
+  printf("PASS: %zu casts on %u threads, %u rounds (hits %llu, misses %llu)\n",
+         cases.size(), kThreads, kRounds, (unsigned long long) stats.hits,
+         (unsigned long long) stats.misses);
+  return 0;
+}
@@ -342,6 +342,9 @@ void initializeSDBuildCHAPass(PassRegistry&);
 //this pass is used to build the new v table layout
 void initializeSDLayoutBuilderPass(PassRegistry&);
 
+//this pass is used to devirtualize the vcall sites with a single valid vptr
+void initializeSDDevirtPass(PassRegistry&);
+
 //this pass is used to update the indices of the new layout of the v tables
 void initializeSDUpdateIndicesPass(PassRegistry&);
 
@@ -209,6 +209,7 @@ namespace {
       (void) llvm::createSDFixPass();
       (void) llvm::createSDBuildCHAPass();
       (void) llvm::createSDLayoutBuilderPass();
+      (void) llvm::createSDDevirtPass();
       (void) llvm::createSDUpdateIndicesPass();
       (void) llvm::createSDMoveBasicBlocksPass();
       (void) llvm::createSDSubstModulePass();
@@ -226,7 +226,8 @@ this are the CastSan passes*/
 ModulePass* createSDFixPass();
 ModulePass* createSDBuildCHAPass();
 ModulePass* createSDLayoutBuilderPass(bool interleave = false);
-ModulePass* createSDUpdateIndicesPass();
+ModulePass* createSDDevirtPass();
+ModulePass* createSDUpdateIndicesPass(bool crossDSO = false);
 ModulePass* createSDMoveBasicBlocksPass();
 ModulePass* createSDSubstModulePass();
 
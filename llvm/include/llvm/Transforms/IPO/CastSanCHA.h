@@ -1,3 +1,6 @@
+#ifndef LLVM_TRANSFORMS_IPO_CASTSAN_CHA_H
+#define LLVM_TRANSFORMS_IPO_CASTSAN_CHA_H
+
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO/CastSan.h"
 #include "llvm/Transforms/IPO.h"
@@ -143,7 +146,7 @@ namespace llvm {
 
 public:
     SDBuildCHA() : ModulePass(ID) {
-      std::cerr << "\nCreating SDBuildCHA pass!\n";
+      DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "\nCreating SDBuildCHA pass!\n");
       initializeSDBuildCHAPass(*PassRegistry::getPassRegistry());
     }
 
@@ -191,9 +194,9 @@ public:
       //for each of the root nodes
       verifyClouds(M);
 
-      std::cerr << "Undefined vtables: \n";
+      DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "Undefined vtables: \n");
       for (auto i : undefinedVTables) {
-        std::cerr << i << "\n";
+        DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << i << "\n");
       }
 
       sd_print("\nP2. Finished building CHA ...\n");
@@ -386,3 +389,5 @@ public:
   };
 
 }
+
+#endif
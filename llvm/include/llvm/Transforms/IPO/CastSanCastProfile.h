@@ -0,0 +1,71 @@
+#ifndef LLVM_TRANSFORMS_IPO_CASTSAN_CAST_PROFILE_H
+#define LLVM_TRANSFORMS_IPO_CASTSAN_CAST_PROFILE_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+
+namespace llvm {
+
+  /**
+   * Per site profile of the cast checks (the cast_info intrinsics).
+   *
+   * With -sd-cast-profile-generate every check site gets a
+   * { i64 id, i64 count } record in the __castsan_sites section and
+   * increments its count before the check. The runtime (hextype_profile.cc)
+   * writes the records to CASTSAN_PROFILE_FILE when the program exits.
+   *
+   * With -sd-cast-profile-use=<file> the counts decide where the check
+   * goes:
+   *  - CP_INLINE  : run at least sd-cast-profile-hot times, inline compare
+   *  - CP_OUTLINE : run less than sd-cast-profile-cold times, runtime call
+   *  - CP_DEFAULT : everything else, and sites the profile does not know
+   *
+   * The site ids hash the function, the target class and the position of
+   * the site among the checks for that class in the function, so they
+   * stay the same between the instrumented and the optimized build.
+   */
+  class SDCastProfile {
+  public:
+    enum placement_t {
+      CP_DEFAULT = 0,
+      CP_INLINE,
+      CP_OUTLINE
+    };
+
+    SDCastProfile(Module& M, Function* castInfo);
+
+    bool isGenerating() const;
+
+    /**
+     * Count the executions of the check site CI, before CI.
+     */
+    void emitCounter(CallInst* CI);
+
+    /**
+     * Where the check of CI goes. Only call it for the sites that apply
+     * the placement, it is counted in the statistics.
+     */
+    placement_t place(CallInst* CI);
+
+    /**
+     * Make the runtime write the profile, if any counters were emitted.
+     */
+    void finish();
+
+    static const char* placementName(placement_t placement);
+
+  private:
+    Module& M;
+    DenseMap<CallInst*, uint64_t> siteIds;
+    DenseMap<uint64_t, uint64_t> counts;
+    uint64_t countersEmitted;
+    uint64_t placementCount[CP_OUTLINE + 1];
+
+    void computeSiteIds(Function* castInfo);
+    void readProfile();
+  };
+
+}
+
+#endif
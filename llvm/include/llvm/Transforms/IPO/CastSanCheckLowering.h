@@ -0,0 +1,95 @@
+#ifndef LLVM_TRANSFORMS_IPO_CASTSAN_CHECK_LOWERING_H
+#define LLVM_TRANSFORMS_IPO_CASTSAN_CHECK_LOWERING_H
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/IPO/CastSanLayoutBuilder.h"
+
+#include <map>
+#include <vector>
+
+namespace llvm {
+
+  /**
+   * Picks the cheapest correct form of a vptr check for a set of
+   * coalesced ranges (see SDLayoutBuilder::memRangeMap) and emits it.
+   *
+   * The forms are:
+   *  - CK_EQ            : vptr == start (a single range of width 1)
+   *  - CK_ROTATE        : a single rotate-compare
+   *  - CK_MULTI_RANGE   : up to sd-max-check-ranges rotate-compares or'ed together
+   *  - CK_INLINE_BITSET : one rotate-compare over the whole span plus a test
+   *                       against a 64 bit immediate mask
+   *  - CK_MEM_BITSET    : same as above, but the mask is a byte array in .rodata
+   *                       (modeled on the LowerBitSets pass)
+   *
+   * The range forms are emitted as sd_subst_check_range intrinsics, so the
+   * final lowering (and the constant vptr folding) is still done in P5.
+   * The bitset forms are emitted as plain IR.
+   */
+  class SDCheckLowering {
+  public:
+    typedef SDLayoutBuilder::mem_range_t mem_range_t;
+
+    enum check_kind_t {
+      CK_EQ = 0,
+      CK_ROTATE,
+      CK_MULTI_RANGE,
+      CK_INLINE_BITSET,
+      CK_MEM_BITSET,
+      CK_NUM_KINDS
+    };
+
+    struct check_plan_t {
+      check_kind_t kind;
+      uint64_t cost;                   // estimated cost in instructions
+      uint64_t alignment;              // distance in bytes between two valid vptrs
+      std::vector<mem_range_t> ranges; // the ranges, sorted by descending width
+      Constant* spanStart;             // start of the first range (bitsets only)
+      uint64_t span;                   // number of slots covered by the ranges (bitsets only)
+      std::vector<bool> bits;          // slot i of the span is a valid vptr (bitsets only)
+    };
+
+    SDCheckLowering(Module& M) : M(M), bitsetBytes(0) {
+      for (unsigned i = 0; i < CK_NUM_KINDS; i++)
+        kindCount[i] = 0;
+    }
+
+    /**
+     * Compute the costs of all applicable forms for the given ranges
+     * and return the cheapest one.
+     */
+    check_plan_t plan(const std::vector<mem_range_t>& ranges, uint64_t alignment);
+
+    /**
+     * Emit the check described by the plan before the builder's insertion
+     * point. The result is an i1 that is true iff vptr is valid.
+     */
+    Value* emit(IRBuilder<>& builder, Value* vptr, const check_plan_t& plan);
+
+    static const char* kindName(check_kind_t kind);
+
+    /**
+     * Print how many sites were lowered with each form.
+     */
+    void printStatistics();
+
+  private:
+    Module& M;
+    uint64_t kindCount[CK_NUM_KINDS];
+    uint64_t bitsetBytes;
+
+    // identical bitsets of the same cloud share their global
+    std::map<std::pair<Constant*, std::vector<bool> >, GlobalVariable*> bitsetMap;
+
+    Value* emitRangeCheck(IRBuilder<>& builder, Value* vptr,
+                          const mem_range_t& range, uint64_t alignment);
+    Value* emitBitsetCheck(IRBuilder<>& builder, Value* vptr, const check_plan_t& plan);
+    GlobalVariable* getBitsetGlobal(const check_plan_t& plan);
+  };
+
+}
+
+#endif
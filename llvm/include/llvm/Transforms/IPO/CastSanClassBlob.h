@@ -0,0 +1,89 @@
+#ifndef LLVM_TRANSFORMS_IPO_CASTSAN_CLASS_BLOB_H
+#define LLVM_TRANSFORMS_IPO_CASTSAN_CLASS_BLOB_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * named md that holds the class info of all classes of a module, the
+ * IR linker appends the operands of all linked modules to it
+ */
+#define SD_MD_CLASSBLOB      "sd.class_blob"
+#define SD_CLASSBLOB_VERSION 1
+
+namespace llvm {
+
+  /**
+   * The class info written by sd_insertVtableMD() (CastSanVtblMD.h) and read
+   * by SDBuildCHA::extractMetadata(), in a compact form.
+   *
+   * The old form was one NamedMDNode per class with one MDTuple per
+   * sub-vtable and an MDString and MDNode per parent. Now the classes of a
+   * module are collected during code generation and written once, as one
+   * operand of SD_MD_CLASSBLOB:
+   *
+   *   !{!"<blob>", !{<vtable globals or null>}}
+   *
+   * The blob is a sequence of ULEB128 numbers:
+   *
+   *   version numStrings (length bytes)* numClasses class*
+   *   class  := nameIdx vtblIdx numSubs sub*
+   *   sub    := order start end addressPoint numParents parent*
+   *   parent := nameIdx vtblIdx order
+   *
+   * Every name is stored once in the string table. A vtblIdx is 0 if there
+   * is no vtable global, otherwise the index + 1 into the tuple of globals.
+   * The globals are kept as references since the IR linker may rename them,
+   * the decoder then takes the name of the global instead of the stored one.
+   */
+  class SDClassBlob {
+  public:
+    typedef std::pair<std::string, uint64_t> parent_t; // parent vtable name, order
+
+    struct sub_vtable_t {
+      uint64_t order;
+      uint64_t start;
+      uint64_t end;
+      uint64_t addressPoint;
+      std::vector<parent_t> parents;
+    };
+
+    struct class_info_t {
+      std::string className;
+      std::vector<sub_vtable_t> subVtables;
+    };
+
+    bool hasClass(StringRef className) const {
+      return classNames.count(className);
+    }
+
+    /**
+     * Adds the class info of a class, a class that was already added is ignored
+     */
+    void addClass(const class_info_t &info);
+
+    /**
+     * Writes the collected classes into one new operand of SD_MD_CLASSBLOB.
+     * The vtable globals are looked up in M by name at this point.
+     */
+    void emit(Module &M) const;
+
+    /**
+     * Decodes one operand of SD_MD_CLASSBLOB and appends its classes.
+     * Returns the size of the blob in bytes.
+     */
+    static uint64_t decode(const MDNode *op, std::vector<class_info_t> &classes);
+
+  private:
+    std::vector<class_info_t> infos;
+    StringSet<> classNames;
+  };
+}
+
+#endif
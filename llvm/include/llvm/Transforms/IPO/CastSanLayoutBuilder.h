@@ -1,3 +1,6 @@
+#ifndef LLVM_TRANSFORMS_IPO_CASTSAN_LAYOUT_BUILDER_H
+#define LLVM_TRANSFORMS_IPO_CASTSAN_LAYOUT_BUILDER_H
+
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO/CastSan.h"
 #include "llvm/Transforms/IPO/CastSanCHA.h"
@@ -12,6 +15,7 @@
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/Pass.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
 #include "llvm/Transforms/Utils/Local.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/CallSite.h"
@@ -76,8 +80,9 @@ namespace llvm {
     pad_map_t prePadMap;
     bool interleave;                                        // this is a flag used to decide if we interleave or order the cloud 
 
-    SDLayoutBuilder(bool interl = false) : ModulePass(ID), interleave(interl) {
-      std::cerr << "SDLayoutBuilder(" << interl << ")\n";
+    SDLayoutBuilder(bool interl = false) : ModulePass(ID), interleave(interl), paddingBytesSaved(0), hasProfile(false),
+                                         clonedThunks(0), foldedThunks(0) {
+      DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "SDLayoutBuilder(" << interl << ")\n");
       initializeSDLayoutBuilderPass(*PassRegistry::getPassRegistry());
       dummyVtable = vtbl_t("DUMMY_VTBL", 0); //this v tables are used during padding 
     }
@@ -104,6 +109,9 @@ namespace llvm {
       on the used interleaving flag. 
       */
       
+      //Paul: find the hot clouds from the profile counts, if there are any
+      collectCloudProfile(M);
+
       buildNewLayouts(M);
 
       //after building the new layout verify them according to some imposed conditions 
@@ -118,6 +126,7 @@ namespace llvm {
     */
     void getAnalysisUsage(AnalysisUsage &AU) const override {
       AU.addRequired<SDBuildCHA>();
+      AU.addRequired<BlockFrequencyInfoWrapperPass>();
       AU.addPreserved<SDBuildCHA>();
     }
  
@@ -163,6 +172,26 @@ namespace llvm {
     Value* newVtblAddress(Module& M, const vtbl_name_t& name, Instruction* inst);
     Constant* newVtblAddressConst(Module& M, const vtbl_t& vtbl);
 
+    /**
+     * Choose the distance in entries between the address points of an
+     * ordered cloud, minimizing padding and cache lines touched.
+     */
+    uint64_t chooseCloudStride(vtbl_name_t& vtbl);
+    int64_t paddingBytesSaved;                              // padding removed by chooseCloudStride, over all clouds
+
+    /**
+     * Sum up the profile counts (entry count times relative block frequency)
+     * of the vcall and cast sites of each cloud and mark the clouds that
+     * cover sd-hot-cloud-percent of all counts as hot. Without profile
+     * data nothing is marked and the layout stays as it was.
+     */
+    void collectCloudProfile(Module& M);
+    bool isHotCloud(const vtbl_name_t& vtbl);
+
+    bool hasProfile;                                        // at least one site had a profile count
+    std::map<vtbl_name_t, uint64_t> cloudProfileCount;      // root -> executions of its vcall and cast sites
+    std::set<vtbl_name_t> hotClouds;
+
     /**
      * Order and pad the cloud given by the root element.
      */
@@ -224,6 +253,18 @@ namespace llvm {
 
     void createThunkFunctions(Module&, const vtbl_name_t& rootName);
     Function* getVthunkFunction(Constant* vtblElement);
+
+    /**
+     * Many clones of a vthunk are identical after the vcall indices are
+     * substituted. Hash the body of a new clone and if an identical clone
+     * already exists, erase the new one and return the existing one.
+     */
+    Function* mergeThunkFunction(Function* newThunkF);
+
+    std::map<std::string, Function*> newThunkMap;               // new vthunk name -> (merged) clone
+    std::map<size_t, std::vector<std::pair<std::string, Function*> > > thunkBodyMap; // body hash -> (body, clone)
+    uint64_t clonedThunks;
+    uint64_t foldedThunks;
     
     /*Paul: 
      *cha stores the result of the CHA pass.
@@ -236,3 +277,5 @@ namespace llvm {
   };
 
 }
+
+#endif
@@ -1,25 +1,48 @@
 #ifndef LLVM_TRANSFORMS_IPO_CASTSAN_LOG_H
 #define LLVM_TRANSFORMS_IPO_CASTSAN_LOG_H
 
-#include <iostream>
 #include <cstdio>
-#include "llvm/Support/raw_ostream.h"
-#include <execinfo.h>
 #include <stdarg.h>
+#include <vector>
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
 
+//Paul: the debug type of all the CastSan passes and of the CastSan parts of
+//clang. sd_print and the DEBUG output only show up with -debug-only=castsan
+//(-mllvm -debug-only=castsan for clang), builds with NDEBUG have none. The
+//counters are llvm::Statistic (-stats) and the phases of the passes have
+//timers (-time-passes). The check sites are optimization remarks, see
+//CastSanRemarks.h.
+#define SD_DEBUG_TYPE "castsan"
+
+#ifndef NDEBUG
 #define SD_DEBUG
+#endif
 
 //Paul: this is the default terminal printing method
 static void sd_print(const char* fmt, ...) {
 #ifdef SD_DEBUG
+  if (!llvm::DebugFlag || !llvm::isCurrentDebugType(SD_DEBUG_TYPE))
+    return;
+
   va_list args;
-  va_start(args,fmt);
-  fprintf(stderr, "SD] ");
-  vfprintf(stderr, fmt,args);
+  va_start(args, fmt);
+  char buf[256];
+  va_list argsCopy;
+  va_copy(argsCopy, args);
+  int len = vsnprintf(buf, sizeof(buf), fmt, argsCopy);
+  va_end(argsCopy);
+
+  llvm::dbgs() << "SD] ";
+  if (len >= (int) sizeof(buf)) {
+    std::vector<char> longBuf(len + 1);
+    vsnprintf(longBuf.data(), longBuf.size(), fmt, args);
+    llvm::dbgs() << longBuf.data();
+  } else if (len > 0) {
+    llvm::dbgs() << buf;
+  }
   va_end(args);
-  fflush(stderr);
 #endif
 }
 
 #endif
-
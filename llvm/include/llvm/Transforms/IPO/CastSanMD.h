@@ -23,7 +23,16 @@
 #define SD_MD_CHECK      "sd.check"       // class name, annotate the check 
 
 /**
- * named md used to store the vtable info
+ * named md with one row !{placeholder, class name, old vtable index} per
+ * vtable index used in a member pointer to a virtual method, see
+ * sd_rewriteMemberPointers() in CodeGenModule.cpp
+ */
+#define SD_MD_MPTR_TABLE         "sd.mptr_table"
+#define SD_MPTR_PLACEHOLDER_NAME "__sd_mptr_index"
+
+/**
+ * named md used to store the vtable info, one per class. The compiler now
+ * writes SD_MD_CLASSBLOB instead (CastSanClassBlob.h), only older bitcode has it.
  */
 #define SD_MD_CLASSINFO  "sd.class_info." 
 
@@ -0,0 +1,51 @@
+#ifndef LLVM_TRANSFORMS_IPO_CASTSAN_REMARKS_H
+#define LLVM_TRANSFORMS_IPO_CASTSAN_REMARKS_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Instruction.h"
+
+namespace llvm {
+
+  /**
+   * Per check site records of the CastSan passes.
+   *
+   * Every record is emitted as an LLVM optimization remark of the pass
+   * "castsan" (-pass-remarks=castsan, -pass-remarks-missed=castsan,
+   * -pass-remarks-analysis=castsan). If -sd-remarks-file=<path> is given
+   * (-Wl,-plugin-opt=-sd-remarks-file=<path> at link time) the records are
+   * also written to that file as YAML documents:
+   *
+   *   --- !Analysis
+   *   Pass:            castsan
+   *   Name:            RangeCheck
+   *   DebugLoc:        { File: 'a.cpp', Line: 12, Column: 7 }
+   *   Function:        '_Z3fooP1A'
+   *   Args:
+   *     - Site:            cast
+   *     - Class:           '_ZTS1B'
+   *     - Width:           4
+   *   ...
+   *
+   * scripts/castsan_remarks.py aggregates these files.
+   */
+  enum sd_remark_kind_t {
+    SD_REMARK_PASSED = 0, // the check was removed (constant folded, devirtualized)
+    SD_REMARK_MISSED,     // the check could not be built (no metadata)
+    SD_REMARK_ANALYSIS    // a check was emitted
+  };
+
+  /**
+   * Record one check site. I has to be still linked into its function.
+   *  name      : ConstFolded, EqCheck, RangeCheck, BitsetCheck, NoMetadata, Devirtualized
+   *  site      : vcall, cast or dyncast
+   *  className : the class the check is for
+   *  width     : the number of valid vptrs, -1 if not known
+   *  detail    : the lowering (inline, call, a check kind) or the callee
+   */
+  void sd_emitRemark(sd_remark_kind_t kind, StringRef name, const Instruction* I,
+                     StringRef site, StringRef className, int64_t width = -1,
+                     StringRef detail = "");
+
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef LLVM_TRANSFORMS_IPO_CASTSAN_SAMPLING_H
+#define LLVM_TRANSFORMS_IPO_CASTSAN_SAMPLING_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+
+namespace llvm {
+
+  /**
+   * Sampled cast checks (-sd-sample-cast-checks).
+   *
+   * Every guarded site has its own thread local countdown. The unsampled
+   * path is the decrement of the countdown and a branch, the vptr load
+   * moves into the sampled block when only the check uses it:
+   *
+   *   %c = load i32, i32* @sd.sample_countdown      ; thread local
+   *   %n = add i32 %c, -1
+   *   store i32 %n, i32* @sd.sample_countdown
+   *   br (%n <= 0), %sample, %cont
+   * sample:
+   *   %vptr = load i8*, i8** %obj
+   *   store (call @__castsan_sample_next(%site)), @sd.sample_countdown
+   *   <the check>
+   * cont:
+   *   %ok = phi [true, %head], [<check>, %sample]
+   *
+   * The countdowns start at 0, so the first execution of a site in a
+   * thread is always checked. __castsan_sample_next (hextype_sampling.cc)
+   * returns the period of the site, which starts at 1 and only grows to
+   * the runtime rate (CASTSAN_SAMPLE_RATE) once the site has been checked
+   * often enough, so rarely run sites stay checked every time.
+   *
+   * The countdowns are initial-exec TLS, except in PIC modules (shared
+   * objects, but also PIE executables) where they are local-dynamic so that
+   * a dlopen-ed object does not run out of static TLS.
+   */
+  class SDCastSampler {
+  public:
+    SDCastSampler(Module& M);
+
+    bool isEnabled() const;
+
+    /**
+     * Guard the check of CI. Returns the instruction the check has to be
+     * emitted before, it only runs on sampled executions.
+     */
+    Instruction* guard(CallInst* CI);
+
+    /**
+     * The value that replaces CI: checkResult on sampled executions, true
+     * otherwise. Returns checkResult for sites that are not guarded.
+     */
+    Value* merge(CallInst* CI, Value* checkResult);
+
+  private:
+    Module& M;
+    DenseMap<CallInst*, std::pair<BasicBlock*, BasicBlock*> > guards; // head, sample block
+  };
+
+}
+
+#endif
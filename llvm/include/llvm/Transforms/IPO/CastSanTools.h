@@ -4,6 +4,8 @@
 #include "llvm/ADT/StringRef.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Metadata.h"
 
 #include <string>
 
@@ -84,6 +86,36 @@ static bool validConstVptr(llvm::GlobalVariable *rootVtbl,
       return false;
 }
 
+/*Paul:
+returns the vtable name from the class name tuple of an sd_ intrinsic
+(see sd_getClassNameMetadata in ItaniumCXXABI.cpp). If the vtable global
+was emitted, its name is taken, otherwise the stored class name.
+*/
+static std::string sd_getClassNameFromMD(llvm::MDNode* mdNode, unsigned operandNo = 0) {
+  llvm::MDTuple* mdTuple = llvm::cast<llvm::MDTuple>(mdNode);
+  assert(mdTuple->getNumOperands() > operandNo + 1);
+
+  llvm::MDNode* nameMdNode = llvm::cast<llvm::MDNode>(mdTuple->getOperand(operandNo).get());
+  llvm::MDString* mdStr = llvm::cast<llvm::MDString>(nameMdNode->getOperand(0));
+
+  llvm::StringRef strRef = mdStr->getString();
+  assert(sd_isVtableName_ref(strRef));
+
+  llvm::MDNode* gvMd = llvm::cast<llvm::MDNode>(mdTuple->getOperand(operandNo+1).get());
+
+  llvm::ConstantAsMetadata* vtblConsMd = llvm::dyn_cast_or_null<llvm::ConstantAsMetadata>(gvMd->getOperand(0).get());
+  if (vtblConsMd == NULL) {
+    // no vtable global was emitted ("NO_VTABLE")
+    return strRef.str();
+  }
+
+  llvm::GlobalVariable* vtbl = llvm::cast<llvm::GlobalVariable>(vtblConsMd->getValue());
+
+  llvm::StringRef vtblNameRef = vtbl->getName();
+  assert(vtblNameRef.startswith(strRef));
+
+  return vtblNameRef.str();
+}
 
 #endif
 
@@ -10,6 +10,7 @@
 #include "llvm/Transforms/IPO/CastSanTools.h"
 #include "llvm/Transforms/IPO/CastSanMD.h"
 #include "llvm/Transforms/IPO/CastSanGVMd.h"
+#include "llvm/Transforms/IPO/CastSanClassBlob.h"
 
 #include <iostream>
 #include <string>
@@ -51,28 +52,18 @@ public:
   {
   }
 
-  //returns the MDNode
-  llvm::MDNode *getMDNode(llvm::Module &M, llvm::LLVMContext &C)
+  //returns the info of this sub-vtable for the class blob
+  llvm::SDClassBlob::sub_vtable_t getBlobInfo() const
   {
-    std::vector<llvm::Metadata *> tuple;
-    std::vector<llvm::Metadata *> parentsTuple;
+    llvm::SDClassBlob::sub_vtable_t sub;
 
-    parentsTuple.push_back(sd_getMDNumber(C, parents.size()));
+    sub.order = order;
+    sub.start = start;
+    sub.end = end;
+    sub.addressPoint = addressPoint;
+    sub.parents.assign(parents.begin(), parents.end());
 
-    for (auto it : parents)
-    {
-      parentsTuple.push_back(sd_getMDString(C, it.first));
-      parentsTuple.push_back(sd_getMDNumber(C, it.second));
-      parentsTuple.push_back(sd_getClassVtblGVMD(it.first, M));
-    }
-
-    tuple.push_back(sd_getMDNumber(C, order));
-    tuple.push_back(sd_getMDNumber(C, start));
-    tuple.push_back(sd_getMDNumber(C, end));
-    tuple.push_back(sd_getMDNumber(C, addressPoint));
-    tuple.push_back(llvm::MDNode::get(C, parentsTuple));
-
-    return llvm::MDNode::get(C, tuple);
+    return sub;
   }
 
   void dump(std::ostream &out)
@@ -179,7 +170,7 @@ static std::vector<SD_VtableMD> sd_generateSubvtableInfo(clang::CodeGen::CodeGen
   std::vector<SD_VtableMD> subVtables;
   unsigned order = 0; // order of the sub-vtable
 
-  std::cerr << "Emitting subvtable info for " << RD->getQualifiedNameAsString() << "\n";
+  DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "Emitting subvtable info for " << RD->getQualifiedNameAsString() << "\n");
 
   //print inheritance map and add the parent vtables to the addrPtMap
   //std::map<inheritance_path_t, uint64_t> = VTLayout->getInheritanceMap()
@@ -201,13 +192,13 @@ static std::vector<SD_VtableMD> sd_generateSubvtableInfo(clang::CodeGen::CodeGen
     //printing the parent inherintance path for one v table layout if length > 0
     if (parentInheritancePath.size() > 0)
     {
-      std::cerr << "\n---Print an inheritance path with legth: " << parentInheritancePath.size() << "---\n";
-      std::cerr << "addrPt: " << addrPt << "-> has following inheritance chain: \n";
+      DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "\n---Print an inheritance path with legth: " << parentInheritancePath.size() << "---\n");
+      DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "addrPt: " << addrPt << "-> has following inheritance chain: \n");
       for (auto it1 : parentInheritancePath)
-        std::cerr << "parent inheritance map element: " << it1->getQualifiedNameAsString() << ",\n";
+        DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "parent inheritance map element: " << it1->getQualifiedNameAsString() << ",\n");
     }
     
-    std::cerr << "\n (order in Inheritance Map " << it.second << ")\n";
+    DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "\n (order in Inheritance Map " << it.second << ")\n");
 
     //declare an empty v table
     vtbl_t parentVtbl("", 0);
@@ -239,7 +230,7 @@ static std::vector<SD_VtableMD> sd_generateSubvtableInfo(clang::CodeGen::CodeGen
       }
     }
 
-    std::cerr << "addr Pt:" << addrPt << " direct parent = " << parentVtbl.first << ", order: " << parentVtbl.second << "\n";
+    DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "addr Pt:" << addrPt << " direct parent = " << parentVtbl.first << ", order: " << parentVtbl.second << "\n");
 
     // add the v table with order number 0 declared above
     //collect all the parent v tables
@@ -329,12 +320,12 @@ static std::vector<SD_VtableMD> sd_generateSubvtableInfo(clang::CodeGen::CodeGen
 }
 
 /**
- * Given a vtable layout, insert a NamedMDNode that contains the information about the
- * vtable that is required for interleaving. This function is called from CGVTables.cpp
- * locate in the code generation part of the compiler.
+ * Given a vtable layout, add the information about the vtable that is required
+ * for interleaving to the class blob of the module. This function is called from
+ * CGVTables.cpp locate in the code generation part of the compiler.
  * This information will be generated for each v table.
- * Each v table and its parents are added in the 
- * new node and added to the name metadata node SD_MD_CLASSINFO. 
+ * Each v table and its parents are added to the SDClassBlob of the CodeGenModule,
+ * which writes them into the named metadata SD_MD_CLASSBLOB (see CastSanClassBlob.h).
  *
  * This function is called during code generation. Before any of our passes starts.
  */
@@ -372,7 +363,7 @@ static void sd_insertVtableMD(clang::CodeGen::CodeGenModule *CGM,
                               const clang::BaseSubobject *Base = NULL)
 {
 
-  std::cerr << " CGM: " << CGM << " VTLayout: " << VTLayout << " RD: " << RD << " RD->getQualifiedNameAsString() (class name): " << RD->getQualifiedNameAsString() << "\n";
+  DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << " CGM: " << CGM << " VTLayout: " << VTLayout << " RD: " << RD << " RD->getQualifiedNameAsString() (class name): " << RD->getQualifiedNameAsString() << "\n");
   assert(CGM && VTLayout && RD);
 
   clang::CodeGen::CGCXXABI *ABI = &CGM->getCXXABI();
@@ -387,52 +378,36 @@ static void sd_insertVtableMD(clang::CodeGen::CodeGenModule *CGM,
     return;
   }
 
-  //this generates the sub vtable info from the base and returns a vector of SD_VtableMD objects
-  //all the v tables of the most derived parent classes of this class are added to the subVtables
-  std::vector<SD_VtableMD> subVtables = sd_generateSubvtableInfo(CGM, ABI, VTLayout, RD, Base);
+  llvm::SDClassBlob &classBlob = CGM->getCastSanClassBlob();
 
-  // if we didn't produce anything, return ?
-  if (subVtables.size() == 0)
+  // don't produce any duplicate md
+  if (classBlob.hasClass(className))
   {
     return;
   }
 
-  //our named metadata SD_MD_CLASSINFO will be inserted as a new NamedMDNode
-  llvm::NamedMDNode *classInfo = CGM->getModule().getOrInsertNamedMetadata(SD_MD_CLASSINFO + className);
+  //this generates the sub vtable info from the base and returns a vector of SD_VtableMD objects
+  //all the v tables of the most derived parent classes of this class are added to the subVtables
+  std::vector<SD_VtableMD> subVtables = sd_generateSubvtableInfo(CGM, ABI, VTLayout, RD, Base);
 
-  // don't produce any duplicate md
-  if (classInfo->getNumOperands() > 0)
+  // if we didn't produce anything, return ?
+  if (subVtables.size() == 0)
   {
-    std::set<uint64_t> aps;
-    for (auto &&AP : VTLayout->getAddressPoints())
-    {
-      aps.insert(AP.second);
-    }
-
-    // last 1 is for class vtable
-    //assert(classInfo->getNumOperands() == (2 + aps.size() + 1));
     return;
   }
 
-  llvm::LLVMContext &C = CGM->getLLVMContext();
-
-  llvm::Module &M = CGM->getModule();
-
-  // first put the class name
-  classInfo->addOperand(llvm::MDNode::get(C, sd_getMDString(C, className)));
+  // the vtable global variables (this one's and the parents') are looked up
+  // by name when the blob is written, at the end of the module
+  llvm::SDClassBlob::class_info_t classInfo;
+  classInfo.className = className;
 
-  // second put the vtable global variable as a new MDNode into classInfo
-  classInfo->addOperand(sd_getClassVtblGVMD(className, M, VTable));
-
-  // third put the size of the tuple
-  classInfo->addOperand(llvm::MDNode::get(C, sd_getMDNumber(C, subVtables.size())));
-
-  // then add md for each sub-vtable
   for (unsigned i = 0; i < subVtables.size(); ++i)
   {
-    classInfo->addOperand(subVtables[i].getMDNode(M, C));
+    classInfo.subVtables.push_back(subVtables[i].getBlobInfo());
   }
 
+  classBlob.addClass(classInfo);
+
   // make sure parent class' metadata is added too
   for (auto &&AP : VTLayout->getAddressPoints())
   {
@@ -442,7 +417,7 @@ static void sd_insertVtableMD(clang::CodeGen::CodeGenModule *CGM,
     //do recursive call if subRD != RD "CXXRecordDecl"
     if (subRD != RD)
     {
-      std::cerr << "Recursively calling sd_insertVtableMD for " << subRD->getQualifiedNameAsString() << "\n";
+      DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "Recursively calling sd_insertVtableMD for " << subRD->getQualifiedNameAsString() << "\n");
       sd_insertVtableMD(CGM,
                         NULL,
                         &(CGM->getVTables().getItaniumVTableContext().getVTableLayout(subRD)),
@@ -453,7 +428,7 @@ static void sd_insertVtableMD(clang::CodeGen::CodeGenModule *CGM,
 
   //save the v table layout inheritance paths
   //the path will help to check to which inheritance path a certain v table belongs
-  std::cerr << "Storing all inheritance paths contained in the VTableLayout \n";
+  DEBUG_WITH_TYPE(SD_DEBUG_TYPE, llvm::dbgs() << "Storing all inheritance paths contained in the VTableLayout \n");
 
   //store the number of paths
   //classInfo->addOperand(llvm::MDNode::get(C, sd_getMDNumber(C, VTLayout->getInheritanceMap().size())));
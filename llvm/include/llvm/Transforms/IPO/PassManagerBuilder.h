@@ -137,6 +137,7 @@ public:
   bool PerformThinLTO;
   bool EmitIVTBLs; //Paul: flag variable used for interleaving the v tables
   bool EmitOVTBLs; //Paul: flag variable used for ordering the v tables
+  bool CastSanCrossDSO; // register the vptr ranges at load time, for checks across DSOs
 
 
   /// Profile data file name that the instrumentation will be written to.
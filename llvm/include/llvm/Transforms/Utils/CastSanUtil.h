@@ -10,10 +10,15 @@
 #ifndef LLVM_TRANSFORMS_UTILS_CASTSAN_H
 #define LLVM_TRANSFORMS_UTILS_CASTSAN_H
 
+#include "llvm/ADT/StringSet.h"
 #include "llvm/IR/IRBuilder.h"
 #include <map>
 #include <vector>
-#define CS_MD_TYPEINFO "CS_Type_MD_"
+
+// One operand per linked module, each a tuple of type records sorted by
+// (hash, mangled name):
+//   !{i64 hash, !"mangled name", i64 polymorphic, [N x i64] parent hashes}
+#define CS_MD_TYPETABLE "CS_Type_Table"
 
 
 namespace llvm {
@@ -37,6 +42,26 @@ namespace llvm {
 		std::vector<std::pair<CHTreeNode*, CHTreeNode*>> DiamondRootInTreeWithChild; // All roots in which this CHTreeNode causes diamond inheritance
 	};
 	
+	class CastSanTypeTable {
+	public:
+		struct TypeRecord {
+			bool Polymorphic;
+			std::vector<uint64_t> ParentHashes;
+		};
+		typedef std::pair<uint64_t, std::string> RecordKey; // hash, mangled name
+
+		// false if a type with this mangled name is already in the table
+		bool insert(const std::string & MangledName, uint64_t TypeHash,
+		            bool Polymorphic, const std::vector<uint64_t> & ParentHashes);
+
+		// adds the sorted table as one operand of CS_MD_TYPETABLE
+		void emit(Module & M) const;
+
+	private:
+		std::map<RecordKey, TypeRecord> Records;
+		StringSet<> MangledNames;
+	};
+
 	class CastSanUtil {
 	private:
 		void extendTypeMetadata();
@@ -47,6 +72,10 @@ namespace llvm {
 		bool isSubtreeInTree(CHTreeNode * Subtree, CHTreeNode * Tree, CHTreeNode * Root = nullptr);
 		void removeDuplicates();
 		void findLoop(std::vector<CHTreeNode*> & path, CHTreeNode * node);
+		void addTypeRecord(MDNode * Record, uint64_t TypeHash);
+		void addLegacyTypeRecord(NamedMDNode * Node);
+		void addType(uint64_t TypeHash, StringRef MangledName, bool Polymorphic,
+		             const std::vector<uint64_t> & ParentHashes);
 		const DataLayout & DL;
 	public:
 		CastSanUtil(const DataLayout &DL)
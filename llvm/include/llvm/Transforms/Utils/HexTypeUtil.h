@@ -10,6 +10,8 @@
 #ifndef LLVM_TRANSFORMS_UTILS_HEXTYPE_H
 #define LLVM_TRANSFORMS_UTILS_HEXTYPE_H
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Utils/CastSanUtil.h"
@@ -31,6 +33,7 @@
 #define VLAOBJADD 2
 #define CONOBJDEL 3
 #define VLAOBJDEL 4
+#define FRAMEOBJADD 5
 
 namespace llvm {
 
@@ -40,12 +43,27 @@ namespace llvm {
   extern cl::opt<bool> ClCompileTimeVerifyOpt;
   extern cl::opt<bool> ClCreateCastRelatedTypeList;
   extern cl::opt<bool> ClInlineOpt;
+  extern cl::opt<bool> ClAllocMetadataOpt;
+  extern cl::opt<bool> ClStackFrameOpt;
+  extern cl::opt<bool> ClStackCastReachOpt;
+  extern cl::opt<bool> ClGlobalTableOpt;
   extern cl::opt<bool> ClMakeLogInfo;
   extern cl::opt<bool> ClMakeTypeInfo;
 
   typedef std::list<std::pair<uint64_t, StructType*>> StructElementInfoTy;
   typedef std::map<Function *, std::vector<Instruction *> *> FunctionReturnTy;
 
+  //Paul: one traced (sub)object of a stack frame registered as a whole,
+  //has to match FrameObjDesc in compiler-rt/lib/hextype/hextype_frame.h.
+  //Also describes the globals of the global object table.
+  typedef struct FrameObjInfo {
+    uint32_t ObjIndex;      // alloca the object lives in
+    uint32_t Offset;        // offset of the object in the alloca
+    uint32_t TypeSize;      // distance between two array elements
+    uint32_t ArraySize;
+    uint32_t FakeVPointer;
+  } FrameObjInfo;
+
   class TypeDetailInfo {
   public:
     uint64_t TypeHashValue;
@@ -110,8 +128,17 @@ namespace llvm {
     std::set<std::string> CastingRelatedSet;
     std::set<std::string> CastingRelatedExtendSet;
 
+    //Paul: per-module hash caches, see getCachedHashValueFromSTy and
+    //isCastingRelatedHash
+    DenseMap<StructType *, uint64_t> STyHashCache;
+    DenseSet<uint64_t> CastingRelatedHashSet;
+    size_t CastingRelatedHashedNum = 0;
+
 	CastSanUtil CastSan;
 
+    //Paul: filled by collectFrameObj and collectStaticObj
+    std::vector<FrameObjInfo> FrameObjs;
+
     GlobalVariable *typeInfoArrayGlobal;
     GlobalVariable *typePhantomInfoArrayGlobal;
 
@@ -121,6 +148,8 @@ namespace llvm {
     Instruction *findNextInstruction(Instruction *);
     AllocaInst *findAllocaForValue(Value *);
     void emitRemoveInst(Module *, IRBuilder<> &, AllocaInst *);
+    void collectFrameObj(Module *, AllocaInst *, uint32_t);
+    void collectStaticObj(Module *, Type *, uint64_t, uint32_t, uint32_t);
     void getStructOffsets(StructType *, StructElementInfoTy &, uint32_t);
     void getArrayOffsets(Type *, StructElementInfoTy &, uint32_t);
     void insertUpdate(Module *, IRBuilder<> &, std::string, Value *,
@@ -136,6 +165,8 @@ namespace llvm {
     GlobalVariable *getObjTypeMap(Module &);
     GlobalVariable *emitAsGlobalVal(Module &, char *, std::vector<Constant*> *);
     void getTypeInfoFromClang();
+    uint64_t getCachedHashValueFromSTy(StructType *);
+    bool isCastingRelatedHash(uint64_t);
 
   private:
     bool VisitCheck[MAXNODE];
@@ -1,6 +1,7 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO/CastSan.h"
 #include "llvm/Transforms/IPO/CastSanCHA.h"
+#include "llvm/Transforms/IPO/CastSanClassBlob.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/IR/InstIterator.h"
@@ -20,6 +21,7 @@
 
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Support/Debug.h"
 
 #include <list>
 #include <vector>
@@ -41,6 +43,8 @@ using namespace llvm;
 
 #include <iostream>
 
+#define DEBUG_TYPE "castsan"
+
 char SDBuildCHA::ID = 0;
 
 INITIALIZE_PASS(SDBuildCHA, "sdcha", "Build CHA pass for CastSan", false, false)
@@ -223,6 +227,12 @@ void SDBuildCHA::buildClouds(Module &M) {
     // this function is called for each generated v table, during code generation  
     extractMetadata(static_cast<NamedMDNode*>(itr), infoVec);
   }
+
+  // Paul: the compact class info of all linked modules (see CastSanClassBlob.h),
+  // after the per class nodes above, which only older bitcode still has
+  if (NamedMDNode* classBlob = M.getNamedMetadata(SD_MD_CLASSBLOB))
+    extractMetadata(classBlob, infoVec);
+
     //nmd_t is the main top root node type, now iterate through the info vector   
     for (const nmd_t& info : infoVec) {
      
@@ -345,16 +355,16 @@ void SDBuildCHA::buildClouds(Module &M) {
     const vtbl_name_t &className = it.first;
     const std::vector<vtbl_set_t> &parentSetV = it.second;
 
-    std::cerr << "(class name: " << className << ", parents: [";
+    DEBUG(dbgs() << "(class name: " << className << ", parents: [");
 
     for (int ind = 0; ind < parentSetV.size(); ind++) {
-      std::cerr << "index: "<< ind <<"{";
+      DEBUG(dbgs() << "index: "<< ind <<"{");
       for (auto ptIt : parentSetV[ind])
-        std::cerr << "<" << ptIt.first << "," << ptIt.second << ">,";
-      std::cerr << "},";
+        DEBUG(dbgs() << "<" << ptIt.first << "," << ptIt.second << ">,");
+      DEBUG(dbgs() << "},");
     }
 
-    std::cerr << "]\n";
+    DEBUG(dbgs() << "]\n");
   }
   
   //Paul: Check that all possible parents are in the same layout cloud
@@ -419,6 +429,46 @@ std::vector<SDBuildCHA::nmd_t> SDBuildCHA::extractMetadata(NamedMDNode* md, std:
   
   std::set<vtbl_name_t> classes;
 
+  // Paul: the compact form has one operand per linked module. Every module
+  // repeats the classes it has seen, so keep the first info of each class.
+  if (md->getName() == SD_MD_CLASSBLOB) {
+    for (const nmd_t& info : infoVec)
+      classes.insert(info.className);
+
+    std::vector<SDClassBlob::class_info_t> blobClasses;
+    uint64_t blobBytes = 0;
+    for (unsigned op = 0; op < md->getNumOperands(); op++)
+      blobBytes += SDClassBlob::decode(md->getOperand(op), blobClasses);
+
+    for (const SDClassBlob::class_info_t& blobInfo : blobClasses) {
+      if (!classes.insert(blobInfo.className).second)
+        continue;
+
+      SDBuildCHA::nmd_t info;
+      info.className = blobInfo.className;
+
+      for (const SDClassBlob::sub_vtable_t& sub : blobInfo.subVtables) {
+        SDBuildCHA::nmd_sub_t subInfo;
+        subInfo.order        = sub.order;
+        subInfo.start        = sub.start;
+        subInfo.end          = sub.end;
+        subInfo.addressPoint = sub.addressPoint;
+        subInfo.parents.insert(sub.parents.begin(), sub.parents.end());
+
+        bool currRangeCheck = (subInfo.start <= subInfo.addressPoint && subInfo.addressPoint <= subInfo.end);
+        bool prevVtblCheck = (info.subVTables.empty() || info.subVTables.back().end < subInfo.start);
+        assert(currRangeCheck && prevVtblCheck);
+
+        info.subVTables.push_back(subInfo);
+      }
+      infoVec.push_back(info);
+    }
+
+    sd_print("class info: %u modules, %lu class entries in %lu bytes, %lu classes in total\n",
+             md->getNumOperands(), blobClasses.size(), blobBytes, infoVec.size());
+    return infoVec;
+  }
+
   unsigned op = 0;
 
   // Paul: iterate until all module operands have been visited
@@ -620,9 +670,9 @@ SDBuildCHA::vtbl_t SDBuildCHA::getFirstDefinedChild(const vtbl_t &vtbl) {
 
   // If we get here then there is an undefined class with no
   // defined subclasses.
-  std::cerr << vtbl.first << "," << vtbl.second << " doesn't have first defined child\n";
+  DEBUG(dbgs() << vtbl.first << "," << vtbl.second << " doesn't have first defined child\n");
   for (const vtbl_t& c : order) {
-    std::cerr << c.first << "," << c.second << " isn't defined\n";
+    DEBUG(dbgs() << c.first << "," << c.second << " isn't defined\n");
   }
   assert(false); // unreachable
 }
@@ -673,7 +723,7 @@ int64_t SDBuildCHA::getSubVTableIndex(const vtbl_name_t& derived, const vtbl_nam
     //check if base is an acestor of one of the derived classes 
     if (isAncestor(vtbl_t(base, 0), vtbl_t(derived, ind))) {
       if (res != -1) {
-        std::cerr << "Ambiguity: not a unique path for upcast " << derived << " to " << base << "\n";
+        DEBUG(dbgs() << "Ambiguity: not a unique path for upcast " << derived << " to " << base << "\n");
         return -1;
       }
       res = ind;
@@ -0,0 +1,179 @@
+#include "llvm/Transforms/IPO/CastSanCastProfile.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+#include "llvm/Transforms/IPO/CastSanLog.h"
+#include "llvm/Transforms/IPO/CastSanTools.h"
+#include "llvm/Support/Debug.h"
+
+#include <inttypes.h>
+
+#define DEBUG_TYPE "castsan"
+
+STATISTIC(NumCastSiteCounters, "Number of cast check sites counted");
+STATISTIC(NumCastSitesInline, "Number of cast checks inlined by the profile");
+STATISTIC(NumCastSitesOutline, "Number of cast checks outlined by the profile");
+
+using namespace llvm;
+
+static cl::opt<bool>
+SDCastProfileGenerate("sd-cast-profile-generate", cl::init(false), cl::Hidden,
+                      cl::desc("Count the executions of every cast check site"));
+
+static cl::opt<std::string>
+SDCastProfileUse("sd-cast-profile-use", cl::init(""), cl::Hidden,
+                 cl::desc("Place the cast checks according to this cast profile"));
+
+static cl::opt<unsigned>
+SDCastProfileHot("sd-cast-profile-hot", cl::init(10000), cl::Hidden,
+                 cl::desc("Cast checks run at least this often are inlined"));
+
+static cl::opt<unsigned>
+SDCastProfileCold("sd-cast-profile-cold", cl::init(100), cl::Hidden,
+                  cl::desc("Cast checks run less often than this call the runtime"));
+
+SDCastProfile::SDCastProfile(Module& M, Function* castInfo) : M(M), countersEmitted(0) {
+  for (unsigned i = 0; i <= CP_OUTLINE; i++)
+    placementCount[i] = 0;
+
+  if (!castInfo || (!SDCastProfileGenerate && SDCastProfileUse.empty()))
+    return;
+
+  computeSiteIds(castInfo);
+  if (!SDCastProfileUse.empty())
+    readProfile();
+}
+
+bool SDCastProfile::isGenerating() const {
+  return SDCastProfileGenerate;
+}
+
+//Paul: the use list order of cast_info differs between builds, the order
+//of the instructions in a function does not
+void SDCastProfile::computeSiteIds(Function* castInfo) {
+  for (Function& F : M) {
+    StringMap<uint64_t> ordinals;
+    for (Instruction& I : instructions(F)) {
+      CallInst* CI = dyn_cast<CallInst>(&I);
+      if (!CI || CI->getCalledFunction() != castInfo)
+        continue;
+
+      MDNode* mdNode = cast<MDNode>(cast<MetadataAsValue>(CI->getArgOperand(1))->getMetadata());
+      std::string className = sd_getClassNameFromMD(mdNode, 0);
+      uint64_t ordinal = ordinals[className]++;
+
+      std::string key = F.getName().str() + ":" + className + ":" + std::to_string(ordinal);
+      siteIds[CI] = MD5Hash(key);
+    }
+  }
+}
+
+//Paul: lines of "<id in hex> <count>", see hextype_profile.cc
+void SDCastProfile::readProfile() {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> buf = MemoryBuffer::getFile(SDCastProfileUse);
+  if (!buf) {
+    errs() << "CastSan: could not read the cast profile " << SDCastProfileUse
+           << ": " << buf.getError().message() << "\n";
+    return;
+  }
+
+  for (line_iterator it(**buf, true, '#'); !it.is_at_end(); ++it) {
+    std::pair<StringRef, StringRef> fields = it->trim().split(' ');
+    uint64_t id, count;
+    if (fields.first.getAsInteger(16, id) || fields.second.trim().getAsInteger(10, count)) {
+      errs() << "CastSan: malformed line " << it.line_number() << " in "
+             << SDCastProfileUse << "\n";
+      continue;
+    }
+    //Paul: profiles of several runs are just concatenated
+    counts[id] += count;
+  }
+
+  sd_print("cast profile: %zu sites from %s\n", (size_t) counts.size(), SDCastProfileUse.c_str());
+}
+
+void SDCastProfile::emitCounter(CallInst* CI) {
+  auto id = siteIds.find(CI);
+  if (!SDCastProfileGenerate || id == siteIds.end())
+    return;
+
+  LLVMContext& C = M.getContext();
+  Type* Int64Ty = Type::getInt64Ty(C);
+  StructType* siteTy = StructType::get(Int64Ty, Int64Ty, nullptr);
+
+  Constant* fields[] = { ConstantInt::get(Int64Ty, id->second), ConstantInt::get(Int64Ty, 0) };
+  GlobalVariable* site = new GlobalVariable(M, siteTy, false, GlobalValue::PrivateLinkage,
+                                            ConstantStruct::get(siteTy, fields), "sd.cast_site");
+  site->setSection("__castsan_sites");
+  site->setAlignment(8);
+
+  //Paul: a plain increment like the -fprofile-instr-generate counters,
+  //a lost update between threads does not matter for the placement
+  IRBuilder<> builder(CI);
+  Value* countPtr = builder.CreateStructGEP(siteTy, site, 1);
+  Value* count = builder.CreateLoad(countPtr);
+  builder.CreateStore(builder.CreateAdd(count, ConstantInt::get(Int64Ty, 1)), countPtr);
+
+  countersEmitted++;
+  NumCastSiteCounters++;
+}
+
+SDCastProfile::placement_t SDCastProfile::place(CallInst* CI) {
+  if (counts.empty())
+    return CP_DEFAULT;
+
+  auto id = siteIds.find(CI);
+  if (id == siteIds.end())
+    return CP_DEFAULT;
+
+  auto count = counts.find(id->second);
+  if (count == counts.end())
+    return CP_DEFAULT;
+
+  placement_t placement = CP_DEFAULT;
+  if (count->second >= SDCastProfileHot)
+    placement = CP_INLINE;
+  else if (count->second < SDCastProfileCold)
+    placement = CP_OUTLINE;
+
+  placementCount[placement]++;
+  switch (placement) {
+  case CP_INLINE:  NumCastSitesInline++;    break;
+  case CP_OUTLINE: NumCastSitesOutline++;   break;
+  default: break;
+  }
+  return placement;
+}
+
+void SDCastProfile::finish() {
+  sd_print("cast profile: counters %" PRIu64 ", default %" PRIu64 ", inline %" PRIu64
+           ", outline %" PRIu64 "\n",
+           countersEmitted, placementCount[CP_DEFAULT], placementCount[CP_INLINE],
+           placementCount[CP_OUTLINE]);
+
+  if (!countersEmitted)
+    return;
+
+  //Paul: registers the atexit handler that writes the __castsan_sites section
+  LLVMContext& C = M.getContext();
+  Function* init = cast<Function>(M.getOrInsertFunction("__castsan_profile_init",
+                                                        Type::getVoidTy(C), nullptr));
+  appendToGlobalCtors(M, init, 0);
+}
+
+const char* SDCastProfile::placementName(placement_t placement) {
+  switch (placement) {
+  case CP_DEFAULT: return "default";
+  case CP_INLINE:  return "hot";
+  case CP_OUTLINE: return "cold";
+  }
+  return "unknown";
+}
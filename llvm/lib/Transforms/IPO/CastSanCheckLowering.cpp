@@ -0,0 +1,300 @@
+#include "llvm/Transforms/IPO/CastSanCheckLowering.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/Support/CommandLine.h"
+
+#include "llvm/Transforms/IPO/CastSanLog.h"
+#include "llvm/Support/Debug.h"
+
+#include <algorithm>
+#include <inttypes.h>
+#include <math.h>
+
+#define DEBUG_TYPE "castsan"
+
+STATISTIC(NumEqVptrChecks, "Number of vptr checks lowered as eq");
+STATISTIC(NumRotateVptrChecks, "Number of vptr checks lowered as rotate");
+STATISTIC(NumMultiRangeVptrChecks, "Number of vptr checks lowered as multi-range");
+STATISTIC(NumInlineBitsetVptrChecks, "Number of vptr checks lowered as inline-bitset");
+STATISTIC(NumMemBitsetVptrChecks, "Number of vptr checks lowered as mem-bitset");
+STATISTIC(NumBitsetBytes, "Number of bytes in vptr check bitsets");
+
+using namespace llvm;
+
+static cl::opt<unsigned>
+SDMaxCheckRanges("sd-max-check-ranges", cl::init(3), cl::Hidden,
+                 cl::desc("Maximum number of rotate-compares emitted for one vptr check"));
+
+static cl::opt<unsigned>
+SDMaxBitsetSlots("sd-max-bitset-slots", cl::init(4096), cl::Hidden,
+                 cl::desc("Maximum number of vtable slots covered by one vptr check bitset"));
+
+static cl::opt<bool>
+SDDisableBitsetChecks("sd-disable-bitset-checks", cl::init(false), cl::Hidden,
+                      cl::desc("Only use range compares when lowering vptr checks"));
+
+// Cost model, in (roughly) x86-64 instructions per check. A rotate-compare
+// is sub + ror + cmp, the or of two compares is one more instruction, and
+// the bitset test adds and + shr + and to the bounds check. The memory
+// bitset additionally pays for the select and the load from .rodata.
+#define SD_EQ_COST              1
+#define SD_ROTATE_COST          3
+#define SD_OR_COST              1
+#define SD_INLINE_BITSET_COST   (SD_ROTATE_COST + 3)
+#define SD_MEM_BITSET_COST      (SD_INLINE_BITSET_COST + 4)
+
+//Paul: sort ranges by descending width, so the most likely range is tested first
+struct sd_range_wider_first {
+  inline bool operator()(const SDCheckLowering::mem_range_t &r1, const SDCheckLowering::mem_range_t &r2) {
+    return r1.second > r2.second;
+  }
+};
+
+/**
+ * The range starts are built in SDLayoutBuilder::newVtblAddressConst as
+ * (ptrtoint cloud) + offset. Return the cloud and the offset in bytes.
+ */
+static bool sd_getRangeStartOffset(Constant* start, Constant*& cloud, uint64_t& off) {
+  ConstantExpr* CE = dyn_cast<ConstantExpr>(start);
+  if (!CE || CE->getOpcode() != Instruction::Add)
+    return false;
+
+  ConstantInt* offC = dyn_cast<ConstantInt>(CE->getOperand(1));
+  if (!offC)
+    return false;
+
+  cloud = CE->getOperand(0);
+  off = offC->getZExtValue();
+  return true;
+}
+
+const char* SDCheckLowering::kindName(check_kind_t kind) {
+  switch (kind) {
+  case CK_EQ:            return "eq";
+  case CK_ROTATE:        return "rotate";
+  case CK_MULTI_RANGE:   return "multi-range";
+  case CK_INLINE_BITSET: return "inline-bitset";
+  case CK_MEM_BITSET:    return "mem-bitset";
+  default:               break;
+  }
+  return "unknown";
+}
+
+SDCheckLowering::check_plan_t SDCheckLowering::plan(const std::vector<mem_range_t>& ranges, uint64_t alignment) {
+  assert(ranges.size() > 0 && "no ranges to check");
+  assert((alignment & (alignment - 1)) == 0 && "alignment is not a power of 2");
+
+  check_plan_t p;
+  p.alignment = alignment;
+  p.ranges    = ranges;
+  p.spanStart = nullptr;
+  p.span      = 0;
+  std::sort(p.ranges.begin(), p.ranges.end(), sd_range_wider_first());
+
+  // a single range can not get cheaper than the rotate or eq check
+  if (p.ranges.size() == 1) {
+    p.kind = p.ranges[0].second > 1 ? CK_ROTATE : CK_EQ;
+    p.cost = p.ranges[0].second > 1 ? SD_ROTATE_COST : SD_EQ_COST;
+    return p;
+  }
+
+  uint64_t k = p.ranges.size();
+  uint64_t multiCost = k * SD_ROTATE_COST + (k - 1) * SD_OR_COST;
+  bool multiOk = k <= SDMaxCheckRanges;
+
+  // try to cover all ranges with one bitset. All ranges have to live inside
+  // the same cloud and start on a slot boundary.
+  bool bitsetOk = !SDDisableBitsetChecks;
+  Constant* cloud = nullptr;
+  uint64_t minOff = UINT64_MAX, maxEnd = 0;
+
+  for (const mem_range_t& r : p.ranges) {
+    Constant* c;
+    uint64_t off;
+    if (!bitsetOk || !sd_getRangeStartOffset(r.first, c, off) ||
+        (cloud && c != cloud)) {
+      bitsetOk = false;
+      break;
+    }
+    cloud = c;
+    if (off < minOff) {
+      minOff = off;
+      p.spanStart = r.first;
+    }
+    maxEnd = std::max(maxEnd, off + r.second * alignment);
+  }
+
+  if (bitsetOk) {
+    for (const mem_range_t& r : p.ranges) {
+      Constant* c;
+      uint64_t off;
+      sd_getRangeStartOffset(r.first, c, off);
+      if ((off - minOff) % alignment != 0) {
+        bitsetOk = false;
+        break;
+      }
+    }
+  }
+
+  uint64_t bitsetCost = UINT64_MAX;
+  check_kind_t bitsetKind = CK_MEM_BITSET;
+
+  if (bitsetOk) {
+    p.span = (maxEnd - minOff) / alignment;
+    if (p.span <= 64) {
+      bitsetKind = CK_INLINE_BITSET;
+      bitsetCost = SD_INLINE_BITSET_COST;
+    } else if (p.span <= SDMaxBitsetSlots) {
+      bitsetKind = CK_MEM_BITSET;
+      bitsetCost = SD_MEM_BITSET_COST;
+    } else {
+      bitsetOk = false;
+    }
+  }
+
+  // prefer the range checks on ties, they do not need any extra data
+  if (bitsetOk && (!multiOk || bitsetCost < multiCost)) {
+    p.kind = bitsetKind;
+    p.cost = bitsetCost;
+    p.bits.assign(p.span, false);
+
+    for (const mem_range_t& r : p.ranges) {
+      Constant* c;
+      uint64_t off;
+      sd_getRangeStartOffset(r.first, c, off);
+      uint64_t first = (off - minOff) / alignment;
+      for (uint64_t i = 0; i < r.second; i++)
+        p.bits[first + i] = true;
+    }
+  } else {
+    // even if there are more ranges than sd-max-check-ranges, this is
+    // still the only correct form we can emit
+    p.kind = CK_MULTI_RANGE;
+    p.cost = multiCost;
+  }
+
+  return p;
+}
+
+Value* SDCheckLowering::emitRangeCheck(IRBuilder<>& builder, Value* vptr,
+                                       const mem_range_t& range, uint64_t alignment) {
+  LLVMContext& C = M.getContext();
+  Type *IntPtrTy = M.getDataLayout().getIntPtrType(C, 0);
+
+  llvm::Value *castVptr = builder.CreateBitCast(vptr, IntegerType::getInt8PtrTy(C));
+  llvm::Value *width = llvm::ConstantInt::get(IntPtrTy, range.second);
+  llvm::Value *align = llvm::ConstantInt::get(IntPtrTy, alignment);
+  llvm::Value *Args[] = {castVptr, range.first, width, align};
+
+  //Paul: the final form (rotate or eq) is picked in P5
+  return builder.CreateCall(Intrinsic::getDeclaration(&M, Intrinsic::sd_subst_check_range), Args);
+}
+
+GlobalVariable* SDCheckLowering::getBitsetGlobal(const check_plan_t& plan) {
+  auto key = std::make_pair(plan.spanStart, plan.bits);
+  auto it = bitsetMap.find(key);
+  if (it != bitsetMap.end())
+    return it->second;
+
+  LLVMContext& C = M.getContext();
+  std::vector<uint8_t> bytes((plan.span + 7) / 8, 0);
+  for (uint64_t i = 0; i < plan.span; i++)
+    if (plan.bits[i])
+      bytes[i / 8] |= 1 << (i % 8);
+
+  Constant* init = ConstantDataArray::get(C, bytes);
+  GlobalVariable* gv = new GlobalVariable(M, init->getType(), true,
+                                          GlobalValue::PrivateLinkage, init, "sd.bitset");
+  gv->setUnnamedAddr(true);
+
+  bitsetBytes += bytes.size();
+  bitsetMap[key] = gv;
+  return gv;
+}
+
+Value* SDCheckLowering::emitBitsetCheck(IRBuilder<>& builder, Value* vptr, const check_plan_t& plan) {
+  LLVMContext& C = M.getContext();
+  const DataLayout &DL = M.getDataLayout();
+  Type *IntPtrTy = DL.getIntPtrType(C, 0);
+  unsigned ptrBits = DL.getPointerSizeInBits(0);
+  int alignmentBits = floor(log(plan.alignment + 0.5)/log(2.0));
+
+  // slot index of vptr inside the span, misaligned pointers are rotated
+  // into the high bits and fail the bounds check
+  llvm::Value *vptrInt = builder.CreatePtrToInt(vptr, IntPtrTy);
+  llvm::Value *diff    = builder.CreateSub(vptrInt, plan.spanStart);
+  llvm::Value *diffShr = builder.CreateLShr(diff, alignmentBits);
+  llvm::Value *diffShl = builder.CreateShl(diff, ptrBits - alignmentBits);
+  llvm::Value *index   = builder.CreateOr(diffShr, diffShl);
+  llvm::Value *inRange = builder.CreateICmpULT(index, llvm::ConstantInt::get(IntPtrTy, plan.span));
+
+  llvm::Value *bit;
+  if (plan.kind == CK_INLINE_BITSET) {
+    uint64_t mask = 0;
+    for (uint64_t i = 0; i < plan.span; i++)
+      if (plan.bits[i])
+        mask |= 1ULL << i;
+
+    // the shift amount is masked so that out of range indices do not produce poison
+    llvm::Value *shAmt = builder.CreateAnd(index, llvm::ConstantInt::get(IntPtrTy, 63));
+    llvm::Value *bits  = builder.CreateLShr(llvm::ConstantInt::get(IntPtrTy, mask), shAmt);
+    bit = builder.CreateTrunc(bits, Type::getInt1Ty(C));
+  } else {
+    GlobalVariable* bitsetGV = getBitsetGlobal(plan);
+    Type *Int8Ty = Type::getInt8Ty(C);
+
+    // never load outside of the bitset
+    llvm::Value *safeIndex = builder.CreateSelect(inRange, index, llvm::ConstantInt::get(IntPtrTy, 0));
+    llvm::Value *byteIndex = builder.CreateLShr(safeIndex, 3);
+    llvm::Value *Idxs[] = {llvm::ConstantInt::get(IntPtrTy, 0), byteIndex};
+    llvm::Value *bytePtr   = builder.CreateInBoundsGEP(bitsetGV->getValueType(), bitsetGV, Idxs);
+    llvm::Value *byte      = builder.CreateLoad(bytePtr);
+    llvm::Value *bitIndex  = builder.CreateTrunc(builder.CreateAnd(safeIndex, 7), Int8Ty);
+    bit = builder.CreateTrunc(builder.CreateLShr(byte, bitIndex), Type::getInt1Ty(C));
+  }
+
+  return builder.CreateAnd(inRange, bit);
+}
+
+Value* SDCheckLowering::emit(IRBuilder<>& builder, Value* vptr, const check_plan_t& plan) {
+  kindCount[plan.kind]++;
+
+  switch (plan.kind) {
+  case CK_EQ:
+  case CK_ROTATE:
+    return emitRangeCheck(builder, vptr, plan.ranges[0], plan.alignment);
+
+  case CK_MULTI_RANGE: {
+    llvm::Value *inRange = nullptr;
+    for (const mem_range_t& r : plan.ranges) {
+      llvm::Value *check = emitRangeCheck(builder, vptr, r, plan.alignment);
+      inRange = inRange ? builder.CreateOr(inRange, check) : check;
+    }
+    return inRange;
+  }
+
+  case CK_INLINE_BITSET:
+  case CK_MEM_BITSET:
+    return emitBitsetCheck(builder, vptr, plan);
+
+  default:
+    break;
+  }
+
+  llvm_unreachable("unknown vptr check kind");
+}
+
+void SDCheckLowering::printStatistics() {
+  sd_print("\n ---vptr check lowering--- \n");
+  for (unsigned i = 0; i < CK_NUM_KINDS; i++)
+    sd_print(" %s checks: %" PRIu64 " \n", kindName((check_kind_t) i), kindCount[i]);
+  sd_print(" bitset bytes: %" PRIu64 " in %zu globals \n", bitsetBytes, bitsetMap.size());
+
+  NumEqVptrChecks += kindCount[CK_EQ];
+  NumRotateVptrChecks += kindCount[CK_ROTATE];
+  NumMultiRangeVptrChecks += kindCount[CK_MULTI_RANGE];
+  NumInlineBitsetVptrChecks += kindCount[CK_INLINE_BITSET];
+  NumMemBitsetVptrChecks += kindCount[CK_MEM_BITSET];
+  NumBitsetBytes += bitsetBytes;
+}
@@ -0,0 +1,204 @@
+#include "llvm/Transforms/IPO/CastSanClassBlob.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace {
+
+  /**
+   * Assigns the string and vtable indices while the blob is written
+   */
+  class BlobTables {
+  public:
+    BlobTables(Module &M) : M(M) {}
+
+    // a string index, followed by the vtable index
+    void name(StringRef name, raw_ostream &OS) {
+      encodeULEB128(stringIndex(name), OS);
+      encodeULEB128(vtableIndex(name), OS);
+    }
+
+  private:
+    uint64_t stringIndex(StringRef str) {
+      auto res = stringIndices.insert(std::make_pair(str, strings.size()));
+      if (res.second)
+        strings.push_back(str);
+      return res.first->second;
+    }
+
+    // 0 if the module has no vtable with this name
+    uint64_t vtableIndex(StringRef name) {
+      GlobalVariable *gv = name.empty() ? nullptr : M.getGlobalVariable(name, true);
+      if (!gv)
+        return 0;
+
+      auto res = vtableIndices.insert(std::make_pair(name, vtables.size() + 1));
+      if (res.second)
+        vtables.push_back(ConstantAsMetadata::get(gv));
+      return res.first->second;
+    }
+
+  public:
+    std::vector<StringRef> strings;
+    std::vector<Metadata*> vtables;
+
+  private:
+    Module &M;
+    StringMap<uint64_t> stringIndices;
+    StringMap<uint64_t> vtableIndices;
+  };
+
+  /**
+   * Reads the ULEB128 numbers and strings of a blob, a blob that ends too
+   * early is a fatal error
+   */
+  class BlobReader {
+  public:
+    BlobReader(StringRef blob) : blob(blob), pos(0) {}
+
+    uint64_t number() {
+      const uint8_t *p = blob.bytes_begin() + pos;
+      uint64_t value = 0;
+      unsigned shift = 0;
+      do {
+        if (pos >= blob.size() || shift >= 64)
+          report_fatal_error("CastSan: malformed " SD_MD_CLASSBLOB);
+        value |= uint64_t(*p & 0x7f) << shift;
+        shift += 7;
+        pos++;
+      } while (*p++ & 0x80);
+      return value;
+    }
+
+    StringRef string() {
+      uint64_t length = number();
+      if (length > blob.size() - pos)
+        report_fatal_error("CastSan: malformed " SD_MD_CLASSBLOB);
+      StringRef str = blob.substr(pos, length);
+      pos += length;
+      return str;
+    }
+
+  private:
+    StringRef blob;
+    size_t pos;
+  };
+
+  // the name of the vtable global if it is still there, the stored name otherwise
+  std::string vtableName(BlobReader &reader, const MDNode *vtables,
+                         const std::vector<StringRef> &strings) {
+    uint64_t strIdx = reader.number();
+    uint64_t vtblIdx = reader.number();
+    if (strIdx >= strings.size() || vtblIdx > vtables->getNumOperands())
+      report_fatal_error("CastSan: malformed " SD_MD_CLASSBLOB);
+    if (vtblIdx == 0)
+      return strings[strIdx];
+
+    // a global that was deleted leaves a null operand behind
+    auto *cam = dyn_cast_or_null<ConstantAsMetadata>(vtables->getOperand(vtblIdx - 1).get());
+    if (!cam)
+      return strings[strIdx];
+    return cam->getValue()->getName();
+  }
+}
+
+void SDClassBlob::addClass(const class_info_t &info) {
+  if (!classNames.insert(info.className).second)
+    return;
+  infos.push_back(info);
+}
+
+void SDClassBlob::emit(Module &M) const {
+  if (infos.empty())
+    return;
+
+  BlobTables tables(M);
+  std::string body;
+  raw_string_ostream bodyOS(body);
+
+  encodeULEB128(infos.size(), bodyOS);
+  for (const class_info_t &info : infos) {
+    tables.name(info.className, bodyOS);
+    encodeULEB128(info.subVtables.size(), bodyOS);
+
+    for (const sub_vtable_t &sub : info.subVtables) {
+      encodeULEB128(sub.order, bodyOS);
+      encodeULEB128(sub.start, bodyOS);
+      encodeULEB128(sub.end, bodyOS);
+      encodeULEB128(sub.addressPoint, bodyOS);
+      encodeULEB128(sub.parents.size(), bodyOS);
+
+      for (const parent_t &parent : sub.parents) {
+        tables.name(parent.first, bodyOS);
+        encodeULEB128(parent.second, bodyOS);
+      }
+    }
+  }
+  bodyOS.flush();
+
+  // the string table goes first, it is only complete after the classes
+  std::string blob;
+  raw_string_ostream blobOS(blob);
+  encodeULEB128(SD_CLASSBLOB_VERSION, blobOS);
+  encodeULEB128(tables.strings.size(), blobOS);
+  for (StringRef str : tables.strings) {
+    encodeULEB128(str.size(), blobOS);
+    blobOS << str;
+  }
+  blobOS << body;
+  blobOS.flush();
+
+  LLVMContext &C = M.getContext();
+  Metadata *ops[] = { MDString::get(C, blob), MDNode::get(C, tables.vtables) };
+  M.getOrInsertNamedMetadata(SD_MD_CLASSBLOB)->addOperand(MDNode::get(C, ops));
+}
+
+uint64_t SDClassBlob::decode(const MDNode *op, std::vector<class_info_t> &classes) {
+  if (op->getNumOperands() != 2)
+    report_fatal_error("CastSan: malformed " SD_MD_CLASSBLOB);
+
+  auto *blobMD = dyn_cast_or_null<MDString>(op->getOperand(0).get());
+  auto *vtables = dyn_cast_or_null<MDNode>(op->getOperand(1).get());
+  if (!blobMD || !vtables)
+    report_fatal_error("CastSan: malformed " SD_MD_CLASSBLOB);
+
+  StringRef blob = blobMD->getString();
+  BlobReader reader(blob);
+
+  if (reader.number() != SD_CLASSBLOB_VERSION)
+    report_fatal_error("CastSan: " SD_MD_CLASSBLOB " of another compiler version");
+
+  std::vector<StringRef> strings(reader.number());
+  for (StringRef &str : strings)
+    str = reader.string();
+
+  uint64_t numClasses = reader.number();
+  for (uint64_t c = 0; c < numClasses; c++) {
+    class_info_t info;
+    info.className = vtableName(reader, vtables, strings);
+
+    info.subVtables.resize(reader.number());
+    for (sub_vtable_t &sub : info.subVtables) {
+      sub.order        = reader.number();
+      sub.start        = reader.number();
+      sub.end          = reader.number();
+      sub.addressPoint = reader.number();
+
+      sub.parents.resize(reader.number());
+      for (parent_t &parent : sub.parents) {
+        parent.first = vtableName(reader, vtables, strings);
+        parent.second = reader.number();
+      }
+    }
+    classes.push_back(std::move(info));
+  }
+
+  return blob.size();
+}
@@ -0,0 +1,373 @@
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Transforms/IPO/CastSan.h"
+#include "llvm/Transforms/IPO/CastSanLayoutBuilder.h"
+#include "llvm/Transforms/IPO/CastSanRemarks.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+#include "llvm/Transforms/IPO/CastSanLog.h"
+#include "llvm/Transforms/IPO/CastSanTools.h"
+#include "llvm/Support/Debug.h"
+
+#include <vector>
+
+#define DEBUG_TYPE "castsan"
+
+STATISTIC(NumDevirtChecksRemoved, "Number of vptr checks removed by devirtualization");
+STATISTIC(NumDevirtLoadsFolded, "Number of vtable loads folded");
+STATISTIC(NumDevirtCalls, "Number of virtual calls devirtualized");
+
+// you have to modify the following 4 files for each additional LLVM pass
+// 1. include/llvm/IPO.h
+// 2. lib/Transforms/IPO/IPO.cpp
+// 3. include/llvm/LinkAllPasses.h
+// 4. include/llvm/InitializePasses.h
+// 5. lib/Transforms/IPO/PassManagerBuilder.cpp
+
+#define WORD_WIDTH 8
+
+using namespace llvm;
+
+static cl::opt<bool>
+SDDevirtualize("sd-devirt", cl::init(true), cl::Hidden,
+               cl::desc("Make the vcalls whose vptr is known exactly direct and drop their checks"));
+
+namespace {
+  /**
+   * Pass for devirtualizing the checked vcall sites, it runs between P3 and P4.
+   *
+   * After the layout is built every sd_get_checked_vptr site has a set of
+   * valid vptr values (SDLayoutBuilder::memRangeMap). If there is only one
+   * of them (the cloud below the static type has a single defined vtable),
+   * or if the vptr is a constant that is valid, the vptr of every object
+   * that passes the check is known. The check is dropped, the vptr is
+   * replaced by that address and the loads of the function pointers are
+   * folded from the new vtable, so the calls become direct. A forged vptr
+   * can no longer pick the target, which is what the check was for.
+   *
+   * This needs the whole program: with cross-DSO checks other DSOs may
+   * define more vtables in the same cloud, so the pass is not added then.
+   */
+  struct SDDevirt : public ModulePass {
+    static char ID; // Pass identification, replacement for typeid
+
+    typedef SDLayoutBuilder::vtbl_t      vtbl_t;
+    typedef SDLayoutBuilder::mem_range_t mem_range_t;
+
+    SDDevirt() : ModulePass(ID) {
+      sd_print("initializing SDDevirt pass\n");
+      initializeSDDevirtPass(*PassRegistry::getPassRegistry());
+    }
+
+    virtual ~SDDevirt() {
+      sd_print("deleting SDDevirt pass\n");
+    }
+
+    bool runOnModule(Module &M) override;
+
+    /*Paul:
+    P4 uses the same layout and CHA results, so both have to be preserved*/
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.addRequired<SDLayoutBuilder>();
+      AU.addRequired<SDBuildCHA>();
+      AU.addPreserved<SDLayoutBuilder>();
+      AU.addPreserved<SDBuildCHA>();
+    }
+
+  private:
+    SDLayoutBuilder* layoutBuilder;
+    SDBuildCHA* cha;
+
+    uint64_t checksRemoved;      // sd_get_checked_vptr sites without a check now
+    uint64_t singleVtableSites;  // ... because the cloud has a single defined vtable
+    uint64_t constVptrSites;     // ... because the vptr was a valid constant
+    uint64_t loadsFolded;        // loads from the vtable replaced by a constant
+    uint64_t callsDevirtualized; // indirect calls through such a load
+
+    /**
+     * The (sub-)vtable the check of the site is done against, this has to
+     * match SDUpdateIndices::handleSDGetCheckedVtbl.
+     */
+    vtbl_t siteVtbl(CallInst* CI);
+
+    /**
+     * The only vptr value that passes the check of the site, as a new
+     * vtable global and a byte offset into it. False if there are several.
+     */
+    bool exactVptr(const DataLayout& DL, CallInst* CI, const vtbl_t& vtbl,
+                   GlobalVariable*& gv, int64_t& offset);
+
+    /**
+     * Replace the checked vptr by gv + offset and fold the vtable loads
+     * done through it.
+     */
+    void devirtualize(Module& M, CallInst* CI, GlobalVariable* gv, int64_t offset);
+  };
+}
+
+/// ----------------------------------------------------------------------------
+/// SDDevirt implementation, this is executed between P3 and P4.
+/// ----------------------------------------------------------------------------
+
+/*Paul:
+the mem range starts are built by SDLayoutBuilder::newVtblAddressConst()
+as (ptrtoint gv) + offset*/
+static bool sd_decodeRangeStart(Constant* start, GlobalVariable*& gv, int64_t& offset) {
+  ConstantExpr* add = dyn_cast<ConstantExpr>(start);
+  if (!add || add->getOpcode() != Instruction::Add)
+    return false;
+
+  ConstantExpr* gvInt = dyn_cast<ConstantExpr>(add->getOperand(0));
+  ConstantInt* off = dyn_cast<ConstantInt>(add->getOperand(1));
+  if (!gvInt || gvInt->getOpcode() != Instruction::PtrToInt || !off)
+    return false;
+
+  gv = dyn_cast<GlobalVariable>(gvInt->getOperand(0));
+  offset = off->getSExtValue();
+  return gv != nullptr;
+}
+
+SDDevirt::vtbl_t SDDevirt::siteVtbl(CallInst* CI) {
+  MDNode* mdNode = cast<MDNode>(cast<MetadataAsValue>(CI->getArgOperand(1))->getMetadata());
+  MDNode* mdNode1 = cast<MDNode>(cast<MetadataAsValue>(CI->getArgOperand(2))->getMetadata());
+
+  std::string className = sd_getClassNameFromMD(mdNode, 0);
+  std::string preciseClassName = sd_getClassNameFromMD(mdNode1, 0);
+  vtbl_t vtbl(className, 0);
+
+  if (cha->knowsAbout(vtbl) && preciseClassName != className) {
+    int64_t ind = cha->getSubVTableIndex(preciseClassName, className);
+    SDLayoutBuilder::vtbl_name_t n = preciseClassName;
+
+    if (ind == -1) {
+      ind = cha->getSubVTableIndex(className, preciseClassName);
+      n = className;
+    }
+
+    if (ind != -1)
+      vtbl = vtbl_t(n, ind);
+  }
+
+  return vtbl;
+}
+
+bool SDDevirt::exactVptr(const DataLayout& DL, CallInst* CI, const vtbl_t& vtbl,
+                         GlobalVariable*& gv, int64_t& offset) {
+  if (!layoutBuilder->hasMemRange(vtbl) || !cha->hasAncestor(vtbl))
+    return false;
+
+  const std::vector<mem_range_t>& ranges = layoutBuilder->getMemRange(vtbl);
+  SDLayoutBuilder::vtbl_name_t root = cha->getAncestor(vtbl);
+  assert(layoutBuilder->alignmentMap.count(root));
+  int64_t alignment = layoutBuilder->alignmentMap[root];
+
+  // a single defined vtable in the cloud, this is the CK_EQ check
+  if (ranges.size() == 1 && ranges[0].second == 1) {
+    if (!sd_decodeRangeStart(ranges[0].first, gv, offset))
+      return false;
+    singleVtableSites++;
+    return true;
+  }
+
+  // a constant vptr, e.g. after the constructor was inlined
+  Constant* vptr = dyn_cast<Constant>(CI->getArgOperand(0));
+  if (!vptr)
+    return false;
+
+  APInt vptrOff(DL.getPointerSizeInBits(0), 0);
+  GlobalVariable* vptrGV =
+    dyn_cast<GlobalVariable>(vptr->stripAndAccumulateInBoundsConstantOffsets(DL, vptrOff));
+  if (!vptrGV)
+    return false;
+
+  // it has to be valid, otherwise the check stays and traps
+  for (const mem_range_t& range : ranges) {
+    GlobalVariable* rangeGV;
+    int64_t rangeStart;
+    if (!sd_decodeRangeStart(range.first, rangeGV, rangeStart) || rangeGV != vptrGV)
+      continue;
+
+    int64_t diff = vptrOff.getSExtValue() - rangeStart;
+    if (diff >= 0 && diff % alignment == 0 && diff / alignment < (int64_t) range.second) {
+      gv = vptrGV;
+      offset = vptrOff.getSExtValue();
+      constVptrSites++;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void SDDevirt::devirtualize(Module& M, CallInst* CI, GlobalVariable* gv, int64_t offset) {
+  const DataLayout &DL = M.getDataLayout();
+  LLVMContext& C = M.getContext();
+  Type* Int64Ty = Type::getInt64Ty(C);
+  Function* vtblIndexF = M.getFunction(Intrinsic::getName(Intrinsic::sd_get_vtbl_index));
+  ConstantArray* init = dyn_cast<ConstantArray>(gv->getInitializer());
+  assert(init && offset % WORD_WIDTH == 0);
+
+  // the pointers derived from the checked vptr, with their byte offset to it
+  std::vector<std::pair<Instruction*, int64_t> > worklist;
+  std::vector<std::pair<LoadInst*, Constant*> > loads;
+  std::vector<WeakVH> derived;
+
+  for (User* U : CI->users())
+    if (BitCastInst* BC = dyn_cast<BitCastInst>(U))
+      worklist.push_back(std::make_pair(BC, 0));
+
+  while (!worklist.empty()) {
+    Instruction* ptr = worklist.back().first;
+    int64_t ptrOff = worklist.back().second;
+    worklist.pop_back();
+    derived.push_back(ptr);
+
+    for (User* U : ptr->users()) {
+      if (BitCastInst* BC = dyn_cast<BitCastInst>(U)) {
+        worklist.push_back(std::make_pair(BC, ptrOff));
+
+      } else if (GetElementPtrInst* GEP = dyn_cast<GetElementPtrInst>(U)) {
+        if (GEP->getPointerOperand() != ptr || GEP->getNumIndices() != 1)
+          continue;
+
+        // the vtable index is a constant or still the old index, see
+        // SDUpdateIndices::handleSDGetVtblIndex
+        Value* idxV = *GEP->idx_begin();
+        int64_t idx;
+        if (ConstantInt* idxC = dyn_cast<ConstantInt>(idxV)) {
+          idx = idxC->getSExtValue();
+        } else {
+          CallInst* idxCI = dyn_cast<CallInst>(idxV);
+          if (!idxCI || !vtblIndexF || idxCI->getCalledFunction() != vtblIndexF)
+            continue;
+
+          int64_t oldIndex = cast<ConstantInt>(idxCI->getArgOperand(0))->getSExtValue();
+          MDNode* mdNode = cast<MDNode>(cast<MetadataAsValue>(idxCI->getArgOperand(1))->getMetadata());
+          std::string className = sd_getClassNameFromMD(mdNode, 0);
+          idx = layoutBuilder->translateVtblInd(vtbl_t(className, 0), oldIndex, true);
+
+          // P4 would put in the same index
+          idxCI->replaceAllUsesWith(ConstantInt::get(Int64Ty, idx));
+          idxCI->eraseFromParent();
+        }
+
+        uint64_t elemSize = DL.getTypeAllocSize(GEP->getSourceElementType());
+        worklist.push_back(std::make_pair(GEP, ptrOff + idx * (int64_t) elemSize));
+
+      } else if (LoadInst* LI = dyn_cast<LoadInst>(U)) {
+        int64_t elemOff = offset + ptrOff;
+        if (!LI->isSimple() || elemOff < 0 || elemOff % WORD_WIDTH != 0 ||
+            elemOff / WORD_WIDTH >= (int64_t) init->getNumOperands())
+          continue;
+
+        // the new vtables hold i8* elements: functions, offsets and RTTI
+        Constant* elem = init->getOperand(elemOff / WORD_WIDTH);
+        Type* loadTy = LI->getType();
+        if (DL.getTypeStoreSize(loadTy) != WORD_WIDTH)
+          continue;
+
+        // a null function pointer is padding, leave such a load alone
+        if (loadTy->isPointerTy() && !elem->isNullValue())
+          loads.push_back(std::make_pair(LI, ConstantExpr::getPointerCast(elem, loadTy)));
+        else if (loadTy->isIntegerTy())
+          loads.push_back(std::make_pair(LI, ConstantExpr::getPtrToInt(elem, loadTy)));
+      }
+    }
+  }
+
+  // every object that passes the check has this vptr
+  Constant* idxs[] = { ConstantInt::get(Int64Ty, 0), ConstantInt::get(Int64Ty, offset / WORD_WIDTH) };
+  Constant* exact = ConstantExpr::getInBoundsGetElementPtr(gv->getValueType(), gv, idxs);
+  CI->replaceAllUsesWith(ConstantExpr::getBitCast(exact, CI->getType()));
+  CI->eraseFromParent();
+  checksRemoved++;
+
+  for (auto& load : loads) {
+    LoadInst* LI = load.first;
+    Function* callee = dyn_cast<Function>(load.second->stripPointerCasts());
+    for (User* U : LI->users()) {
+      CallSite CS(U);
+      if (!CS || CS.getCalledValue() != LI)
+        continue;
+
+      callsDevirtualized++;
+      //Paul: shows up with -pass-remarks=castsan
+      Instruction* call = CS.getInstruction();
+      sd_emitRemark(SD_REMARK_PASSED, "Devirtualized", call, "vcall", gv->getName(),
+                    -1, callee ? callee->getName() : "");
+    }
+
+    LI->replaceAllUsesWith(load.second);
+    LI->eraseFromParent();
+    loadsFolded++;
+  }
+
+  for (WeakVH& V : derived)
+    if (V)
+      RecursivelyDeleteTriviallyDeadInstructions(V);
+}
+
+bool SDDevirt::runOnModule(Module &M) {
+  layoutBuilder = &getAnalysis<SDLayoutBuilder>();
+  cha = &getAnalysis<SDBuildCHA>();
+
+  checksRemoved = singleVtableSites = constVptrSites = loadsFolded = callsDevirtualized = 0;
+
+  Function *sd_checked_vptrF = M.getFunction(Intrinsic::getName(Intrinsic::sd_get_checked_vptr));
+  if (!SDDevirtualize || !sd_checked_vptrF)
+    return false;
+
+  sd_print("\n P3.5 Started running the devirtualization pass ...\n");
+
+  const DataLayout &DL = M.getDataLayout();
+
+  // devirtualize() erases the call, so collect them first
+  std::vector<CallInst*> sites;
+  for (User* U : sd_checked_vptrF->users())
+    sites.push_back(cast<CallInst>(U));
+
+  for (CallInst* CI : sites) {
+    vtbl_t vtbl = siteVtbl(CI);
+    GlobalVariable* gv;
+    int64_t offset;
+
+    if (!exactVptr(DL, CI, vtbl, gv, offset))
+      continue;
+
+    sd_print("D1: vtable {%s, %d} has a single valid vptr at %s+%ld \n",
+             vtbl.first.c_str(), vtbl.second, gv->getName().data(), offset);
+    devirtualize(M, CI, gv, offset);
+  }
+
+  sd_print("\n ---P3.5 SDDevirt Statistics--- \n");
+  sd_print(" vcall sites: %lu \n", sites.size());
+  sd_print(" checks removed: %lu (single vtable: %lu, constant vptr: %lu) \n",
+           checksRemoved, singleVtableSites, constVptrSites);
+  sd_print(" vtable loads folded: %lu \n", loadsFolded);
+  sd_print(" calls devirtualized: %lu \n", callsDevirtualized);
+
+  NumDevirtChecksRemoved += checksRemoved;
+  NumDevirtLoadsFolded += loadsFolded;
+  NumDevirtCalls += callsDevirtualized;
+
+  return checksRemoved > 0;
+}
+
+char SDDevirt::ID = 0;
+
+INITIALIZE_PASS_BEGIN(SDDevirt, "sddevirt", "Devirtualize CastSan vcall sites with an exactly known vptr", false, false)
+INITIALIZE_PASS_DEPENDENCY(SDLayoutBuilder)
+INITIALIZE_PASS_DEPENDENCY(SDBuildCHA)
+INITIALIZE_PASS_END(SDDevirt, "sddevirt", "Devirtualize CastSan vcall sites with an exactly known vptr", false, false)
+
+ModulePass* llvm::createSDDevirtPass() {
+  return new SDDevirt();
+}
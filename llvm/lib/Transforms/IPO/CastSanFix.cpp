@@ -18,6 +18,7 @@
 
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Support/Debug.h"
 
 #include <list>
 #include <vector>
@@ -26,6 +27,8 @@
 #include <algorithm>
 #include <sstream>
 
+#define DEBUG_TYPE "castsan"
+
 // you have to modify the following 4 files for each additional LLVM pass
 // 1. include/llvm/IPO.h
 // 2. lib/Transforms/IPO/IPO.cpp
@@ -6,6 +6,7 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO/CastSan.h"
 #include "llvm/Transforms/IPO/CastSanLayoutBuilder.h"
+#include "llvm/Transforms/IPO/CastSanRemarks.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/IR/InstIterator.h"
@@ -24,6 +25,7 @@
 
 #include "llvm/Transforms/IPO/CastSanLog.h"
 #include "llvm/Transforms/IPO/CastSanTools.h"
+#include "llvm/Support/Debug.h"
 
 //#include "llvm/Transforms/Utils/ValueMapper.h"
 //#include "llvm/Transforms/Utils/Cloning.h"
@@ -37,6 +39,11 @@
 #include <iostream>
 #include <limits>
 
+#define DEBUG_TYPE "castsan"
+
+STATISTIC(NumCastRangeChecks, "Number of cast range checks");
+STATISTIC(NumCastEqChecks, "Number of cast eq checks");
+STATISTIC(NumCastConstChecks, "Number of cast checks folded to true");
 
 using namespace llvm;
 
@@ -110,7 +117,7 @@ struct CastSanInsertChecks : public ModulePass {
 				castSumWidth = castSumWidth + widthInt;
 
 				if (validConstVptr(rootVtbl, startOff->getSExtValue(), widthInt, DL, vptr, 0)) {
-            
+					sd_emitRemark(SD_REMARK_PASSED, "ConstFolded", CI, "cast", rootVtbl->getName(), widthInt);
 					CI->replaceAllUsesWith(llvm::ConstantInt::getTrue(C));
 					CI->eraseFromParent();
 
@@ -127,6 +134,7 @@ struct CastSanInsertChecks : public ModulePass {
 					llvm::Value *diffShl = builder.CreateShl(diff, DL.getPointerSizeInBits(0) - alignmentBits);
 					llvm::Value *diffRor = builder.CreateOr(diffShr, diffShl);
 					llvm::Value *inRange = builder.CreateICmpULE(diffRor, width); 
+					sd_emitRemark(SD_REMARK_ANALYSIS, "RangeCheck", CI, "cast", rootVtbl->getName(), widthInt);
 					CI->replaceAllUsesWith(inRange);
 					CI->eraseFromParent();
 					castRangeSubst += 1;
@@ -138,6 +146,7 @@ struct CastSanInsertChecks : public ModulePass {
 					llvm::Value *vptrInt = builder.CreatePtrToInt(vptr, IntPtrTy);
 					llvm::Value *inRange = builder.CreateICmpEQ(vptrInt, start);
 
+					sd_emitRemark(SD_REMARK_ANALYSIS, "EqCheck", CI, "cast", rootVtbl->getName(), widthInt);
 					CI->replaceAllUsesWith(inRange);
 					CI->eraseFromParent();
             
@@ -147,7 +156,7 @@ struct CastSanInsertChecks : public ModulePass {
 			}
 		}
 		else {
-			std::cerr << "CastCheck: no subst_cast_check" << std::endl;
+			DEBUG(dbgs() << "CastCheck: no subst_cast_check\n");
 		}
       
 		//finished adding all the range checks, now print some statistics.
@@ -161,6 +170,10 @@ struct CastSanInsertChecks : public ModulePass {
 		sd_print(" Total const_ptr % d \n", castConstPtr);
 		sd_print(" Average width % lf \n", castSumWidth * 1.0 / (castRangeSubst + castEqSubst + castConstPtr));
 
+		NumCastRangeChecks += castRangeSubst;
+		NumCastEqChecks += castEqSubst;
+		NumCastConstChecks += castConstPtr;
+
 
 		//one of these values has to be > than 0 
 		return castRangeSubst > 0 || castEqSubst > 0 || castConstPtr > 0;
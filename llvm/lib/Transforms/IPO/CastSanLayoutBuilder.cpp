@@ -14,6 +14,8 @@
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/CallSite.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/ADT/Hashing.h"
 
 #include "llvm/Transforms/IPO/CastSanLayoutBuilder.h"
 #include "llvm/Transforms/IPO/CastSanLog.h"
@@ -21,6 +23,8 @@
 
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/Timer.h"
 
 #include <list>
 #include <vector>
@@ -28,6 +32,12 @@
 #include <map>
 #include <algorithm>
 
+#define DEBUG_TYPE "castsan"
+
+STATISTIC(NumClonedThunks, "Number of vthunks cloned for the new vtables");
+STATISTIC(NumFoldedThunks, "Number of cloned vthunks folded into an identical one");
+STATISTIC(NumPaddingBytesSaved, "Number of vtable padding bytes saved by the cloud stride");
+
 // you have to modify the following 4 files for each additional LLVM pass
 // 1. include/llvm/IPO.h
 // 2. lib/Transforms/IPO/IPO.cpp
@@ -48,6 +58,7 @@ char SDLayoutBuilder::ID = 0;
 
 INITIALIZE_PASS_BEGIN(SDLayoutBuilder, "sdovt", "Oredered VTable Layout Builder for CastSan", false, false)
 INITIALIZE_PASS_DEPENDENCY(SDBuildCHA) //Paul: depends on this pass
+INITIALIZE_PASS_DEPENDENCY(BlockFrequencyInfoWrapperPass)
 INITIALIZE_PASS_END(SDLayoutBuilder, "sdovt", "Oredered VTable Layout Builder for CastSan", false, false)
 
 static bool sd_isVthunk(const llvm::StringRef& name) {
@@ -62,9 +73,9 @@ the new layout are ok, as expected)
 The check is done by printing the v table in the terminal*/
 static void dumpNewLayout(const SDLayoutBuilder::interleaving_list_t &interleaving) {
   uint64_t ind = 0;
-  std::cerr << "New vtable layout:\n";
+  DEBUG(dbgs() << "New vtable layout:\n");
   for (auto elem : interleaving) {
-    std::cerr << ind << " : " << elem.first.first << "," << elem.first.second << "[" << elem.second << "]\n";
+    DEBUG(dbgs() << ind << " : " << elem.first.first << "," << elem.first.second << "[" << elem.second << "]\n");
     ind ++;
   }
 }
@@ -88,7 +99,7 @@ bool SDLayoutBuilder::verifyNewLayouts(Module &M) {
 
     indMap.clear();
   
-    std::cerr << "Verifying cloud : " << vtbl << "\n";
+    DEBUG(dbgs() << "Verifying cloud : " << vtbl << "\n");
     // Build a map (vtbl_t -> (uint64_t -> uint64_t)) with the old-to-new index mapping encoded in the
     // interleaving
     for (auto elem : interleaving) {
@@ -104,8 +115,8 @@ bool SDLayoutBuilder::verifyNewLayouts(Module &M) {
         indMap[vname] = std::map<uint64_t, uint64_t>();
       } else {
         if (indMap[vname].count(oldPos) != 0) {
-          std::cerr << "In ivtbl " << vtbl << " entry " << vname.first << "," << vname.second << "[" << oldPos << "]"
-            << " appears twice - at " << indMap[vname][oldPos] << " and " << i << std::endl;
+          errs() << "In ivtbl " << vtbl << " entry " << vname.first << "," << vname.second << "[" << oldPos << "]"
+            << " appears twice - at " << indMap[vname][oldPos] << " and " << i << "\n";
          
           //Paul: dump layout in case of mismatch
           dumpNewLayout(interleaving);
@@ -134,7 +145,7 @@ bool SDLayoutBuilder::verifyNewLayouts(Module &M) {
       }
 
       if (indMap.find(n) == indMap.end()) {
-          std::cerr << "In ivtbl " << vtbl << " missing " << n.first << "," << n.second << std::endl;
+          errs() << "In ivtbl " << vtbl << " missing " << n.first << "," << n.second << "\n";
           
           //Paul: dump layout in case of mismatch
           dumpNewLayout(interleaving);
@@ -147,11 +158,11 @@ bool SDLayoutBuilder::verifyNewLayouts(Module &M) {
       auto minMax = std::minmax_element (indMap[n].begin(), indMap[n].end());
 
       if ((minMax.second->first - minMax.first->first + 1) != oldVtblSize) {
-          std::cerr << "In ivtbl " << vtbl << " min-max rangefor "
+          errs() << "In ivtbl " << vtbl << " min-max rangefor "
             << n.first << "," << n.second << 
             " is (" << minMax.first->first << "-"
             << minMax.second->first << ") expected size "
-            << oldVtblSize << std::endl;
+            << oldVtblSize << "\n";
           
           //Paul: dump layout in case of mismatch
           dumpNewLayout(interleaving);
@@ -159,8 +170,8 @@ bool SDLayoutBuilder::verifyNewLayouts(Module &M) {
       }
 
       if (indMap[n].size() != oldVtblSize) {
-          std::cerr << "In ivtbl " << vtbl << " index mapping for " << n.first << "," << n.second << 
-            " has " << indMap[n].size() << " expected " << oldVtblSize << std::endl;
+          errs() << "In ivtbl " << vtbl << " index mapping for " << n.first << "," << n.second << 
+            " has " << indMap[n].size() << " expected " << oldVtblSize << "\n";
           
           //Paul: dump layout in case of mismatch
           dumpNewLayout(interleaving);
@@ -268,7 +279,7 @@ Function* SDLayoutBuilder::getVthunkFunction(Constant* vtblElement) {
   // if this a constant bitcast expression, this might be a vthunk
   // cast and assign the vtbl element as a constant expresion 
   // check if it is a bit cast expresion, BITCAST_OPCODE == 28 
-  if ((bcExpr = dyn_cast<ConstantExpr>(vtblElement)) && bcExpr->getOpcode() != 46 && std::cerr << " ---- DEBUG OPCODE: " << bcExpr->getOpcode() << std::endl && bcExpr->getOpcode() == BITCAST_OPCODE) {
+  if ((bcExpr = dyn_cast<ConstantExpr>(vtblElement)) && bcExpr->getOpcode() == BITCAST_OPCODE) {
    
    //get first operant 
     Constant* operand = bcExpr->getOperand(0);
@@ -326,7 +337,7 @@ void SDLayoutBuilder::createThunkFunctions(Module& M, const vtbl_name_t& rootNam
       //skyp if thunkF is null 
       if (! thunkF)
       {
-	      std::cerr << " ------------- DEBUG: skip " << std::endl;
+	      DEBUG(dbgs() << " ------------- DEBUG: skip \n");
         continue;
       }
 
@@ -341,10 +352,10 @@ void SDLayoutBuilder::createThunkFunctions(Module& M, const vtbl_name_t& rootNam
       //attack to the name of the thunk function the name of the parent class 
       std::string newThunkName(NEW_VTHUNK_NAME(thunkF, parentClass));
 
-      std::cerr << " --------- DEBUG: new name: " << newThunkName << std::endl;
+      DEBUG(dbgs() << " --------- DEBUG: new name: " << newThunkName << "\n");
       
       //if allready exists than skip 
-      if (M.getFunction(newThunkName)) {
+      if (newThunkMap.count(newThunkName)) {
         // we already created such function, will use that later
         continue;
       }
@@ -364,9 +375,13 @@ void SDLayoutBuilder::createThunkFunctions(Module& M, const vtbl_name_t& rootNam
       //start replacing the old index in the instruction witht the new index 
       CallInst* CI = NULL; //declare a new call instruction 
       
-      //if the function is null than skip loop iteration 
-      if(sd_vcall_indexF == NULL)
+      //if the function is null than skip loop iteration, the clone is
+      //still the thunk of this parent
+      if(sd_vcall_indexF == NULL) {
+        clonedThunks++;
+        newThunkMap[newThunkName] = mergeThunkFunction(newThunkF);
         continue;
+      }
 
       // go over its instructions and replace the one with the metadata
       // go over each function 
@@ -411,8 +426,310 @@ void SDLayoutBuilder::createThunkFunctions(Module& M, const vtbl_name_t& rootNam
       }
 
       // this function should have a metadata
+
+      //fold the clone into an identical one, if there is any
+      clonedThunks++;
+      newThunkMap[newThunkName] = mergeThunkFunction(newThunkF);
+    }
+  }
+}
+
+static cl::opt<bool>
+SDMergeVthunks("sd-merge-vthunks", cl::init(true), cl::Hidden,
+               cl::desc("Fold identical vthunk clones into one function"));
+
+Function* SDLayoutBuilder::mergeThunkFunction(Function* newThunkF) {
+  // a declaration has no body to compare
+  if (!SDMergeVthunks || newThunkF->isDeclaration())
+    return newThunkF;
+
+  // everything but the name: signature, attributes and the basic blocks.
+  // The clones keep the value names of the original thunk, so identical
+  // clones print identically.
+  std::string body;
+  raw_string_ostream out(body);
+  out << *newThunkF->getFunctionType() << " "
+      << newThunkF->getCallingConv() << " "
+      << newThunkF->getLinkage() << " "
+      << newThunkF->getAttributes().getAsString(AttributeSet::FunctionIndex) << "\n";
+  for (const BasicBlock& BB : *newThunkF)
+    out << BB;
+  out.flush();
+
+  size_t hash = hash_value(StringRef(body));
+  std::vector<std::pair<std::string, Function*> >& bucket = thunkBodyMap[hash];
+
+  for (auto& entry : bucket) {
+    if (entry.first == body) {
+      sd_print("Folded vthunk %s into %s\n", newThunkF->getName().data(), entry.second->getName().data());
+      newThunkF->eraseFromParent();
+      foldedThunks++;
+      return entry.second;
+    }
+  }
+
+  bucket.push_back(std::make_pair(body, newThunkF));
+  return newThunkF;
+}
+
+static cl::opt<bool>
+SDMinPaddingLayout("sd-min-padding-layout", cl::init(true), cl::Hidden,
+                   cl::desc("Choose the address point stride of ordered clouds to minimize padding"));
+
+#define CACHE_LINE_ENTRIES 8 // 64 byte cache lines
+
+static cl::opt<bool>
+SDProfileLayout("sd-profile-layout", cl::init(true), cl::Hidden,
+                cl::desc("Use the profile counts of vcall and cast sites to place hot clouds"));
+
+static cl::opt<unsigned>
+SDHotCloudPercent("sd-hot-cloud-percent", cl::init(99), cl::Hidden,
+                  cl::desc("The hot clouds are the most executed clouds that together cover this percentage of all site counts"));
+
+#define SD_HOT_VTABLE_SECTION  ".data.rel.ro.sd.hot"
+#define SD_COLD_VTABLE_SECTION ".data.rel.ro.sd.cold"
+
+/**
+ * Place the (pre, size) pairs of a cloud like orderCloud does, with the
+ * address points aligned to stride entries. Returns the total number of
+ * entries, and in lines the cache lines of the cloud plus the cache lines
+ * spanned by the function pointer part of each vtable. The latter alone
+ * (the lines touched by dispatch) is returned in dispatchLines.
+ */
+static uint64_t sd_simulateOrderedCloud(const std::vector<std::pair<uint64_t, uint64_t> >& entries,
+                                        uint64_t stride, uint64_t& lines, uint64_t& dispatchLines) {
+  uint64_t pos = 0;
+  dispatchLines = 0;
+
+  for (auto& e : entries) {
+    uint64_t padEntries = pos + e.first;
+    pos += (padEntries % stride == 0) ? 0 : stride - (padEntries % stride);
+
+    uint64_t addrPt = pos + e.first;
+    if (e.second > e.first)
+      dispatchLines += (addrPt + e.second - e.first - 1) / CACHE_LINE_ENTRIES - addrPt / CACHE_LINE_ENTRIES + 1;
+    pos += e.second;
+  }
+
+  lines = dispatchLines + (pos + CACHE_LINE_ENTRIES - 1) / CACHE_LINE_ENTRIES;
+  return pos;
+}
+
+static uint64_t sd_nextPowerOf2(uint64_t max) {
+  if (max == 0)
+    return 1;
+
+  max--;
+  max |= max >> 1;   // Divide by 2^k for consecutive doublings of k up to 32,
+  max |= max >> 2;   // and then or the results.
+  max |= max >> 4;
+  max |= max >> 8;
+  max |= max >> 16;
+  max |= max >> 32;
+  max++;            // The result is a number of 1 bits equal to the number
+                    // of bits in the original number, plus 1. That's the
+                    // next highest power of 2.
+  return max;
+}
+
+/**
+ * Name of the class in the metadata tuple operand of a vcall or cast site
+ * intrinsic, see sd_getClassNameFromMD in CastSanTools.h.
+ */
+static bool sd_getSiteClassName(CallInst* CI, unsigned argNo, std::string& className) {
+  MetadataAsValue* arg = dyn_cast<MetadataAsValue>(CI->getArgOperand(argNo));
+  if (!arg)
+    return false;
+
+  MDTuple* mdTuple = dyn_cast<MDTuple>(arg->getMetadata());
+  if (!mdTuple || mdTuple->getNumOperands() == 0)
+    return false;
+
+  MDNode* nameMdNode = dyn_cast_or_null<MDNode>(mdTuple->getOperand(0).get());
+  if (!nameMdNode || nameMdNode->getNumOperands() == 0)
+    return false;
+
+  MDString* mdStr = dyn_cast_or_null<MDString>(nameMdNode->getOperand(0));
+  if (!mdStr)
+    return false;
+
+  className = mdStr->getString().str();
+  return true;
+}
+
+/*Paul:
+the interleaved and ordered layouts do not know which classes are used at
+run time. Both an instrumentation profile (-fprofile-instr-use) and a sample
+profile (-fprofile-sample-use) end up as function entry counts and branch
+weights in the IR, so the number of executions of each vcall and cast site
+is its function entry count scaled by the relative frequency of its block.
+The counts are summed up per cloud.
+*/
+void SDLayoutBuilder::collectCloudProfile(Module& M) {
+  hasProfile = false;
+  cloudProfileCount.clear();
+  hotClouds.clear();
+
+  if (!SDProfileLayout)
+    return;
+
+  // intrinsic and operand number of the class metadata
+  std::vector<std::pair<Function*, unsigned> > siteFuns;
+  siteFuns.push_back(std::make_pair(M.getFunction(Intrinsic::getName(Intrinsic::sd_check_vtbl)), 1));
+  siteFuns.push_back(std::make_pair(M.getFunction(Intrinsic::getName(Intrinsic::sd_get_checked_vptr)), 1));
+  siteFuns.push_back(std::make_pair(M.getFunction(Intrinsic::getName(Intrinsic::cast_info)), 0));
+
+  std::map<Function*, BlockFrequencyInfo*> bfiMap;
+  uint64_t total = 0;
+
+  for (auto& sf : siteFuns) {
+    if (!sf.first)
+      continue;
+
+    for (const Use& U : sf.first->uses()) {
+      CallInst* CI = dyn_cast<CallInst>(U.getUser());
+      if (!CI)
+        continue;
+
+      Function* F = CI->getParent()->getParent();
+      Optional<uint64_t> entryCount = F->getEntryCount();
+      if (!entryCount.hasValue())
+        continue;
+
+      std::string className;
+      if (!sd_getSiteClassName(CI, sf.second, className))
+        continue;
+
+      vtbl_t classVtbl(className, 0);
+      vtbl_name_t root;
+      if (cha->isRoot(className))
+        root = className;
+      else if (cha->hasAncestor(classVtbl))
+        root = cha->getAncestor(classVtbl);
+      else
+        continue;
+
+      if (bfiMap.find(F) == bfiMap.end())
+        bfiMap[F] = &getAnalysis<BlockFrequencyInfoWrapperPass>(*F).getBFI();
+      BlockFrequencyInfo* BFI = bfiMap[F];
+
+      uint64_t count = entryCount.getValue();
+      uint64_t entryFreq = BFI->getEntryFreq();
+      if (entryFreq != 0)
+        count = (uint64_t) ((double) count * BFI->getBlockFreq(CI->getParent()).getFrequency() / entryFreq);
+
+      hasProfile = true;
+      cloudProfileCount[root] += count;
+      total += count;
     }
   }
+
+  if (!hasProfile) {
+    sd_print("No profile counts for vcall or cast sites, hot cloud placement is off\n");
+    return;
+  }
+
+  // take the clouds with the highest counts until they cover the percentage
+  std::vector<std::pair<uint64_t, vtbl_name_t> > counts;
+  for (auto& c : cloudProfileCount)
+    counts.push_back(std::make_pair(c.second, c.first));
+  std::sort(counts.rbegin(), counts.rend());
+
+  uint64_t covered = 0;
+  for (auto& c : counts) {
+    if (c.first == 0 || (double) covered * 100 >= (double) total * SDHotCloudPercent)
+      break;
+    covered += c.first;
+    hotClouds.insert(c.second);
+    sd_print("Hot cloud %s: %lu site executions\n", c.second.c_str(), c.first);
+  }
+
+  sd_print("%lu of %lu clouds are hot (%lu of %lu site executions)\n",
+           hotClouds.size(), (uint64_t) cha->getNumberOfRoots(), covered, total);
+}
+
+bool SDLayoutBuilder::isHotCloud(const vtbl_name_t& vtbl) {
+  return hotClouds.find(vtbl) != hotClouds.end();
+}
+
+/*Paul:
+choose the distance (in entries) between two consecutive address points of
+an ordered cloud. The rotate range check needs a power of 2, and the entries
+after one address point plus the entries before the next one have to fit
+in between. The old choice, the power of 2 above the largest vtable, is kept
+for comparison and with -sd-min-padding-layout=false.
+*/
+uint64_t SDLayoutBuilder::chooseCloudStride(SDLayoutBuilder::vtbl_name_t& vtbl) {
+  vtbl_t root(vtbl,0);
+  order_t pre = cha->preorder(root);
+
+  // (entries before the address point, size) of each defined vtable, in layout order
+  std::vector<std::pair<uint64_t, uint64_t> > entries;
+  uint64_t maxSize = 0;
+
+  for(const vtbl_t &child : pre) {
+    const range_t& r = cha->getRange(child);
+    uint64_t size = r.second - r.first + 1;
+    if (size > maxSize)
+      maxSize = size;
+
+    if(cha->isUndefined(child.first))
+      continue;
+
+    entries.push_back(std::make_pair(cha->addrPt(child) - r.first, size));
+  }
+
+  uint64_t legacyStride = sd_nextPowerOf2(maxSize);
+  if (!SDMinPaddingLayout)
+    return legacyStride;
+
+  uint64_t minGap = 1;
+  for (unsigned i = 0; i + 1 < entries.size(); i++) {
+    uint64_t gap = entries[i].second - entries[i].first + entries[i+1].first;
+    if (gap > minGap)
+      minGap = gap;
+  }
+
+  // larger strides put every address point on a cache line, so the
+  // candidates go up to one cache line
+  uint64_t minStride = sd_nextPowerOf2(minGap);
+  uint64_t maxStride = std::max(minStride, (uint64_t) CACHE_LINE_ENTRIES);
+  bool hot = isHotCloud(vtbl);
+  bool cold = hasProfile && !hot;
+  uint64_t bestStride = 0, bestSize = 0, bestLines = 0, bestDispatch = 0;
+  for (uint64_t stride = minStride; stride <= maxStride; stride *= 2) {
+    uint64_t lines, dispatch;
+    uint64_t size = sd_simulateOrderedCloud(entries, stride, lines, dispatch);
+
+    bool better;
+    if (hot)        // hot clouds: fewest lines touched by dispatch, then the most compact
+      better = dispatch < bestDispatch || (dispatch == bestDispatch &&
+               (lines < bestLines || (lines == bestLines && size < bestSize)));
+    else if (cold)  // cold clouds are never dispatched through, only the size matters
+      better = size < bestSize;
+    else
+      better = lines < bestLines || (lines == bestLines && size < bestSize);
+
+    if (bestStride == 0 || better) {
+      bestStride = stride;
+      bestSize = size;
+      bestLines = lines;
+      bestDispatch = dispatch;
+    }
+  }
+
+  uint64_t legacyLines, legacyDispatch;
+  uint64_t legacySize = sd_simulateOrderedCloud(entries, legacyStride, legacyLines, legacyDispatch);
+  int64_t saved = ((int64_t) legacySize - (int64_t) bestSize) * WORD_WIDTH;
+  paddingBytesSaved += saved;
+
+  sd_print("Cloud %s (%s): stride %lu -> %lu, size %lu -> %lu bytes, cache lines %lu -> %lu, dispatch lines %lu -> %lu, saved %ld bytes\n",
+           vtbl.c_str(), hot ? "hot" : (cold ? "cold" : "no profile"),
+           legacyStride, bestStride,
+           legacySize * WORD_WIDTH, bestSize * WORD_WIDTH,
+           legacyLines, bestLines, legacyDispatch, bestDispatch, saved);
+
+  return bestStride;
 }
 
 /*Paul: 
@@ -433,25 +750,7 @@ void SDLayoutBuilder::orderCloud(SDLayoutBuilder::vtbl_name_t& vtbl) {
 
   vtbl_t root(vtbl,0);
   order_t pre = cha->preorder(root);
-  uint64_t max = 0;
-
-  for(const vtbl_t child : pre) {
-    const range_t& r = cha->getRange(child);
-    uint64_t size = r.second - r.first + 1;
-    if (size > max)
-      max = size;
-  }
-
-  max--;
-  max |= max >> 1;   // Divide by 2^k for consecutive doublings of k up to 32,
-  max |= max >> 2;   // and then or the results.
-  max |= max >> 4;
-  max |= max >> 8;
-  max |= max >> 16;
-  max |= max >> 32;
-  max++;            // The result is a number of 1 bits equal to the number
-                    // of bits in the original number, plus 1. That's the
-                    // next highest power of 2.
+  uint64_t max = chooseCloudStride(vtbl);
 
   assert((max & (max-1)) == 0 && "max is not a power of 2");
 
@@ -459,7 +758,7 @@ void SDLayoutBuilder::orderCloud(SDLayoutBuilder::vtbl_name_t& vtbl) {
 
   //sd_print("ALIGNMENT: %s, %u\n", vtbl.data(), max*WORD_WIDTH);
 
-  for(const vtbl_t child : pre) {
+  for(const vtbl_t &child : pre) {
     if(cha->isUndefined(child.first))
       continue;
 
@@ -471,7 +770,7 @@ void SDLayoutBuilder::orderCloud(SDLayoutBuilder::vtbl_name_t& vtbl) {
 
     for(unsigned i=0; i<padSize; i++) {
       if (orderedVtbl.size() % max == 0 && orderedVtbl.size() != 0) {
-        std::cerr << "dummy entry is " << max << " aligned in cloud " << vtbl << std::endl;
+        DEBUG(dbgs() << "dummy entry is " << max << " aligned in cloud " << vtbl << "\n");
       }
       orderedVtbl.push_back(interleaving_t(dummyVtable,0));
     }
@@ -777,15 +1076,15 @@ void SDLayoutBuilder::calculateVPtrRangesHelper(const SDLayoutBuilder::vtbl_t& v
     coalesced_ranges.push_back(range_t(start,end));
   
   //print the ranges 
-  std::cerr << "Range for: {" << vtbl.first << "," << vtbl.second << "} From ranges [";
+  DEBUG(dbgs() << "Range for: {" << vtbl.first << "," << vtbl.second << "} From ranges [");
   for (auto it : ranges)
-    std::cerr << "(" << it.first << "," << it.second << "),";
+    DEBUG(dbgs() << "(" << it.first << "," << it.second << "),");
 
-  std::cerr << "] coalesced [";
+  DEBUG(dbgs() << "] coalesced [");
   for (auto it : coalesced_ranges)
-    std::cerr << "(" << it.first << "," << it.second << "),";
+    DEBUG(dbgs() << "(" << it.first << "," << it.second << "),");
     
-  std::cerr << "]\n";
+  DEBUG(dbgs() << "]\n");
   
   rangeMap[vtbl] = coalesced_ranges;
 }
@@ -866,7 +1165,7 @@ void SDLayoutBuilder::calculateVPtrRanges(Module& M, SDLayoutBuilder::vtbl_name_
   //print preorder nodes of one root node 
   sd_print("\ncalculateVPtrRanges: Preorder nodes of root %s are: \n", vtbl.c_str());
   for (uint64_t i= 0; i < preorderV.size(); i++)
-  std::cerr << "first: " << preorderV[i].first << ", second: " << preorderV[i].second << "\n";
+  DEBUG(dbgs() << "first: " << preorderV[i].first << ", second: " << preorderV[i].second << "\n");
 
   std::map<vtbl_t, uint64_t> indMap;
 
@@ -879,9 +1178,9 @@ void SDLayoutBuilder::calculateVPtrRanges(Module& M, SDLayoutBuilder::vtbl_name_
  
   //Paul: iterate through all the nodes for this root 
   //and print the ranges 
-  std::cerr << "\n Printing and buid memRangeMap for root node " << vtbl.c_str() << " \n";
+  DEBUG(dbgs() << "\n Printing and buid memRangeMap for root node " << vtbl.c_str() << " \n");
   for (uint64_t i = 0; i < preorderV.size(); i++) {
-    std::cerr << "For pre node first: " << preorderV[i].first << ", and pre node second:" << preorderV[i].second << " ";
+    DEBUG(dbgs() << "For pre node first: " << preorderV[i].first << ", and pre node second:" << preorderV[i].second << " ");
 
     for (auto it : rangeMap[preorderV[i]]) {
       uint64_t start = it.first,
@@ -896,8 +1195,8 @@ void SDLayoutBuilder::calculateVPtrRanges(Module& M, SDLayoutBuilder::vtbl_name_
         if (cha->isDefined(preorderV[j])) 
             def_count++;
 
-      std::cerr << "(range " << start << "-" << end << " contains "
-        << def_count << " defined,";
+      DEBUG(dbgs() << "(range " << start << "-" << end << " contains "
+        << def_count << " defined,");
       
       //skip if not defined 
       if (def_count == 0)
@@ -905,19 +1204,19 @@ void SDLayoutBuilder::calculateVPtrRanges(Module& M, SDLayoutBuilder::vtbl_name_
       
       //if undefined than skip it 
       while (cha->isUndefined(preorderV[start]) && start < end) {
-        std::cerr << "skipping " << preorderV[start].first << "," << preorderV[start].second 
-          << ",";
+        DEBUG(dbgs() << "skipping " << preorderV[start].first << "," << preorderV[start].second 
+          << ",");
         start++;
       }
 
-      std::cerr << "final range " << preorderV[start].first << "," << preorderV[start].second
-        << "+" << def_count << ")";
+      DEBUG(dbgs() << "final range " << preorderV[start].first << "," << preorderV[start].second
+        << "+" << def_count << ")");
     
       // Paul: for each node a memory range will be added to the map and 
       // and a definition count will be icremented and added. Add to the memRangeMap. 
       memRangeMap[preorderV[i]].push_back(mem_range_t(newVtblAddressConst(M, preorderV[start]), def_count));
     }
-    std::cerr << "\n";
+    DEBUG(dbgs() << "\n");
   }
 }
 
@@ -973,8 +1272,8 @@ void SDLayoutBuilder::createNewVTable(Module& M, SDLayoutBuilder::vtbl_name_t& v
       if (thunk) {
 
         //create a new thunk function with a new name based on thunk and the parent class name 
-        Function* newThunk = M.getFunction(NEW_VTHUNK_NAME(thunk, cha->getLayoutClassName(ivtbl.first)));
-        assert(newThunk);
+        assert(newThunkMap.count(NEW_VTHUNK_NAME(thunk, cha->getLayoutClassName(ivtbl.first))));
+        Function* newThunk = newThunkMap[NEW_VTHUNK_NAME(thunk, cha->getLayoutClassName(ivtbl.first))];
         
         //create a new bit cast constant using the newthunk and the context Context
         Constant* newC = ConstantExpr::getBitCast(newThunk, IntegerType::getInt8PtrTy(Context));
@@ -1013,6 +1312,17 @@ void SDLayoutBuilder::createNewVTable(Module& M, SDLayoutBuilder::vtbl_name_t& v
   // The new v table will be added in the end in the new Constant
   newGlobalVariable->setAlignment(alignmentMap[vtbl]);
 
+  // Paul: hot clouds start on a cache line, so that the dispatch lines
+  // computed in chooseCloudStride are the real ones. alignmentMap is not
+  // changed, the range checks only depend on the address point stride.
+  // With a profile, hot and cold clouds are grouped in their own sections.
+  if (isHotCloud(vtbl)) {
+    newGlobalVariable->setAlignment(std::max(alignmentMap[vtbl], (unsigned) (CACHE_LINE_ENTRIES * WORD_WIDTH)));
+    newGlobalVariable->setSection(SD_HOT_VTABLE_SECTION);
+  } else if (hasProfile) {
+    newGlobalVariable->setSection(SD_COLD_VTABLE_SECTION);
+  }
+
   //set initializer 
   newGlobalVariable->setInitializer(newVtableInit);
 
@@ -1412,69 +1722,107 @@ void SDLayoutBuilder::buildNewLayouts(Module &M) {
 
   sd_print("CHA cloud map has %d root nodes \n", cha->getNumberOfRoots());
   
-  //1: we iterate through all roots contained in the cloud, order or interleave them 
-  for (auto itr = cha->roots_begin(); itr != cha->roots_end(); itr++) {
+  {
+    NamedRegionTimer T("Order or interleave clouds", "CastSan", TimePassesIsEnabled);
+
+    //1: we iterate through all roots contained in the cloud, order or interleave them 
+    for (auto itr = cha->roots_begin(); itr != cha->roots_end(); itr++) {
    
-    vtbl_name_t vtbl = *itr;         // get the v table name as string
+      vtbl_name_t vtbl = *itr;         // get the v table name as string
  
-    //Paul: interleave or order for each v table separatelly 
-    if (interleave){
-      //interleaveCloud(vtbl);         // interleave the cloud or
+      //Paul: interleave or order for each v table separatelly 
+      if (interleave){
+        //interleaveCloud(vtbl);         // interleave the cloud or
 
-      //our interleaving method 
-      interleaveCloudNew(vtbl);         // interleave the cloud or
+        //our interleaving method 
+        interleaveCloudNew(vtbl);         // interleave the cloud or
 
-    }else{
-      orderCloud(vtbl);              // order the cloud
-    }
+      }else{
+        orderCloud(vtbl);              // order the cloud
+      }
     
-    // Paul: we can create a new algorithm which is a combination of the interleaving and ordering algorithms
-    // The algorithm should remove the disadvantages of both of these algorithms and it should carefully 
-    // filter out v tables which are not the v table ancestor path 
+      // Paul: we can create a new algorithm which is a combination of the interleaving and ordering algorithms
+      // The algorithm should remove the disadvantages of both of these algorithms and it should carefully 
+      // filter out v tables which are not the v table ancestor path 
 
 
-    //Paul: calculate the new layout indices
-    // the new indices will be used when inserting the new v table layouts inside the metadata.
-    // Inside this method the interleavedMap obtained in the interleaveCloud or 
-    // orderCloud will be used to compute the new index of the v table. 
-    // This is just a simple counting and ssigning an index number to the new elements.
-    calculateNewLayoutInds(vtbl);    // calculate the new indices from the interleaved vtable
+      //Paul: calculate the new layout indices
+      // the new indices will be used when inserting the new v table layouts inside the metadata.
+      // Inside this method the interleavedMap obtained in the interleaveCloud or 
+      // orderCloud will be used to compute the new index of the v table. 
+      // This is just a simple counting and ssigning an index number to the new elements.
+      calculateNewLayoutInds(vtbl);    // calculate the new indices from the interleaved vtable
+    }
   }
   
-  //2: we iterate through all roots contained in the cloud and replace 
-  //v thunks and emit global variables.
-  for (auto itr = cha->roots_begin(); itr != cha->roots_end(); itr++) {
+  {
+    NamedRegionTimer T("Emit new vtables", "CastSan", TimePassesIsEnabled);
 
-    // get the v table name as string
-    vtbl_name_t vtbl = *itr;        
+    //2: we iterate through all roots contained in the cloud and replace 
+    //v thunks and emit global variables.
+    for (auto itr = cha->roots_begin(); itr != cha->roots_end(); itr++) {
+
+      // get the v table name as string
+      vtbl_name_t vtbl = *itr;        
     
-    // create new thunk function and add it to M.getFunctionList().push_back(newThunkF);
-    // replace the old v pointer whith the new one using Intrinsics::sd_vcall_indexF
-    createThunkFunctions(M, vtbl); 
-
-    // emit the new global variables with the new v tables inside.  
-    // Previously that mens that the v tables where extended with
-    // all v table children of a given root node. This means that to many v tables are attached 
-    // to a Global Variable. This is bad! (attack surface is increased).
-    // Note: the added range checks reflect the contents of this global variable 
-    createNewVTable(M, vtbl);        
+      // create new thunk function and add it to M.getFunctionList().push_back(newThunkF);
+      // replace the old v pointer whith the new one using Intrinsics::sd_vcall_indexF
+      createThunkFunctions(M, vtbl); 
+
+      // emit the new global variables with the new v tables inside.  
+      // Previously that mens that the v tables where extended with
+      // all v table children of a given root node. This means that to many v tables are attached 
+      // to a Global Variable. This is bad! (attack surface is increased).
+      // Note: the added range checks reflect the contents of this global variable 
+      createNewVTable(M, vtbl);        
+    }
   }
 
-  // 3: we iterate through all roots contained in the cloud and 
-  // calculate v pointer ranges and than verify the v pointer ranges
-  for (auto itr = cha->roots_begin(); itr != cha->roots_end(); itr++) {
-    vtbl_name_t vtbl = *itr;  // get the v table name as string
+  // Paul: emit the hot clouds back to back, the most frequently dispatched first
+  if (!hotClouds.empty()) {
+    std::vector<std::pair<uint64_t, vtbl_name_t> > hot;
+    for (const vtbl_name_t& root : hotClouds)
+      hot.push_back(std::make_pair(cloudProfileCount[root], root));
+    std::sort(hot.rbegin(), hot.rend());
+
+    for (auto& h : hot) {
+      GlobalVariable* gv = cloudStartMap[NEW_VTABLE_NAME(h.second)];
+      assert(gv);
+      gv->removeFromParent();
+      M.getGlobalList().push_back(gv);
+    }
+  }
+
+  {
+    NamedRegionTimer T("Calculate vptr ranges", "CastSan", TimePassesIsEnabled);
+
+    // 3: we iterate through all roots contained in the cloud and 
+    // calculate v pointer ranges and than verify the v pointer ranges
+    for (auto itr = cha->roots_begin(); itr != cha->roots_end(); itr++) {
+      vtbl_name_t vtbl = *itr;  // get the v table name as string
     
-    //calculate the v ptr ranges, these will added into the checks.
-    //this ranges have to be the most restrictive as posible and precise.
-    //There is at the moment no better way as considering the object base class 
-    //and the base class of the function which the object is calling, see SW paper.
-    calculateVPtrRanges(M, vtbl);  
-
-    //Check that the ranges of the descendants are disjoint:
-    //1.This means they do not overlap at all.
-    //2.Check that each descendent is in one of the ranges. 
-    verifyVPtrRanges(vtbl);         
+      //calculate the v ptr ranges, these will added into the checks.
+      //this ranges have to be the most restrictive as posible and precise.
+      //There is at the moment no better way as considering the object base class 
+      //and the base class of the function which the object is calling, see SW paper.
+      calculateVPtrRanges(M, vtbl);  
+
+      //Check that the ranges of the descendants are disjoint:
+      //1.This means they do not overlap at all.
+      //2.Check that each descendent is in one of the ranges. 
+      verifyVPtrRanges(vtbl);         
+    }
   }
+
+  if (!interleave)
+    sd_print("Ordered layout saved %ld bytes of padding in total\n", paddingBytesSaved);
+
+  sd_print("Folded %lu of %lu cloned vthunks\n", foldedThunks, clonedThunks);
+  thunkBodyMap.clear();
+
+  NumClonedThunks += clonedThunks;
+  NumFoldedThunks += foldedThunks;
+  if (paddingBytesSaved > 0)
+    NumPaddingBytesSaved += paddingBytesSaved;
 }
 
@@ -21,6 +21,7 @@
 
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Support/Debug.h"
 
 #include <list>
 #include <vector>
@@ -30,6 +31,8 @@
 #include <algorithm>
 #include <iostream>
 
+#define DEBUG_TYPE "castsan"
+
 // you have to modify the following 4 files for each additional LLVM pass
 // 1. include/llvm/IPO.h
 // 2. lib/Transforms/IPO/IPO.cpp
@@ -77,8 +80,8 @@ namespace {
         // Paul: this is an internal LLVM Function
         Function::BasicBlockListType &bbs = fIt->getBasicBlockList(); //Paul; this is a LLVM bb function list type
         for (auto bb : toMove) {
-          std::cerr << "Moving " << bb->getName().str() << " to end in " << 
-            fIt->getName().str() << "\n";
+          DEBUG(dbgs() << "Moving " << bb->getName().str() << " to end in " << 
+            fIt->getName().str() << "\n");
 
           //Paul: remove the bb from the bbs list 
           bbs.remove(bb); 
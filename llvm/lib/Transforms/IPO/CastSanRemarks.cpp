@@ -0,0 +1,119 @@
+#include "llvm/Transforms/IPO/CastSanRemarks.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+#include <string>
+
+#define DEBUG_TYPE "castsan"
+
+using namespace llvm;
+
+static cl::opt<std::string>
+SDRemarksFile("sd-remarks-file", cl::init(""), cl::Hidden,
+              cl::desc("Write the CastSan check site records as YAML to this file"));
+
+//Paul: the file is truncated when the first record of the process is
+//written, all the CastSan passes of one link append to it
+static raw_fd_ostream* sd_getRemarksStream() {
+  static std::unique_ptr<raw_fd_ostream> stream;
+  static bool opened = false;
+
+  if (!opened) {
+    opened = true;
+    std::error_code EC;
+    stream.reset(new raw_fd_ostream(SDRemarksFile, EC, sys::fs::F_Text));
+    if (EC) {
+      errs() << "CastSan: could not open " << SDRemarksFile << ": " << EC.message() << "\n";
+      stream.reset();
+    }
+  }
+  return stream.get();
+}
+
+//Paul: YAML single quoted scalar, the only escape is '' for '
+static void sd_writeQuoted(raw_ostream& OS, StringRef str) {
+  OS << "'";
+  for (char c : str) {
+    if (c == '\'')
+      OS << "'";
+    OS << c;
+  }
+  OS << "'";
+}
+
+static void sd_writeRecord(raw_ostream& OS, sd_remark_kind_t kind, StringRef name,
+                           const Instruction* I, StringRef site, StringRef className,
+                           int64_t width, StringRef detail) {
+  static const char* kindTags[] = { "Passed", "Missed", "Analysis" };
+
+  OS << "--- !" << kindTags[kind] << "\n";
+  OS << "Pass:            castsan\n";
+  OS << "Name:            " << name << "\n";
+  if (const DILocation* loc = I->getDebugLoc()) {
+    OS << "DebugLoc:        { File: ";
+    sd_writeQuoted(OS, loc->getFilename());
+    OS << ", Line: " << loc->getLine() << ", Column: " << loc->getColumn() << " }\n";
+  }
+  OS << "Function:        ";
+  sd_writeQuoted(OS, I->getFunction()->getName());
+  OS << "\n";
+  OS << "Args:\n";
+  OS << "  - Site:            " << site << "\n";
+  OS << "  - Class:           ";
+  sd_writeQuoted(OS, className);
+  OS << "\n";
+  if (width >= 0)
+    OS << "  - Width:           " << width << "\n";
+  if (!detail.empty()) {
+    OS << "  - Detail:          ";
+    sd_writeQuoted(OS, detail);
+    OS << "\n";
+  }
+  OS << "...\n";
+}
+
+void llvm::sd_emitRemark(sd_remark_kind_t kind, StringRef name, const Instruction* I,
+                         StringRef site, StringRef className, int64_t width,
+                         StringRef detail) {
+  const Function& F = *I->getFunction();
+  LLVMContext& C = F.getContext();
+  const DebugLoc& loc = I->getDebugLoc();
+
+  std::string msg;
+  raw_string_ostream msgOS(msg);
+  if (name == "Devirtualized") {
+    msgOS << "devirtualized call to " << (detail.empty() ? "a constant" : detail);
+  } else if (kind == SD_REMARK_MISSED) {
+    msgOS << "no CastSan metadata for the " << site << " check for " << className;
+  } else {
+    msgOS << site << " check for " << className << ": " << name;
+    if (width >= 0)
+      msgOS << " over " << width << " vptr(s)";
+    if (!detail.empty())
+      msgOS << " [" << detail << "]";
+  }
+  msgOS.flush();
+
+  switch (kind) {
+  case SD_REMARK_PASSED:
+    emitOptimizationRemark(C, DEBUG_TYPE, F, loc, msg);
+    break;
+  case SD_REMARK_MISSED:
+    emitOptimizationRemarkMissed(C, DEBUG_TYPE, F, loc, msg);
+    break;
+  case SD_REMARK_ANALYSIS:
+    emitOptimizationRemarkAnalysis(C, DEBUG_TYPE, F, loc, msg);
+    break;
+  }
+
+  if (SDRemarksFile.empty())
+    return;
+
+  if (raw_fd_ostream* OS = sd_getRemarksStream())
+    sd_writeRecord(*OS, kind, name, I, site, className, width, detail);
+}
@@ -0,0 +1,127 @@
+#include "llvm/Transforms/IPO/CastSanSampling.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#include "llvm/Transforms/IPO/CastSanLog.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "castsan"
+
+STATISTIC(NumSampledCastChecks, "Number of cast checks guarded by a sampling countdown");
+
+using namespace llvm;
+
+static cl::opt<bool>
+SDSampleCastChecks("sd-sample-cast-checks", cl::init(false), cl::Hidden,
+                   cl::desc("Only check every N-th execution of a cast check site, "
+                            "N is set at runtime with CASTSAN_SAMPLE_RATE"));
+
+SDCastSampler::SDCastSampler(Module& M) : M(M) {}
+
+bool SDCastSampler::isEnabled() const {
+  return SDSampleCastChecks;
+}
+
+//Paul: the instructions that compute the vptr of CI (the load and the casts
+//of its address) and have no other user, latest first. Nothing between them
+//and CI may write memory, they run after it once moved into the sampled block.
+static std::vector<Instruction*> vptrChain(CallInst* CI) {
+  std::vector<Instruction*> chain;
+  Value* V = CI->getArgOperand(2);
+  while (Instruction* I = dyn_cast<Instruction>(V)) {
+    if (I->getParent() != CI->getParent() || !I->hasOneUse())
+      break;
+    if (LoadInst* LI = dyn_cast<LoadInst>(I)) {
+      if (!LI->isSimple())
+        break;
+    } else if (!isa<CastInst>(I) && !isa<GetElementPtrInst>(I)) {
+      break;
+    }
+    chain.push_back(I);
+    V = I->getOperand(0);
+  }
+
+  if (!chain.empty()) {
+    for (BasicBlock::iterator it = chain.back()->getIterator(); &*it != CI; ++it)
+      if (it->mayWriteToMemory())
+        return std::vector<Instruction*>();
+  }
+  return chain;
+}
+
+Instruction* SDCastSampler::guard(CallInst* CI) {
+  if (!SDSampleCastChecks)
+    return CI;
+
+  LLVMContext& C = M.getContext();
+  Type* Int32Ty = Type::getInt32Ty(C);
+  Type* Int64Ty = Type::getInt64Ty(C);
+  Type* Int8PtrTy = Type::getInt8PtrTy(C);
+
+  //Paul: initial-exec, so the countdown is a fixed offset from the thread
+  //pointer and the unsampled path has no load except the countdown itself.
+  //A shared object would take its initial-exec variables from the small
+  //static TLS surplus of glibc, which a few thousand sites exhaust when it
+  //is dlopen-ed, so PIC modules use local-dynamic. The IR does not tell a
+  //PIE from a shared object, those pay for it as well.
+  GlobalVariable::ThreadLocalMode tlsModel =
+    M.getPICLevel() == PICLevel::Default ? GlobalValue::InitialExecTLSModel
+                                         : GlobalValue::LocalDynamicTLSModel;
+  GlobalVariable* countdown =
+    new GlobalVariable(M, Int32Ty, false, GlobalValue::InternalLinkage,
+                       ConstantInt::get(Int32Ty, 0), "sd.sample_countdown",
+                       nullptr, tlsModel);
+
+  // { i64 checks, i32 period, i32 checks at this period }, see hextype_sampling.cc
+  StructType* siteTy = StructType::get(Int64Ty, Int32Ty, Int32Ty, nullptr);
+  Constant* fields[] = { ConstantInt::get(Int64Ty, 0), ConstantInt::get(Int32Ty, 1),
+                         ConstantInt::get(Int32Ty, 0) };
+  GlobalVariable* site = new GlobalVariable(M, siteTy, false, GlobalValue::PrivateLinkage,
+                                            ConstantStruct::get(siteTy, fields), "sd.sample_site");
+
+  //Paul: the countdown goes in front of the vptr load, so that the
+  //unsampled path does not touch the object at all
+  std::vector<Instruction*> chain = vptrChain(CI);
+  Instruction* splitAt = chain.empty() ? CI : chain.back();
+
+  IRBuilder<> builder(splitAt);
+  Value* count = builder.CreateLoad(countdown);
+  Value* next = builder.CreateAdd(count, ConstantInt::get(Int32Ty, -1));
+  builder.CreateStore(next, countdown);
+  Value* sample = builder.CreateICmpSLE(next, ConstantInt::get(Int32Ty, 0));
+
+  BasicBlock* head = CI->getParent();
+  MDBuilder MDB(C);
+  TerminatorInst* term = SplitBlockAndInsertIfThen(sample, splitAt, false,
+                                                   MDB.createBranchWeights(1, 100));
+
+  for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+    (*it)->moveBefore(term);
+
+  builder.SetInsertPoint(term);
+  Constant* nextF = M.getOrInsertFunction("__castsan_sample_next", Int32Ty, Int8PtrTy, nullptr);
+  Value* period = builder.CreateCall(nextF, builder.CreateBitCast(site, Int8PtrTy));
+  builder.CreateStore(period, countdown);
+
+  guards[CI] = std::make_pair(head, term->getParent());
+  NumSampledCastChecks++;
+  return term;
+}
+
+Value* SDCastSampler::merge(CallInst* CI, Value* checkResult) {
+  auto it = guards.find(CI);
+  if (it == guards.end())
+    return checkResult;
+
+  //Paul: the split started the block of CI, the phi goes first
+  PHINode* phi = PHINode::Create(checkResult->getType(), 2, "sd.sampled",
+                                 &CI->getParent()->front());
+  phi->addIncoming(ConstantInt::getTrue(M.getContext()), it->second.first);
+  phi->addIncoming(checkResult, it->second.second);
+  guards.erase(it);
+  return phi;
+}
@@ -1,6 +1,10 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO/CastSan.h"
 #include "llvm/Transforms/IPO/CastSanLayoutBuilder.h"
+#include "llvm/Transforms/IPO/CastSanCastProfile.h"
+#include "llvm/Transforms/IPO/CastSanCheckLowering.h"
+#include "llvm/Transforms/IPO/CastSanRemarks.h"
+#include "llvm/Transforms/IPO/CastSanSampling.h"
 #include "llvm/Transforms/IPO.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/IR/InstIterator.h"
@@ -16,6 +20,7 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/CallSite.h"
 #include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/CommandLine.h"
 
 #include "llvm/Transforms/IPO/CastSanLog.h"
 #include "llvm/Transforms/IPO/CastSanTools.h"
@@ -23,6 +28,9 @@
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Utils/HexTypeUtil.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/Timer.h"
 
 #include <list>
 #include <vector>
@@ -30,9 +38,24 @@
 #include <map>
 #include <math.h>
 #include <algorithm>
+#include <inttypes.h>
 #include <iostream>
 #include <limits>
 
+#define DEBUG_TYPE "castsan"
+
+STATISTIC(NumIndexSubst, "Number of vtable index substitutions");
+STATISTIC(NumVcallRangeChecks, "Number of vcall range checks");
+STATISTIC(NumVcallEqChecks, "Number of vcall eq checks");
+STATISTIC(NumVcallConstChecks, "Number of vcall checks folded to true");
+STATISTIC(NumMemberPtrIndices, "Number of member pointer indices translated");
+STATISTIC(NumRangeDescriptors, "Number of cross-DSO range descriptors");
+STATISTIC(NumCrossDSOSlowPaths, "Number of cross-DSO slow path checks");
+STATISTIC(NumCastChecks, "Number of cast checks");
+STATISTIC(NumCastChecksNoMD, "Number of cast checks without metadata");
+STATISTIC(NumInlinedCastChecks, "Number of cast checks inlined");
+STATISTIC(NumDynCastChecks, "Number of dynamic_cast range checks");
+
 // you have to modify the following 4 files for each additional LLVM pass
 // 1. include/llvm/IPO.h
 // 2. lib/Transforms/IPO/IPO.cpp
@@ -42,6 +65,10 @@
 
 using namespace llvm;
 
+static cl::opt<bool>
+SDInlineCastChecks("sd-inline-cast-checks", cl::init(false), cl::Hidden,
+                   cl::desc("Emit cast range checks as IR instead of runtime calls"));
+
 namespace {
   /**
    * Pass for updating the annotated instructions with the new indices
@@ -52,7 +79,7 @@ namespace {
   struct SDUpdateIndices : public ModulePass {
     static char ID; // Pass identification, replacement for typeid
 
-    SDUpdateIndices() : ModulePass(ID) {
+    SDUpdateIndices(bool crossDSO = false) : ModulePass(ID), crossDSO(crossDSO) {
       sd_print("initializing SDUpdateIndices pass\n");
       initializeSDUpdateIndicesPass(*PassRegistry::getPassRegistry());
     }
@@ -69,27 +96,59 @@ namespace {
       //Paul: second get the results from the class hierarchy analysis pass
       cha = &getAnalysis<SDBuildCHA>();
 
+      //picks the cheapest form of each vptr check (range, multi-range or bitset)
+      SDCheckLowering lowering(M);
+      checkLowering = &lowering;
+      crossDSOSlowPaths = 0;
+
       sd_print("\n P4. Started running the 4th pass (Update indices) ...\n");
 
-      //Paul: substitute the old v table index witht the new one
-      //Intrinsic::sd_get_vtbl_index -> Intrinsic::sd_subst_vtbl_index
-      handleSDGetVtblIndex(&M); 
- 
-      //Paul: adds the range check (casted_vptr, start, width, alingment)
-      //Intrinsic::sd_check_vtbl -> Intrinsic::sd_subst_check_range
-      handleSDCheckVtbl(&M);  
+      //Paul: the phases show up in -time-passes
+      {
+        NamedRegionTimer T("Update vtable indices", "CastSan", TimePassesIsEnabled);
+
+        //Paul: substitute the old v table index witht the new one
+        //Intrinsic::sd_get_vtbl_index -> Intrinsic::sd_subst_vtbl_index
+        handleSDGetVtblIndex(&M); 
+
+        //Paul: the same for the member pointers to virtual methods
+        //SD_MD_MPTR_TABLE placeholder -> new index
+        handleSDMemberPointers(M);
+      }
+
+      {
+        NamedRegionTimer T("Insert vptr checks", "CastSan", TimePassesIsEnabled);
 
-      //Paul: add the range checks, success, failed path, the trap and replace the terminator   
-      //Intrinsic::sd_get_checked_vptr ->  Intrinsic::sd_subst_check_range             
-      handleSDGetCheckedVtbl(&M);            
+        //Paul: adds the range check (casted_vptr, start, width, alingment)
+        //Intrinsic::sd_check_vtbl -> Intrinsic::sd_subst_check_range
+        handleSDCheckVtbl(&M);  
 
-      //Paul: this are for the additional v pointer which are not checked based on ranges 
-      //Intrinsic::sd_get_vcall_index -> null (there is no substitution function used here)
-      handleRemainingSDGetVcallIndex(&M);   
+        //Paul: add the range checks, success, failed path, the trap and replace the terminator   
+        //Intrinsic::sd_get_checked_vptr ->  Intrinsic::sd_subst_check_range             
+        handleSDGetCheckedVtbl(&M);            
 
-      handleCheckCast(M); 
+        //Paul: this are for the additional v pointer which are not checked based on ranges 
+        //Intrinsic::sd_get_vcall_index -> null (there is no substitution function used here)
+        handleRemainingSDGetVcallIndex(&M);   
+      }
+
+      {
+        NamedRegionTimer T("Insert cast checks", "CastSan", TimePassesIsEnabled);
+        handleCheckCast(M); 
+      }
+
+      //Paul: in cross-DSO mode, publish the ranges of this DSO to the runtime index
+      if (crossDSO)
+        emitRangeDescriptorTable(M);
+      NumCrossDSOSlowPaths += crossDSOSlowPaths;
+
+      checkLowering->printStatistics();
+      checkLowering = nullptr;
 
-      layoutBuilder->removeOldLayouts(M);    //Paul: remove old layouts
+      {
+        NamedRegionTimer T("Remove old vtables", "CastSan", TimePassesIsEnabled);
+        layoutBuilder->removeOldLayouts(M);    //Paul: remove old layouts
+      }
       layoutBuilder->clearAnalysisResults(); //Paul: clear all data structures holding analysis data
 
       sd_print("\n P4. Finished removing thunks from (Update indices) pass...\n");
@@ -107,13 +166,37 @@ namespace {
   private:
     SDLayoutBuilder* layoutBuilder;
     SDBuildCHA* cha;
+    SDCheckLowering* checkLowering;
+    bool crossDSO;                 // vptrs may point into the clouds of other DSOs
+    uint64_t crossDSOSlowPaths;
     
     // metadata ids
     void handleSDGetVtblIndex(Module* M);
+    void handleSDMemberPointers(Module& M);
     void handleSDCheckVtbl(Module* M);
     void handleSDGetCheckedVtbl(Module* M);
     void handleRemainingSDGetVcallIndex(Module* M);
     void handleCheckCast(Module & M);
+
+    /**
+     * Cross-DSO mode: call the runtime range index for the given vtable,
+     * returns an i1 that is true iff vptr is valid in any loaded DSO.
+     */
+    Value* emitCrossDSOCheck(IRBuilder<>& builder, Module* M, Value* vptr,
+                             const SDLayoutBuilder::vtbl_t& vtbl);
+
+    /**
+     * Cross-DSO mode: if the local check inRange in front of CI fails,
+     * ask the runtime index. Returns the combined result.
+     */
+    Value* addCrossDSOFallback(Module* M, CallInst* CI, Value* vptr, Value* inRange,
+                               const SDLayoutBuilder::vtbl_t& vtbl);
+
+    /**
+     * Cross-DSO mode: emit the range descriptors of all vtables of this
+     * module and register them with the runtime when the DSO is loaded.
+     */
+    void emitRangeDescriptorTable(Module& M);
   };
 }
 
@@ -121,51 +204,6 @@ namespace {
 /// SDUpdateIndices implementation, this are executed inside P4. Next, P5 is executed.
 /// ----------------------------------------------------------------------------
 
-static std::string sd_getClassNameFromMD(llvm::MDNode* mdNode, unsigned operandNo = 0) {
-//  llvm::MDTuple* mdTuple = dyn_cast<llvm::MDTuple>(mdNode);
-//  assert(mdTuple);
-
-  llvm::MDTuple* mdTuple = cast<llvm::MDTuple>(mdNode);
-  assert(mdTuple->getNumOperands() > operandNo + 1);
-
-//  llvm::MDNode* nameMdNode = dyn_cast<llvm::MDNode>(mdTuple->getOperand(operandNo).get());
-//  assert(nameMdNode);
-  llvm::MDNode* nameMdNode = cast<llvm::MDNode>(mdTuple->getOperand(operandNo).get());
-
-//  llvm::MDString* mdStr = dyn_cast<llvm::MDString>(nameMdNode->getOperand(0));
-//  assert(mdStr);
-  llvm::MDString* mdStr = cast<llvm::MDString>(nameMdNode->getOperand(0));
-
-  StringRef strRef = mdStr->getString();
-  assert(sd_isVtableName_ref(strRef));
-
-//  llvm::MDNode* gvMd = dyn_cast<llvm::MDNode>(mdTuple->getOperand(operandNo+1).get());
-  llvm::MDNode* gvMd = cast<llvm::MDNode>(mdTuple->getOperand(operandNo+1).get());
-
-//  SmallString<256> OutName;
-//  llvm::raw_svector_ostream Out(OutName);
-//  gvMd->print(Out, CURR_MODULE);
-//  Out.flush();
-
-  llvm::ConstantAsMetadata* vtblConsMd = dyn_cast_or_null<ConstantAsMetadata>(gvMd->getOperand(0).get());
-  if (vtblConsMd == NULL) {
-//    llvm::MDNode* tmpnode = dyn_cast<llvm::MDNode>(gvMd);
-//    llvm::MDString* tmpstr = dyn_cast<llvm::MDString>(tmpnode->getOperand(0));
-//    assert(tmpstr->getString() == "NO_VTABLE");
-
-    return strRef.str();
-  }
-
-//  llvm::GlobalVariable* vtbl = dyn_cast<llvm::GlobalVariable>(vtblConsMd->getValue());
-//  assert(vtbl);
-  llvm::GlobalVariable* vtbl = cast<llvm::GlobalVariable>(vtblConsMd->getValue());
-
-  StringRef vtblNameRef = vtbl->getName();
-  assert(vtblNameRef.startswith(strRef));
-
-  return vtblNameRef.str();
-}
-
 //Paul: this returns the v table index and puts it in a function 
 // it uses this functions to get the old v table index and to substitute it 
 //Intrinsic::sd_get_vtbl_index -> Intrinsic::sd_subst_vtbl_index
@@ -233,12 +271,53 @@ void SDUpdateIndices::handleSDGetVtblIndex(Module* M) {
   }
 }
 
-//Paul: this is used for the in-place sort operation 
-struct range_less_than_key {
-  inline bool operator()(const SDLayoutBuilder::mem_range_t &r1, const SDLayoutBuilder::mem_range_t &r2) {
-    return r1.second > r2.second; // Invert sign to sort in descending order
+//Paul: the member pointers to virtual methods hold the address of a
+//placeholder instead of the vtable index, see sd_rewriteMemberPointers()
+//in CodeGenModule.cpp. Every row of the table is translated once and the
+//placeholder is replaced everywhere, so the member pointers become
+//constants again before the LTO optimizations run.
+void SDUpdateIndices::handleSDMemberPointers(Module& M) {
+  NamedMDNode* table = M.getNamedMetadata(SD_MD_MPTR_TABLE);
+  if (!table)
+    return;
+
+  Type* intType = IntegerType::getInt64Ty(M.getContext());
+  uint64_t translated = 0;
+
+  // collect the rows first, replacing a placeholder changes them
+  std::vector<std::pair<GlobalVariable*, int64_t> > rows;
+  for (unsigned i = 0; i < table->getNumOperands(); i++) {
+    MDNode* row = table->getOperand(i);
+    assert(row->getNumOperands() == 3);
+
+    // GlobalDCE deletes the placeholders of member pointers that are not used
+    auto* placeholderMD = dyn_cast_or_null<ConstantAsMetadata>(row->getOperand(0).get());
+    if (!placeholderMD)
+      continue;
+    GlobalVariable* placeholder = dyn_cast<GlobalVariable>(placeholderMD->getValue());
+    if (!placeholder)
+      continue;
+
+    std::string className = sd_getClassNameFromMD(cast<MDNode>(row->getOperand(1).get()), 0);
+    int64_t oldIndex = mdconst::extract<ConstantInt>(row->getOperand(2))->getSExtValue();
+
+    SDLayoutBuilder::vtbl_t classVtbl(className, 0);
+    int64_t newIndex = layoutBuilder->translateVtblInd(classVtbl, oldIndex, true);
+    rows.push_back(std::make_pair(placeholder, newIndex));
+  }
+
+  for (auto& row : rows) {
+    GlobalVariable* placeholder = row.first;
+    Constant* newIndex = ConstantInt::get(intType, row.second);
+    placeholder->replaceAllUsesWith(ConstantExpr::getIntToPtr(newIndex, placeholder->getType()));
+    placeholder->eraseFromParent();
+    translated++;
   }
-};
+
+  table->eraseFromParent();
+  sd_print("P4. translated %lu member pointer indices \n", translated);
+  NumMemberPtrIndices += translated;
+}
 
 //Paul: adds the range check (casted_vptr, start, width, alingment)
 //add check v table and check v table range 
@@ -327,10 +406,50 @@ void SDUpdateIndices::handleSDCheckVtbl(Module* M) {
       } 
     }
 
+    LLVMContext& C = CI->getContext();
+
+    // the coalesced ranges are precise even for non-primary vtables,
+    // whose valid vptrs do not form a single range
+    if (layoutBuilder->hasMemRange(vtbl)) {
+      if(!cha->hasAncestor(vtbl)) {
+        sd_print("%s\n", vtbl.first.data());
+        assert(false);
+      }
+
+      SDLayoutBuilder::vtbl_name_t root = cha->getAncestor(vtbl);
+      assert(layoutBuilder->alignmentMap.count(root));
+
+      SDCheckLowering::check_plan_t plan =
+        checkLowering->plan(layoutBuilder->getMemRange(vtbl), layoutBuilder->alignmentMap[root]);
+
+      sd_print(" [%s check over %zu range(s), cost = %" PRIu64 "]  \n",
+               SDCheckLowering::kindName(plan.kind), plan.ranges.size(), plan.cost);
+
+      //Paul: the range forms are recorded when P5 lowers them
+      if (plan.kind == SDCheckLowering::CK_INLINE_BITSET ||
+          plan.kind == SDCheckLowering::CK_MEM_BITSET) {
+        uint64_t validVptrs = 0;
+        for (const SDCheckLowering::mem_range_t& range : plan.ranges)
+          validVptrs += range.second;
+        sd_emitRemark(SD_REMARK_ANALYSIS, "BitsetCheck", CI, "vcall", vtbl.first,
+                      validVptrs, SDCheckLowering::kindName(plan.kind));
+      }
+
+      IRBuilder<> builder(CI);
+      llvm::Value* inRange = checkLowering->emit(builder, vptr, plan);
+
+      if (crossDSO)
+        inRange = addCrossDSOFallback(M, CI, vptr, inRange, vtbl);
+
+      CI->replaceAllUsesWith(inRange);
+      CI->eraseFromParent();
+      continue;
+    }
+
     //Paul: calculate the start address of the new v table
     if (cha->knowsAbout(vtbl) &&
        (!cha->isUndefined(vtbl) || cha->hasFirstDefinedChild(vtbl))) {
-      
+
       // calculate the new index
       start = cha->isUndefined(vtbl) ?
         layoutBuilder->getVTableRangeStart(cha->getFirstDefinedChild(vtbl)) : //Paul: first child or first v table
@@ -350,16 +469,16 @@ void SDUpdateIndices::handleSDCheckVtbl(Module* M) {
       rangeWidth = 0;
       //std::cerr << "Emitting empty range for " << vtbl.first << "," << vtbl.second << "\n";
       sd_print(" [ no metadata available ] \n");
+      sd_emitRemark(SD_REMARK_MISSED, "NoMetadata", CI, "vcall", vtbl.first,
+                    -1, crossDSO ? "cross-dso" : "");
     }
 
-    LLVMContext& C = CI->getContext();
-    
     //Paul: the start variable is not NULL
     if (start) {
       IRBuilder<> builder(CI);
       builder.SetInsertPoint(CI);//Paul: used to specifi insertion points
 
-      std::cerr << "llvm.sd.callsite.range:" << rangeWidth << std::endl;
+      DEBUG(dbgs() << "llvm.sd.callsite.range:" << rangeWidth << "\n");
         
       // The shift here is implicit since rangeWidth is in terms of indices, not bytes
       llvm::Value *width    = llvm::ConstantInt::get(IntPtrTy, rangeWidth); //rangeWidth is here 0
@@ -381,11 +500,23 @@ void SDUpdateIndices::handleSDCheckVtbl(Module* M) {
       //we will be calling the function sd_subst_check_range witht the parameters, Args  
       llvm::Value* newIntr = builder.CreateCall(Intrinsic::getDeclaration(M, Intrinsic::sd_subst_check_range), Args);
 
+      if (crossDSO)
+        newIntr = addCrossDSOFallback(M, CI, vptr, newIntr, vtbl);
+
       CI->replaceAllUsesWith(newIntr); //Paul: add a new call instruction with rangeWidth = 0 
       CI->eraseFromParent();
 
     } else { //Paul: if start == NULL
-      std::cerr << "llvm.sd.callsite.false:" << vtbl.first << "," << vtbl.second << std::endl;
+      DEBUG(dbgs() << "llvm.sd.callsite.false:" << vtbl.first << "," << vtbl.second << "\n");
+
+      // the class may be defined in another DSO
+      if (crossDSO) {
+        IRBuilder<> builder(CI);
+        CI->replaceAllUsesWith(emitCrossDSOCheck(builder, M, vptr, vtbl));
+        CI->eraseFromParent();
+        continue;
+      }
+
       CI->replaceAllUsesWith(llvm::ConstantInt::getFalse(C));
       CI->eraseFromParent();
     }
@@ -500,14 +631,8 @@ void SDUpdateIndices::handleSDGetCheckedVtbl(Module* M) {
       SDLayoutBuilder::vtbl_name_t root = cha->getAncestor(vtbl);
       assert(layoutBuilder->alignmentMap.count(root));
 
-      //determine the alignment value 
-      llvm::Constant* alignment = llvm::ConstantInt::get(IntPtrTy, layoutBuilder->alignmentMap[root]);
-      
-      int i = 0;
-
       //notice a v table can have multiple ranges 
-      std::vector<SDLayoutBuilder::mem_range_t> ranges(layoutBuilder->getMemRange(vtbl));
-      std::sort(ranges.begin(), ranges.end(), range_less_than_key()); //Paul: sort the elements in the range 
+      const std::vector<SDLayoutBuilder::mem_range_t>& ranges = layoutBuilder->getMemRange(vtbl);
 
       uint64_t sum = 0;
       //Paul: iterate throught the ranges and compute width 
@@ -515,70 +640,55 @@ void SDUpdateIndices::handleSDGetCheckedVtbl(Module* M) {
       for (auto rangeIt : ranges) {
         sum += rangeIt.second; //Paul: compute the width of the range 
       }
-      
+
+      //pick the cheapest check covering all ranges
+      SDCheckLowering::check_plan_t plan =
+        checkLowering->plan(ranges, layoutBuilder->alignmentMap[root]);
+
       //printing some statistics 
-      sd_print("For vTable: {%s , %d } emitting: %d range check(s) with total width of the ranges: %d \n", 
+      sd_print("For vTable: {%s , %" PRIu64 " } emitting: %s check for %zu range(s) with total width of the ranges: %" PRIu64 " (cost = %" PRIu64 ")\n", 
                                        vtbl.first.c_str(), 
                                        vtbl.second, 
+                                       SDCheckLowering::kindName(plan.kind),
                                        ranges.size(), 
-                                       sum);
-  
-      //Paul: iterate throught the ranges for one v table at a time 
-      for (auto rangeIt : ranges) {
-        llvm::Value *start = rangeIt.first;
-        llvm::Value *width = llvm::ConstantInt::get(IntPtrTy, rangeIt.second);
-        llvm::Value *Args[] = {castVptr, start, width, alignment};
-   
-        //Paul: create the fast path success, this Intrinsic::sd_subst_check_range function
-        // was previously added during code generation 
-        //create a call to named fast path success 
-        llvm::Value* fastPathSuccess = builder.CreateCall(Intrinsic::getDeclaration(M,
-                                                     Intrinsic::sd_subst_check_range),
-                                                                                Args);
-
-        char blockName[256];
-        
-        //give a name to the failed block and attach an increment value to it, i
-        snprintf(blockName, sizeof(blockName), "sd.fastcheck.fail.%d", i);
+                                       sum,
+                                       plan.cost);
 
-        //Paul: create the fast path check failed block 
-        //F is the parent block of the current instructon block making the call to Intrinsic::sd_get_checked_vptr
-        llvm::BasicBlock *fastCheckFailed = llvm::BasicBlock::Create(F->getContext(), blockName, F);
-        
-        //Paul: create the the conditional branch and add fast path success Call, success BB and fast check failed BB
-        llvm::BranchInst *BI = builder.CreateCondBr(fastPathSuccess, SuccessBB, fastCheckFailed);
-        llvm::MDBuilder MDB(BI->getContext());
-
-        //Paul: set the branch weights 
-        BI->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(
-                                              std::numeric_limits<uint32_t>::max(),
-                                              std::numeric_limits<uint32_t>::min()));
-
-        //Paul: set the insertion point 
-        builder.SetInsertPoint(fastCheckFailed); //Paul: builder set the insertion point
-        i++;
-      }
+      //Paul: create the fast path success
+      llvm::Value* fastPathSuccess = checkLowering->emit(builder, castVptr, plan);
+
+      //Paul: create the fast path check failed block 
+      //F is the parent block of the current instructon block making the call to Intrinsic::sd_get_checked_vptr
+      llvm::BasicBlock *fastCheckFailed = llvm::BasicBlock::Create(F->getContext(), "sd.fastcheck.fail.0", F);
+
+      //Paul: create the the conditional branch and add fast path success Call, success BB and fast check failed BB
+      llvm::BranchInst *BI = builder.CreateCondBr(fastPathSuccess, SuccessBB, fastCheckFailed);
+      llvm::MDBuilder MDB(BI->getContext());
+
+      //Paul: set the branch weights 
+      BI->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(
+                                            std::numeric_limits<uint32_t>::max(),
+                                            std::numeric_limits<uint32_t>::min()));
+
+      //Paul: set the insertion point 
+      builder.SetInsertPoint(fastCheckFailed); //Paul: builder set the insertion point
+    }
+
+    //Paul: slow path, the vptr may point into the cloud of another DSO.
+    //This replaces the old _vptr_safe slow path.
+    if (crossDSO) {
+      llvm::BasicBlock *checkFailed = llvm::BasicBlock::Create(F->getContext(), "sd.check.fail", F);
+      llvm::Value* slowPathSuccess = emitCrossDSOCheck(builder, M, castVptr, vtbl);
+
+      BranchInst *BI = builder.CreateCondBr(slowPathSuccess, SuccessBB, checkFailed);
+      llvm::MDBuilder MDB(BI->getContext());
+      BI->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(
+        std::numeric_limits<uint32_t>::max(),
+        std::numeric_limits<uint32_t>::min()));
+
+      builder.SetInsertPoint(checkFailed);
     }
 
-    /*
-    llvm::BasicBlock *checkFailed = llvm::BasicBlock::Create(F->getContext(), "sd.check.fail", F);
-    llvm::Type* argTs[] = { Int8PtrTy, Int8PtrTy };
-    llvm::FunctionType *vptr_safeT = llvm::FunctionType::get(llvm::Type::getInt1Ty(C), argTs, false);
-    llvm::Constant *vptr_safeF = M->getOrInsertFunction("_Z9vptr_safePKvPKc", vptr_safeT);
-    llvm::Value* slowPathSuccess = builder.CreateCall2(
-                vptr_safeF,
-                castVptr,
-                builder.CreateGlobalStringPtr(className));
-                // TODO: Add dynamic class name to _vptr_safe as well
-
-    BranchInst *BI = builder.CreateCondBr(slowPathSuccess, SuccessBB, checkFailed);
-    llvm::MDBuilder MDB(BI->getContext());
-    BI->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(
-      std::numeric_limits<uint32_t>::max(),
-      std::numeric_limits<uint32_t>::min()));
-
-    builder.SetInsertPoint(checkFailed);
-    */
     // Insert Check Failure
     builder.CreateCall(Intrinsic::getDeclaration(M, Intrinsic::trap)); //Paul: insert the check failure trap 
    
@@ -592,6 +702,152 @@ void SDUpdateIndices::handleSDGetCheckedVtbl(Module* M) {
   } //end of all uses for loop.
 }
 
+/**
+ * Key of a (vtable, sub-vtable index) in the cross-DSO range index. It has
+ * to be the same in every DSO, so this is FNV-1a over the mangled vtable
+ * name and the index.
+ */
+static uint64_t sd_crossDSOClassHash(const SDLayoutBuilder::vtbl_t& vtbl) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (char c : vtbl.first) {
+    hash ^= (uint8_t) c;
+    hash *= 1099511628211ULL;
+  }
+  hash ^= vtbl.second;
+  hash *= 1099511628211ULL;
+  return hash;
+}
+
+Value* SDUpdateIndices::emitCrossDSOCheck(IRBuilder<>& builder, Module* M, Value* vptr,
+                                          const SDLayoutBuilder::vtbl_t& vtbl) {
+  LLVMContext& C = M->getContext();
+  Type* Int8PtrTy = IntegerType::getInt8PtrTy(C);
+  Type* Int64Ty = Type::getInt64Ty(C);
+  Type* Int32Ty = Type::getInt32Ty(C);
+
+  // int __sd_cross_dso_check(const void* vptr, uint64_t classHash), see libdyncast/cross_dso.cpp
+  Type* argTs[] = { Int8PtrTy, Int64Ty };
+  FunctionType* checkT = FunctionType::get(Int32Ty, argTs, false);
+  Constant* checkF = M->getOrInsertFunction("__sd_cross_dso_check", checkT);
+
+  Value* args[] = { builder.CreateBitCast(vptr, Int8PtrTy),
+                    ConstantInt::get(Int64Ty, sd_crossDSOClassHash(vtbl)) };
+  Value* res = builder.CreateCall(checkF, args);
+
+  crossDSOSlowPaths++;
+  return builder.CreateICmpNE(res, ConstantInt::get(Int32Ty, 0));
+}
+
+Value* SDUpdateIndices::addCrossDSOFallback(Module* M, CallInst* CI, Value* vptr, Value* inRange,
+                                            const SDLayoutBuilder::vtbl_t& vtbl) {
+  LLVMContext& C = M->getContext();
+  BasicBlock* BB = CI->getParent();
+  Function* F = BB->getParent();
+
+  // BB: local check -> cont or slow, slow: runtime index -> cont
+  BasicBlock* contBB = BB->splitBasicBlock(CI, "sd.cross_dso.cont");
+  BasicBlock* slowBB = BasicBlock::Create(C, "sd.cross_dso.check", F, contBB);
+
+  Instruction* oldTerminator = BB->getTerminator();
+  IRBuilder<> builder(oldTerminator);
+  BranchInst* BI = builder.CreateCondBr(inRange, contBB, slowBB);
+  MDBuilder MDB(C);
+  BI->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(
+                                        std::numeric_limits<uint32_t>::max(),
+                                        std::numeric_limits<uint32_t>::min()));
+  oldTerminator->eraseFromParent();
+
+  builder.SetInsertPoint(slowBB);
+  Value* slowRes = emitCrossDSOCheck(builder, M, vptr, vtbl);
+  builder.CreateBr(contBB);
+
+  builder.SetInsertPoint(&contBB->front());
+  PHINode* res = builder.CreatePHI(Type::getInt1Ty(C), 2);
+  res->addIncoming(ConstantInt::getTrue(C), BB);
+  res->addIncoming(slowRes, slowBB);
+  return res;
+}
+
+/*Paul:
+one descriptor per coalesced range of each vtable in this module:
+  { uint64_t classHash; uint64_t start; uint32_t width; uint32_t alignShift; }
+(struct __sd_range_desc in libdyncast/cross_dso.cpp). A constructor hands
+the table to the runtime when the DSO is loaded, a destructor takes it back.
+*/
+void SDUpdateIndices::emitRangeDescriptorTable(Module& M) {
+  LLVMContext& C = M.getContext();
+  Type* Int8PtrTy = IntegerType::getInt8PtrTy(C);
+  Type* Int64Ty = Type::getInt64Ty(C);
+  Type* Int32Ty = Type::getInt32Ty(C);
+  Type* VoidTy = Type::getVoidTy(C);
+
+  Type* descFields[] = { Int64Ty, Int64Ty, Int32Ty, Int32Ty };
+  StructType* descTy = StructType::get(C, makeArrayRef(descFields));
+
+  std::vector<Constant*> descs;
+  for (auto& it : layoutBuilder->memRangeMap) {
+    const SDLayoutBuilder::vtbl_t& vtbl = it.first;
+    if (!cha->hasAncestor(vtbl))
+      continue;
+
+    SDLayoutBuilder::vtbl_name_t root = cha->getAncestor(vtbl);
+    assert(layoutBuilder->alignmentMap.count(root));
+    uint64_t alignment = layoutBuilder->alignmentMap[root];
+    uint32_t alignShift = 0;
+    while ((1ULL << alignShift) < alignment)
+      alignShift++;
+
+    uint64_t hash = sd_crossDSOClassHash(vtbl);
+    for (const SDLayoutBuilder::mem_range_t& r : it.second) {
+      Constant* fields[] = { ConstantInt::get(Int64Ty, hash),
+                             ConstantExpr::getZExtOrBitCast(r.first, Int64Ty),
+                             ConstantInt::get(Int32Ty, r.second),
+                             ConstantInt::get(Int32Ty, alignShift) };
+      descs.push_back(ConstantStruct::get(descTy, fields));
+    }
+  }
+
+  if (descs.empty())
+    return;
+
+  ArrayType* tableTy = ArrayType::get(descTy, descs.size());
+  GlobalVariable* table = new GlobalVariable(M, tableTy, true, GlobalValue::PrivateLinkage,
+                                             ConstantArray::get(tableTy, descs), "sd.range_table");
+  Constant* tablePtr = ConstantExpr::getBitCast(table, Int8PtrTy);
+
+  // void __sd_register_ranges(const __sd_range_desc*, uint64_t)
+  Type* regArgTs[] = { Int8PtrTy, Int64Ty };
+  Constant* registerF = M.getOrInsertFunction("__sd_register_ranges",
+                                              FunctionType::get(VoidTy, regArgTs, false));
+  // void __sd_unregister_ranges(const __sd_range_desc*)
+  Type* unregArgTs[] = { Int8PtrTy };
+  Constant* unregisterF = M.getOrInsertFunction("__sd_unregister_ranges",
+                                                FunctionType::get(VoidTy, unregArgTs, false));
+
+  FunctionType* ctorT = FunctionType::get(VoidTy, false);
+
+  Function* ctor = Function::Create(ctorT, GlobalValue::InternalLinkage, "sd.register_range_table", &M);
+  IRBuilder<> builder(BasicBlock::Create(C, "entry", ctor));
+  Value* regArgs[] = { tablePtr, ConstantInt::get(Int64Ty, descs.size()) };
+  builder.CreateCall(registerF, regArgs);
+  builder.CreateRetVoid();
+  // before any other constructor can make a virtual call
+  appendToGlobalCtors(M, ctor, 0);
+
+  Function* dtor = Function::Create(ctorT, GlobalValue::InternalLinkage, "sd.unregister_range_table", &M);
+  builder.SetInsertPoint(BasicBlock::Create(C, "entry", dtor));
+  Value* unregArgs[] = { tablePtr };
+  builder.CreateCall(unregisterF, unregArgs);
+  builder.CreateRetVoid();
+  appendToGlobalDtors(M, dtor, 0);
+
+  sd_print("\n ---cross-DSO--- \n");
+  sd_print(" range descriptors: %lu (%lu bytes) \n", descs.size(),
+           descs.size() * M.getDataLayout().getTypeAllocSize(descTy));
+  sd_print(" slow path checks: %lu \n", crossDSOSlowPaths);
+  NumRangeDescriptors += descs.size();
+}
+
 //Paul: read the v call index and add replace all uses with this new value 
 //it uses: 
 // Intrinsic::sd_get_vcall_index -> null 
@@ -626,10 +882,17 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
   auto Int64Ty = Type::getInt64Ty(C);
   auto Int8Ty = Type::getInt8Ty(C);
   Type *IntPtrTy = DL.getIntPtrType(C, 0);
+  uint64_t inlinedCastChecks = 0;
+  SDCastProfile profile(M, cast_info);
+  SDCastSampler sampler(M);
 
   if(cast_info) {
-  for(const Use & U : cast_info->uses()) {
-    llvm::CallInst * CI = cast<CallInst>(U.getUser());
+  //Paul: collect the calls first, the profile counters are put in front of them
+  std::vector<llvm::CallInst*> castInfos;
+  for (const Use &U : cast_info->uses())
+    castInfos.push_back(cast<CallInst>(U.getUser()));
+
+  for (llvm::CallInst* CI : castInfos) {
  
     // get the VTable Base Class Metadata
     llvm::MetadataAsValue* arg1 = dyn_cast<MetadataAsValue>(CI->getArgOperand(0));
@@ -653,7 +916,7 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
     llvm::Value* vptr = CI->getArgOperand(2);
     assert(vptr);
 
-    std::cerr << "CastCheck: Checking cast to: " << preciseClassName << " using VTable with root: " << vBaseClassName << std::endl;
+    DEBUG(dbgs() << "CastCheck: Checking cast to: " << preciseClassName << " using VTable with root: " << vBaseClassName << "\n");
 
     // get VTable info from CastSan
     // first the vtable we want to add the range check in
@@ -666,7 +929,7 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
     if (cha->knowsAbout(vtbl)) {
       if (preciseClassName != vBaseClassName) {
         int64_t ind = cha->getSubVTableIndex(preciseClassName, vBaseClassName);
-        std::cerr << "CastCheck: Index = " << ind << std::endl;
+        DEBUG(dbgs() << "CastCheck: Index = " << ind << "\n");
         if (ind != -1) {
           vtbl = SDLayoutBuilder::vtbl_t(preciseClassName, ind);
         }
@@ -674,7 +937,7 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
     }
     else
     {
-      std::cerr << "CastCheck: cha does not know about vtbl :(" << std::endl;
+      DEBUG(dbgs() << "CastCheck: cha does not know about vtbl :(\n");
     }
 
     // the following is mainly the same as handleSDCheckVtbl() above:
@@ -688,12 +951,16 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
         layoutBuilder->getVTableRangeStart(vtbl);
       
       rangeWidth = cha->getCloudSize(vtbl.first);
-      std::cerr << "CastCheck: [rangeWidth = " << rangeWidth << " start = " << start << "] " << std::endl;
+      DEBUG(dbgs() << "CastCheck: [rangeWidth = " << rangeWidth << " start = " << start << "] \n");
     } else {
       start = NULL;
       rangeWidth = 0;
-      std::cerr << "CastCheck: [ no metadata available ] " << std::endl;
+      DEBUG(dbgs() << "CastCheck: [ no metadata available ] \n");
+      NumCastChecksNoMD++;
+      //Paul: such a cast always fails the check
+      sd_emitRemark(SD_REMARK_MISSED, "NoMetadata", CI, "cast", preciseClassName);
     }
+    NumCastChecks++;
 
     LLVMContext& C = CI->getContext();
     
@@ -701,19 +968,39 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
       IRBuilder<> builder(CI);
       builder.SetInsertPoint(CI);
         
-      llvm::Value *width    = llvm::ConstantInt::get(IntPtrTy, rangeWidth);
       llvm::Type *Int8PtrTy = IntegerType::getInt8PtrTy(C);
       llvm::Value *castVptr = builder.CreateBitCast(vptr, Int8PtrTy); 
 
       // we do not have the root of the VTable: break up.
       if(!cha->hasAncestor(vtbl)) {
-        std::cerr << vtbl.first.data() << std::endl;
+        errs() << vtbl.first.data() << "\n";
         assert(false);
       }
 
       SDLayoutBuilder::vtbl_name_t root = cha->getAncestor(vtbl);
       assert(layoutBuilder->alignmentMap.count(root));
 
+      //Paul: the coalesced ranges of the layout, as for the vcall checks. The
+      //cloud size range above is only exact if the subtree is one range. A
+      //single range keeps the checks below, several ranges or a bitset can
+      //only be checked inline, the runtime takes one range.
+      bool lowerCheck = false;
+      SDCheckLowering::check_plan_t plan;
+      if (layoutBuilder->hasMemRange(vtbl)) {
+        plan = checkLowering->plan(layoutBuilder->getMemRange(vtbl),
+                                   layoutBuilder->alignmentMap[root]);
+        if (plan.kind == SDCheckLowering::CK_EQ || plan.kind == SDCheckLowering::CK_ROTATE) {
+          start = plan.ranges[0].first;
+          rangeWidth = plan.ranges[0].second;
+        } else {
+          lowerCheck = true;
+        }
+        DEBUG(dbgs() << "CastCheck: " << SDCheckLowering::kindName(plan.kind) << " check for "
+                     << plan.ranges.size() << " range(s)\n");
+      }
+
+      llvm::Value *width    = llvm::ConstantInt::get(IntPtrTy, rangeWidth);
+
       int64_t alignmentBits = floor(log(layoutBuilder->alignmentMap[root] + 0.5)/log(2.0));
       llvm::Constant* alignment = llvm::ConstantInt::get(IntPtrTy, alignmentBits);
       llvm::Constant* alignment_r = llvm::ConstantInt::get(IntPtrTy, DL.getPointerSizeInBits(0) - alignmentBits);
@@ -722,12 +1009,76 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
       llvm::GlobalVariable* rootVtbl = dyn_cast<llvm::GlobalVariable>(rootVtblInt->getOperand(0));
       llvm::ConstantInt* startOff    = dyn_cast<llvm::ConstantInt>(start->getOperand(1));
 
-      std::cerr << "CastCheck: Putting subst_cast_check in!" << std::endl;
+      DEBUG(dbgs() << "CastCheck: Putting subst_cast_check in!\n");
       
-      if (validConstVptr(rootVtbl, startOff->getSExtValue(), rangeWidth, DL, castVptr, 0)) {
-	      
+      //Paul: P5 folds the range checks of a lowered check with a constant vptr
+      if (!lowerCheck &&
+          validConstVptr(rootVtbl, startOff->getSExtValue(), rangeWidth, DL, castVptr, 0)) {
+	      sd_emitRemark(SD_REMARK_PASSED, "ConstFolded", CI, "cast", preciseClassName, rangeWidth);
 	      CI->replaceAllUsesWith(llvm::ConstantInt::getTrue(C));
 	      CI->eraseFromParent();
+	      continue;
+      }
+
+      profile.emitCounter(CI);
+      builder.SetInsertPoint(CI);
+
+      //Paul: with a cast profile hot sites are inlined and cold ones call
+      //the runtime, whatever -sd-inline-cast-checks says. Lowered checks
+      //are always inline, the profile has nothing to place there.
+      SDCastProfile::placement_t placement =
+	      lowerCheck ? SDCastProfile::CP_DEFAULT : profile.place(CI);
+      bool inlineCheck = SDInlineCastChecks;
+      if (placement == SDCastProfile::CP_INLINE)
+	      inlineCheck = true;
+      else if (placement == SDCastProfile::CP_OUTLINE)
+	      inlineCheck = false;
+
+      //Paul: the sites the profile knows to be cold are checked every time
+      if (placement != SDCastProfile::CP_OUTLINE)
+	      builder.SetInsertPoint(sampler.guard(CI));
+
+      if (lowerCheck) {
+	      //Paul: the range forms are recorded when P5 lowers them
+	      if (plan.kind == SDCheckLowering::CK_INLINE_BITSET ||
+	          plan.kind == SDCheckLowering::CK_MEM_BITSET) {
+		      uint64_t validVptrs = 0;
+		      for (const SDCheckLowering::mem_range_t& range : plan.ranges)
+			      validVptrs += range.second;
+		      sd_emitRemark(SD_REMARK_ANALYSIS, "BitsetCheck", CI, "cast", preciseClassName,
+		                    validVptrs, SDCheckLowering::kindName(plan.kind));
+	      }
+	      llvm::Value *inRange = checkLowering->emit(builder, castVptr, plan);
+	      llvm::Value *result = sampler.merge(CI, inRange);
+	      CI->replaceAllUsesWith(result);
+	      CI->eraseFromParent();
+	      inlinedCastChecks++;
+      } else if (inlineCheck) {
+	      //Paul: the rotate-compare of __type_casting_verification_ranged as
+	      //plain IR. A loop that checks every element of an array is then
+	      //straight-line arithmetic the loop vectorizer can widen, as long as
+	      //it does not branch to the trap per element.
+	      llvm::Value *vptrInt = builder.CreatePtrToInt(castVptr, IntPtrTy);
+	      llvm::Value *inRange;
+	      if (rangeWidth > 1) {
+		      llvm::Value *diff = builder.CreateSub(vptrInt, start);
+		      llvm::Value *diffRor = diff;
+		      if (alignmentBits > 0) {
+			      llvm::Value *diffShr = builder.CreateLShr(diff, alignmentBits);
+			      llvm::Value *diffShl = builder.CreateShl(diff, DL.getPointerSizeInBits(0) - alignmentBits);
+			      diffRor = builder.CreateOr(diffShr, diffShl);
+		      }
+		      inRange = builder.CreateICmpULT(diffRor, width);
+	      } else {
+		      inRange = builder.CreateICmpEQ(vptrInt, start);
+	      }
+
+	      sd_emitRemark(SD_REMARK_ANALYSIS, rangeWidth > 1 ? "RangeCheck" : "EqCheck", CI,
+	                    "cast", preciseClassName, rangeWidth, "inline");
+	      llvm::Value *result = sampler.merge(CI, inRange);
+	      CI->replaceAllUsesWith(result);
+	      CI->eraseFromParent();
+	      inlinedCastChecks++;
       } else if (rangeWidth > 1) {
 	      llvm::Value *Args[] = {start, width, alignment, alignment_r, castVptr};
 	      Function *castCheckFunction =
@@ -736,7 +1087,8 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
 			      Int64Ty, Int64Ty, Int64Ty, Int64Ty, Int8PtrTy, nullptr);
 	      llvm::Value* newIntrCast = builder.CreateCall(castCheckFunction, Args);
 	      
-	      CI->replaceAllUsesWith(newIntrCast);
+	      sd_emitRemark(SD_REMARK_ANALYSIS, "RangeCheck", CI, "cast", preciseClassName, rangeWidth, "call");
+	      CI->replaceAllUsesWith(sampler.merge(CI, newIntrCast));
 	      CI->eraseFromParent();
       } else {
 	      llvm::Value *Args[] = {start, castVptr};
@@ -745,36 +1097,13 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
 			      "__type_casting_verification_equal", BoolTy,
 			      Int64Ty, Int8PtrTy, nullptr);
 	      llvm::Value* newIntrCast = builder.CreateCall(castCheckFunction, Args);
-	      CI->replaceAllUsesWith(newIntrCast);
+	      sd_emitRemark(SD_REMARK_ANALYSIS, "EqCheck", CI, "cast", preciseClassName, rangeWidth, "call");
+	      CI->replaceAllUsesWith(sampler.merge(CI, newIntrCast));
 	      CI->eraseFromParent();
       }
-      /*if (rangeWidth > 1) {
-        // The shift here is implicit since rangeWidth is in terms of indices, not bytes
-
-        // Rotate right by 3 to push the lowest order bits into the higher order bits
-        llvm::Value *vptrInt = builder.CreatePtrToInt(castVptr, IntPtrTy);
-        llvm::Value *startInt = builder.CreatePtrToInt(start, IntegerType::getInt64Ty(C));
-
-        llvm::Value *diff = builder.CreateSub(vptrInt, startInt);
-        llvm::Value *diffShr = builder.CreateLShr(diff, 3);
-        llvm::Value *diffShl = builder.CreateShl(diff, DL.getPointerSizeInBits(0) - 3);
-        llvm::Value *diffRor = builder.CreateOr(diffShr, diffShl);
-
-        llvm::Value *inRange = builder.CreateICmpULE(diffRor, width);
-          
-        CI->replaceAllUsesWith(inRange);
-        CI->eraseFromParent();
-      } else {
-        llvm::Value *startInt = builder.CreatePtrToInt(start, IntegerType::getInt64Ty(C));
-        llvm::Value *vptrInt = builder.CreatePtrToInt(castVptr, IntPtrTy);
-        llvm::Value *inRange = builder.CreateICmpEQ(vptrInt, startInt);
-
-        CI->replaceAllUsesWith(inRange);
-        CI->eraseFromParent();
-      }*/
 
     } else {
-	    std::cerr << "CastCheck: llvm.sd.callsite.false:" << vtbl.first << "," << vtbl.second << std::endl;
+	    DEBUG(dbgs() << "CastCheck: llvm.sd.callsite.false:" << vtbl.first << "," << vtbl.second << "\n");
 	    CI->replaceAllUsesWith(llvm::ConstantInt::getFalse(C));
 	    CI->eraseFromParent();
     }
@@ -788,8 +1117,12 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
   
   Function * subst_dynamic_castF = M.getFunction("__dynamic_casting_verification");
   if (subst_dynamic_castF) {
-	  for (const Use &U : subst_dynamic_castF->uses()) {
-		  llvm::CallInst* CI = cast<CallInst>(U.getUser());
+	  //Paul: collect the calls first, most of them are replaced below
+	  std::vector<llvm::CallInst*> dynCasts;
+	  for (const Use &U : subst_dynamic_castF->uses())
+		  dynCasts.push_back(cast<CallInst>(U.getUser()));
+
+	  for (llvm::CallInst* CI : dynCasts) {
 		  IRBuilder<> builder(CI);
 		  
 		  ConstantInt * ConstDstTypeHash = dyn_cast<ConstantInt>(CI->getArgOperand(2));
@@ -804,7 +1137,7 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
 		  auto DstMangledName = DstType.MangledName;
 		  auto SrcMangledName = SrcType.MangledName;
 
-		  std::cerr << "Cast from " << SrcMangledName << " to " << DstMangledName << std::endl;
+		  DEBUG(dbgs() << "Cast from " << SrcMangledName << " to " << DstMangledName << "\n");
 		  
 		  assert (DstType.Polymorphic && SrcType.Polymorphic && "Dynamic cast is not possible");
 		  
@@ -836,7 +1169,7 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
 			  if (BaseType->MangledName.compare(DstType.MangledName) != 0) {
 
 				  int64_t ind = cha->getSubVTableIndex(DstType.MangledName, BaseType->MangledName);
-				  std::cerr << "CastCheck: Index = " << ind << std::endl;
+				  DEBUG(dbgs() << "CastCheck: Index = " << ind << "\n");
 				  if (ind != -1) {
 					  vtbl = SDLayoutBuilder::vtbl_t(DstType.MangledName, ind);
 				  }
@@ -844,7 +1177,7 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
 		  }
 		  else
 		  {
-			  std::cerr << "CastCheck: cha does not know about vtbl :(" << std::endl;
+			  DEBUG(dbgs() << "CastCheck: cha does not know about vtbl :(\n");
 		  }
 		  
 		  // the following is mainly the same as handleSDCheckVtbl() above:
@@ -858,67 +1191,132 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
                                  layoutBuilder->getVTableRangeStart(vtbl);
 
 			  rangeWidth = cha->getCloudSize(vtbl.first);
-			  std::cerr << "CastCheck: [rangeWidth = " << rangeWidth << " start = " << start << "] " << std::endl;
+			  DEBUG(dbgs() << "CastCheck: [rangeWidth = " << rangeWidth << " start = " << start << "] \n");
 		  } else {
 			  start = NULL;
 			  rangeWidth = 0;
-			  std::cerr << "CastCheck: [ no metadata available ] " << std::endl;
+			  DEBUG(dbgs() << "CastCheck: [ no metadata available ] \n");
 		  }
 		  
-		  LLVMContext& C = CI->getContext();
-		  
-		  if (start) {
-			  IRBuilder<> builder(CI);
-			  builder.SetInsertPoint(CI);
-
-			  if (rangeWidth > 1)
-			  {
-				  llvm::Value *width    = llvm::ConstantInt::get(IntPtrTy, rangeWidth);
-				  llvm::Type *Int8PtrTy = IntegerType::getInt8PtrTy(C);
-				  
-				  // we do not have the root of the VTable: break up.
-				  if(!cha->hasAncestor(vtbl)) {
-					  std::cerr << vtbl.first.data() << std::endl;
-					  assert(false);
+		  //Paul: the clang side falls back to the RTTI walk on a null result,
+		  //so a cast without metadata just always takes the slow path
+		  if (!start) {
+			  sd_emitRemark(SD_REMARK_MISSED, "NoMetadata", CI, "dyncast", DstMangledName, -1, "rtti");
+			  CI->replaceAllUsesWith(llvm::ConstantPointerNull::get(cast<PointerType>(CI->getType())));
+			  CI->eraseFromParent();
+			  continue;
+		  }
+		  NumDynCastChecks++;
+
+		  // we do not have the root of the VTable: break up.
+		  if(!cha->hasAncestor(vtbl)) {
+			  errs() << vtbl.first.data() << "\n";
+			  assert(false);
+		  }
+
+		  SDLayoutBuilder::vtbl_name_t root = cha->getAncestor(vtbl);
+		  assert(layoutBuilder->alignmentMap.count(root));
+		  int64_t alignmentBits = floor(log(layoutBuilder->alignmentMap[root] + 0.5)/log(2.0));
+
+		  //Paul: the coalesced ranges of the layout, like for cast_info above.
+		  //Only a single range can go to the runtime, the other forms are
+		  //always checked inline.
+		  bool lowerCheck = false;
+		  SDCheckLowering::check_plan_t plan;
+		  if (layoutBuilder->hasMemRange(vtbl)) {
+			  plan = checkLowering->plan(layoutBuilder->getMemRange(vtbl),
+			                             layoutBuilder->alignmentMap[root]);
+			  if (plan.kind == SDCheckLowering::CK_EQ || plan.kind == SDCheckLowering::CK_ROTATE) {
+				  start = plan.ranges[0].first;
+				  rangeWidth = plan.ranges[0].second;
+			  } else {
+				  lowerCheck = true;
+			  }
+		  }
+		  //Paul: the range forms are recorded when P5 lowers them
+		  if (lowerCheck && plan.kind != SDCheckLowering::CK_MULTI_RANGE) {
+			  uint64_t validVptrs = 0;
+			  for (const SDCheckLowering::mem_range_t& range : plan.ranges)
+				  validVptrs += range.second;
+			  sd_emitRemark(SD_REMARK_ANALYSIS, "BitsetCheck", CI, "dyncast", DstMangledName,
+			                validVptrs, SDCheckLowering::kindName(plan.kind));
+		  } else if (!lowerCheck)
+			  sd_emitRemark(SD_REMARK_ANALYSIS, rangeWidth > 1 ? "RangeCheck" : "EqCheck", CI, "dyncast",
+			                DstMangledName, rangeWidth, SDInlineCastChecks ? "inline" : "call");
+
+		  builder.SetInsertPoint(CI);
+		  auto src = CI->getArgOperand(0);
+		  auto off = CI->getArgOperand(5);
+
+		  if (lowerCheck) {
+			  llvm::Type *Int8PtrTy = IntegerType::getInt8PtrTy(C);
+			  llvm::Value *vptrAddr = builder.CreateBitCast(src, Int8PtrTy->getPointerTo());
+			  llvm::Value *vptr     = builder.CreateLoad(vptrAddr);
+			  llvm::Value *inRange  = checkLowering->emit(builder, vptr, plan);
+
+			  llvm::Value *dst = builder.CreateGEP(src, builder.CreateNeg(off));
+			  llvm::Value *result = builder.CreateSelect(inRange, dst,
+			                                             llvm::ConstantPointerNull::get(cast<PointerType>(CI->getType())));
+			  CI->replaceAllUsesWith(result);
+			  CI->eraseFromParent();
+			  inlinedCastChecks++;
+		  } else if (SDInlineCastChecks) {
+			  //Paul: one range compare on the vptr of the source and the
+			  //static offset, no call at all
+			  llvm::Value *vptrAddr = builder.CreateBitCast(src, IntPtrTy->getPointerTo());
+			  llvm::Value *vptrInt  = builder.CreateLoad(vptrAddr);
+			  llvm::Value *inRange;
+			  if (rangeWidth > 1) {
+				  llvm::Value *diff = builder.CreateSub(vptrInt, start);
+				  llvm::Value *diffRor = diff;
+				  if (alignmentBits > 0) {
+					  llvm::Value *diffShr = builder.CreateLShr(diff, alignmentBits);
+					  llvm::Value *diffShl = builder.CreateShl(diff, DL.getPointerSizeInBits(0) - alignmentBits);
+					  diffRor = builder.CreateOr(diffShr, diffShl);
 				  }
-				  
-				  SDLayoutBuilder::vtbl_name_t root = cha->getAncestor(vtbl);
-				  assert(layoutBuilder->alignmentMap.count(root));
-				  
-				  int64_t alignmentBits = floor(log(layoutBuilder->alignmentMap[root] + 0.5)/log(2.0));
-				  llvm::Constant* alignment = llvm::ConstantInt::get(IntPtrTy, alignmentBits);
-				  llvm::Constant* alignment_r = llvm::ConstantInt::get(IntPtrTy, DL.getPointerSizeInBits(0) - alignmentBits);
-				  
-				  llvm::Constant* rootVtblInt    = dyn_cast<llvm::Constant>(start->getOperand(0));
-				  llvm::GlobalVariable* rootVtbl = dyn_cast<llvm::GlobalVariable>(rootVtblInt->getOperand(0));
-				  llvm::ConstantInt* startOff    = dyn_cast<llvm::ConstantInt>(start->getOperand(1));
-				  
-				  std::cerr << "CastCheck: Changing dynamic_cast arguments!" << std::endl;
-				  
-				  CI->setArgOperand(1, start);
-				  CI->setArgOperand(2, width);
-				  CI->setArgOperand(3, alignment);
-				  CI->setArgOperand(4, alignment_r);
+				  inRange = builder.CreateICmpULT(diffRor, llvm::ConstantInt::get(IntPtrTy, rangeWidth));
 			  } else {
-				  auto src = CI->getArgOperand(0);
-				  auto off = CI->getArgOperand(5);
-				  
-				  Function *dynCastEqualFunction =
-					  (Function*)M.getOrInsertFunction(
-						  "__dynamic_casting_verification_equal", CI->getType(),
-						  src->getType(), HexTypeUtilSet.Int64Ty, off->getType(), nullptr);
-				  Value *Param[3] = { src, start, off };
-				  Value * dynCastEqual = builder.CreateCall(dynCastEqualFunction, Param);
-				  CI->replaceAllUsesWith(dynCastEqual);//Paul: write the v pointer back 
-				  CI->eraseFromParent();
-				  
+				  inRange = builder.CreateICmpEQ(vptrInt, start);
 			  }
+
+			  llvm::Value *dst = builder.CreateGEP(src, builder.CreateNeg(off));
+			  llvm::Value *result = builder.CreateSelect(inRange, dst,
+			                                             llvm::ConstantPointerNull::get(cast<PointerType>(CI->getType())));
+			  CI->replaceAllUsesWith(result);
+			  CI->eraseFromParent();
+			  inlinedCastChecks++;
+		  } else if (rangeWidth > 1) {
+			  llvm::Value *width    = llvm::ConstantInt::get(IntPtrTy, rangeWidth);
+			  llvm::Constant* alignment = llvm::ConstantInt::get(IntPtrTy, alignmentBits);
+			  llvm::Constant* alignment_r = llvm::ConstantInt::get(IntPtrTy, DL.getPointerSizeInBits(0) - alignmentBits);
+			  
+			  DEBUG(dbgs() << "CastCheck: Changing dynamic_cast arguments!\n");
+			  
+			  CI->setArgOperand(1, start);
+			  CI->setArgOperand(2, width);
+			  CI->setArgOperand(3, alignment);
+			  CI->setArgOperand(4, alignment_r);
+		  } else {
+			  Function *dynCastEqualFunction =
+				  (Function*)M.getOrInsertFunction(
+					  "__dynamic_casting_verification_equal", CI->getType(),
+					  src->getType(), HexTypeUtilSet.Int64Ty, off->getType(), nullptr);
+			  Value *Param[3] = { src, start, off };
+			  Value * dynCastEqual = builder.CreateCall(dynCastEqualFunction, Param);
+			  CI->replaceAllUsesWith(dynCastEqual);//Paul: write the v pointer back 
+			  CI->eraseFromParent();
 		  }
 	  }
 	  
   } else {	  
-	  std::cerr << "No dynamic casting functions.... " << std::endl;
+	  DEBUG(dbgs() << "No dynamic casting functions.... \n");
   }
+
+  profile.finish();
+
+  if (SDInlineCastChecks)
+    DEBUG(dbgs() << "CastCheck: " << inlinedCastChecks << " cast checks inlined\n");
+  NumInlinedCastChecks += inlinedCastChecks;
 }
 
 
@@ -1035,7 +1433,8 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
 
           //check if vptr is constant
           if (validConstVptr(rootVtbl, startOff->getSExtValue(), widthInt, DL, vptr, 0)) {
-            
+            sd_emitRemark(SD_REMARK_PASSED, "ConstFolded", CI, "vcall", rootVtbl->getName(), widthInt);
+
             //replace call instruction with an constant int 
             CI->replaceAllUsesWith(llvm::ConstantInt::getTrue(C));
             CI->eraseFromParent();
@@ -1064,6 +1463,8 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
             
             //create comparison, diffRor <= width 
             llvm::Value *inRange = builder.CreateICmpULE(diffRor, width); //Paul: create a comparison expr.
+
+            sd_emitRemark(SD_REMARK_ANALYSIS, "RangeCheck", CI, "vcall", rootVtbl->getName(), widthInt);
             
             //replace the in range check 
             CI->replaceAllUsesWith(inRange);
@@ -1083,6 +1484,7 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
             //create comparison, v pointer == start  
             llvm::Value *inRange = builder.CreateICmpEQ(vptrInt, start);
 
+            sd_emitRemark(SD_REMARK_ANALYSIS, "EqCheck", CI, "vcall", rootVtbl->getName(), widthInt);
             CI->replaceAllUsesWith(inRange);
             CI->eraseFromParent();
             
@@ -1103,6 +1505,11 @@ void SDUpdateIndices::handleCheckCast(Module & M) {
       sd_print(" Total const_ptr % d \n", constPtr);
       sd_print(" Average width % lf \n", sumWidth * 1.0 / (rangeSubst + eqSubst + constPtr));
 
+      NumIndexSubst += indexSubst;
+      NumVcallRangeChecks += rangeSubst;
+      NumVcallEqChecks += eqSubst;
+      NumVcallConstChecks += constPtr;
+
       //one of these values has to be > than 0 
       return indexSubst > 0 || rangeSubst > 0 || eqSubst > 0 || constPtr > 0;
     }
@@ -1119,8 +1526,8 @@ INITIALIZE_PASS_DEPENDENCY(SDBuildCHA)
 INITIALIZE_PASS_END(SDUpdateIndices, "cc", "Change Constant", false, false)
 
 
-ModulePass* llvm::createSDUpdateIndicesPass() {
-  return new SDUpdateIndices();
+ModulePass* llvm::createSDUpdateIndicesPass(bool crossDSO) {
+  return new SDUpdateIndices(crossDSO);
 }
 
 ModulePass* llvm::createSDSubstModulePass() {
@@ -141,6 +141,7 @@ PassManagerBuilder::PassManagerBuilder() {
     MergeFunctions = false;
     EmitIVTBLs = false;
     EmitOVTBLs = false;
+    CastSanCrossDSO = false;
     PrepareForLTO = false;
     PGOInstrGen = RunPGOInstrGen;
     PGOInstrUse = RunPGOInstrUse;
@@ -752,7 +753,10 @@ void PassManagerBuilder::populateLTOPassManager(legacy::PassManagerBase &PM) {
     PM.add(llvm::createSDFixPass()); // P1
     PM.add(llvm::createSDBuildCHAPass()); // P2
     PM.add(llvm::createSDLayoutBuilderPass(EmitIVTBLs)); // P3
-    PM.add(llvm::createSDUpdateIndicesPass()); // P4
+    //Paul: other DSOs may add vtables to a cloud, only devirtualize the whole program
+    if (!CastSanCrossDSO)
+      PM.add(llvm::createSDDevirtPass()); // P3.5
+    PM.add(llvm::createSDUpdateIndicesPass(CastSanCrossDSO)); // P4
   }
 
   if (EmitIVTBLs) {
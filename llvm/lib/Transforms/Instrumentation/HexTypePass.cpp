@@ -10,6 +10,9 @@
 //===------------------------------------------------------------------===//
 
 #include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/CallSite.h"
 #include "llvm/Pass.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/LLVMContext.h"
@@ -24,9 +27,12 @@
 #include "llvm/Transforms/Utils/HexTypeUtil.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
 #include "llvm/Transforms/Instrumentation.h"
+#include "llvm/Support/Debug.h"
 
 #include <iostream>
 
+#define DEBUG_TYPE "hextype"
+
 using namespace llvm;
 #define MAXLEN 10000
 
@@ -52,6 +58,16 @@ namespace {
     std::map<Instruction *, Function *> AllAllocaWithFnSet;
     //Paul: cast map
     std::map<Function*, bool> mayCastMap;
+    //Paul: allocas that flow to a cast check (-stack-cast-reach-opt)
+    std::set<AllocaInst *> CastReachAllocas;
+    //Paul: a check may see a pointer loaded from memory or passed in from
+    //outside the module, then every captured alloca may reach it
+    bool CastReachUnknown = false;
+    std::map<Function *, DominatorTree *> DomTrees;
+    std::map<Function *, LoopInfo *> LoopInfos;
+    uint64_t NumStackObjs = 0;
+    uint64_t NumCastReachSkipped = 0;
+    uint64_t NumCastReachDeferred = 0;
 
     void getAnalysisUsage(AnalysisUsage &Info) const {
       Info.addRequired<CallGraphWrapperPass>();
@@ -166,12 +182,247 @@ namespace {
         }
     }
     
+    static bool isCastCheckFn(Function *F) {
+      return F->getName().startswith("__type_casting_verification") ||
+             F->getName().startswith("__dynamic_casting_verification");
+    }
+
+    //Paul: walk backwards from the source operand of every cast check and
+    //collect the allocas it can come from. Arguments of internal functions
+    //are followed to all their call sites and call results to the returns
+    //of the callee, anything else (loads, external code) is unknown.
+    void collectCastReach(Module &M) {
+      SmallPtrSet<Value *, 32> Visited;
+      SmallVector<Value *, 64> WorkList;
+
+      for (Function &F : M) {
+        if (!isCastCheckFn(&F))
+          continue;
+        for (User *U : F.users()) {
+          CallSite CS(U);
+          if (CS && CS.getCalledFunction() == &F && CS.arg_size() > 0)
+            WorkList.push_back(CS.getArgument(0));
+        }
+      }
+
+      while (!WorkList.empty()) {
+        Value *V = WorkList.pop_back_val();
+        if (!Visited.insert(V).second)
+          continue;
+
+        if (AllocaInst *AI = dyn_cast<AllocaInst>(V)) {
+          CastReachAllocas.insert(AI);
+        } else if (isa<Constant>(V)) {
+          // globals are traced by globalObjTracing
+          continue;
+        } else if (CastInst *CI = dyn_cast<CastInst>(V)) {
+          WorkList.push_back(CI->getOperand(0));
+        } else if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(V)) {
+          WorkList.push_back(GEP->getPointerOperand());
+        } else if (PHINode *PN = dyn_cast<PHINode>(V)) {
+          for (Value *Incoming : PN->incoming_values())
+            WorkList.push_back(Incoming);
+        } else if (SelectInst *SI = dyn_cast<SelectInst>(V)) {
+          WorkList.push_back(SI->getTrueValue());
+          WorkList.push_back(SI->getFalseValue());
+        } else if (Argument *A = dyn_cast<Argument>(V)) {
+          Function *F = A->getParent();
+          if (!F->hasLocalLinkage() || F->hasAddressTaken()) {
+            CastReachUnknown = true;
+            continue;
+          }
+          for (User *U : F->users())
+            WorkList.push_back(CallSite(U).getArgument(A->getArgNo()));
+        } else if (CallSite CS = CallSite(V)) {
+          Function *Callee = CS.getCalledFunction();
+          if (!Callee || Callee->isDeclaration()) {
+            CastReachUnknown = true;
+            continue;
+          }
+          for (BasicBlock &BB : *Callee)
+            if (ReturnInst *RI = dyn_cast<ReturnInst>(BB.getTerminator()))
+              if (RI->getReturnValue())
+                WorkList.push_back(RI->getReturnValue());
+        } else {
+          CastReachUnknown = true;
+        }
+      }
+    }
+
+    //Paul: the slice only sees the checks of this module. An alloca whose
+    //address is stored, returned or passed to code the slice does not
+    //follow (declarations, indirect calls, functions other modules can
+    //call) may reach a check in another module. Arguments of the other
+    //functions of the module are followed into the callee.
+    bool mayLeaveModule(AllocaInst *AI) {
+      SmallPtrSet<Value *, 16> Visited;
+      SmallVector<Value *, 16> WorkList;
+      WorkList.push_back(AI);
+
+      while (!WorkList.empty()) {
+        Value *V = WorkList.pop_back_val();
+        if (!Visited.insert(V).second)
+          continue;
+        for (Use &U : V->uses()) {
+          Instruction *I = cast<Instruction>(U.getUser());
+          if (isa<BitCastInst>(I) || isa<GetElementPtrInst>(I) ||
+              isa<PHINode>(I) || isa<SelectInst>(I)) {
+            WorkList.push_back(I);
+          } else if (isa<LoadInst>(I) || isa<ICmpInst>(I)) {
+            continue;
+          } else if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+            if (SI->getValueOperand() == V)
+              return true;
+          } else if (IntrinsicInst *II = dyn_cast<IntrinsicInst>(I)) {
+            // copies of the object do not copy its address
+            if (II->getIntrinsicID() != Intrinsic::lifetime_start &&
+                II->getIntrinsicID() != Intrinsic::lifetime_end &&
+                !isa<DbgInfoIntrinsic>(II) && !isa<MemIntrinsic>(II))
+              return true;
+          } else if (CallSite CS = CallSite(I)) {
+            Function *Callee = CS.getCalledFunction();
+            if (!Callee || Callee->isDeclaration() ||
+                !Callee->hasLocalLinkage() || Callee->hasAddressTaken() ||
+                !CS.isArgOperand(&U))
+              return true;
+            unsigned ArgNo = CS.getArgumentNo(&U);
+            if (ArgNo >= Callee->arg_size())
+              return true;
+            Function::arg_iterator Arg = Callee->arg_begin();
+            std::advance(Arg, ArgNo);
+            WorkList.push_back(&*Arg);
+          } else {
+            return true;
+          }
+        }
+      }
+      return false;
+    }
+
+    //Paul: drop the allocas which can never be the source of a cast check
+    void filterCastReach() {
+      for (auto it = AllAllocaSet.begin(); it != AllAllocaSet.end(); ) {
+        AllocaInst *AI = *it;
+        if (CastReachAllocas.count(AI) || mayLeaveModule(AI) ||
+            (CastReachUnknown && PointerMayBeCaptured(AI, true, true))) {
+          ++it;
+          continue;
+        }
+        AllAllocaWithFnSet.erase(AI);
+        it = AllAllocaSet.erase(it);
+        NumCastReachSkipped++;
+      }
+    }
+
+    DominatorTree *getDomTree(Function *F) {
+      DominatorTree *&DT = DomTrees[F];
+      if (!DT)
+        DT = new DominatorTree(*F);
+      return DT;
+    }
+
+    LoopInfo *getLoopInfo(Function *F) {
+      LoopInfo *&LI = LoopInfos[F];
+      if (!LI)
+        LI = new LoopInfo(*getDomTree(F));
+      return LI;
+    }
+
+    //Paul: the object has to be registered before the first use that lets
+    //its address out: calls, pointer stores, ptrtoint, returns, ... Loads
+    //and stores through the address and lifetime markers do not count.
+    //Returns the point right before the first such use in the nearest
+    //common dominator of all of them.
+    Instruction *findEscapePoint(AllocaInst *AI) {
+      SmallPtrSet<Instruction *, 16> Escapes;
+      SmallPtrSet<Value *, 16> Visited;
+      SmallVector<Value *, 16> WorkList;
+      WorkList.push_back(AI);
+
+      while (!WorkList.empty()) {
+        Value *V = WorkList.pop_back_val();
+        if (!Visited.insert(V).second)
+          continue;
+        for (Use &U : V->uses()) {
+          Instruction *I = cast<Instruction>(U.getUser());
+          if (isa<BitCastInst>(I) || isa<GetElementPtrInst>(I)) {
+            WorkList.push_back(I);
+          } else if (isa<LoadInst>(I)) {
+            continue;
+          } else if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+            if (SI->getValueOperand() == V)
+              Escapes.insert(I);
+          } else if (IntrinsicInst *II = dyn_cast<IntrinsicInst>(I)) {
+            if (II->getIntrinsicID() != Intrinsic::lifetime_start &&
+                II->getIntrinsicID() != Intrinsic::lifetime_end &&
+                !isa<DbgInfoIntrinsic>(II))
+              Escapes.insert(I);
+          } else if (PHINode *PN = dyn_cast<PHINode>(I)) {
+            // escapes at the end of the incoming block
+            Escapes.insert(PN->getIncomingBlock(U)->getTerminator());
+          } else {
+            Escapes.insert(I);
+          }
+        }
+      }
+
+      if (Escapes.empty())
+        return nullptr;
+
+      Function *F = AI->getParent()->getParent();
+      DominatorTree *DT = getDomTree(F);
+      BasicBlock *Dom = nullptr;
+      for (Instruction *I : Escapes)
+        Dom = Dom ? DT->findNearestCommonDominator(Dom, I->getParent())
+                  : I->getParent();
+
+      //Paul: never inside a loop the alloca is not in, the update would run
+      //on every iteration. The loop header is dominated by a block outside
+      //of the loop, register at its end.
+      LoopInfo *LI = getLoopInfo(F);
+      BasicBlock *AllocaBB = AI->getParent();
+      Loop *L = LI->getLoopFor(Dom);
+      if (L && !L->contains(AllocaBB)) {
+        while (L && !L->contains(AllocaBB)) {
+          Dom = DT->getNode(Dom)->getIDom()->getBlock();
+          L = LI->getLoopFor(Dom);
+        }
+        return Dom->getTerminator();
+      }
+
+      for (Instruction &I : *Dom)
+        if (Escapes.count(&I))
+          return &I;
+      return Dom->getTerminator();
+    }
+
     //Paul: add tracing for an alloca instruction
     //also add start and end times for tracing this instruction
     void handleAllocaAdd(Module &M) {
+      //Paul: without lifetime markers, register at the first escape. All
+      //points are found before the inline updates start splitting blocks.
+      std::map<AllocaInst *, Instruction *> EscapePoints;
+      if (ClStackCastReachOpt) {
+        for (AllocaInst *AI : AllAllocaSet)
+          if (!LifeTimeStartSet.count(AI))
+            if (Instruction *EscapePoint = findEscapePoint(AI))
+              EscapePoints[AI] = EscapePoint;
+        for (auto &entry : LoopInfos)
+          delete entry.second;
+        LoopInfos.clear();
+        for (auto &entry : DomTrees)
+          delete entry.second;
+        DomTrees.clear();
+      }
+
       for (AllocaInst *AI : AllAllocaSet) {
         //Paul: get the next parent instruction of this instruction
         Instruction *next = HexTypeUtilSet->findNextInstruction(AI);
+        auto EscapePoint = EscapePoints.find(AI);
+        if (EscapePoint != EscapePoints.end() && EscapePoint->second != next) {
+          next = EscapePoint->second;
+          NumCastReachDeferred++;
+        }
         IRBuilder<> Builder(next);
 
         Value *ArraySizeF = NULL;
@@ -228,6 +479,125 @@ namespace {
       }
     }
     
+    //Paul: register the traced objects of one frame with a single
+    //__hextype_push_frame on entry and drop them with __hextype_pop_frame
+    //before every return, see compiler-rt/lib/hextype/hextype_frame.cc
+    void emitFrameRecord(Module &M, Function *F,
+                         std::vector<AllocaInst *> &Allocas) {
+      HexTypeUtilSet->FrameObjs.clear();
+      std::vector<AllocaInst *> Objs;
+      for (AllocaInst *AI : Allocas) {
+        size_t Before = HexTypeUtilSet->FrameObjs.size();
+        HexTypeUtilSet->collectFrameObj(&M, AI, Objs.size());
+        if (HexTypeUtilSet->FrameObjs.size() != Before)
+          Objs.push_back(AI);
+      }
+      if (Objs.empty())
+        return;
+
+      //Paul: constant descriptor table of the frame, one entry per object
+      Type *Int32Ty = HexTypeUtilSet->Int32Ty;
+      StructType *DescTy = StructType::get(Int32Ty, Int32Ty, Int32Ty, Int32Ty,
+                                           Int32Ty, nullptr);
+      std::vector<Constant *> Descs;
+      for (FrameObjInfo &Info : HexTypeUtilSet->FrameObjs) {
+        Constant *Fields[] = {ConstantInt::get(Int32Ty, Info.ObjIndex),
+                              ConstantInt::get(Int32Ty, Info.Offset),
+                              ConstantInt::get(Int32Ty, Info.TypeSize),
+                              ConstantInt::get(Int32Ty, Info.ArraySize),
+                              ConstantInt::get(Int32Ty, Info.FakeVPointer)};
+        Descs.push_back(ConstantStruct::get(DescTy, Fields));
+      }
+      ArrayType *TableTy = ArrayType::get(DescTy, Descs.size());
+      GlobalVariable *Table =
+        new GlobalVariable(M, TableTy, true, GlobalValue::PrivateLinkage,
+                           ConstantArray::get(TableTy, Descs),
+                           "__hextype_frame." + F->getName());
+
+      //Paul: the object addresses live in the frame itself, the address
+      //array goes to the top of the entry block so it stays a static alloca
+      BasicBlock &Entry = F->getEntryBlock();
+      IRBuilder<> BuilderEntry(&*Entry.getFirstInsertionPt());
+      ArrayType *AddrsTy = ArrayType::get(HexTypeUtilSet->Int8PtrTy,
+                                          Objs.size());
+      AllocaInst *Addrs = BuilderEntry.CreateAlloca(AddrsTy, nullptr,
+                                                    "hextype.frame");
+
+      Instruction *LastObj = nullptr;
+      std::set<AllocaInst *> ObjSet(Objs.begin(), Objs.end());
+      for (Instruction &I : Entry)
+        if (AllocaInst *AI = dyn_cast<AllocaInst>(&I))
+          if (ObjSet.count(AI))
+            LastObj = AI;
+
+      IRBuilder<> Builder(HexTypeUtilSet->findNextInstruction(LastObj));
+      for (unsigned i = 0; i < Objs.size(); i++)
+        Builder.CreateStore(
+          Builder.CreatePointerCast(Objs[i], HexTypeUtilSet->Int8PtrTy),
+          Builder.CreateConstGEP2_32(AddrsTy, Addrs, 0, i));
+
+      Type *AddrsPtrTy = HexTypeUtilSet->Int8PtrTy->getPointerTo();
+      Function *PushFn =
+        (Function*)M.getOrInsertFunction("__hextype_push_frame",
+                                         HexTypeUtilSet->VoidTy, AddrsPtrTy,
+                                         HexTypeUtilSet->Int8PtrTy, Int32Ty,
+                                         nullptr);
+      Value *PushParam[3] = {
+        Builder.CreateConstGEP2_32(AddrsTy, Addrs, 0, 0),
+        ConstantExpr::getPointerCast(Table, HexTypeUtilSet->Int8PtrTy),
+        ConstantInt::get(Int32Ty, Descs.size())};
+      Builder.CreateCall(PushFn, PushParam);
+
+      if (ClMakeLogInfo) {
+        Function *ObjUpdateFunction =
+          (Function*)M.getOrInsertFunction("__obj_update_count",
+                                           HexTypeUtilSet->VoidTy, Int32Ty,
+                                           HexTypeUtilSet->Int64Ty, nullptr);
+        Value *Param[2] = {ConstantInt::get(Int32Ty, STACKALLOC),
+                           ConstantInt::get(HexTypeUtilSet->Int64Ty,
+                                            Descs.size())};
+        Builder.CreateCall(ObjUpdateFunction, Param);
+      }
+
+      Function *PopFn =
+        (Function*)M.getOrInsertFunction("__hextype_pop_frame",
+                                         HexTypeUtilSet->VoidTy, AddrsPtrTy,
+                                         nullptr);
+      for (Instruction *Ret : *ReturnInstSet.find(F)->second) {
+        IRBuilder<> BuilderRet(Ret);
+        BuilderRet.CreateCall(PopFn,
+                              BuilderRet.CreateConstGEP2_32(AddrsTy, Addrs,
+                                                            0, 0));
+      }
+    }
+
+    //Paul: take the static allocas out of the per object tracing and
+    //register them per frame. Allocas with lifetime markers may share their
+    //stack slot with another alloca, they keep the per object updates.
+    void handleFrameObjects(Module &M) {
+      std::vector<Function *> FrameFns;
+      std::map<Function *, std::vector<AllocaInst *>> FrameAllocas;
+
+      for (auto it = AllAllocaSet.begin(); it != AllAllocaSet.end(); ) {
+        AllocaInst *AI = *it;
+        if (!AI->isStaticAlloca() || LifeTimeStartSet.count(AI) ||
+            LifeTimeEndSet.count(AI)) {
+          ++it;
+          continue;
+        }
+
+        Function *F = AI->getParent()->getParent();
+        if (FrameAllocas.find(F) == FrameAllocas.end())
+          FrameFns.push_back(F);
+        FrameAllocas[F].push_back(AI);
+        AllAllocaWithFnSet.erase(AI);
+        it = AllAllocaSet.erase(it);
+      }
+
+      for (Function *F : FrameFns)
+        emitFrameRecord(M, F, FrameAllocas[F]);
+    }
+
     //Paul: find all return instructions of a function
     void findReturnInsts(Function *f) {
       std::vector<Instruction*> *TempInstSet = new std::vector<Instruction *>;
@@ -418,11 +788,81 @@ namespace {
         //most likely this will be used to clean up the stack when leaving the stack.
         findReturnInsts(&*F);
       }
+      NumStackObjs = AllAllocaSet.size();
+      //Paul: drop the stack objects no cast check can see
+      if (ClStackCastReachOpt) {
+        collectCastReach(M);
+        filterCastReach();
+      }
+      //Paul: static allocas get one record per frame
+      if (ClStackFrameOpt)
+        handleFrameObjects(M);
       //Paul: insert object tracing functions for allocation instructions declaration
       handleAllocaAdd(M);
       //Paul: insert object tracing functions for allocation instruction deletion
       //life time ends here so we need to clean these allocations up
       handleAllocaDelete(M);
+
+      if (ClStackCastReachOpt)
+        DEBUG(dbgs() << "HexType: " << NumCastReachSkipped << " of "
+                  << NumStackObjs << " stack objects cannot reach a cast check, "
+                  << NumCastReachDeferred << " registrations deferred"
+                  << "\n");
+    }
+
+    //Paul: keep GV alive until the end, it is only referenced by the linker
+    void appendToUsed(Module &M, GlobalValue *GV) {
+      SmallPtrSet<GlobalValue *, 8> Used;
+      GlobalVariable *OldUsed = collectUsedGlobalVariables(M, Used, false);
+      Used.insert(GV);
+
+      std::vector<Constant *> UsedArray;
+      for (GlobalValue *G : Used)
+        UsedArray.push_back(
+          ConstantExpr::getPointerBitCastOrAddrSpaceCast(
+            G, HexTypeUtilSet->Int8PtrTy));
+      if (OldUsed)
+        OldUsed->eraseFromParent();
+
+      ArrayType *ATy = ArrayType::get(HexTypeUtilSet->Int8PtrTy,
+                                      UsedArray.size());
+      GlobalVariable *NewUsed =
+        new GlobalVariable(M, ATy, false, GlobalValue::AppendingLinkage,
+                           ConstantArray::get(ATy, UsedArray), "llvm.used");
+      NewUsed->setSection("llvm.metadata");
+    }
+
+    //Paul: emit the type information of the globals as a table in the
+    //hextype_globals section instead of registering them at startup. The
+    //linker concatenates the tables of all modules, the runtime sorts them
+    //on the first ObjTypeMap miss (see hextype_global_table.cc).
+    void emitGlobalObjTable(Module &M, std::vector<GlobalVariable *> &Globals) {
+      Type *Int32Ty = HexTypeUtilSet->Int32Ty;
+      StructType *DescTy = StructType::get(HexTypeUtilSet->Int8PtrTy,
+                                           Int32Ty, Int32Ty, Int32Ty, Int32Ty,
+                                           nullptr);
+      std::vector<Constant *> Descs;
+      for (FrameObjInfo &Info : HexTypeUtilSet->FrameObjs) {
+        Constant *Fields[] = {
+          ConstantExpr::getPointerCast(Globals[Info.ObjIndex],
+                                       HexTypeUtilSet->Int8PtrTy),
+          ConstantInt::get(Int32Ty, Info.Offset),
+          ConstantInt::get(Int32Ty, Info.TypeSize),
+          ConstantInt::get(Int32Ty, Info.ArraySize),
+          ConstantInt::get(Int32Ty, Info.FakeVPointer)};
+        Descs.push_back(ConstantStruct::get(DescTy, Fields));
+      }
+      if (Descs.empty())
+        return;
+
+      ArrayType *TableTy = ArrayType::get(DescTy, Descs.size());
+      GlobalVariable *Table =
+        new GlobalVariable(M, TableTy, true, GlobalValue::PrivateLinkage,
+                           ConstantArray::get(TableTy, Descs),
+                           "__hextype_global_table");
+      Table->setSection("hextype_globals");
+      Table->setAlignment(8);
+      appendToUsed(M, Table);
     }
 
     //Paul: this function adds the global object tracing handler functions
@@ -433,6 +873,10 @@ namespace {
       BasicBlock *BBGlobal = BasicBlock::Create(M.getContext(),
                                                 "entry", FGlobal);
       IRBuilder<> BuilderGlobal(BBGlobal);
+      //Paul: globals described by the static table (-global-table-opt)
+      std::vector<GlobalVariable *> TableGlobals;
+      HexTypeUtilSet->FrameObjs.clear();
+      bool hasUpdates = false;
       
       //Paul: iterate trough all global objects.
       for (GlobalVariable &GV : M.globals()) {
@@ -464,9 +908,19 @@ namespace {
           //the offsets are the DL date layout sizes of each of the components of this allocation type.
           HexTypeUtilSet->getArrayOffsets(AllocaType, offsets, 0);
           if(offsets.size() == 0) continue;
+
+          //Paul: thread locals have no link time address, they stay dynamic
+          if (ClGlobalTableOpt && !GV.isThreadLocal()) {
+            HexTypeUtilSet->collectStaticObj(
+              &M, AllocaType, cast<ConstantInt>(NElems)->getZExtValue(),
+              GLOBALALLOC, TableGlobals.size());
+            TableGlobals.push_back(&GV);
+            continue;
+          }
           
           //Paul: insert the update for the particular object type allocation and 
           //emit the object tracing function
+          hasUpdates = true;
           HexTypeUtilSet->insertUpdate(&M, BuilderGlobal,
                                        "__update_global_oinfo",
                                        &GV, offsets, HexTypeUtilSet->DL.
@@ -474,6 +928,15 @@ namespace {
                                        NElems, NULL, BBGlobal, AllocaType);
         }
       }
+      if (ClGlobalTableOpt) {
+        emitGlobalObjTable(M, TableGlobals);
+        //Paul: nothing left to register at startup
+        if (!hasUpdates) {
+          FGlobal->eraseFromParent();
+          return;
+        }
+      }
+
       //Paul: set the return of this function to be void
       BuilderGlobal.CreateRetVoid();
       appendToGlobalCtors(M, FGlobal, 0);
@@ -24,9 +24,12 @@
 #include "llvm/Analysis/MemoryBuiltins.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/Support/Debug.h"
 #include <cxxabi.h>
 #include <iostream>
 
+#define DEBUG_TYPE "hextype"
+
 #define MAXLEN 10000
 
 using namespace llvm;
@@ -74,19 +77,9 @@ namespace {
         dyn_cast<ConstantInt>(call->getOperand(1));
       uint64_t TargetHashValue = HashValueConst->getZExtValue();
 
-      if (ClCastObjOpt) {
-        bool isSafeObj = true;
-        std::set<std::string>::iterator it;
-        for (it = HexTypeUtilSet->CastingRelatedSet.begin();
-             it != HexTypeUtilSet->CastingRelatedSet.end(); ++it) {
-          std::string TargetStr = *it;
-          uint64_t TmpHash = HexTypeUtilSet->getHashValueFromStr(TargetStr);
-          if (TmpHash == TargetHashValue)
-            isSafeObj = false;
-        }
-
-        if (isSafeObj) return;
-      }
+      if (ClCastObjOpt &&
+          !HexTypeUtilSet->isCastingRelatedHash(TargetHashValue))
+        return;
 
       std::string funName;
       //Paul: for the new operator
@@ -117,7 +110,7 @@ namespace {
 		      }
 
 	      if (!found) {
-		      std::cerr << "Did not find " << TargetHashValue << std::endl;
+		      DEBUG(dbgs() << "Did not find " << TargetHashValue << "\n");
 		      return;
 	      }
 	      assert (found && "Type not found?");
@@ -561,13 +554,13 @@ namespace {
 								  CHTreeNode & PointerType = CastSan.Types[PointerTypeH];
 
 								  if (CastType.TypeHash != CastTypeH)
-									  std::cerr << "Cannot check cast because we do not have the cast type of " << CastTypeH << std::endl;
+									  DEBUG(dbgs() << "Cannot check cast because we do not have the cast type of " << CastTypeH << "\n");
 								  if(PointerType.TypeHash != PointerTypeH)
-									  std::cerr << "Cannot check cast because we do not have the pointer type of " << PointerTypeH << std::endl;
+									  DEBUG(dbgs() << "Cannot check cast because we do not have the pointer type of " << PointerTypeH << "\n");
 
 								  if (CastType.TypeHash != CastTypeH || PointerType.TypeHash != PointerTypeH)
 								  {
-									  std::cerr << "could not find info in CastSanMD" << std::endl;
+									  DEBUG(dbgs() << "could not find info in CastSanMD\n");
 									  Call->eraseFromParent();
 									  continue;
 									  //assert (CastType.TypeHash == CastTypeH && PointerType.TypeHash == PointerTypeH && "Type not found in CastSan MD!");
@@ -579,15 +572,15 @@ namespace {
 								  Constant * ConstRangeWidth = nullptr;
 								  
 								  if (!RootForCast) {
-									  std::cerr << "The cast from " << PointerType.MangledName << " to " << CastType.MangledName << " should probably not be possible" << std::endl;
+									  DEBUG(dbgs() << "The cast from " << PointerType.MangledName << " to " << CastType.MangledName << " should probably not be possible\n");
 
-									  std::cerr << "CastType Name: " << CastType.TypeHash << ", " << CastType.StructType->getName().str() << std::endl;
-									  std::cerr << "PointerType Name: " << PointerType.TypeHash << ", " << PointerType.StructType->getName().str() << std::endl;
+									  DEBUG(dbgs() << "CastType Name: " << CastType.TypeHash << ", " << CastType.StructType->getName().str() << "\n");
+									  DEBUG(dbgs() << "PointerType Name: " << PointerType.TypeHash << ", " << PointerType.StructType->getName().str() << "\n");
 
-									  std::cerr << std::endl << "Trees of Pointer:" << std::endl;
+									  DEBUG(dbgs() << "\n" << "Trees of Pointer:\n");
 									  for (auto & index : PointerType.TreeIndices)
 										  CastSan.PrintTree(index.first);
-									  std::cerr << std::endl << "Trees of CastType:" << std::endl;
+									  DEBUG(dbgs() << "\n" << "Trees of CastType:\n");
 									  for (auto & index : CastType.TreeIndices)
 										  CastSan.PrintTree(index.first);
 
@@ -9,74 +9,166 @@
 
 #include "llvm/Transforms/Utils/CastSanUtil.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Support/Debug.h"
+#include <functional>
 #include <iostream>
+#include <queue>
+
+#define DEBUG_TYPE "castsan"
+
+// bitcode written before CS_MD_TYPETABLE has one named node per type
+static const char CSLegacyTypeInfoPrefix[] = "CS_Type_MD_";
 
 namespace llvm {
-	void CastSanUtil::getTypeMetadata(Module & M) {
-		assert(Types.size() == 0 && "Already have Metadata....");
-		for (auto MdIt = M.getNamedMDList().begin(); MdIt != M.getNamedMDList().end(); MdIt++) {
-			if (!MdIt->getName().startswith(CS_MD_TYPEINFO))
-				continue;
+	bool CastSanTypeTable::insert(const std::string & MangledName, uint64_t TypeHash,
+	                              bool Polymorphic, const std::vector<uint64_t> & ParentHashes) {
+		if (!MangledNames.insert(MangledName).second)
+			return false;
+
+		TypeRecord & Record = Records[std::make_pair(TypeHash, MangledName)];
+		Record.Polymorphic = Polymorphic;
+		Record.ParentHashes = ParentHashes;
+		return true;
+	}
 
-			MDString * MangledNameMD = dyn_cast_or_null<MDString>(MdIt->getOperand(0)->getOperand(0));
-			assert (MangledNameMD && "CastSan Metadata is missing the mangled name");
+	void CastSanTypeTable::emit(Module & M) const {
+		if (Records.empty())
+			return;
+
+		LLVMContext & C = M.getContext();
+		Type * Int64Ty = Type::getInt64Ty(C);
+		std::vector<Metadata*> Table;
+		Table.reserve(Records.size());
+
+		// std::map keeps the records sorted by (hash, mangled name)
+		for (auto & Entry : Records) {
+			Metadata * Ops[] = {
+				ConstantAsMetadata::get(ConstantInt::get(Int64Ty, Entry.first.first)),
+				MDString::get(C, Entry.first.second),
+				ConstantAsMetadata::get(ConstantInt::get(Int64Ty, Entry.second.Polymorphic ? 1 : 0)),
+				ConstantAsMetadata::get(ConstantDataArray::get(C, Entry.second.ParentHashes))
+			};
+			Table.push_back(MDTuple::get(C, Ops));
+		}
 
-			uint64_t TypeHash = getUInt64MD(MdIt->getOperand(1)->getOperand(0));
+		M.getOrInsertNamedMetadata(CS_MD_TYPETABLE)->addOperand(MDTuple::get(C, Table));
+	}
 
-			CHTreeNode & Type = Types[TypeHash];
-			
-			if (Type.TypeHash != 0) {
-				if (Type.MangledName != MangledNameMD->getString())
-					std::cerr << "Type " << Type.MangledName << " is also known as " << MangledNameMD->getString().str() << std::endl;
-			} else {
-				auto test = MangledNameMD -> getString();
-				Type.MangledName = MangledNameMD->getString();
-				Type.TypeHash = TypeHash;
-				
-				uint64_t Polymorphic = getUInt64MD(MdIt->getOperand(2)->getOperand(0));
-				Type.Polymorphic = Polymorphic == 1 ? true : false;
-			}
-			
-			uint64_t ParentsNum = getUInt64MD(MdIt->getOperand(3)->getOperand(0));
+	void CastSanUtil::getTypeMetadata(Module & M) {
+		assert(Types.size() == 0 && "Already have Metadata....");
 
-			for (uint64_t i = 0; i < ParentsNum; i++)
-			{
-				uint64_t ParentHash = getUInt64MD(MdIt->getOperand(4 + i)->getOperand(0));
-				
-				bool alreadyChild = false;
-				for (auto node : Type.ParentHashes)
-					if (node == ParentHash)
-						alreadyChild = true;
-
-				if (!alreadyChild && ParentHash != TypeHash) {
-					Type.ParentHashes.push_back(ParentHash);
+		NamedMDNode * TypeTables = M.getNamedMetadata(CS_MD_TYPETABLE);
+		if (TypeTables) {
+			// k-way merge of the sorted tables of all linked modules. The records
+			// of a type come one after the other, the first module first, and
+			// Types is filled in hash order.
+			typedef std::pair<unsigned, unsigned> RecordPos; // table, record
+			typedef std::pair<uint64_t, RecordPos> Cursor;
+			std::priority_queue<Cursor, std::vector<Cursor>, std::greater<Cursor>> Heap;
+
+			auto getRecord = [&](const RecordPos & Pos) {
+				MDNode * Table = cast<MDNode>(TypeTables->getOperand(Pos.first));
+				return cast<MDNode>(Table->getOperand(Pos.second).get());
+			};
+
+			for (unsigned T = 0; T < TypeTables->getNumOperands(); T++) {
+				if (TypeTables->getOperand(T)->getNumOperands() > 0) {
+					RecordPos Pos(T, 0);
+					Heap.push(Cursor(getUInt64MD(getRecord(Pos)->getOperand(0)), Pos));
 				}
 			}
 
+			while (!Heap.empty()) {
+				Cursor Cur = Heap.top();
+				Heap.pop();
+				addTypeRecord(getRecord(Cur.second), Cur.first);
+
+				RecordPos Next(Cur.second.first, Cur.second.second + 1);
+				if (Next.second < TypeTables->getOperand(Next.first)->getNumOperands())
+					Heap.push(Cursor(getUInt64MD(getRecord(Next)->getOperand(0)), Next));
+			}
 		}
 
+		for (NamedMDNode & Node : M.getNamedMDList())
+			if (Node.getName().startswith(CSLegacyTypeInfoPrefix))
+				addLegacyTypeRecord(&Node);
+
 		// sanity checks. Each Mangled Name should be unique.
+		StringSet<> MangledNames;
 		for (auto & node : Types)
 		{
 			if (node.second.ParentHashes.size() == 0) {
 				Roots.push_back(&node.second);
 			}
-			int count = 0;
-			for (auto & innerNode : Types)
-			{
-				if (node.second.MangledName == innerNode.second.MangledName)
-					count++;
-			}
-			assert (count == 1 && "There is a duplicate Type with different Hashes.");
+			bool unique = MangledNames.insert(node.second.MangledName).second;
+			assert (unique && "There is a duplicate Type with different Hashes.");
+			(void) unique;
 		}
 
 		extendTypeMetadata();
 	}
 
+	void CastSanUtil::addTypeRecord(MDNode * Record, uint64_t TypeHash) {
+		MDString * MangledNameMD = dyn_cast_or_null<MDString>(Record->getOperand(1));
+		assert (MangledNameMD && "CastSan Metadata is missing the mangled name");
+
+		Constant * Parents = cast<ConstantAsMetadata>(Record->getOperand(3))->getValue();
+		uint64_t ParentsNum = cast<ArrayType>(Parents->getType())->getNumElements();
+
+		std::vector<uint64_t> ParentHashes;
+		for (uint64_t i = 0; i < ParentsNum; i++)
+			ParentHashes.push_back(cast<ConstantInt>(Parents->getAggregateElement(i))->getZExtValue());
+
+		addType(TypeHash, MangledNameMD->getString(), getUInt64MD(Record->getOperand(2)) == 1, ParentHashes);
+	}
+
+	// !{!"mangled name"}, !{i64 hash}, !{i64 polymorphic}, !{i64 parent count}, !{i64 parent}...
+	void CastSanUtil::addLegacyTypeRecord(NamedMDNode * Node) {
+		MDString * MangledNameMD = dyn_cast_or_null<MDString>(Node->getOperand(0)->getOperand(0));
+		assert (MangledNameMD && "CastSan Metadata is missing the mangled name");
+
+		uint64_t TypeHash = getUInt64MD(Node->getOperand(1)->getOperand(0));
+		uint64_t Polymorphic = getUInt64MD(Node->getOperand(2)->getOperand(0));
+		uint64_t ParentsNum = getUInt64MD(Node->getOperand(3)->getOperand(0));
+
+		std::vector<uint64_t> ParentHashes;
+		for (uint64_t i = 0; i < ParentsNum; i++)
+			ParentHashes.push_back(getUInt64MD(Node->getOperand(4 + i)->getOperand(0)));
+
+		addType(TypeHash, MangledNameMD->getString(), Polymorphic == 1, ParentHashes);
+	}
+
+	void CastSanUtil::addType(uint64_t TypeHash, StringRef MangledName, bool Polymorphic,
+	                          const std::vector<uint64_t> & ParentHashes) {
+		// the table records come in hash order, a new type always goes to the end
+		CHTreeNode & Type = Types.emplace_hint(Types.end(), TypeHash, CHTreeNode())->second;
+
+		if (Type.TypeHash != 0) {
+			if (Type.MangledName != MangledName)
+				DEBUG(dbgs() << "Type " << Type.MangledName << " is also known as " << MangledName.str() << "\n");
+		} else {
+			Type.MangledName = MangledName;
+			Type.TypeHash = TypeHash;
+			Type.Polymorphic = Polymorphic;
+		}
+
+		for (uint64_t ParentHash : ParentHashes)
+		{
+			bool alreadyChild = false;
+			for (auto node : Type.ParentHashes)
+				if (node == ParentHash)
+					alreadyChild = true;
+
+			if (!alreadyChild && ParentHash != TypeHash) {
+				Type.ParentHashes.push_back(ParentHash);
+			}
+		}
+	}
+
 	void CastSanUtil::PrintTree(CHTreeNode * root, int deep) {
 		for (int i = 0; i < deep; i++)
-			std::cerr << " ";
-		std::cerr << root->MangledName << std::endl;
+			DEBUG(dbgs() << " ");
+		DEBUG(dbgs() << root->MangledName << "\n");
 		for (auto child : root->Children) {
 			PrintTree(child, deep + 1);
 		}
@@ -134,11 +226,11 @@ namespace llvm {
 		std::vector<CHTreeNode*> newPath;
 		for (auto node : path) {
 			if (node == type) {
-				std::cerr << "Loop detected: " << std::endl;
+				DEBUG(dbgs() << "Loop detected: \n");
 				for (auto n : path) {
-					std::cerr << n->MangledName << std::endl;
+					DEBUG(dbgs() << n->MangledName << "\n");
 				}
-				std::cerr << type->MangledName << std::endl;
+				DEBUG(dbgs() << type->MangledName << "\n");
 			}
 			assert(node != type && "Loop detected.");
 			newPath.push_back(node);
@@ -20,12 +20,16 @@
 #include "llvm/Transforms/Utils/HexTypeUtil.h"
 #include "llvm/Transforms/Utils/CastSanUtil.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/Debug.h"
 
 #include <sys/types.h>
 #include <unistd.h>
 #include <inttypes.h>
 #include <iostream>
 
+#define DEBUG_TYPE "hextype"
+
 #define MAXLEN 1000
 
 namespace llvm {
@@ -59,6 +63,34 @@ namespace llvm {
     cl::desc("compile time verification"),
     cl::Hidden, cl::init(false));
 
+  //Paul: heap objects are typed in their allocator chunk, needs the
+  //clang_rt.hextype_alloc runtime
+  cl::opt<bool> ClAllocMetadataOpt(
+    "alloc-metadata-opt",
+    cl::desc("keep the type of heap objects in the allocator chunk metadata"),
+    cl::Hidden, cl::init(false));
+
+  //Paul: register the stack objects of a frame as one record instead of
+  //one ObjTypeMap entry each
+  cl::opt<bool> ClStackFrameOpt(
+    "stack-frame-opt",
+    cl::desc("per-thread frame registry for stack objects"),
+    cl::Hidden, cl::init(false));
+
+  //Paul: only trace stack objects that can flow to a cast check, and
+  //register them where they first escape instead of at function entry
+  cl::opt<bool> ClStackCastReachOpt(
+    "stack-cast-reach-opt",
+    cl::desc("trace only stack objects reaching a cast check, lazily"),
+    cl::Hidden, cl::init(false));
+
+  //Paul: no startup registration of globals, their type information is
+  //kept in a table the runtime searches when the ObjTypeMap misses
+  cl::opt<bool> ClGlobalTableOpt(
+    "global-table-opt",
+    cl::desc("static table for global object type information"),
+    cl::Hidden, cl::init(false));
+
   cl::opt<bool> ClMakeLogInfo(
     "make-loginfo",
     cl::desc("create log information"),
@@ -69,49 +101,69 @@ namespace llvm {
     cl::desc("create Type-hash information"),
     cl::Hidden, cl::init(false));
   
-  //Paul: compute a crc hash value from a given string
-  uint64_t crc64c(unsigned char *message) {
-    int i, j;
-    unsigned int byte;
-    uint64_t crc, mask;
-    static uint64_t table[256];
-
-    if (table[1] == 0) {
-      for (byte = 0; byte <= 255; byte++) {
-        crc = byte;
-        for (j = 7; j >= 0; j--) {    // Do eight times.
-          mask = -(crc & 1);
-          crc = (crc >> 1) ^ (0xC96C5795D7870F42UL & mask);
+  //Paul: the crc64 of a type name (reflected ECMA polynomial, init and
+  //final xor ~0). Every type hash in the metadata, the typehashinfo files
+  //and the runtime tables is this value, so the result must never change.
+  //The bytes are processed 8 at a time with the slicing-by-8 tables, which
+  //gives the same value as the byte-at-a-time loop. The SSE4.2 crc32
+  //instruction is not an option, it computes the 32 bit Castagnoli crc.
+  namespace {
+    struct Crc64Tables {
+      uint64_t T[8][256];
+
+      Crc64Tables() {
+        for (unsigned byte = 0; byte <= 255; byte++) {
+          uint64_t crc = byte;
+          for (int j = 7; j >= 0; j--) {    // Do eight times.
+            uint64_t mask = -(crc & 1);
+            crc = (crc >> 1) ^ (0xC96C5795D7870F42UL & mask);
+          }
+          T[0][byte] = crc;
         }
-        table[byte] = crc;
+        for (unsigned byte = 0; byte <= 255; byte++)
+          for (unsigned k = 1; k < 8; k++)
+            T[k][byte] = (T[k - 1][byte] >> 8) ^ T[0][T[k - 1][byte] & 0xFF];
       }
-    }
+    };
+  }
+
+  static uint64_t crc64(StringRef message) {
+    static const Crc64Tables tables;
+    const uint64_t (*T)[256] = tables.T;
 
-    i = 0;
-    crc = 0xFFFFFFFFFFFFFFFFUL;
-    while ((byte = message[i]) != 0) {
-      crc = (crc >> 8) ^ table[(crc ^ byte) & 0xFF];
-      i = i + 1;
+    const unsigned char *p = message.bytes_begin();
+    size_t len = message.size();
+    uint64_t crc = 0xFFFFFFFFFFFFFFFFUL;
+
+    for (; len >= 8; len -= 8, p += 8) {
+      crc ^= support::endian::read64le(p);
+      crc = T[7][crc & 0xFF] ^ T[6][(crc >> 8) & 0xFF] ^
+            T[5][(crc >> 16) & 0xFF] ^ T[4][(crc >> 24) & 0xFF] ^
+            T[3][(crc >> 32) & 0xFF] ^ T[2][(crc >> 40) & 0xFF] ^
+            T[1][(crc >> 48) & 0xFF] ^ T[0][crc >> 56];
     }
+    for (; len > 0; len--, p++)
+      crc = (crc >> 8) ^ T[0][(crc ^ *p) & 0xFF];
     return ~crc;
   }
   
   //Paul: string manipualtion
-  void removeTargetStr(std::string& FullStr, std::string RemoveStr) {
+  static void removeTargetStr(std::string& FullStr, StringRef RemoveStr) {
     std::string::size_type i;
 
-    while((i = FullStr.find(RemoveStr)) != std::string::npos) {
-      if (RemoveStr.compare("::") == 0)
+    while((i = FullStr.find(RemoveStr.data(), 0, RemoveStr.size())) !=
+          std::string::npos) {
+      if (RemoveStr == "::")
         FullStr.erase(FullStr.begin(), FullStr.begin() + i + 2);
       else
-        FullStr.erase(i, RemoveStr.length());
+        FullStr.erase(i, RemoveStr.size());
     }
   }
   
   //Paul: string manipulation
-  void removeTargetNum(std::string& TargetStr) {
+  static void removeTargetNum(std::string& TargetStr) {
     std::string::size_type i;
-    if((i = TargetStr.find(".")) == std::string::npos)
+    if((i = TargetStr.find('.')) == std::string::npos)
       return;
 
     if((i+1 < TargetStr.size()) &&
@@ -345,6 +397,39 @@ namespace llvm {
                  Elements, TypeSize, DL.getTypeAllocSize(AllocaType), NULL);
   }
 
+  //Paul: append the traced objects of a static alloca to FrameObjs instead
+  //of emitting update calls for them. ObjIndex is the slot of the alloca in
+  //the address array handed to __hextype_push_frame.
+  void HexTypeLLVMUtil::collectFrameObj(Module *SrcM, AllocaInst *TargetAlloca,
+                                        uint32_t ObjIndex) {
+    ConstantInt *constantSize =
+      dyn_cast<ConstantInt>(TargetAlloca->getArraySize());
+    assert(constantSize && "frame objects are static allocas");
+
+    collectStaticObj(SrcM, TargetAlloca->getAllocatedType(),
+                     constantSize->getZExtValue(), STACKALLOC, ObjIndex);
+  }
+
+  //Paul: same for ArraySize objects of type ObjType, used for frame
+  //objects and for the global object table
+  void HexTypeLLVMUtil::collectStaticObj(Module *SrcM, Type *ObjType,
+                                         uint64_t ArraySize,
+                                         uint32_t AllocType,
+                                         uint32_t ObjIndex) {
+    StructElementInfoTy Elements;
+    getArrayOffsets(ObjType, Elements, 0);
+    if (Elements.size() == 0) return;
+
+    size_t First = FrameObjs.size();
+    IRBuilder<> Builder(SrcM->getContext());
+    emitInstForObjTrace(SrcM, Builder, Elements, FRAMEOBJADD, NULL,
+                        ConstantInt::get(Int64Ty, ArraySize),
+                        DL.getTypeAllocSize(ObjType), 0, AllocType,
+                        NULL, NULL, ObjType);
+    for (size_t i = First; i < FrameObjs.size(); i++)
+      FrameObjs[i].ObjIndex = ObjIndex;
+  }
+
   //Paul: extends the pahntom types with detailed information, see next function
   void HexTypeLLVMUtil::extendPhantomSet(int TargetIndex, int CurrentIndex) {
     if (VisitCheck[CurrentIndex] == true)
@@ -659,22 +744,16 @@ namespace llvm {
     }
   }
   
-  //Paul: used to remove some substrings from other strings
+  //Paul: used to remove some substrings from other strings, in this order
   void HexTypeCommonUtil::syncTypeName(std::string& TargetStr) {
-    SmallVector<std::string, 12> RemoveStrs;
-    RemoveStrs.push_back("class.");
-    RemoveStrs.push_back("./");
-    RemoveStrs.push_back("struct.");
-    RemoveStrs.push_back("union.");
-    RemoveStrs.push_back(".base");
-    RemoveStrs.push_back("trackedtype.");
-    RemoveStrs.push_back("blacklistedtype.");
-    RemoveStrs.push_back("*");
-    RemoveStrs.push_back("'");
-
-    for (unsigned long i=0; i<RemoveStrs.size(); i++)
+    static const char *const RemoveStrs[] = {
+      "class.", "./", "struct.", "union.", ".base",
+      "trackedtype.", "blacklistedtype.", "*", "'"
+    };
+
+    for (const char *RemoveStr : RemoveStrs)
       //Paul: remove the above stings from all target string
-      removeTargetStr(TargetStr, RemoveStrs[i]);
+      removeTargetStr(TargetStr, RemoveStr);
     removeTargetNum(TargetStr);
   }
   
@@ -844,7 +923,8 @@ namespace llvm {
       if (Elements.size() == 0) return;
     }
 
-    if (ObjAddr && ObjAddr->getType()->isPtrOrPtrVectorTy())
+    if (ObjAddr && ObjAddr->getType()->isPtrOrPtrVectorTy() &&
+        EmitType != FRAMEOBJADD)
       ObjAddr = Builder.CreatePointerCast(ObjAddr, Int64PtrTy);
 
     if (ReallocAddr && ReallocAddr->getType()->isPtrOrPtrVectorTy())
@@ -881,7 +961,7 @@ namespace llvm {
 		  if (AllocType == PLACEMENTNEW || AllocType == REINTERPRET)
 			  TypeHashValueInt = entry.first;
 		  else
-			  TypeHashValueInt = getHashValueFromSTy(entry.second);
+			  TypeHashValueInt = getCachedHashValueFromSTy(entry.second);
 		  
 		  for (int i = 0; i < AllTypeNum; i++)
 		  {
@@ -899,10 +979,10 @@ namespace llvm {
     }
     if (k == -1) {
 	    if (type) {
-		    std::cerr << "Type is there! : " << type->getName().str() << std::endl;
+		    DEBUG(dbgs() << "Type is there! : " << type->getName().str() << "\n");
 		    if (type->getName().str().find(".anon.") != std::string::npos)
 		    {
-			    std::cerr << "Anon type. Stop here" << std::endl;
+			    DEBUG(dbgs() << "Anon type. Stop here\n");
 			    return;
 		    }
 	    } else {
@@ -913,10 +993,10 @@ namespace llvm {
 			    if (AllocType == PLACEMENTNEW || AllocType == REINTERPRET)
 				    TypeHashValueInt = entry.first;
 			    else
-				    TypeHashValueInt = getHashValueFromSTy(entry.second);
+				    TypeHashValueInt = getCachedHashValueFromSTy(entry.second);
 			    
 			    
-			    std::cerr << "TypeHash is: " << TypeHashValueInt << std::endl;
+			    DEBUG(dbgs() << "TypeHash is: " << TypeHashValueInt << "\n");
 			    break;
 		    }
 	    }
@@ -944,7 +1024,7 @@ namespace llvm {
       if (AllocType == PLACEMENTNEW || AllocType == REINTERPRET)
         TypeHashValueInt = entry.first;
       else
-        TypeHashValueInt = getHashValueFromSTy(entry.second);
+        TypeHashValueInt = getCachedHashValueFromSTy(entry.second);
 
       uint32_t vpointer;
       vpointer = CastSan.getFakeVPointer(&VType, TypeHashValueInt).second;
@@ -954,6 +1034,20 @@ namespace llvm {
 	      continue;
       }
 
+      //Paul: no code for frame objects, the frame record covers them
+      if (EmitType == FRAMEOBJADD) {
+        ConstantInt *constantArraySize = dyn_cast<ConstantInt>(ArraySize);
+        FrameObjInfo Info = {0, OffsetInt, TypeSizeInt,
+                             (uint32_t)constantArraySize->getZExtValue(),
+                             vpointer};
+        FrameObjs.push_back(Info);
+        continue;
+      }
+
+      //Paul: the object itself, not one of its member subobjects
+      bool isChunkObject = ClAllocMetadataOpt && OffsetInt == 0 &&
+                           (AllocType == HEAPALLOC || AllocType == REALLOC);
+
       Value *OffsetV = ConstantInt::get(Int32Ty, OffsetInt);
       OffsetInt += (constantTypeSize->getZExtValue() * CurrArrayIndex);
       Value *first = ConstantInt::get(IntptrTyN, OffsetInt);
@@ -1083,8 +1177,10 @@ namespace llvm {
             }
           }
           Function *initFunction =
-            //Paul: update object info
-            (Function*)SrcM->getOrInsertFunction("__update_oinfo",
+            //Paul: update object info, in the chunk metadata for heap objects
+            (Function*)SrcM->getOrInsertFunction(isChunkObject ?
+                                                 "__update_heap_chunk_oinfo" :
+                                                 "__update_oinfo",
                                                  VoidTy, IntptrTyN, Int32Ty,
                                                  Int64Ty, Int32Ty, nullptr);
           //Paul: here we added our FakeVPointer
@@ -1160,8 +1256,12 @@ namespace llvm {
       //Paul: add the remove object info
       case VLAOBJDEL:
         {
+          //Paul: the chunk metadata is cleared by free itself, the runtime
+          //only removes the objects that fell back to the ObjTypeMap
           Function *initFunction =
-            (Function*)SrcM->getOrInsertFunction("__remove_oinfo",
+            (Function*)SrcM->getOrInsertFunction(isChunkObject ?
+                                                 "__remove_heap_chunk_oinfo" :
+                                                 "__remove_oinfo",
                                                  VoidTy, IntptrTyN,
                                                  Int32Ty, Int64Ty,
                                                  Int32Ty, nullptr);
@@ -1274,13 +1374,10 @@ namespace llvm {
 
   //Paul: strig manipulation function
   void HexTypeLLVMUtil::syncModuleName(std::string& TargetStr) {
-    SmallVector<std::string, 12> RemoveStrs;
-    RemoveStrs.push_back("./");
-    RemoveStrs.push_back(".");
-    RemoveStrs.push_back("/");
+    static const char *const RemoveStrs[] = { "./", ".", "/" };
 
-    for (unsigned long i=0; i<RemoveStrs.size(); i++)
-      removeTargetStr(TargetStr, RemoveStrs[i]);
+    for (const char *RemoveStr : RemoveStrs)
+      removeTargetStr(TargetStr, RemoveStr);
 
     removeTargetNum(TargetStr);
   }
@@ -1288,17 +1385,41 @@ namespace llvm {
   //Paul: get the hash value from string
   uint64_t HexTypeCommonUtil::getHashValueFromStr(std::string& str) {
     syncTypeName(str);
-    unsigned char *className = new unsigned char[str.length() + 1];
-    strcpy((char *)className, str.c_str());
-    return crc64c(className);
+    return crc64(str);
   }
   
-  //Paul: get hash value from struct type
+  //Paul: get hash value from struct type. The name is synced twice (once
+  //more by getHashValueFromStr), which is part of the hash by now.
   uint64_t HexTypeCommonUtil::getHashValueFromSTy(StructType *STy) {
     std::string str = STy->getName().str();
     syncTypeName(str);
     return getHashValueFromStr(str);
   }
+
+  //Paul: getHashValueFromSTy, computed once per struct type of the module
+  uint64_t HexTypeLLVMUtil::getCachedHashValueFromSTy(StructType *STy) {
+    auto it = STyHashCache.find(STy);
+    if (it != STyHashCache.end())
+      return it->second;
+
+    uint64_t HashValue = getHashValueFromSTy(STy);
+    STyHashCache[STy] = HashValue;
+    return HashValue;
+  }
+
+  //Paul: whether a hash belongs to a type of the casting related set, the
+  //hashes are computed again only when the set has grown
+  bool HexTypeLLVMUtil::isCastingRelatedHash(uint64_t HashValue) {
+    if (CastingRelatedHashedNum != CastingRelatedSet.size()) {
+      CastingRelatedHashSet.clear();
+      for (const std::string &TypeName : CastingRelatedSet) {
+        std::string TargetStr = TypeName;
+        CastingRelatedHashSet.insert(getHashValueFromStr(TargetStr));
+      }
+      CastingRelatedHashedNum = CastingRelatedSet.size();
+    }
+    return CastingRelatedHashSet.count(HashValue);
+  }
   
   //Paul: just check that the struct type is a struct type, is not literal and 
   //not opaque and has name
@@ -1367,8 +1488,7 @@ namespace llvm {
     std::string str = STy->getName().str();
     HexTypeCommonUtil::syncTypeName(str);
     TargetDetailInfo.TypeName.assign(str);
-    TargetDetailInfo.TypeHashValue =
-      HexTypeCommonUtil::getHashValueFromSTy(STy);
+    TargetDetailInfo.TypeHashValue = getCachedHashValueFromSTy(STy);
     TargetDetailInfo.TypeIndex = AllTypeNum;
 
     if (ClMakeTypeInfo) {
@@ -193,6 +193,7 @@ namespace options {
 
   static bool RunSDIVTBLPass = false;
   static bool RunSDOVTBLPass = false;
+  static bool SDCrossDSO = false;
 
   static void process_plugin_option(const char *opt_)
   {
@@ -216,6 +217,8 @@ namespace options {
       RunSDIVTBLPass = true;
     } else if (opt == "sd-ovtbl") {
       RunSDOVTBLPass = true;
+    } else if (opt == "sd-cross-dso") {
+      SDCrossDSO = true;
     } else if (opt == "save-temps") {
       TheOutputType = OT_SAVE_TEMPS;
     } else if (opt == "disable-output") {
@@ -960,6 +963,10 @@ void CodeGen::runLTOPasses() {
   
   PMB.EmitIVTBLs = options::RunSDIVTBLPass;
   PMB.EmitOVTBLs = options::RunSDOVTBLPass;
+  // the DSOs have to agree on the vcall indices, only the ordered layout keeps them
+  if (options::SDCrossDSO && options::RunSDIVTBLPass)
+    message(LDPL_FATAL, "sd-cross-dso needs the ordered vtable layout (sd-ovtbl)");
+  PMB.CastSanCrossDSO = options::SDCrossDSO;
 
   PMB.OptLevel = options::OptLevel;
   PMB.FunctionIndex = CombinedIndex;
@@ -0,0 +1,194 @@
+#!/usr/bin/python
+
+# Aggregates the CastSan check site records written by the LTO passes
+# with -Wl,-plugin-opt=-sd-remarks-file=<path> into hot site reports.
+#
+#   castsan_remarks.py [--counts perf.txt] [--by site|function|class|file]
+#                      [--top N] remarks.yaml [remarks.yaml ...]
+#
+# Without --counts a site is as hot as the cost of its checks. --counts
+# takes lines of "<count> <function>" (e.g. the samples per symbol of
+# "perf report --stdio --sort symbol"), the cost of every check is then
+# weighted with the count of its function.
+
+import sys
+import re
+import argparse
+from collections import defaultdict
+
+# same units as the cost model of SDCheckLowering
+check_costs = {
+  "ConstFolded"   : 0,
+  "Devirtualized" : 0,
+  "NoMetadata"    : 0,
+  "EqCheck"       : 1,
+  "RangeCheck"    : 3,
+  "BitsetCheck"   : 6,
+}
+
+# a call into the runtime instead of the inline compare
+call_cost = 5
+
+loc_re = re.compile(r"\{ File: (.*), Line: (\d+), Column: (\d+) \}")
+arg_re = re.compile(r"\s+- (\w+):\s+(.*)")
+key_re = re.compile(r"(\w+):\s+(.*)")
+
+class Record(object):
+  def __init__(self, kind):
+    self.kind     = kind
+    self.name     = None
+    self.function = None
+    self.file     = None
+    self.line     = 0
+    self.column   = 0
+    self.site     = None
+    self.cls      = None
+    self.width    = None
+    self.detail   = ""
+
+  def loc(self):
+    if self.file is None:
+      return "<unknown>"
+    return "%s:%d:%d" % (self.file, self.line, self.column)
+
+  def cost(self):
+    c = check_costs.get(self.name, 0)
+    if c and self.detail == "call":
+      c += call_cost
+    return c
+
+def unquote(s):
+  s = s.strip()
+  if len(s) >= 2 and s[0] == "'" and s[-1] == "'":
+    return s[1:-1].replace("''", "'")
+  return s
+
+def parse_file(filename):
+  records = []
+  rec = None
+
+  for line in open(filename):
+    line = line.rstrip("\n")
+    if line.startswith("--- !"):
+      rec = Record(line[5:])
+      continue
+    if rec is None:
+      continue
+    if line == "...":
+      records.append(rec)
+      rec = None
+      continue
+
+    m = arg_re.match(line)
+    if m:
+      key, val = m.group(1), unquote(m.group(2))
+      if key == "Site":
+        rec.site = val
+      elif key == "Class":
+        rec.cls = val
+      elif key == "Width":
+        rec.width = int(val)
+      elif key == "Detail":
+        rec.detail = val
+      continue
+
+    m = key_re.match(line)
+    if not m:
+      continue
+    key, val = m.group(1), m.group(2)
+    if key == "Name":
+      rec.name = val
+    elif key == "Function":
+      rec.function = unquote(val)
+    elif key == "DebugLoc":
+      l = loc_re.match(val)
+      if l:
+        rec.file   = unquote(l.group(1))
+        rec.line   = int(l.group(2))
+        rec.column = int(l.group(3))
+
+  return records
+
+def read_counts(filename):
+  counts = {}
+  for line in open(filename):
+    parts = line.split()
+    if len(parts) < 2:
+      continue
+    try:
+      count = float(parts[0].rstrip("%"))
+    except ValueError:
+      continue
+    counts[parts[-1]] = counts.get(parts[-1], 0) + count
+  return counts
+
+def group_key(rec, by):
+  if by == "function":
+    return rec.function
+  if by == "class":
+    return rec.cls
+  if by == "file":
+    return rec.file or "<unknown>"
+  return "%s %s" % (rec.loc(), rec.function)
+
+def print_summary(records):
+  kinds = defaultdict(lambda: [0, 0, 0])
+  for r in records:
+    k = kinds[(r.site, r.name)]
+    k[0] += 1
+    if r.width is not None:
+      k[1] += r.width
+      k[2] += 1
+
+  print("%-8s %-14s %8s %10s" % ("site", "check", "count", "avg width"))
+  for (site, name) in sorted(kinds):
+    count, widths, withWidth = kinds[(site, name)]
+    avg = "%.2f" % (widths * 1.0 / withWidth) if withWidth else "-"
+    print("%-8s %-14s %8d %10s" % (site, name, count, avg))
+
+def print_hot(records, counts, by, top):
+  groups = defaultdict(lambda: [0.0, 0, set()])
+  for r in records:
+    weight = r.cost()
+    if counts is not None:
+      weight *= counts.get(r.function, 0)
+    g = groups[group_key(r, by)]
+    g[0] += weight
+    g[1] += 1
+    g[2].add(r.name)
+
+  hot = sorted(groups.items(), key=lambda kv: kv[1][0], reverse=True)
+  total = sum(g[0] for _, g in hot) or 1.0
+
+  print("")
+  print("%10s %6s %6s  %-30s %s" % ("weight", "%", "checks", "kinds", by))
+  for key, (weight, checks, names) in hot[:top]:
+    if weight == 0:
+      break
+    print("%10.1f %6.2f %6d  %-30s %s" % (weight, weight * 100.0 / total, checks,
+                                          ",".join(sorted(names)), key))
+
+def main():
+  parser = argparse.ArgumentParser(description="CastSan check site report")
+  parser.add_argument("files", nargs="+", help="YAML files written with -sd-remarks-file")
+  parser.add_argument("--counts", help="lines of '<count> <function>'")
+  parser.add_argument("--by", default="site", choices=["site", "function", "class", "file"])
+  parser.add_argument("--top", type=int, default=20)
+  args = parser.parse_args()
+
+  records = []
+  for f in args.files:
+    records.extend(parse_file(f))
+
+  if not records:
+    print("no CastSan records found")
+    return 1
+
+  counts = read_counts(args.counts) if args.counts else None
+
+  print_summary(records)
+  print_hot(records, counts, args.by, args.top)
+  return 0
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -0,0 +1,147 @@
+#!/usr/bin/python
+
+# Watches the live statistics of a program running with the HexType
+# runtime. Start the program with HEXTYPE_STATS_SHM=<name> (or =1 for
+# hextype.<pid>), then
+#
+#   hextype_stats.py [--interval SEC] [--depth] <name|pid|/dev/shm/path>
+#
+# prints the per-second rates of the counters. The segment layout is
+# HexStatsHeader from compiler-rt/lib/hextype/hextype_report.h followed
+# by the 64 bit counters.
+
+import sys
+import os
+import mmap
+import struct
+import time
+import argparse
+
+HEX_STATS_MAGIC   = 0x5453455059545848
+HEX_STATS_VERSION = 1
+HEADER_FMT        = "<QIIQQ"
+HEADER_SIZE       = struct.calcsize(HEADER_FMT)
+
+# the num* indices of hextype_report.h
+numUpdateMiss      = 3
+numGloUp           = 4
+numStackUp         = 5
+numStackRm         = 6
+numHeapUp          = 7
+numHeapRm          = 8
+numRemoveMiss      = 10
+numCasting         = 11
+numVerifiedCasting = 12
+numLookHit         = 15
+numLookMiss        = 16
+numLookFail        = 17
+numCastBadCast     = 22
+numLookArray       = 38
+numLookChunk       = 40
+numFramePush       = 42
+numLookFrame       = 43
+numLookGlobalTable = 44
+numCastBatch       = 45
+numTreeDepth       = 50
+TREE_DEPTH_BINS    = 32
+
+# column name, counters summed up for it
+columns = [
+  ("casts",      [numCasting]),
+  ("badcasts",   [numCastBadCast]),
+  ("batched",    [numCastBatch]),
+  ("look-hit",   [numLookHit]),
+  ("look-tree",  [numLookMiss]),
+  ("look-other", [numLookArray, numLookChunk, numLookFrame, numLookGlobalTable]),
+  ("look-fail",  [numLookFail]),
+  ("updates",    [numGloUp, numStackUp, numHeapUp]),
+  ("upd-miss",   [numUpdateMiss]),
+  ("removes",    [numStackRm, numHeapRm]),
+  ("rm-miss",    [numRemoveMiss]),
+  ("frames",     [numFramePush]),
+]
+
+def segment_path(name):
+  if name.startswith("/dev/shm/"):
+    return name
+  if name.isdigit():
+    return "/dev/shm/hextype.%s" % name
+  return "/dev/shm/" + name.lstrip("/")
+
+class Segment(object):
+  def __init__(self, path):
+    self.f = open(path, "rb")
+    self.m = mmap.mmap(self.f.fileno(), 0, access=mmap.ACCESS_READ)
+    magic, version, self.numCounters, self.pid, self.start = \
+        struct.unpack_from(HEADER_FMT, self.m, 0)
+    if magic != HEX_STATS_MAGIC:
+      raise RuntimeError("%s is not (yet) a HexType statistics segment" % path)
+    if version != HEX_STATS_VERSION:
+      raise RuntimeError("%s has version %d, expected %d" %
+                         (path, version, HEX_STATS_VERSION))
+
+  def read(self):
+    return struct.unpack_from("<%dQ" % self.numCounters, self.m, HEADER_SIZE)
+
+def sum_counters(values, indices):
+  return sum(values[i] for i in indices)
+
+def print_depth(prev, cur):
+  bins = [cur[numTreeDepth + i] - prev[numTreeDepth + i]
+          for i in range(TREE_DEPTH_BINS)]
+  total = sum(bins)
+  if total == 0:
+    return
+  print("  tree depth: " + " ".join("%d%s:%d" % (i, "+" if i == TREE_DEPTH_BINS - 1 else "", b)
+                                    for i, b in enumerate(bins) if b))
+
+def main():
+  parser = argparse.ArgumentParser(description="HexType live statistics")
+  parser.add_argument("segment", help="segment name, pid or /dev/shm path")
+  parser.add_argument("--interval", type=float, default=1.0)
+  parser.add_argument("--depth", action="store_true",
+                      help="also print the rb-tree lookup depth histogram")
+  args = parser.parse_args()
+
+  path = segment_path(args.segment)
+  try:
+    seg = Segment(path)
+  except (IOError, OSError, RuntimeError) as e:
+    print("cannot attach to %s: %s" % (path, e))
+    return 1
+
+  print("attached to %s, pid %d, running for %ds" %
+        (path, seg.pid, int(time.time()) - seg.start))
+  header = " ".join("%11s" % name for name, _ in columns)
+  print(header + "   (per second)")
+
+  prev = seg.read()
+  prevTime = time.time()
+  lines = 0
+  try:
+    while True:
+      time.sleep(args.interval)
+      cur = seg.read()
+      now = time.time()
+      elapsed = now - prevTime
+
+      rates = [(sum_counters(cur, idx) - sum_counters(prev, idx)) / elapsed
+               for _, idx in columns]
+      print(" ".join("%11.0f" % r for r in rates))
+      if args.depth:
+        print_depth(prev, cur)
+
+      lines += 1
+      if lines % 20 == 0:
+        print(header)
+
+      if not os.path.exists("/proc/%d" % seg.pid):
+        print("process %d has exited" % seg.pid)
+        return 0
+
+      prev, prevTime = cur, now
+  except KeyboardInterrupt:
+    return 0
+
+if __name__ == "__main__":
+  sys.exit(main())